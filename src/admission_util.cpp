@@ -0,0 +1,404 @@
+#include "admission_util.h"
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+
+#include "cgi_util.h"
+#include "make_log.h"
+#include "rapidjson/document.h"
+#include "rapidjson/istreamwrapper.h"
+#include "response_util.h"
+
+static AdmissionConfig admit_cfg;
+static InflightBudget inflight;
+static bool inflight_ready = false;
+static std::mutex holder_lock;  // 多线程的服务端同时占用本进程的记录
+
+InflightBudget::~InflightBudget() {
+  if (shared_ != nullptr) {
+    munmap(shared_, sizeof(Shared));
+  }
+}
+
+/**
+ * @brief  打开共享内存，新建时全为0，即没有在途的请求
+ *
+ * @param name  共享内存名，如"/filehub_inflight"
+ * @param limit 总字节数上限
+ *
+ * @return 0 成功，-1 失败
+ */
+int InflightBudget::open(const char *name, long limit) {
+  int fd = shm_open(name, O_RDWR | O_CREAT, 0600);
+  if (fd < 0) {
+    LOG_ERROR(ADMISSION_LOG_MODULE, ADMISSION_LOG_PROC,
+              "shm_open %s err: %s\n", name, strerror(errno));
+    return -1;
+  }
+  if (ftruncate(fd, (off_t)sizeof(Shared)) != 0) {
+    LOG_ERROR(ADMISSION_LOG_MODULE, ADMISSION_LOG_PROC, "ftruncate err: %s\n",
+              strerror(errno));
+    close(fd);
+    return -1;
+  }
+  void *p = mmap(nullptr, sizeof(Shared), PROT_READ | PROT_WRITE, MAP_SHARED,
+                 fd, 0);
+  close(fd);
+  if (p == MAP_FAILED) {
+    LOG_ERROR(ADMISSION_LOG_MODULE, ADMISSION_LOG_PROC, "mmap err: %s\n",
+              strerror(errno));
+    return -1;
+  }
+  if (shared_ != nullptr) {
+    munmap(shared_, sizeof(Shared));
+  }
+  shared_ = (Shared *)p;
+  limit_ = limit;
+  holder_ = nullptr;
+  holder_pid_ = 0;
+  return 0;
+}
+
+/**
+ * @brief  回收已退出进程预留的字节
+ *
+ * @return 回收的记录数
+ */
+int InflightBudget::reclaim() {
+  int n = 0;
+  for (Holder &h : shared_->holders) {
+    int pid = h.pid.load();
+    if (pid <= 0 || kill(pid, 0) == 0 || errno != ESRCH) {
+      continue;
+    }
+    if (!h.pid.compare_exchange_strong(pid, -1)) {
+      continue;  // 其他进程在回收
+    }
+    long bytes = h.bytes.exchange(0);
+    shared_->total.fetch_sub(bytes);
+    h.pid.store(0);
+    LOG_WARNING(ADMISSION_LOG_MODULE, ADMISSION_LOG_PROC,
+                "reclaim %ld bytes of exited process %d\n", bytes, pid);
+    n++;
+  }
+  return n;
+}
+
+/**
+ * @brief  本进程在共享内存中的记录，第一次使用时占用一个空闲记录
+ *         记录用完时返回nullptr，此时只计总数，进程崩溃后无法回收
+ */
+InflightBudget::Holder *InflightBudget::holder() {
+  pid_t pid = getpid();
+  std::lock_guard<std::mutex> guard(holder_lock);
+  if (holder_ != nullptr && holder_pid_ == pid) {
+    return holder_;
+  }
+  holder_ = nullptr;
+  holder_pid_ = pid;
+  for (int round = 0; round < 2 && holder_ == nullptr; round++) {
+    for (Holder &h : shared_->holders) {
+      int expected = 0;
+      if (h.pid.compare_exchange_strong(expected, pid)) {
+        holder_ = &h;
+        break;
+      }
+    }
+    if (holder_ == nullptr && reclaim() == 0) {
+      break;
+    }
+  }
+  if (holder_ == nullptr) {
+    LOG_ERROR(ADMISSION_LOG_MODULE, ADMISSION_LOG_PROC,
+              "no free inflight holder for %d\n", pid);
+    return nullptr;
+  }
+  // pid被复用时，同一pid的旧记录属于已退出的进程
+  for (Holder &h : shared_->holders) {
+    int stale = pid;
+    if (&h != holder_ && h.pid.compare_exchange_strong(stale, -1)) {
+      shared_->total.fetch_sub(h.bytes.exchange(0));
+      h.pid.store(0);
+    }
+  }
+  return holder_;
+}
+
+/**
+ * @brief  预留bytes字节，超过上限时先回收已退出进程的预留再试一次
+ *
+ * @return 预留成功返回true
+ */
+bool InflightBudget::acquire(long bytes) {
+  Holder *h = holder();
+  for (int round = 0; round < 2; round++) {
+    long cur = shared_->total.load();
+    while (cur + bytes <= limit_) {
+      if (shared_->total.compare_exchange_weak(cur, cur + bytes)) {
+        if (h != nullptr) {
+          h->bytes.fetch_add(bytes);
+        }
+        return true;
+      }
+    }
+    if (reclaim() == 0) {
+      break;
+    }
+  }
+  return false;
+}
+
+void InflightBudget::release(long bytes) {
+  Holder *h = holder();
+  if (h != nullptr) {
+    h->bytes.fetch_sub(bytes);
+  }
+  shared_->total.fetch_sub(bytes);
+}
+
+long InflightBudget::used() const {
+  return shared_ == nullptr ? 0 : shared_->total.load();
+}
+
+// 数字可以写成数字或字符串
+static double cfgNumber(const rapidjson::Value &v, const char *key,
+                        double def) {
+  if (!v.IsObject() || !v.HasMember(key)) {
+    return def;
+  }
+  const rapidjson::Value &x = v[key];
+  if (x.IsNumber()) return x.GetDouble();
+  if (x.IsString()) return atof(x.GetString());
+  if (x.IsBool()) return x.GetBool() ? 1 : 0;
+  return def;
+}
+
+/**
+ * @brief  从cfg.json中读取准入配置
+ *
+ * @param cfg (out) 配置
+ *
+ * @return 0 成功(包括没有admission配置)，-1 打开配置文件失败
+ */
+int getAdmissionConfig(AdmissionConfig *cfg) {
+  *cfg = AdmissionConfig();
+  std::ifstream ifs(CFG_PATH);
+  if (!ifs.is_open()) {
+    LOG_ERROR(ADMISSION_LOG_MODULE, ADMISSION_LOG_PROC,
+              "Failed to open cfg.json");
+    return -1;
+  }
+  rapidjson::IStreamWrapper isw(ifs);
+  rapidjson::Document doc;
+  doc.ParseStream(isw);
+  if (doc.HasParseError() || !doc.IsObject() || !doc.HasMember("admission")) {
+    return 0;
+  }
+
+  const rapidjson::Value &a = doc["admission"];
+  if (a.HasMember("paths") && a["paths"].IsArray()) {
+    cfg->paths.clear();
+    const rapidjson::Value &paths = a["paths"];
+    for (auto it = paths.Begin(); it != paths.End(); ++it) {
+      if (it->IsString()) {
+        cfg->paths.push_back(it->GetString());
+      }
+    }
+  }
+  cfg->max_body = (long)cfgNumber(a, "max_body", (double)cfg->max_body);
+  cfg->inflight_bytes =
+      (long)cfgNumber(a, "inflight_bytes", (double)cfg->inflight_bytes);
+  cfg->disk_reserve =
+      (long)cfgNumber(a, "disk_reserve", (double)cfg->disk_reserve);
+  cfg->require_token = cfgNumber(a, "require_token", 0) != 0;
+  if (a.HasMember("staging_dir") && a["staging_dir"].IsString()) {
+    cfg->staging_dir = a["staging_dir"].GetString();
+  }
+  if (a.HasMember("shm_name") && a["shm_name"].IsString()) {
+    cfg->shm_name = a["shm_name"].GetString();
+  }
+  return 0;
+}
+
+int admissionInit() {
+  AdmissionConfig cfg;
+  getAdmissionConfig(&cfg);  // 读不到配置时使用默认值
+  return admissionInit(cfg);
+}
+
+int admissionInit(const AdmissionConfig &cfg) {
+  admit_cfg = cfg;
+  inflight_ready = false;
+  if (cfg.paths.empty()) {
+    return 0;
+  }
+  LOG_INFO(ADMISSION_LOG_MODULE, ADMISSION_LOG_PROC,
+           "max_body = %ld, inflight_bytes = %ld, staging_dir = %s, "
+           "disk_reserve = %ld, require_token = %d\n",
+           cfg.max_body, cfg.inflight_bytes, cfg.staging_dir.c_str(),
+           cfg.disk_reserve, cfg.require_token ? 1 : 0);
+  if (cfg.inflight_bytes <= 0) {
+    return 0;
+  }
+  if (inflight.open(cfg.shm_name.c_str(), cfg.inflight_bytes) != 0) {
+    return -1;
+  }
+  inflight_ready = true;
+  return 0;
+}
+
+bool admissionApplies(const char *path) {
+  if (path == nullptr) {
+    return false;
+  }
+  for (const std::string &p : admit_cfg.paths) {
+    if (p == path) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void admissionCredentials(const QueryParams &query, string_view header_user,
+                          string_view header_token, string_view *user,
+                          string_view *token) {
+  *user = query.get("user");
+  *token = query.get("token");
+  if (user->empty()) {
+    *user = header_user;
+  }
+  if (token->empty()) {
+    *token = header_token;
+  }
+}
+
+long admissionLength(string_view content_length) {
+  if (content_length.empty() || content_length.size() > 18) {
+    return -1;
+  }
+  long len = 0;
+  for (char c : content_length) {
+    if (c < '0' || c > '9') {
+      return -1;
+    }
+    len = len * 10 + (c - '0');
+  }
+  return len;
+}
+
+static bool checkToken(string_view user, string_view token,
+                       sw::redis::Redis *redis) {
+  if (user.empty() || token.empty() || user.size() >= (size_t)USER_NAME_LEN ||
+      token.size() >= (size_t)TOKEN_LEN || redis == nullptr) {
+    return false;
+  }
+  char user_buf[USER_NAME_LEN];
+  char token_buf[TOKEN_LEN];
+  memcpy(user_buf, user.data(), user.size());
+  user_buf[user.size()] = '\0';
+  memcpy(token_buf, token.data(), token.size());
+  token_buf[token.size()] = '\0';
+  return validateToken(redis, user_buf, token_buf);
+}
+
+// 暂存目录放得下len字节并保留disk_reserve
+static bool diskHasRoom(long len) {
+  if (admit_cfg.staging_dir.empty()) {
+    return true;
+  }
+  struct statvfs st;
+  if (statvfs(admit_cfg.staging_dir.c_str(), &st) != 0) {
+    LOG_ERROR(ADMISSION_LOG_MODULE, ADMISSION_LOG_PROC, "statvfs %s err: %s\n",
+              admit_cfg.staging_dir.c_str(), strerror(errno));
+    return true;  // 检查不了时不拦截
+  }
+  double avail = (double)st.f_bavail * (double)st.f_frsize;
+  return avail >= (double)len + (double)admit_cfg.disk_reserve;
+}
+
+/**
+ * @brief  读请求体之前的检查，依次看长度、凭证、磁盘和在途字节数
+ *
+ * @param content_length 请求体长度，-1为没有CONTENT_LENGTH
+ * @param user           凭证中的用户名，可以为空
+ * @param token          凭证中的token，可以为空
+ * @param redis          验证token用的redis连接
+ * @param reserved (out) 预留的字节数
+ *
+ * @return ADMIT_OK为接收
+ */
+AdmitResult admissionCheck(long content_length, string_view user,
+                           string_view token, sw::redis::Redis *redis,
+                           long *reserved) {
+  *reserved = 0;
+  if (content_length < 0) {
+    return ADMIT_NO_LENGTH;
+  }
+  if (content_length > admit_cfg.max_body ||
+      (inflight_ready && content_length > admit_cfg.inflight_bytes)) {
+    LOG_WARNING(ADMISSION_LOG_MODULE, ADMISSION_LOG_PROC,
+                "body too large: %ld\n", content_length);
+    return ADMIT_TOO_LARGE;
+  }
+  if ((admit_cfg.require_token || !token.empty()) &&
+      !checkToken(user, token, redis)) {
+    LOG_WARNING(ADMISSION_LOG_MODULE, ADMISSION_LOG_PROC,
+                "token check failed for [%.*s]\n", (int)user.size(),
+                user.data());
+    return ADMIT_BAD_TOKEN;
+  }
+  if (content_length == 0) {
+    return ADMIT_OK;
+  }
+  if (!diskHasRoom(content_length)) {
+    LOG_WARNING(ADMISSION_LOG_MODULE, ADMISSION_LOG_PROC,
+                "staging dir full, defer %ld bytes\n", content_length);
+    return ADMIT_NO_SPACE;
+  }
+  if (inflight_ready) {
+    if (!inflight.acquire(content_length)) {
+      LOG_WARNING(ADMISSION_LOG_MODULE, ADMISSION_LOG_PROC,
+                  "inflight %ld bytes, defer %ld bytes\n", inflight.used(),
+                  content_length);
+      return ADMIT_BUSY;
+    }
+    *reserved = content_length;
+  }
+  return ADMIT_OK;
+}
+
+void admissionRelease(long reserved) {
+  if (reserved > 0 && inflight_ready) {
+    inflight.release(reserved);
+  }
+}
+
+void appendAdmitReject(std::string *out, AdmitResult result) {
+  switch (result) {
+    case ADMIT_NO_LENGTH:
+      appendLengthRequired(out);
+      break;
+    case ADMIT_TOO_LARGE:
+      appendPayloadTooLarge(out);
+      break;
+    case ADMIT_BAD_TOKEN:
+      appendStatus(out, "111");
+      break;
+    case ADMIT_BUSY:
+    case ADMIT_NO_SPACE:
+      appendServiceUnavailable(out);
+      break;
+    case ADMIT_OK:
+      break;
+  }
+}
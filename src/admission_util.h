@@ -0,0 +1,135 @@
+#ifndef ADMISSION_UTIL_H
+#define ADMISSION_UTIL_H
+
+#include <sw/redis++/redis++.h>
+#include <sys/types.h>
+
+#include <atomic>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "query_util.h"
+
+/*
+   上传类接口的准入检查：在读请求体的第一个字节之前，只看CONTENT_LENGTH、
+   QUERY_STRING/请求头中的凭证和全局的在途字节数，决定接收、拒绝还是让客户端稍后重试。
+
+   - CONTENT_LENGTH超过max_body：413
+   - 带了token(或配置了require_token)但验证不通过：{"code":"111"}
+   - 所有进程正在接收的请求体总字节数超过inflight_bytes，
+     或暂存目录的空闲空间不足 长度 + disk_reserve：503 + Retry-After
+   接收后预留的字节数在请求处理完时归还，一批大文件同时上传时
+   内存和暂存磁盘的占用不超过inflight_bytes。
+
+   凭证：QUERY_STRING中的user/token，或请求头X-User/X-Token。
+   带了凭证时上传表单中的user必须是同一个用户。
+
+   "admission": {
+     "paths": ["/upload", "/delta"],
+     "max_body": 268435456,
+     "inflight_bytes": 1073741824,
+     "staging_dir": ".",
+     "disk_reserve": 1073741824,
+     "require_token": false
+   }
+   nginx的client_max_body_size应不小于max_body，否则413由nginx返回；
+   io_uring服务端的请求体暂存在uring.spool_dir，staging_dir应指向同一目录。
+*/
+
+const char *const ADMISSION_LOG_MODULE = "cgi";
+const char *const ADMISSION_LOG_PROC = "admission";
+
+// 共享内存中记录在途字节数的进程数上限
+const int INFLIGHT_HOLDERS = 256;
+
+struct AdmissionConfig {
+  // 需要准入检查的接口，/delta的差量指令流整个读入内存，同样受max_body限制
+  std::vector<std::string> paths = {"/upload", "/delta"};
+  long max_body = 256L << 20;        // 单个请求体的上限
+  long inflight_bytes = 1L << 30;    // 所有进程同时接收的请求体总字节数
+  std::string staging_dir = ".";     // 请求体落盘的目录，为空时不检查磁盘
+  long disk_reserve = 1L << 30;      // 暂存目录至少保留的空闲空间
+  bool require_token = false;        // 没有凭证的请求也拒绝
+  std::string shm_name = "/filehub_inflight";
+};
+
+enum AdmitResult {
+  ADMIT_OK = 0,
+  ADMIT_NO_LENGTH,  // 没有CONTENT_LENGTH，411
+  ADMIT_TOO_LARGE,  // 超过max_body，413
+  ADMIT_BAD_TOKEN,  // token验证失败，111
+  ADMIT_BUSY,       // 在途字节数已满，503
+  ADMIT_NO_SPACE,   // 暂存目录空间不足，503
+};
+
+// 共享内存中的在途字节计数，同一台机器上的所有进程共用
+// 每个进程另记自己预留的字节数，进程崩溃后由其他进程回收
+class InflightBudget {
+ public:
+  InflightBudget() = default;
+  ~InflightBudget();
+  InflightBudget(const InflightBudget &) = delete;
+  InflightBudget &operator=(const InflightBudget &) = delete;
+
+  // 打开(不存在时创建)共享内存，limit为总字节数上限，成功返回0
+  int open(const char *name, long limit);
+
+  // 预留bytes字节，超过上限返回false
+  bool acquire(long bytes);
+
+  // 归还acquire预留的字节
+  void release(long bytes);
+
+  // 当前所有进程预留的总字节数
+  long used() const;
+
+ private:
+  struct Holder {
+    std::atomic<int> pid;     // 0为空闲，-1为正在回收
+    std::atomic<long> bytes;  // 该进程预留的字节数
+  };
+  struct Shared {
+    std::atomic<long> total;
+    Holder holders[INFLIGHT_HOLDERS];
+  };
+
+  Holder *holder();
+  int reclaim();
+
+  Shared *shared_ = nullptr;
+  long limit_ = 0;
+  Holder *holder_ = nullptr;  // 本进程的记录
+  pid_t holder_pid_ = 0;      // holder_所属的进程，fork后重新占用
+};
+
+// 从cfg.json读取准入配置，缺少时使用默认值
+int getAdmissionConfig(AdmissionConfig *cfg);
+
+// 读取配置并打开共享内存，失败时只检查长度和token，返回-1
+int admissionInit();
+int admissionInit(const AdmissionConfig &cfg);
+
+// 接口是否需要准入检查
+bool admissionApplies(const char *path);
+
+// 取凭证：QUERY_STRING中的user/token优先，没有时用请求头
+void admissionCredentials(const QueryParams &query, string_view header_user,
+                          string_view header_token, string_view *user,
+                          string_view *token);
+
+// 在读请求体之前检查，content_length为-1表示没有
+// 允许时*reserved为预留的字节数，请求结束后交给admissionRelease
+AdmitResult admissionCheck(long content_length, string_view user,
+                           string_view token, sw::redis::Redis *redis,
+                           long *reserved);
+
+void admissionRelease(long reserved);
+
+// CONTENT_LENGTH转为长度，没有或不合法时返回-1
+long admissionLength(string_view content_length);
+
+// 拒绝时的响应(响应头 + body)
+void appendAdmitReject(std::string *out, AdmitResult result);
+
+#endif
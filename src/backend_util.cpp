@@ -0,0 +1,791 @@
+/**
+ * @file backend_util.cpp
+ * @brief 处理函数外部依赖的线上实现：mysql元数据、redis token、fastDFS文件内容
+ * @author ward
+ * @version 1.0
+ * @date 2023年6月24日
+ */
+
+#include "backend_util.h"
+
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <iterator>
+
+#include "cgi_util.h"
+#include "compress_util.h"
+#include "make_log.h"
+#include "mysql_util.h"
+#include "storage_util.h"
+
+//==================== mysql ====================
+
+/**
+ * @brief 执行不返回结果集的sql语句，失败时记录日志
+ *
+ * @return 0成功，-1失败
+ */
+int MysqlMetaStore::exec(const char *sql_cmd) {
+  if (mysqlQuery(conn_, sql_cmd) != 0) {
+    LOG_ERROR(BACKEND_LOG_MODULE, BACKEND_LOG_PROC, "%s 操作失败: %s\n",
+              sql_cmd, mysql_error(conn_));
+    return -1;
+  }
+  return 0;
+}
+
+int MysqlMetaStore::fileRefCount(const char *md5, int *count) {
+  char sql_cmd[SQL_MAX_LEN] = {0};
+  char tmp[512] = {0};
+  snprintf(sql_cmd, sizeof(sql_cmd),
+           "select count from file_info where md5 = '%s'", md5);
+  // 0成功并保存记录集，1没有记录集，2有记录集但是没有保存，-1失败
+  int ret = processResultOne(conn_, sql_cmd, tmp);
+  if (ret == 0) {
+    *count = atoi(tmp);
+    return 0;
+  }
+  return ret == 1 ? 1 : -1;
+}
+
+long MysqlMetaStore::fileSize(const char *md5) {
+  char sql_cmd[SQL_MAX_LEN] = {0};
+  char tmp[512] = {0};
+  snprintf(sql_cmd, sizeof(sql_cmd),
+           "select size from file_info where md5 = '%s'", md5);
+  if (processResultOne(conn_, sql_cmd, tmp) != 0) {
+    return -1;
+  }
+  return atol(tmp);
+}
+
+int MysqlMetaStore::setFileRefCount(const char *md5, int count) {
+  char sql_cmd[SQL_MAX_LEN] = {0};
+  snprintf(sql_cmd, sizeof(sql_cmd),
+           "update file_info set count = %d where md5 = '%s'", count, md5);
+  return exec(sql_cmd);
+}
+
+int MysqlMetaStore::addFileInfo(const char *md5, const char *fileid,
+                                const char *url, long size,
+                                const char *type) {
+  /*
+     -- =============================================== 文件信息表
+     -- md5 文件md5
+     -- file_id 文件id
+     -- url 文件url
+     -- size 文件大小, 以字节为单位
+     -- type 文件类型： png, zip, mp4……
+     -- count 文件引用计数， 默认为1， 每增加一个用户拥有此文件，此计数器+1
+     */
+  char sql_cmd[SQL_MAX_LEN] = {0};
+  snprintf(sql_cmd, sizeof(sql_cmd),
+           "insert into file_info (md5, file_id, url, size, type, count) "
+           "values ('%s', '%s', '%s', '%ld', '%s', %d)",
+           md5, fileid, url, size, type, 1);
+  return exec(sql_cmd);
+}
+
+int MysqlMetaStore::userHasFile(const char *user, const char *md5,
+                                const char *filename) {
+  char sql_cmd[SQL_MAX_LEN] = {0};
+  snprintf(sql_cmd, sizeof(sql_cmd),
+           "select * from user_file_list where user = '%s' and md5 = '%s' and "
+           "filename = '%s'",
+           user, md5, filename);
+  // buf为nullptr时只判断有没有记录
+  int ret = processResultOne(conn_, sql_cmd, nullptr);
+  return ret == 2 ? 1 : (ret == 1 ? 0 : -1);
+}
+
+int MysqlMetaStore::addUserFile(const char *user, const char *md5,
+                                const char *filename,
+                                const char *create_time) {
+  /*
+     -- =============================================== 用户文件列表
+     -- user 文件所属用户
+     -- md5 文件md5
+     -- createtime 文件创建时间
+     -- filename 文件名字
+     -- shared_status 共享状态, 0为没有共享， 1为共享
+     -- pv 文件下载量，默认值为0，下载一次加1
+     */
+  char sql_cmd[SQL_MAX_LEN] = {0};
+  snprintf(sql_cmd, sizeof(sql_cmd),
+           "insert into user_file_list(user, md5, createtime, filename, "
+           "shared_status, pv) values ('%s', '%s', '%s', '%s', %d, %d)",
+           user, md5, create_time, filename, 0, 0);
+  return exec(sql_cmd);
+}
+
+int MysqlMetaStore::userFileCount(const char *user, long *count) {
+  char sql_cmd[SQL_MAX_LEN] = {0};
+  char tmp[512] = {0};
+  snprintf(sql_cmd, sizeof(sql_cmd),
+           "select count from user_file_count where user = '%s'", user);
+  int ret = processResultOne(conn_, sql_cmd, tmp);
+  if (ret == 0) {
+    *count = atol(tmp);
+    return 0;
+  }
+  return ret == 1 ? 1 : -1;
+}
+
+int MysqlMetaStore::incUserFileCount(const char *user) {
+  char sql_cmd[SQL_MAX_LEN] = {0};
+  long count = 0;
+  int ret = userFileCount(user, &count);
+  if (ret == 1) {
+    // 用户之前没有上传过文件，插入一条数据
+    snprintf(sql_cmd, sizeof(sql_cmd),
+             "insert into user_file_count (user, count) values('%s', %d)",
+             user, 1);
+  } else if (ret == 0) {
+    snprintf(sql_cmd, sizeof(sql_cmd),
+             "update user_file_count set count = %ld where user = '%s'",
+             count + 1, user);
+  } else {
+    return -1;
+  }
+  return exec(sql_cmd);
+}
+
+std::unique_ptr<MetaRows> MysqlMetaStore::listUserFiles(const char *cmd,
+                                                        const char *user,
+                                                        int start, int count) {
+  char sql_cmd[SQL_MAX_LEN] = {0};
+  if (makeFileListSql(sql_cmd, cmd, user, start, count) != 0 ||
+      exec(sql_cmd) != 0) {
+    return nullptr;
+  }
+  MYSQL_RES *res_set = mysql_store_result(conn_);  // 获取结果集
+  if (res_set == nullptr) {
+    LOG_ERROR(BACKEND_LOG_MODULE, BACKEND_LOG_PROC,
+              "mysql_store_result error: %s!\n", mysql_error(conn_));
+    return nullptr;
+  }
+  return std::unique_ptr<MetaRows>(new MysqlRows(res_set));
+}
+
+int MysqlMetaStore::fileLocation(const char *user, const char *md5,
+                                 const char *filename, FileLocation *loc) {
+  char sql_cmd[SQL_MAX_LEN] = {0};
+  snprintf(sql_cmd, sizeof(sql_cmd),
+           "select file_info.file_id, file_info.size, "
+           "user_file_list.shared_status, file_info.codec, "
+           "file_info.pack_offset, file_info.pack_length "
+           "from file_info, user_file_list where user_file_list.user = '%s' "
+           "and user_file_list.md5 = '%s' and user_file_list.filename = '%s' "
+           "and file_info.md5 = user_file_list.md5",
+           user, md5, filename);
+  if (exec(sql_cmd) != 0) {
+    return -1;
+  }
+  MYSQL_RES *res_set = mysql_store_result(conn_);
+  if (res_set == nullptr) {
+    LOG_ERROR(BACKEND_LOG_MODULE, BACKEND_LOG_PROC,
+              "mysql_store_result error: %s!\n", mysql_error(conn_));
+    return -1;
+  }
+  MysqlRows rows(res_set);
+  char **row = rows.next();
+  if (row == nullptr || row[0] == nullptr) {
+    return 1;
+  }
+  loc->fileid = row[0];
+  loc->size = row[1] != nullptr ? atol(row[1]) : 0;
+  loc->shared = row[2] != nullptr && atoi(row[2]) == 1;
+  loc->codec = row[3] != nullptr ? row[3] : CODEC_NONE;
+  loc->pack_offset = -1;
+  loc->pack_length = 0;
+  if (row[4] != nullptr && row[5] != nullptr) {
+    loc->pack_offset = atol(row[4]);
+    loc->pack_length = atol(row[5]);
+  }
+  return 0;
+}
+
+int MysqlMetaStore::addFilePv(const std::vector<FilePv> &pvs) {
+  if (pvs.empty()) {
+    return 0;
+  }
+  // 一批更新一次提交，只有一次刷盘
+  if (exec("start transaction") != 0) {
+    return -1;
+  }
+  char sql_cmd[SQL_MAX_LEN] = {0};
+  for (const FilePv &pv : pvs) {
+    snprintf(sql_cmd, sizeof(sql_cmd),
+             "update user_file_list set pv = pv + %ld where user = '%s' and "
+             "md5 = '%s' and filename = '%s'",
+             pv.count, pv.user.c_str(), pv.md5.c_str(), pv.filename.c_str());
+    if (exec(sql_cmd) != 0) {
+      exec("rollback");
+      return -1;
+    }
+  }
+  return exec("commit");
+}
+
+int MysqlMetaStore::setShared(const char *user, const char *md5,
+                              const char *filename, bool shared,
+                              long share_time) {
+  /*
+     -- share_time 共享时间，没有共享为null
+     -- alter table user_file_list add column share_time datetime default null;
+     */
+  char sql_cmd[SQL_MAX_LEN] = {0};
+  if (shared) {
+    snprintf(sql_cmd, sizeof(sql_cmd),
+             "update user_file_list set shared_status = 1, "
+             "share_time = from_unixtime(%ld) where user = '%s' and "
+             "md5 = '%s' and filename = '%s'",
+             share_time, user, md5, filename);
+  } else {
+    snprintf(sql_cmd, sizeof(sql_cmd),
+             "update user_file_list set shared_status = 0, share_time = null "
+             "where user = '%s' and md5 = '%s' and filename = '%s'",
+             user, md5, filename);
+  }
+  return exec(sql_cmd);
+}
+
+// 共享文件的字段：shared_status, share_time, pv, size, type
+// file_info.url是storage上的地址(打包的为整个容器)，不放进公开的共享列表
+static void sharedFileFromRow(char **row, SharedFile *file) {
+  bool shared = row[0] != nullptr && atoi(row[0]) == 1;
+  file->share_time = shared && row[1] != nullptr ? atol(row[1]) : 0;
+  file->pv = row[2] != nullptr ? atol(row[2]) : 0;
+  file->size = row[3] != nullptr ? atol(row[3]) : 0;
+  file->type = row[4] != nullptr ? row[4] : "";
+}
+
+int MysqlMetaStore::sharedFile(const char *user, const char *md5,
+                               const char *filename, SharedFile *file) {
+  char sql_cmd[SQL_MAX_LEN] = {0};
+  snprintf(sql_cmd, sizeof(sql_cmd),
+           "select user_file_list.shared_status, "
+           "unix_timestamp(user_file_list.share_time), user_file_list.pv, "
+           "file_info.size, file_info.type "
+           "from file_info, user_file_list where user_file_list.user = '%s' "
+           "and user_file_list.md5 = '%s' and user_file_list.filename = '%s' "
+           "and file_info.md5 = user_file_list.md5",
+           user, md5, filename);
+  if (exec(sql_cmd) != 0) {
+    return -1;
+  }
+  MYSQL_RES *res_set = mysql_store_result(conn_);
+  if (res_set == nullptr) {
+    LOG_ERROR(BACKEND_LOG_MODULE, BACKEND_LOG_PROC,
+              "mysql_store_result error: %s!\n", mysql_error(conn_));
+    return -1;
+  }
+  MysqlRows rows(res_set);
+  char **row = rows.next();
+  if (row == nullptr) {
+    return 1;
+  }
+  file->user = user;
+  file->md5 = md5;
+  file->filename = filename;
+  sharedFileFromRow(row, file);
+  return 0;
+}
+
+int MysqlMetaStore::sharedFiles(std::vector<SharedFile> *files) {
+  if (exec("select user_file_list.user, user_file_list.md5, "
+           "user_file_list.filename, user_file_list.shared_status, "
+           "unix_timestamp(user_file_list.share_time), user_file_list.pv, "
+           "file_info.size, file_info.type "
+           "from file_info, user_file_list where "
+           "user_file_list.shared_status = 1 and "
+           "file_info.md5 = user_file_list.md5") != 0) {
+    return -1;
+  }
+  // 逐行从服务端取，不把整个结果集先读到客户端
+  MYSQL_RES *res_set = mysql_use_result(conn_);
+  if (res_set == nullptr) {
+    LOG_ERROR(BACKEND_LOG_MODULE, BACKEND_LOG_PROC,
+              "mysql_use_result error: %s!\n", mysql_error(conn_));
+    return -1;
+  }
+  MysqlRows rows(res_set);
+  char **row;
+  while ((row = rows.next()) != nullptr) {
+    if (row[0] == nullptr || row[1] == nullptr || row[2] == nullptr) {
+      continue;
+    }
+    SharedFile file;
+    file.user = row[0];
+    file.md5 = row[1];
+    file.filename = row[2];
+    sharedFileFromRow(row + 3, &file);
+    files->push_back(std::move(file));
+  }
+  return 0;
+}
+
+int MysqlMetaStore::addShareLink(const ShareLink &link) {
+  char sql_cmd[SQL_MAX_LEN] = {0};
+  snprintf(sql_cmd, sizeof(sql_cmd),
+           "insert into share_link (code, user, md5, filename, expire_time, "
+           "max_downloads, hits) values ('%s', '%s', '%s', '%s', %ld, %ld, 0)",
+           link.code.c_str(), link.user.c_str(), link.md5.c_str(),
+           link.filename.c_str(), link.expire_time, link.max_downloads);
+  if (exec(sql_cmd) != 0) {
+    return mysql_errno(conn_) == 1062 ? 1 : -1;  // ER_DUP_ENTRY
+  }
+  return 0;
+}
+
+int MysqlMetaStore::shareLink(const char *code, ShareLink *link) {
+  char sql_cmd[SQL_MAX_LEN] = {0};
+  snprintf(sql_cmd, sizeof(sql_cmd),
+           "select user, md5, filename, expire_time, max_downloads, hits "
+           "from share_link where code = '%s'",
+           code);
+  if (exec(sql_cmd) != 0) {
+    return -1;
+  }
+  MYSQL_RES *res_set = mysql_store_result(conn_);
+  if (res_set == nullptr) {
+    LOG_ERROR(BACKEND_LOG_MODULE, BACKEND_LOG_PROC,
+              "mysql_store_result error: %s!\n", mysql_error(conn_));
+    return -1;
+  }
+  MysqlRows rows(res_set);
+  char **row = rows.next();
+  if (row == nullptr || row[0] == nullptr || row[1] == nullptr ||
+      row[2] == nullptr) {
+    return 1;
+  }
+  link->code = code;
+  link->user = row[0];
+  link->md5 = row[1];
+  link->filename = row[2];
+  link->expire_time = row[3] != nullptr ? atol(row[3]) : 0;
+  link->max_downloads = row[4] != nullptr ? atol(row[4]) : 0;
+  link->hits = row[5] != nullptr ? atol(row[5]) : 0;
+  return 0;
+}
+
+int MysqlMetaStore::addShareLinkHits(
+    const std::vector<std::pair<std::string, long>> &hits) {
+  if (hits.empty()) {
+    return 0;
+  }
+  if (exec("start transaction") != 0) {
+    return -1;
+  }
+  char sql_cmd[SQL_MAX_LEN] = {0};
+  for (const auto &hit : hits) {
+    snprintf(sql_cmd, sizeof(sql_cmd),
+             "update share_link set hits = hits + %ld where code = '%s'",
+             hit.second, hit.first.c_str());
+    if (exec(sql_cmd) != 0) {
+      exec("rollback");
+      return -1;
+    }
+  }
+  return exec("commit");
+}
+
+/**
+ * @brief 生成用户文件列表一页的sql语句，多表指定行范围查询
+ *
+ * @param sql_cmd (out) sql语句，长度SQL_MAX_LEN
+ * @param cmd normal为上传顺序，pvasc/pvdesc按下载量升序/降序
+ * @param user 用户名
+ * @param start 起始位置
+ * @param count 个数
+ *
+ * @return 0成功，cmd不认识时返回-1
+ */
+int makeFileListSql(char *sql_cmd, const char *cmd, const char *user,
+                    int start, int count) {
+  const char *order;
+  if (strcmp(cmd, "normal") == 0) {
+    order = "";
+  } else if (strcmp(cmd, "pvasc") == 0) {
+    order = " order by pv asc";
+  } else if (strcmp(cmd, "pvdesc") == 0) {
+    order = " order by pv desc";
+  } else {
+    return -1;
+  }
+  // 打包和压缩存储的文件在storage上的url不是文件本身，url为空
+  snprintf(sql_cmd, SQL_MAX_LEN,
+           "select user_file_list.user, user_file_list.md5, "
+           "user_file_list.createtime, user_file_list.filename, "
+           "user_file_list.shared_status, user_file_list.pv, "
+           "if(file_info.pack_offset is null and "
+           "ifnull(file_info.codec, 'none') = 'none', file_info.url, ''), "
+           "file_info.size, file_info.type from file_info, user_file_list "
+           "where user = '%s' and file_info.md5 = user_file_list.md5%s "
+           "limit %d, %d",
+           user, order, start, count);
+  LOG_DEBUG(BACKEND_LOG_MODULE, BACKEND_LOG_PROC, "sql_cmd = %s\n", sql_cmd);
+  return 0;
+}
+
+//==================== redis ====================
+
+bool RedisTokenStore::validate(const char *user, const char *token) {
+  return validateToken(redis_, user, token);
+}
+
+static const char SHARE_TIME_KEY[] = "share:time";
+static const char SHARE_PV_KEY[] = "share:pv";
+static const char SHARE_INFO_KEY[] = "share:info";
+static const char SHARE_SYNCED_KEY[] = "share:synced";
+static const char SHARE_LOCK_KEY[] = "share:lock";
+// 共享/取消共享过的member，重建替换时以旧排行中的状态为准
+static const char SHARE_DIRTY_KEY[] = "share:dirty";
+// pv_util中还没落库的下载量
+static const char SHARE_PV_PENDING_KEY[] = "pv:pending";
+static const char SHARE_PV_FLUSHING_KEY[] = "pv:flushing";
+// 重建时先写入的新排行，写完后一次改名替换
+static const char SHARE_NEW_TIME_KEY[] = "share:time:new";
+static const char SHARE_NEW_PV_KEY[] = "share:pv:new";
+static const char SHARE_NEW_INFO_KEY[] = "share:info:new";
+
+// 每次EVAL写入的共享文件数，避免一个脚本阻塞redis太久
+static const size_t SHARE_BATCH = 500;
+
+/*
+   加入共享文件
+   KEYS[1] share:time  KEYS[2] share:pv  KEYS[3] share:info
+   KEYS[4] share:dirty，重建时写入新排行不需要，为空
+   ARGV 依次为 member、共享时间、下载量、文件信息
+*/
+static const char SHARE_ADD_LUA[] = R"(
+for i = 1, #ARGV, 4 do
+  redis.call('ZADD', KEYS[1], ARGV[i + 1], ARGV[i])
+  redis.call('ZADD', KEYS[2], ARGV[i + 2], ARGV[i])
+  redis.call('HSET', KEYS[3], ARGV[i], ARGV[i + 3])
+  if KEYS[4] then
+    redis.call('SADD', KEYS[4], ARGV[i])
+  end
+end
+return 1
+)";
+
+/*
+   移出共享文件
+   KEYS[1] share:time  KEYS[2] share:pv  KEYS[3] share:info
+   KEYS[4] share:dirty  ARGV[1] member
+*/
+static const char SHARE_REMOVE_LUA[] = R"(
+redis.call('ZREM', KEYS[1], ARGV[1])
+redis.call('ZREM', KEYS[2], ARGV[1])
+redis.call('HDEL', KEYS[3], ARGV[1])
+redis.call('SADD', KEYS[4], ARGV[1])
+return 1
+)";
+
+/*
+   累加下载量，只累加已共享的文件
+   KEYS[1] share:time  KEYS[2] share:pv  ARGV 依次为 member、次数
+*/
+static const char SHARE_PV_LUA[] = R"(
+for i = 1, #ARGV, 2 do
+  if redis.call('ZSCORE', KEYS[1], ARGV[i]) then
+    redis.call('ZINCRBY', KEYS[2], ARGV[i + 1], ARGV[i])
+  end
+end
+return 1
+)";
+
+/*
+   排行的一页，一次往返取回名次、文件信息和下载量
+   KEYS[1] 排序用的有序集合  KEYS[2] share:pv  KEYS[3] share:info
+   KEYS[4] share:synced  ARGV[1] 起始名次  ARGV[2] 结束名次(包含)
+   排行还没有建立时返回空数组，否则返回 总数, {member, 文件信息, 下载量}...
+*/
+static const char SHARE_LIST_LUA[] = R"(
+if redis.call('EXISTS', KEYS[4]) == 0 then
+  return {}
+end
+local out = {tostring(redis.call('ZCARD', KEYS[1]))}
+if tonumber(ARGV[2]) >= tonumber(ARGV[1]) then
+  for _, m in ipairs(redis.call('ZREVRANGE', KEYS[1], ARGV[1], ARGV[2])) do
+    out[#out + 1] = m
+    out[#out + 1] = redis.call('HGET', KEYS[3], m) or ''
+    out[#out + 1] = redis.call('ZSCORE', KEYS[2], m) or '0'
+  end
+end
+return out
+)";
+
+/*
+   新排行替换旧排行，并标记排行已建立
+   KEYS[1..3] 新的time/pv/info  KEYS[4..6] 旧的time/pv/info
+   KEYS[7] share:synced  KEYS[8] share:dirty
+   KEYS[9] pv:pending  KEYS[10] pv:flushing  ARGV[1] 同步时间
+   新排行读的是mysql，替换前：
+   - 还没落库的下载量累加到新排行
+   - share:dirty中的member在读mysql之后可能又共享/取消共享过，
+     以旧排行中的状态为准(旧排行的下载量已含推送过的次数，新共享的沿用它)
+*/
+static const char SHARE_SWAP_LUA[] = R"(
+for k = 9, 10 do
+  local pv = redis.call('HGETALL', KEYS[k])
+  for i = 1, #pv, 2 do
+    if redis.call('ZSCORE', KEYS[1], pv[i]) then
+      redis.call('ZINCRBY', KEYS[2], pv[i + 1], pv[i])
+    end
+  end
+end
+for _, m in ipairs(redis.call('SMEMBERS', KEYS[8])) do
+  local t = redis.call('ZSCORE', KEYS[4], m)
+  if t then
+    if not redis.call('ZSCORE', KEYS[1], m) then
+      redis.call('ZADD', KEYS[2], redis.call('ZSCORE', KEYS[5], m) or 0, m)
+    end
+    redis.call('ZADD', KEYS[1], t, m)
+    redis.call('HSET', KEYS[3], m, redis.call('HGET', KEYS[6], m) or '')
+  else
+    redis.call('ZREM', KEYS[1], m)
+    redis.call('ZREM', KEYS[2], m)
+    redis.call('HDEL', KEYS[3], m)
+  end
+end
+redis.call('DEL', KEYS[8])
+for i = 1, 3 do
+  if redis.call('EXISTS', KEYS[i]) == 1 then
+    redis.call('RENAME', KEYS[i], KEYS[i + 3])
+  else
+    redis.call('DEL', KEYS[i + 3])
+  end
+end
+redis.call('SET', KEYS[7], ARGV[1])
+return 1
+)";
+
+static std::string shareMember(const std::string &user, const std::string &md5,
+                               const std::string &filename) {
+  return user + '\n' + md5 + '\n' + filename;
+}
+
+// share:info中的文件信息：共享时间\n大小\n类型
+static std::string shareInfo(const SharedFile &f) {
+  return std::to_string(f.share_time) + '\n' + std::to_string(f.size) + '\n' +
+         f.type;
+}
+
+// member和文件信息拆回SharedFile，格式不对时返回false
+static bool parseShared(const std::string &member, const std::string &info,
+                        SharedFile *f) {
+  size_t p1 = member.find('\n');
+  size_t p2 = p1 == std::string::npos ? p1 : member.find('\n', p1 + 1);
+  size_t i1 = info.find('\n');
+  size_t i2 = i1 == std::string::npos ? i1 : info.find('\n', i1 + 1);
+  if (p2 == std::string::npos || i2 == std::string::npos) {
+    return false;
+  }
+  f->user = member.substr(0, p1);
+  f->md5 = member.substr(p1 + 1, p2 - p1 - 1);
+  f->filename = member.substr(p2 + 1);
+  f->share_time = atol(info.c_str());
+  f->size = atol(info.c_str() + i1 + 1);
+  // 旧版本在类型后面还有url，忽略
+  size_t i3 = info.find('\n', i2 + 1);
+  f->type = info.substr(
+      i2 + 1, i3 == std::string::npos ? std::string::npos : i3 - i2 - 1);
+  return true;
+}
+
+int RedisShareIndex::addTo(const std::vector<SharedFile> &files,
+                           const char *time_key, const char *pv_key,
+                           const char *info_key, const char *dirty_key) {
+  std::vector<std::string> keys = {time_key, pv_key, info_key};
+  if (dirty_key != nullptr) {
+    keys.push_back(dirty_key);
+  }
+  std::vector<std::string> args;
+  for (size_t i = 0; i < files.size(); i += SHARE_BATCH) {
+    args.clear();
+    for (size_t j = i; j < files.size() && j < i + SHARE_BATCH; j++) {
+      const SharedFile &f = files[j];
+      args.push_back(shareMember(f.user, f.md5, f.filename));
+      args.push_back(std::to_string(f.share_time));
+      args.push_back(std::to_string(f.pv));
+      args.push_back(shareInfo(f));
+    }
+    try {
+      redis_->eval<long long>(SHARE_ADD_LUA, keys.begin(), keys.end(),
+                              args.begin(), args.end());
+    } catch (const sw::redis::Error &e) {
+      LOG_ERROR(BACKEND_LOG_MODULE, BACKEND_LOG_PROC, "share add err: %s\n",
+                e.what());
+      return -1;
+    }
+  }
+  return 0;
+}
+
+int RedisShareIndex::add(const std::vector<SharedFile> &files) {
+  return addTo(files, SHARE_TIME_KEY, SHARE_PV_KEY, SHARE_INFO_KEY,
+               SHARE_DIRTY_KEY);
+}
+
+int RedisShareIndex::remove(const char *user, const char *md5,
+                            const char *filename) {
+  try {
+    redis_->eval<long long>(
+        SHARE_REMOVE_LUA,
+        {SHARE_TIME_KEY, SHARE_PV_KEY, SHARE_INFO_KEY, SHARE_DIRTY_KEY},
+        {shareMember(user, md5, filename)});
+  } catch (const sw::redis::Error &e) {
+    LOG_ERROR(BACKEND_LOG_MODULE, BACKEND_LOG_PROC, "share remove err: %s\n",
+              e.what());
+    return -1;
+  }
+  return 0;
+}
+
+int RedisShareIndex::list(bool by_pv, long start, long count,
+                          std::vector<SharedFile> *files, long *total) {
+  std::vector<std::string> keys = {by_pv ? SHARE_PV_KEY : SHARE_TIME_KEY,
+                                   SHARE_PV_KEY, SHARE_INFO_KEY,
+                                   SHARE_SYNCED_KEY};
+  std::vector<std::string> args = {std::to_string(start),
+                                   std::to_string(start + count - 1)};
+  std::vector<std::string> reply;
+  try {
+    redis_->eval(SHARE_LIST_LUA, keys.begin(), keys.end(), args.begin(),
+                 args.end(), std::back_inserter(reply));
+  } catch (const sw::redis::Error &e) {
+    LOG_ERROR(BACKEND_LOG_MODULE, BACKEND_LOG_PROC, "share list err: %s\n",
+              e.what());
+    return -1;
+  }
+  if (reply.empty()) {
+    return 1;
+  }
+  *total = atol(reply[0].c_str());
+  for (size_t i = 1; i + 2 < reply.size(); i += 3) {
+    SharedFile f;
+    if (!parseShared(reply[i], reply[i + 1], &f)) {
+      LOG_WARNING(BACKEND_LOG_MODULE, BACKEND_LOG_PROC,
+                  "bad share member [%s]\n", reply[i].c_str());
+      continue;
+    }
+    f.pv = (long)strtod(reply[i + 2].c_str(), nullptr);
+    files->push_back(std::move(f));
+  }
+  return 0;
+}
+
+int RedisShareIndex::addPv(const std::vector<FilePv> &pvs) {
+  if (pvs.empty()) {
+    return 0;
+  }
+  std::vector<std::string> keys = {SHARE_TIME_KEY, SHARE_PV_KEY};
+  std::vector<std::string> args;
+  args.reserve(pvs.size() * 2);
+  for (const FilePv &pv : pvs) {
+    args.push_back(shareMember(pv.user, pv.md5, pv.filename));
+    args.push_back(std::to_string(pv.count));
+  }
+  try {
+    redis_->eval<long long>(SHARE_PV_LUA, keys.begin(), keys.end(),
+                            args.begin(), args.end());
+  } catch (const sw::redis::Error &e) {
+    LOG_ERROR(BACKEND_LOG_MODULE, BACKEND_LOG_PROC, "share pv err: %s\n",
+              e.what());
+    return -1;
+  }
+  return 0;
+}
+
+bool RedisShareIndex::claimSync(int interval_s) {
+  try {
+    return redis_->set(SHARE_LOCK_KEY, std::to_string(getpid()),
+                       std::chrono::seconds(interval_s > 0 ? interval_s : 1),
+                       sw::redis::UpdateType::NOT_EXIST);
+  } catch (const sw::redis::Error &e) {
+    LOG_ERROR(BACKEND_LOG_MODULE, BACKEND_LOG_PROC, "share lock err: %s\n",
+              e.what());
+    return false;
+  }
+}
+
+/*
+   释放本进程持有的share:lock
+   KEYS[1] share:lock  ARGV[1] 本进程的pid
+*/
+static const char SHARE_UNLOCK_LUA[] = R"(
+if redis.call('GET', KEYS[1]) == ARGV[1] then
+  return redis.call('DEL', KEYS[1])
+end
+return 0
+)";
+
+void RedisShareIndex::releaseSync() {
+  try {
+    redis_->eval<long long>(SHARE_UNLOCK_LUA, {SHARE_LOCK_KEY},
+                            {std::to_string(getpid())});
+  } catch (const sw::redis::Error &e) {
+    LOG_ERROR(BACKEND_LOG_MODULE, BACKEND_LOG_PROC, "share unlock err: %s\n",
+              e.what());
+  }
+}
+
+int RedisShareIndex::replace(const std::vector<SharedFile> &files) {
+  try {
+    redis_->del(SHARE_NEW_TIME_KEY);
+    redis_->del(SHARE_NEW_PV_KEY);
+    redis_->del(SHARE_NEW_INFO_KEY);
+  } catch (const sw::redis::Error &e) {
+    LOG_ERROR(BACKEND_LOG_MODULE, BACKEND_LOG_PROC, "share del err: %s\n",
+              e.what());
+    return -1;
+  }
+  if (addTo(files, SHARE_NEW_TIME_KEY, SHARE_NEW_PV_KEY, SHARE_NEW_INFO_KEY,
+            nullptr) != 0) {
+    return -1;
+  }
+  std::vector<std::string> keys = {
+      SHARE_NEW_TIME_KEY, SHARE_NEW_PV_KEY,     SHARE_NEW_INFO_KEY,
+      SHARE_TIME_KEY,     SHARE_PV_KEY,         SHARE_INFO_KEY,
+      SHARE_SYNCED_KEY,   SHARE_DIRTY_KEY,      SHARE_PV_PENDING_KEY,
+      SHARE_PV_FLUSHING_KEY};
+  std::vector<std::string> args = {std::to_string(time(nullptr))};
+  try {
+    redis_->eval<long long>(SHARE_SWAP_LUA, keys.begin(), keys.end(),
+                            args.begin(), args.end());
+  } catch (const sw::redis::Error &e) {
+    LOG_ERROR(BACKEND_LOG_MODULE, BACKEND_LOG_PROC, "share swap err: %s\n",
+              e.what());
+    return -1;
+  }
+  return 0;
+}
+
+//==================== fastDFS ====================
+
+int FdfsBlobStore::upload(const char *filename, char *fileid) {
+  return uploadToStorage(filename, fileid);
+}
+
+int FdfsBlobStore::fileUrl(const char *fileid, char *url) {
+  return makeFileUrl(fileid, url);
+}
+
+int FdfsBlobStore::download(const char *fileid, long offset, long length,
+                            const char *local_file) {
+  return offset < 0 ? downloadFromStorage(fileid, local_file)
+                    : downloadRangeFromStorage(fileid, offset, length,
+                                               local_file);
+}
+
+int FdfsBlobStore::stream(const char *fileid, long offset, long length,
+                          const DataSink &sink) {
+  return streamFromStorage(fileid, offset, length, sink);
+}
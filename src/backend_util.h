@@ -0,0 +1,321 @@
+#ifndef BACKEND_UTIL_H
+#define BACKEND_UTIL_H
+
+#include <mysql/mysql.h>
+#include <sw/redis++/redis++.h>
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+/*
+   处理函数访问外部依赖的接口：
+   - MetaStore   文件元数据(mysql)：秒传、文件个数和列表、上传入库、下载
+   - TokenStore  登录token(redis)
+   - BlobStore   文件内容(fastDFS)
+   - ShareIndex  共享文件的排行(redis)，公开的共享列表只读它
+   线上由openCgiContext创建mysql/redis/fastDFS的实现，
+   fake_util.h中是内存中的实现，处理函数不需要任何服务就能在基准测试的循环中、
+   perf下单独运行，测到的是我们自己代码的开销。
+
+   登录、注册、增量同步、打包和配额仍直接使用CgiContext中的连接。
+*/
+
+const char *const BACKEND_LOG_MODULE = "cgi";
+const char *const BACKEND_LOG_PROC = "backend";
+
+// 文件列表的字段数：user, md5, createtime, filename, shared_status, pv,
+// url(打包和压缩存储的文件为空), size, type
+const int FILE_ROW_FIELDS = 9;
+
+// 下载一个文件需要的信息
+struct FileLocation {
+  std::string fileid;      // 文件id，打包的文件为容器的id
+  long size = 0;           // 文件大小
+  bool shared = false;     // user_file_list.shared_status
+  std::string codec;       // 存储编码(compress_util.h)
+  long pack_offset = -1;   // 打包的文件在容器中的位置，未打包为-1
+  long pack_length = 0;
+};
+
+// 流式接收数据，返回非0时停止
+typedef std::function<int(const char *data, size_t len)> DataSink;
+
+// 一个文件的下载次数增量
+struct FilePv {
+  std::string user;
+  std::string md5;
+  std::string filename;
+  long count;
+};
+
+// 一个共享文件，共享列表的一项
+struct SharedFile {
+  std::string user;      // 文件主人
+  std::string md5;
+  std::string filename;
+  long share_time = 0;   // 共享时间(unix秒)，没有共享为0
+  long pv = 0;           // 下载量
+  long size = 0;
+  std::string type;
+};
+
+// 分享短链接(link_util.h)
+struct ShareLink {
+  std::string code;        // 短链接的code
+  std::string user;        // 文件主人
+  std::string md5;
+  std::string filename;
+  long expire_time = 0;    // 过期时间(unix秒)，0为不过期
+  long max_downloads = 0;  // 最多下载次数，0为不限
+  long hits = 0;           // 已落库的点击量
+};
+
+// 查询结果的行，字段为'\0'结尾的字符串，NULL字段为nullptr
+class MetaRows {
+ public:
+  virtual ~MetaRows() {}
+
+  // 行数
+  virtual size_t size() const = 0;
+
+  // 下一行，没有更多行时返回nullptr
+  virtual char **next() = 0;
+};
+
+// 文件元数据
+class MetaStore {
+ public:
+  virtual ~MetaStore() {}
+
+  // 文件的引用计数，0存在，1不存在，-1失败
+  virtual int fileRefCount(const char *md5, int *count) = 0;
+
+  // 文件大小，不存在或失败时返回-1
+  virtual long fileSize(const char *md5) = 0;
+
+  // 设置文件的引用计数，0成功，-1失败
+  virtual int setFileRefCount(const char *md5, int count) = 0;
+
+  // 新增文件信息，引用计数为1，0成功，-1失败
+  virtual int addFileInfo(const char *md5, const char *fileid,
+                          const char *url, long size, const char *type) = 0;
+
+  // 用户是否已有同名的此文件，1有，0没有，-1失败
+  virtual int userHasFile(const char *user, const char *md5,
+                          const char *filename) = 0;
+
+  // 文件加入用户的文件列表，0成功，-1失败
+  virtual int addUserFile(const char *user, const char *md5,
+                          const char *filename, const char *create_time) = 0;
+
+  // 用户文件数量，0成功，1没有记录，-1失败
+  virtual int userFileCount(const char *user, long *count) = 0;
+
+  // 用户文件数量 + 1，没有记录时新增，0成功，-1失败
+  virtual int incUserFileCount(const char *user) = 0;
+
+  // 用户文件列表的一页，cmd为normal/pvasc/pvdesc，失败或cmd不认识时返回nullptr
+  virtual std::unique_ptr<MetaRows> listUserFiles(const char *cmd,
+                                                  const char *user,
+                                                  int start, int count) = 0;
+
+  // 用户的文件在存储中的位置，0找到，1没有此文件，-1失败
+  virtual int fileLocation(const char *user, const char *md5,
+                           const char *filename, FileLocation *loc) = 0;
+
+  // 批量增加user_file_list.pv，在一个事务中提交，0成功，-1失败
+  virtual int addFilePv(const std::vector<FilePv> &pvs) = 0;
+
+  // 设置共享状态，shared时同时记下共享时间share_time，0成功，-1失败
+  virtual int setShared(const char *user, const char *md5,
+                        const char *filename, bool shared,
+                        long share_time) = 0;
+
+  // 用户的一个文件用于共享列表的信息，0找到，1没有此文件，-1失败
+  virtual int sharedFile(const char *user, const char *md5,
+                         const char *filename, SharedFile *file) = 0;
+
+  // 所有已共享的文件，0成功，-1失败
+  virtual int sharedFiles(std::vector<SharedFile> *files) = 0;
+
+  // 新增分享链接，0成功，1 code已存在，-1失败
+  virtual int addShareLink(const ShareLink &link) = 0;
+
+  // 按code查分享链接，0找到，1没有，-1失败
+  virtual int shareLink(const char *code, ShareLink *link) = 0;
+
+  // 批量增加share_link.hits(code, 次数)，在一个事务中提交，0成功，-1失败
+  virtual int addShareLinkHits(
+      const std::vector<std::pair<std::string, long>> &hits) = 0;
+};
+
+// 登录token
+class TokenStore {
+ public:
+  virtual ~TokenStore() {}
+
+  // 验证用户的token
+  virtual bool validate(const char *user, const char *token) = 0;
+};
+
+// 共享文件的排行：按下载量和按共享时间两个有序集合
+class ShareIndex {
+ public:
+  virtual ~ShareIndex() {}
+
+  // 加入或更新共享文件，0成功，-1失败
+  virtual int add(const std::vector<SharedFile> &files) = 0;
+
+  // 移出共享文件，0成功，-1失败
+  virtual int remove(const char *user, const char *md5,
+                     const char *filename) = 0;
+
+  // 排行的一页，by_pv按下载量降序，否则按共享时间从新到旧，total为共享文件总数
+  // 0成功，1排行还没有从mysql建立，-1失败
+  virtual int list(bool by_pv, long start, long count,
+                   std::vector<SharedFile> *files, long *total) = 0;
+
+  // 累加已共享文件的下载量，没有共享的忽略，0成功，-1失败
+  virtual int addPv(const std::vector<FilePv> &pvs) = 0;
+
+  // 抢同步的锁，interval_s秒内所有进程中只有一个调用者得到true
+  virtual bool claimSync(int interval_s) = 0;
+
+  // 同步失败时释放抢到的锁，让其它进程不必等到间隔结束就能重试
+  virtual void releaseSync() = 0;
+
+  // 用files整体替换排行，替换是原子的，0成功，-1失败
+  // 读取files之后共享/取消共享的文件以替换时排行中的为准，
+  // 还没落库的下载量累加到files的下载量上
+  virtual int replace(const std::vector<SharedFile> &files) = 0;
+};
+
+// 文件内容
+class BlobStore {
+ public:
+  virtual ~BlobStore() {}
+
+  // 上传本地文件，得到文件id，0成功，-1失败
+  virtual int upload(const char *filename, char *fileid) = 0;
+
+  // 文件的完整url，0成功，-1失败
+  virtual int fileUrl(const char *fileid, char *url) = 0;
+
+  // 下载到本地文件，offset < 0时下载整个文件，否则只下载[offset, offset + length)
+  // 0成功，-1失败
+  virtual int download(const char *fileid, long offset, long length,
+                       const char *local_file) = 0;
+
+  // 边下载边把内容交给sink，不落本地文件，offset的含义同download
+  // 0成功，-1失败或sink中止
+  virtual int stream(const char *fileid, long offset, long length,
+                     const DataSink &sink) = 0;
+};
+
+//==================== 线上的实现 ====================
+
+// mysql结果集，析构时释放
+class MysqlRows : public MetaRows {
+ public:
+  explicit MysqlRows(MYSQL_RES *res) : res_(res) {}
+  ~MysqlRows() override { mysql_free_result(res_); }
+  MysqlRows(const MysqlRows &) = delete;
+  MysqlRows &operator=(const MysqlRows &) = delete;
+
+  size_t size() const override { return mysql_num_rows(res_); }
+  char **next() override { return mysql_fetch_row(res_); }
+
+ private:
+  MYSQL_RES *res_;
+};
+
+// 不持有连接，连接由CgiContext管理
+class MysqlMetaStore : public MetaStore {
+ public:
+  explicit MysqlMetaStore(MYSQL *conn) : conn_(conn) {}
+
+  int fileRefCount(const char *md5, int *count) override;
+  long fileSize(const char *md5) override;
+  int setFileRefCount(const char *md5, int count) override;
+  int addFileInfo(const char *md5, const char *fileid, const char *url,
+                  long size, const char *type) override;
+  int userHasFile(const char *user, const char *md5,
+                  const char *filename) override;
+  int addUserFile(const char *user, const char *md5, const char *filename,
+                  const char *create_time) override;
+  int userFileCount(const char *user, long *count) override;
+  int incUserFileCount(const char *user) override;
+  std::unique_ptr<MetaRows> listUserFiles(const char *cmd, const char *user,
+                                          int start, int count) override;
+  int fileLocation(const char *user, const char *md5, const char *filename,
+                   FileLocation *loc) override;
+  int addFilePv(const std::vector<FilePv> &pvs) override;
+  int setShared(const char *user, const char *md5, const char *filename,
+                bool shared, long share_time) override;
+  int sharedFile(const char *user, const char *md5, const char *filename,
+                 SharedFile *file) override;
+  int sharedFiles(std::vector<SharedFile> *files) override;
+  int addShareLink(const ShareLink &link) override;
+  int shareLink(const char *code, ShareLink *link) override;
+  int addShareLinkHits(
+      const std::vector<std::pair<std::string, long>> &hits) override;
+
+ private:
+  int exec(const char *sql_cmd);
+
+  MYSQL *conn_;
+};
+
+class RedisTokenStore : public TokenStore {
+ public:
+  explicit RedisTokenStore(sw::redis::Redis *redis) : redis_(redis) {}
+
+  bool validate(const char *user, const char *token) override;
+
+ private:
+  sw::redis::Redis *redis_;
+};
+
+// 三个key(share_util.h)：share:time、share:pv两个有序集合，
+// member为 user\n md5\n filename；share:info为member到文件信息的hash
+class RedisShareIndex : public ShareIndex {
+ public:
+  explicit RedisShareIndex(sw::redis::Redis *redis) : redis_(redis) {}
+
+  int add(const std::vector<SharedFile> &files) override;
+  int remove(const char *user, const char *md5,
+             const char *filename) override;
+  int list(bool by_pv, long start, long count, std::vector<SharedFile> *files,
+           long *total) override;
+  int addPv(const std::vector<FilePv> &pvs) override;
+  bool claimSync(int interval_s) override;
+  void releaseSync() override;
+  int replace(const std::vector<SharedFile> &files) override;
+
+ private:
+  int addTo(const std::vector<SharedFile> &files, const char *time_key,
+            const char *pv_key, const char *info_key, const char *dirty_key);
+
+  sw::redis::Redis *redis_;
+};
+
+// 通过fdfs命令行工具访问fastDFS(storage_util.h)
+class FdfsBlobStore : public BlobStore {
+ public:
+  int upload(const char *filename, char *fileid) override;
+  int fileUrl(const char *fileid, char *url) override;
+  int download(const char *fileid, long offset, long length,
+               const char *local_file) override;
+  int stream(const char *fileid, long offset, long length,
+             const DataSink &sink) override;
+};
+
+// 生成用户文件列表一页的sql语句，cmd不认识时返回-1
+// io_uring服务端的异步查询使用同一条语句
+int makeFileListSql(char *sql_cmd, const char *cmd, const char *user,
+                    int start, int count);
+
+#endif
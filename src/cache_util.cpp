@@ -0,0 +1,595 @@
+/**
+ * @file cache_util.cpp
+ * @brief web层的本地磁盘读穿缓存：TinyLFU接纳、LRU淘汰、并发未命中合并
+ * @author ward
+ * @version 1.0
+ * @date 2023年7月4日
+ */
+
+#include "cache_util.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <mutex>
+#include <vector>
+
+#include "cgi_util.h"
+#include "delta_util.h"
+#include "make_log.h"
+
+// sketch的行数，估计值取各行的最小值
+static const int SKETCH_ROWS = 4;
+// 计数器上限，与TinyLFU一样用4位就够区分冷热
+static const uint8_t SKETCH_MAX = 15;
+// 命中时距上次更新mtime超过这么多秒才再更新，避免每次命中都写inode
+static const time_t CACHE_TOUCH_S = 60;
+
+// 淘汰候选队列的长度，扫描时只放最旧的这么多个
+static const uint32_t CACHE_QUEUE_MAX = 4096;
+static const char *const CACHE_INDEX_SHM_NAME = "/filehub_cache_index";
+
+// 共享内存中的sketch：头部之后是SKETCH_ROWS * width个计数器
+struct SketchHeader {
+  std::atomic<uint64_t> additions;  // 上次减半以来记录的次数
+};
+
+// 淘汰候选
+struct CacheVictim {
+  char name[256];  // 缓存文件名
+  long size;
+  time_t mtime;  // 入队时的mtime
+};
+
+// 共享内存中的索引，持有<dir>/.index.lock的flock时读写
+struct CacheIndex {
+  char dir[256];      // 索引对应的缓存目录
+  long used;          // 已用字节数，包括正在取入的
+  time_t scan_time;   // 上次扫描的时间，0为没有扫描过
+  int rescan;         // 队列用完，请求尽快扫描
+  uint32_t head;      // 队首在ring中的位置
+  uint32_t count;     // 队列长度
+  CacheVictim ring[CACHE_QUEUE_MAX];
+};
+
+static CacheConfig cache_cfg;
+static bool cache_enabled = false;
+static SketchHeader *sketch = nullptr;
+static std::atomic<uint8_t> *counters = nullptr;
+static size_t sketch_width = 0;
+static std::atomic<unsigned long> part_seq{0};
+static CacheIndex *cache_index = nullptr;
+static int index_lock_fd = -1;
+// flock按打开的文件互斥，同一进程的线程共用index_lock_fd，还要一把进程内的锁
+static std::mutex index_mutex;
+
+CacheConfig cacheConfig() {
+  CacheConfig cfg;
+  std::string value;
+  if (getCfgValue(CFG_PATH, "cache", "dir", value) == 0) {
+    cfg.dir = value;
+  }
+  if (getCfgValue(CFG_PATH, "cache", "location", value) == 0 &&
+      !value.empty()) {
+    cfg.location = value;
+    if (value.back() != '/') {
+      cfg.location += '/';
+    }
+  }
+  if (getCfgValue(CFG_PATH, "cache", "max_mb", value) == 0 &&
+      atol(value.c_str()) > 0) {
+    cfg.max_bytes = atol(value.c_str()) << 20;
+  }
+  if (getCfgValue(CFG_PATH, "cache", "max_object_mb", value) == 0 &&
+      atol(value.c_str()) > 0) {
+    cfg.max_object_bytes = atol(value.c_str()) << 20;
+  }
+  if (getCfgValue(CFG_PATH, "cache", "admit_min", value) == 0) {
+    cfg.admit_min = atoi(value.c_str());
+  }
+  if (getCfgValue(CFG_PATH, "cache", "sketch_width", value) == 0 &&
+      atol(value.c_str()) > 0) {
+    cfg.sketch_width = atol(value.c_str());
+  }
+  if (getCfgValue(CFG_PATH, "cache", "scan_s", value) == 0 &&
+      atoi(value.c_str()) > 0) {
+    cfg.scan_s = atoi(value.c_str());
+  }
+  return cfg;
+}
+
+// 打开共享内存中的sketch，名字带上宽度，修改sketch_width后使用新的
+static int openSketch(size_t width) {
+  size_t n = 1024;
+  while (n < width) {
+    n <<= 1;
+  }
+  char shm_name[64];
+  snprintf(shm_name, sizeof(shm_name), "/filehub_cache_sketch_%zu", n);
+
+  int fd = shm_open(shm_name, O_RDWR | O_CREAT, 0600);
+  if (fd < 0) {
+    LOG_ERROR(CACHE_LOG_MODULE, CACHE_LOG_PROC, "shm_open %s err: %s\n",
+              shm_name, strerror(errno));
+    return -1;
+  }
+  // 新建的共享内存全为0，即所有计数为0
+  size_t len = sizeof(SketchHeader) + SKETCH_ROWS * n;
+  if (ftruncate(fd, (off_t)len) != 0) {
+    LOG_ERROR(CACHE_LOG_MODULE, CACHE_LOG_PROC, "ftruncate err: %s\n",
+              strerror(errno));
+    close(fd);
+    return -1;
+  }
+  void *p = mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED) {
+    LOG_ERROR(CACHE_LOG_MODULE, CACHE_LOG_PROC, "mmap err: %s\n",
+              strerror(errno));
+    return -1;
+  }
+  sketch = (SketchHeader *)p;
+  counters = (std::atomic<uint8_t> *)((char *)p + sizeof(SketchHeader));
+  sketch_width = n;
+  return 0;
+}
+
+// 打开共享内存中的索引
+static int openIndex() {
+  int fd = shm_open(CACHE_INDEX_SHM_NAME, O_RDWR | O_CREAT, 0600);
+  if (fd < 0) {
+    LOG_ERROR(CACHE_LOG_MODULE, CACHE_LOG_PROC, "shm_open %s err: %s\n",
+              CACHE_INDEX_SHM_NAME, strerror(errno));
+    return -1;
+  }
+  if (ftruncate(fd, (off_t)sizeof(CacheIndex)) != 0) {
+    LOG_ERROR(CACHE_LOG_MODULE, CACHE_LOG_PROC, "ftruncate err: %s\n",
+              strerror(errno));
+    close(fd);
+    return -1;
+  }
+  void *p = mmap(nullptr, sizeof(CacheIndex), PROT_READ | PROT_WRITE,
+                 MAP_SHARED, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED) {
+    LOG_ERROR(CACHE_LOG_MODULE, CACHE_LOG_PROC, "mmap err: %s\n",
+              strerror(errno));
+    return -1;
+  }
+  cache_index = (CacheIndex *)p;
+  return 0;
+}
+
+// 持有索引的锁：进程内的mutex + 进程间的flock
+class IndexLock {
+ public:
+  IndexLock() : guard_(index_mutex) {
+    while (flock(index_lock_fd, LOCK_EX) != 0 && errno == EINTR) {
+    }
+  }
+  ~IndexLock() { flock(index_lock_fd, LOCK_UN); }
+  IndexLock(const IndexLock &) = delete;
+  IndexLock &operator=(const IndexLock &) = delete;
+
+ private:
+  std::lock_guard<std::mutex> guard_;
+};
+
+static void queuePush(const char *name, long size, time_t mtime) {
+  if (cache_index->count >= CACHE_QUEUE_MAX) {
+    return;  // 放不下的等下次扫描
+  }
+  CacheVictim &v =
+      cache_index->ring[(cache_index->head + cache_index->count++) %
+                        CACHE_QUEUE_MAX];
+  snprintf(v.name, sizeof(v.name), "%s", name);
+  v.size = size;
+  v.mtime = mtime;
+}
+
+static CacheVictim queuePop() {
+  CacheVictim v = cache_index->ring[cache_index->head];
+  cache_index->head = (cache_index->head + 1) % CACHE_QUEUE_MAX;
+  cache_index->count--;
+  return v;
+}
+
+// 放回队首，queuePop的逆操作
+static void queueUnpop(const CacheVictim &v) {
+  cache_index->head = (cache_index->head + CACHE_QUEUE_MAX - 1) % CACHE_QUEUE_MAX;
+  cache_index->ring[cache_index->head] = v;
+  cache_index->count++;
+}
+
+// 缓存文件，不是临时文件和锁文件
+static bool isCacheEntry(const char *name) {
+  size_t n = strlen(name);
+  return name[0] != '.' && !(n >= 5 && strcmp(name + n - 5, ".lock") == 0);
+}
+
+/**
+ * @brief 扫描缓存目录，重建索引：已用字节数为目录中文件的总大小，
+ *        队列为最旧的CACHE_QUEUE_MAX个文件
+ *        扫描时不持有锁，扫描期间取入的文件可能不在队列中，下次扫描补上
+ *
+ * @return 0成功，-1打不开目录
+ */
+static int scanIndex() {
+  DIR *dir = opendir(cache_cfg.dir.c_str());
+  if (dir == nullptr) {
+    LOG_ERROR(CACHE_LOG_MODULE, CACHE_LOG_PROC, "opendir %s err: %s\n",
+              cache_cfg.dir.c_str(), strerror(errno));
+    return -1;
+  }
+  std::vector<CacheVictim> entries;
+  long used = 0;
+  struct dirent *ent;
+  while ((ent = readdir(dir)) != nullptr) {
+    if (!isCacheEntry(ent->d_name) ||
+        strlen(ent->d_name) >= sizeof(CacheVictim::name)) {
+      continue;
+    }
+    struct stat st;
+    std::string path = cache_cfg.dir + "/" + ent->d_name;
+    if (stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode)) {
+      CacheVictim v;
+      snprintf(v.name, sizeof(v.name), "%s", ent->d_name);
+      v.size = (long)st.st_size;
+      v.mtime = st.st_mtime;
+      entries.push_back(v);
+      used += st.st_size;
+    }
+  }
+  closedir(dir);
+  size_t n = std::min(entries.size(), (size_t)CACHE_QUEUE_MAX);
+  std::partial_sort(entries.begin(), entries.begin() + n, entries.end(),
+                    [](const CacheVictim &a, const CacheVictim &b) {
+                      return a.mtime < b.mtime;
+                    });
+
+  IndexLock lock;
+  snprintf(cache_index->dir, sizeof(cache_index->dir), "%s",
+           cache_cfg.dir.c_str());
+  cache_index->used = used;
+  cache_index->scan_time = time(nullptr);
+  cache_index->rescan = 0;
+  cache_index->head = 0;
+  cache_index->count = 0;
+  for (size_t i = 0; i < n; i++) {
+    cache_index->ring[cache_index->count++] = entries[i];
+  }
+  LOG_INFO(CACHE_LOG_MODULE, CACHE_LOG_PROC,
+           "scanned %zu entries, %ld bytes\n", entries.size(), used);
+  return 0;
+}
+
+void cacheMaintain() {
+  if (!cache_enabled) {
+    return;
+  }
+  bool due;
+  {
+    IndexLock lock;
+    due = cache_index->rescan ||
+          time(nullptr) - cache_index->scan_time >= cache_cfg.scan_s;
+  }
+  if (due) {
+    scanIndex();
+  }
+}
+
+int cacheInit(const CacheConfig &cfg) {
+  cache_cfg = cfg;
+  cache_enabled = false;
+  if (cfg.dir.empty()) {
+    return 0;
+  }
+  if (mkdir(cfg.dir.c_str(), 0755) != 0 && errno != EEXIST) {
+    LOG_ERROR(CACHE_LOG_MODULE, CACHE_LOG_PROC, "mkdir %s err: %s\n",
+              cfg.dir.c_str(), strerror(errno));
+    return -1;
+  }
+  if (sketch == nullptr && openSketch(cfg.sketch_width) != 0) {
+    return -1;
+  }
+  if (cache_index == nullptr && openIndex() != 0) {
+    return -1;
+  }
+  if (index_lock_fd >= 0) {
+    close(index_lock_fd);
+  }
+  std::string lock_path = cfg.dir + "/.index.lock";
+  index_lock_fd = open(lock_path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  if (index_lock_fd < 0) {
+    LOG_ERROR(CACHE_LOG_MODULE, CACHE_LOG_PROC, "open %s err: %s\n",
+              lock_path.c_str(), strerror(errno));
+    return -1;
+  }
+  // 第一个打开这个目录的进程扫描一次，之后的进程直接使用
+  bool scanned;
+  {
+    IndexLock lock;
+    scanned = cache_index->scan_time != 0 &&
+              strcmp(cache_index->dir, cfg.dir.c_str()) == 0;
+  }
+  if (!scanned && scanIndex() != 0) {
+    return -1;
+  }
+  cache_enabled = true;
+  LOG_INFO(CACHE_LOG_MODULE, CACHE_LOG_PROC,
+           "dir = %s, max_bytes = %ld, admit_min = %d\n", cfg.dir.c_str(),
+           cfg.max_bytes, cfg.admit_min);
+  return 0;
+}
+
+bool cacheEnabled() { return cache_enabled; }
+
+const std::string &cacheLocation() { return cache_cfg.location; }
+
+std::string cacheName(const std::string &key) {
+  std::string name = key;
+  std::replace(name.begin(), name.end(), '/', '_');
+  return name;
+}
+
+// FNV-1a，两半作为双重哈希的两个基数
+static uint64_t sketchHash(const std::string &name) {
+  uint64_t h = 1469598103934665603ULL;
+  for (unsigned char c : name) {
+    h ^= c;
+    h *= 1099511628211ULL;
+  }
+  return h;
+}
+
+static size_t sketchIndex(uint64_t h, int row) {
+  uint32_t h1 = (uint32_t)h, h2 = (uint32_t)(h >> 32) | 1;
+  return row * sketch_width + ((h1 + row * h2) & (sketch_width - 1));
+}
+
+static int sketchEstimate(const std::string &name) {
+  uint64_t h = sketchHash(name);
+  int freq = SKETCH_MAX;
+  for (int i = 0; i < SKETCH_ROWS; i++) {
+    freq = std::min(freq, (int)counters[sketchIndex(h, i)].load(
+                              std::memory_order_relaxed));
+  }
+  return freq;
+}
+
+// 所有计数减半；并发的增加可能被覆盖，只影响计数精度
+static void sketchAge() {
+  for (size_t i = 0; i < SKETCH_ROWS * sketch_width; i++) {
+    counters[i].store(counters[i].load(std::memory_order_relaxed) >> 1,
+                      std::memory_order_relaxed);
+  }
+}
+
+// 记一次访问，返回记录后的估计次数
+static int sketchIncrement(const std::string &name) {
+  uint64_t h = sketchHash(name);
+  int freq = SKETCH_MAX;
+  for (int i = 0; i < SKETCH_ROWS; i++) {
+    std::atomic<uint8_t> &c = counters[sketchIndex(h, i)];
+    uint8_t v = c.load(std::memory_order_relaxed);
+    while (v < SKETCH_MAX &&
+           !c.compare_exchange_weak(v, v + 1, std::memory_order_relaxed)) {
+    }
+    freq = std::min(freq, v < SKETCH_MAX ? v + 1 : (int)SKETCH_MAX);
+  }
+
+  // 记满一个周期的进程负责减半
+  uint64_t sample = (uint64_t)cache_cfg.sample_factor * sketch_width;
+  uint64_t n = sketch->additions.fetch_add(1, std::memory_order_relaxed) + 1;
+  if (n >= sample &&
+      sketch->additions.compare_exchange_strong(n, 0,
+                                                std::memory_order_relaxed)) {
+    sketchAge();
+  }
+  return freq;
+}
+
+int cacheFrequency(const std::string &key) {
+  return cache_enabled ? sketchEstimate(cacheName(key)) : 0;
+}
+
+// 缓存文件存在且大小一致时返回true，大小不对的(写坏的)删除
+static bool lookup(const std::string &path, long size) {
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0) {
+    return false;
+  }
+  if (!S_ISREG(st.st_mode) || st.st_size != size) {
+    LOG_WARNING(CACHE_LOG_MODULE, CACHE_LOG_PROC, "drop bad entry %s\n",
+                path.c_str());
+    IndexLock lock;
+    if (unlink(path.c_str()) == 0 && S_ISREG(st.st_mode)) {
+      cache_index->used -= st.st_size;
+    }
+    return false;
+  }
+  // mtime即最近使用时间
+  if (time(nullptr) - st.st_mtime >= CACHE_TOUCH_S) {
+    utimensat(AT_FDCWD, path.c_str(), nullptr, 0);
+  }
+  return true;
+}
+
+/**
+ * @brief 为size字节的新文件腾出空间并预留：从队首选出要淘汰的文件，
+ *        新文件比它们都热时才删除它们并接纳
+ *        队首的文件已不存在的出队，入队后被命中过的重新排到队尾
+ *
+ * @return true 接纳(已计入used，取入失败时unreserve)，false 不接纳
+ */
+static bool makeRoom(const std::string &name, int freq, long size) {
+  IndexLock lock;
+  long need = cache_index->used + size - cache_cfg.max_bytes;
+  std::vector<CacheVictim> victims;
+  long freed = 0;
+  // 每个候选最多看一次，被命中过的排到队尾后不会再看到
+  for (uint32_t seen = cache_index->count; freed < need && seen > 0; seen--) {
+    CacheVictim v = queuePop();
+    struct stat st;
+    std::string path = cache_cfg.dir + "/" + v.name;
+    if (stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) {
+      continue;
+    }
+    if (st.st_mtime > v.mtime) {
+      queuePush(v.name, (long)st.st_size, st.st_mtime);
+      continue;
+    }
+    // TinyLFU：不比要淘汰的文件热就不接纳
+    if (sketchEstimate(v.name) >= freq) {
+      queueUnpop(v);
+      break;
+    }
+    v.size = (long)st.st_size;
+    victims.push_back(v);
+    freed += v.size;
+  }
+  if (freed < need) {
+    for (auto it = victims.rbegin(); it != victims.rend(); ++it) {
+      queueUnpop(*it);
+    }
+    if (cache_index->count == 0) {
+      cache_index->rescan = 1;  // 队列用完，等定时任务扫描
+    }
+    return false;
+  }
+  for (const CacheVictim &v : victims) {
+    std::string path = cache_cfg.dir + "/" + v.name;
+    if (unlink(path.c_str()) == 0) {
+      cache_index->used -= v.size;
+    }
+    LOG_INFO(CACHE_LOG_MODULE, CACHE_LOG_PROC, "evict %s for %s\n", v.name,
+             name.c_str());
+  }
+  cache_index->used += size;
+  return true;
+}
+
+// 取入失败，退还makeRoom预留的空间
+static void unreserve(long size) {
+  IndexLock lock;
+  cache_index->used -= size;
+}
+
+// 取入缓存：先写到隐藏的临时文件，校验大小和md5后改名
+static CacheResult fill(const std::string &name, const std::string &path,
+                        long size, const char *md5, const CacheFetch &fetch) {
+  std::string part = cache_cfg.dir + "/." + name + ".part." +
+                     std::to_string(getpid()) + "." +
+                     std::to_string(part_seq.fetch_add(1));
+  if (fetch(part.c_str()) != 0) {
+    LOG_ERROR(CACHE_LOG_MODULE, CACHE_LOG_PROC, "fetch %s failed\n",
+              name.c_str());
+    unlink(part.c_str());
+    unreserve(size);
+    return CACHE_ERROR;
+  }
+  struct stat st;
+  char real_md5[MD5_LEN] = {0};
+  if (stat(part.c_str(), &st) != 0 || st.st_size != size ||
+      md5File(part.c_str(), real_md5) != 0 || strcasecmp(real_md5, md5) != 0) {
+    LOG_ERROR(CACHE_LOG_MODULE, CACHE_LOG_PROC,
+              "%s integrity check failed, md5 %s != %s\n", name.c_str(),
+              real_md5, md5);
+    unlink(part.c_str());
+    unreserve(size);
+    return CACHE_ERROR;
+  }
+  // nginx的worker要能读
+  chmod(part.c_str(), 0644);
+  if (rename(part.c_str(), path.c_str()) != 0) {
+    LOG_ERROR(CACHE_LOG_MODULE, CACHE_LOG_PROC, "rename %s err: %s\n",
+              part.c_str(), strerror(errno));
+    unlink(part.c_str());
+    unreserve(size);
+    return CACHE_ERROR;
+  }
+  {
+    IndexLock lock;
+    queuePush(name.c_str(), size, st.st_mtime);
+  }
+  LOG_INFO(CACHE_LOG_MODULE, CACHE_LOG_PROC, "cached %s, %ld bytes\n",
+           name.c_str(), size);
+  return CACHE_HIT;
+}
+
+/**
+ * @brief 打开并锁住锁文件，返回时锁文件仍在路径上
+ *        持有者用完后删除锁文件，在此之前打开了它的请求拿到的是已删除的inode，
+ *        要重新打开，否则会和锁新文件的请求同时进入
+ *
+ * @return 持有锁的fd，关闭即释放；失败返回-1
+ */
+static int lockFile(const std::string &lock_path) {
+  for (;;) {
+    int fd = open(lock_path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0) {
+      return -1;
+    }
+    while (flock(fd, LOCK_EX) != 0 && errno == EINTR) {
+    }
+    struct stat held, cur;
+    if (fstat(fd, &held) == 0 && stat(lock_path.c_str(), &cur) == 0 &&
+        held.st_dev == cur.st_dev && held.st_ino == cur.st_ino) {
+      return fd;
+    }
+    close(fd);
+  }
+}
+
+CacheResult cacheGet(const std::string &key, long size, const char *md5,
+                     const CacheFetch &fetch, std::string *path) {
+  if (!cache_enabled || size < 0) {
+    return CACHE_BYPASS;
+  }
+  std::string name = cacheName(key);
+  if (name.size() >= sizeof(CacheVictim::name)) {
+    return CACHE_BYPASS;
+  }
+  std::string full = cache_cfg.dir + "/" + name;
+  int freq = sketchIncrement(name);
+  if (lookup(full, size)) {
+    *path = full;
+    return CACHE_HIT;
+  }
+  if (size > cache_cfg.max_object_bytes || freq < cache_cfg.admit_min) {
+    return CACHE_BYPASS;
+  }
+
+  // 同一个文件同时只有一个请求去取，其余的等它取完后再查一次
+  std::string lock_path = full + ".lock";
+  int lfd = lockFile(lock_path);
+  if (lfd < 0) {
+    return CACHE_BYPASS;
+  }
+  CacheResult ret;
+  if (lookup(full, size)) {
+    ret = CACHE_HIT;
+  } else if (!makeRoom(name, freq, size)) {
+    ret = CACHE_BYPASS;
+  } else {
+    ret = fill(name, full, size, md5, fetch);
+  }
+  // 持有锁时删除，还在等待旧锁文件的请求拿到锁后发现已删除，改锁新的文件
+  unlink(lock_path.c_str());
+  close(lfd);
+  if (ret == CACHE_HIT) {
+    *path = full;
+  }
+  return ret;
+}
@@ -0,0 +1,105 @@
+#ifndef CACHE_UTIL_H
+#define CACHE_UTIL_H
+
+#include <cstddef>
+#include <functional>
+#include <string>
+
+/*
+   web层的本地磁盘缓存：热门文件(共享文件的反复下载)从storage取一次后
+   放在本机磁盘上，之后由nginx从本地发送，读到的是本地磁盘或page cache。
+
+   - 以storage的file_id为key(打包的文件再带上在容器中的位置)，缓存的总是
+     文件的原始内容，写入前用文件的md5校验，命中时校验大小。
+   - 总大小不超过max_mb，单个文件不超过max_object_mb；
+     满了按最近使用时间(命中时更新文件的mtime)淘汰。
+   - 已用字节数和淘汰候选队列放在共享内存的索引中，所有进程在
+     <dir>/.index.lock上flock后修改，接纳和淘汰不扫描目录：
+     候选队列按mtime从旧到新，新取入的文件排在队尾；淘汰时从队首取，
+     队首文件的mtime比入队时新(期间被命中)就重新排到队尾。
+     目录只在启动(索引不是这个目录的)和后台定时任务(cacheMaintain)中扫描，
+     校正已用字节数并重建队列；队列用完时请求定时任务尽快扫描，这期间不接纳。
+   - 接纳按访问频率(TinyLFU)：访问次数记在共享内存的count-min sketch里，
+     同一台机器上所有worker和接口程序共用，每记满sample_factor * width次
+     所有计数减半，旧的热度逐渐衰减。
+     访问次数不到admit_min的文件不缓存(只下载一次的文件不会挤掉热门文件)；
+     空间不够时，只有比要淘汰的文件都更热才接纳。
+   - 同一个文件并发未命中时只有一个请求去storage取，其余的在
+     <name>.lock上flock等待，取完后直接命中。
+
+   缓存目录由nginx的internal location直接发送：
+   location /dl_cache/ {
+       internal;
+       alias /home/ward/FileHub/cache/;
+       sendfile on;
+   }
+
+   "cache": {"dir": "/home/ward/FileHub/cache", "location": "/dl_cache/",
+             "max_mb": 10240, "max_object_mb": 256, "admit_min": 2,
+             "sketch_width": 65536, "scan_s": 300}
+   dir为空时不使用缓存。
+*/
+
+const char *const CACHE_LOG_MODULE = "cgi";
+const char *const CACHE_LOG_PROC = "cache";
+
+// 缓存配置
+struct CacheConfig {
+  std::string dir;                      // 缓存目录，为空时不缓存
+  std::string location = "/dl_cache/";  // 缓存目录对应的nginx internal location
+  long max_bytes = 10240L << 20;        // 总大小上限
+  long max_object_bytes = 256L << 20;   // 单个文件的大小上限
+  int admit_min = 2;                    // 接纳需要的最少访问次数
+  size_t sketch_width = 65536;          // sketch每行的计数器个数
+  int sample_factor = 10;               // 记满sample_factor * width次时计数减半
+  int scan_s = 300;                     // 定时扫描目录、校正索引的间隔
+};
+
+enum CacheResult {
+  CACHE_HIT = 0,     // 已在缓存中(或刚刚取入)，path为缓存文件
+  CACHE_BYPASS = 1,  // 不缓存，调用者直接从storage取
+  CACHE_ERROR = -1,  // 取入失败(storage出错或md5不一致)
+};
+
+// 把文件内容取到path，成功返回0
+typedef std::function<int(const char *path)> CacheFetch;
+
+// 从cfg.json的"cache"读取配置
+CacheConfig cacheConfig();
+
+/**
+ * @brief 打开缓存目录和共享内存中的sketch
+ *
+ * @return 0 成功(dir为空时不缓存，也返回0)，-1 失败，此时不缓存
+ */
+int cacheInit(const CacheConfig &cfg);
+
+// 是否在使用缓存
+bool cacheEnabled();
+
+// 缓存目录对应的nginx internal location，以'/'结尾
+const std::string &cacheLocation();
+
+// 缓存文件名：key中的'/'换成'_'
+std::string cacheName(const std::string &key);
+
+/**
+ * @brief 读穿：命中时返回缓存文件；未命中且接纳时调用fetch取入，
+ *        并发未命中的其他请求等待这一次取入
+ *
+ * @param key   缓存的key，如file_id
+ * @param size  文件大小
+ * @param md5   文件md5，取入的内容与它不一致时丢弃
+ * @param fetch 把文件内容取到指定路径
+ * @param path  (out) 命中时为缓存文件的完整路径
+ */
+CacheResult cacheGet(const std::string &key, long size, const char *md5,
+                     const CacheFetch &fetch, std::string *path);
+
+// 后台定时任务调用：到了scan_s或队列用完时扫描目录，重建索引
+void cacheMaintain();
+
+// 估计的访问次数(测试用)
+int cacheFrequency(const std::string &key);
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef CGI_HANDLERS_H
+#define CGI_HANDLERS_H
+
+#include <cstddef>
+
+#include "cgi_server.h"
+#include "cgi_util.h"
+
+// 各接口的处理函数，定义在对应的 *_cgi.cpp 中
+void loginHandler(CgiContext *ctx);    // login_cgi.cpp
+void regHandler(CgiContext *ctx);      // reg_cgi.cpp
+void md5Handler(CgiContext *ctx);      // md5_cgi.cpp
+void myfilesHandler(CgiContext *ctx);  // myfiles_cgi.cpp
+void uploadHandler(CgiContext *ctx);   // upload_cgi.cpp
+void deltaHandler(CgiContext *ctx);    // delta_cgi.cpp
+void dlHandler(CgiContext *ctx);       // dl_cgi.cpp
+void metricsHandler(CgiContext *ctx);  // metrics_cgi.cpp
+void sharefilesHandler(CgiContext *ctx);  // sharefiles_cgi.cpp
+
+// 各接口的初始化函数
+int md5Init();     // md5_cgi.cpp
+int uploadInit();  // upload_cgi.cpp
+int deltaInit();   // delta_cgi.cpp
+int dlInit();      // dl_cgi.cpp
+int sharefilesInit();  // sharefiles_cgi.cpp
+
+// 各接口解析请求的函数，微基准(test/micro_bench)也直接调用
+int getLoginInfo(char *login_buf, char *user, size_t user_size, char *pwd,
+                 size_t pwd_size);  // login_cgi.cpp
+int getRegInfo(char *reg_buf, char *user, char *nick_name, char *pwd,
+               char *email, size_t field_size);  // reg_cgi.cpp
+int get_md5_info(char *buf, char *user, char *token, char *md5,
+                 char *filename);  // md5_cgi.cpp
+int get_count_info(char *buf, char *user, char *token);  // myfiles_cgi.cpp
+int get_fileslist_info(char *buf, char *user, char *token, int &start,
+                       int &count);  // myfiles_cgi.cpp
+
+// 差量请求的参数(delta_cgi.cpp)
+struct DeltaInfo {
+  char user[USER_NAME_LEN];
+  char token[TOKEN_LEN];
+  char base_md5[MD5_LEN];  // 旧版本md5
+  char md5[MD5_LEN];       // 新版本md5
+  char filename[FILE_NAME_LEN];
+  int block_size;
+};
+int getDeltaInfo(char *buf, DeltaInfo *info, bool patch);  // delta_cgi.cpp
+
+// 接收上传的文件并保存到本地临时文件(upload_cgi.cpp)
+int recvSaveFile(long len, char *user, char *filename, char *md5,
+                 long *p_size, char *local_file);
+
+// io_uring服务端的协程处理函数，没有定义CGI_URING时为nullptr
+#ifdef CGI_URING
+Task myfilesUringHandler(UringRequest *req, CgiContext *ctx);  // myfiles_cgi.cpp
+#define MYFILES_URING_HANDLER myfilesUringHandler
+#else
+#define MYFILES_URING_HANDLER nullptr
+#endif
+
+#endif
@@ -0,0 +1,503 @@
+#include "cgi_server.h"
+
+#include <pthread.h>
+#include <signal.h>
+#include <sys/socket.h>
+
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <mutex>
+#include <system_error>
+#include <thread>
+
+#include "admission_util.h"
+#include "backend_util.h"
+#include "json_util.h"
+#include "make_log.h"
+#include "metrics_util.h"
+#include "mysql_util.h"
+#include "prefork_util.h"
+#include "ratelimit_util.h"
+#include "response_util.h"
+
+thread_local FCGX_Request request;
+static thread_local bool response_aborted = false;
+
+// initCgiRoutes的路由表和各路由的指标接口编号
+static const CgiRoute *metric_routes = nullptr;
+static int metric_route_count = 0;
+static int metric_endpoints[METRICS_MAX_ENDPOINTS];
+
+// cmd为nullptr的路由按请求中的cmd分接口记录，(路由, cmd) -> 接口编号，
+// 条数有上限，cmd是客户端给的，乱填的cmd不能占满共享内存中的接口
+static const int CMD_ENDPOINT_MAX = 32;
+struct CmdEndpoint {
+  const CgiRoute *route;
+  char cmd[16];
+  int endpoint;
+};
+static CmdEndpoint cmd_endpoints[CMD_ENDPOINT_MAX];
+static int cmd_endpoint_count = 0;
+static std::mutex cmd_endpoint_lock;
+
+/**
+ * @brief 请求路径，优先使用SCRIPT_NAME，nginx未设置时使用DOCUMENT_URI
+ */
+static const char *requestPath() {
+  const char *path = FCGX_GetParam("SCRIPT_NAME", request.envp);
+  if (path == nullptr || *path == '\0') {
+    path = FCGX_GetParam("DOCUMENT_URI", request.envp);
+  }
+  return path == nullptr ? "" : path;
+}
+
+/**
+ * @brief 查找路由，路径需完全匹配，cmd为nullptr的路由匹配任意cmd
+ *        只有一条路由时不检查路径(单接口程序)
+ *
+ * @return 匹配的路由，没有时返回nullptr
+ */
+const CgiRoute *findCgiRoute(const CgiRoute *routes, int count,
+                             const char *path, string_view cmd) {
+  if (count == 1) {
+    return &routes[0];
+  }
+  const CgiRoute *fallback = nullptr;
+  for (int i = 0; i < count; i++) {
+    if (strcmp(routes[i].path, path) != 0) {
+      continue;
+    }
+    if (routes[i].cmd == nullptr) {
+      if (fallback == nullptr) {
+        fallback = &routes[i];
+      }
+    } else if (cmd == routes[i].cmd) {
+      return &routes[i];
+    }
+  }
+  return fallback;
+}
+
+/**
+ * @brief 调用各路由的初始化函数，同一个初始化函数可能被多条路由共用，只调用一次
+ *
+ * @return 0成功，-1失败
+ */
+int initCgiRoutes(const CgiRoute *routes, int count) {
+  for (int i = 0; i < count; i++) {
+    CgiInit init = routes[i].init;
+    bool seen = false;
+    for (int j = 0; j < i && !seen; j++) {
+      seen = routes[j].init == init;
+    }
+    if (init == nullptr || seen) {
+      continue;
+    }
+    if (init() != 0) {
+      LOG_ERROR(SERVER_LOG_MODULE, SERVER_LOG_PROC, "%s init failed!\n",
+                routes[i].path);
+      return -1;
+    }
+  }
+  // 限流的共享内存打不开时不限流，不影响接口
+  if (rateLimitInit() != 0) {
+    LOG_ERROR(SERVER_LOG_MODULE, SERVER_LOG_PROC, "rateLimitInit failed!\n");
+  }
+  if (admissionInit() != 0) {
+    LOG_ERROR(SERVER_LOG_MODULE, SERVER_LOG_PROC, "admissionInit failed!\n");
+  }
+  traceInit();
+
+  // 指标的共享内存打不开时不记录指标
+  metric_routes = routes;
+  metric_route_count = count < METRICS_MAX_ENDPOINTS ? count
+                                                     : METRICS_MAX_ENDPOINTS;
+  if (metricsOpen() != 0) {
+    LOG_ERROR(SERVER_LOG_MODULE, SERVER_LOG_PROC, "metricsOpen failed!\n");
+  }
+  for (int i = 0; i < metric_route_count; i++) {
+    metric_endpoints[i] = metricsEndpoint(routes[i].path, routes[i].cmd);
+  }
+  std::lock_guard<std::mutex> lock(cmd_endpoint_lock);
+  cmd_endpoint_count = 0;
+  return 0;
+}
+
+// 可以作为接口记录的cmd：小写字母、数字和'_'，放得下CmdEndpoint.cmd
+static bool metricCmd(string_view cmd) {
+  if (cmd.empty() || cmd.size() >= sizeof(CmdEndpoint::cmd)) {
+    return false;
+  }
+  for (char c : cmd) {
+    if (!((c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c == '_')) {
+      return false;
+    }
+  }
+  return true;
+}
+
+int cgiRouteEndpoint(const CgiRoute *route, string_view cmd) {
+  if (metric_routes == nullptr || route < metric_routes ||
+      route >= metric_routes + metric_route_count) {
+    return -1;
+  }
+  int endpoint = metric_endpoints[route - metric_routes];
+  if (route->cmd != nullptr || !metricCmd(cmd)) {
+    return endpoint;
+  }
+
+  std::lock_guard<std::mutex> lock(cmd_endpoint_lock);
+  for (int i = 0; i < cmd_endpoint_count; i++) {
+    const CmdEndpoint &e = cmd_endpoints[i];
+    if (e.route == route && cmd == e.cmd) {
+      return e.endpoint;
+    }
+  }
+  // 满了以后新的cmd记在路由上；共享内存中的接口满了同样如此，
+  // 并且记下结果，不再每次去登记
+  if (cmd_endpoint_count >= CMD_ENDPOINT_MAX) {
+    return endpoint;
+  }
+  CmdEndpoint &e = cmd_endpoints[cmd_endpoint_count++];
+  e.route = route;
+  memcpy(e.cmd, cmd.data(), cmd.size());
+  e.cmd[cmd.size()] = '\0';
+  int id = metricsEndpoint(route->path, e.cmd);
+  e.endpoint = id >= 0 ? id : endpoint;
+  return e.endpoint;
+}
+
+// 限流需要请求体中的用户名时，请求体先读到这里，再代替request.in交给处理函数
+struct BodyReplay {
+  FCGX_Stream stream;
+  FCGX_Stream *orig = nullptr;  // 原来的request.in，处理完后换回
+  unsigned char buf[RATELIMIT_BODY_MAX];
+};
+
+static void replayFill(FCGX_Stream *s) { s->isClosed = 1; }
+
+static void replayEmpty(FCGX_Stream *, int) {}
+
+/**
+ * @brief 按限流策略检查请求，在处理函数解析json、访问数据库之前执行
+ *        先按IP检查；策略需要用户名时把请求体读入内存找到用户名，
+ *        请求体过长或找不到用户名时拒绝
+ *
+ * @return 允许返回true，应返回429时返回false
+ */
+static bool admitRequest(const CgiRoute *route, CgiContext *ctx,
+                         BodyReplay *replay) {
+  const RatePolicy *policy = rateLimitPolicy(route->path);
+  if (policy == nullptr) {
+    return true;
+  }
+  const char *ip = FCGX_GetParam("REMOTE_ADDR", request.envp);
+  if (!rateLimitAllow(policy, ip == nullptr ? "" : ip, "", ctx->redis)) {
+    return false;
+  }
+  if (!policy->user.enabled()) {
+    return true;
+  }
+  const char *contentLength = FCGX_GetParam("CONTENT_LENGTH", request.envp);
+  int len = (contentLength == nullptr) ? 0 : atoi(contentLength);
+  // 取不到用户名的请求不放行，否则填充请求体或转义用户名就能绕过
+  if (len <= 0 || len > (int)RATELIMIT_BODY_MAX) {
+    LOG_WARNING(SERVER_LOG_MODULE, SERVER_LOG_PROC,
+                "%s body length %d, no user to rate limit\n", route->path,
+                len);
+    return false;
+  }
+
+  int n = FCGX_GetStr((char *)replay->buf, len, request.in);
+  memset(&replay->stream, 0, sizeof(replay->stream));
+  replay->stream.isReader = 1;
+  replay->stream.rdNext = replay->stream.stopUnget = replay->buf;
+  replay->stream.stop = replay->buf + (n > 0 ? n : 0);
+  replay->stream.fillBuffProc = replayFill;
+  replay->stream.emptyBuffProc = replayEmpty;
+  replay->orig = request.in;
+  request.in = &replay->stream;
+
+  char user[USER_NAME_LEN];
+  if (n <= 0 || !rateLimitScanUser((const char *)replay->buf, n,
+                                   policy->user_field.c_str(), user,
+                                   sizeof(user))) {
+    LOG_WARNING(SERVER_LOG_MODULE, SERVER_LOG_PROC, "%s no %s in body\n",
+                route->path, policy->user_field.c_str());
+    return false;
+  }
+  return rateLimitAllow(policy, "", user, ctx->redis);
+}
+
+/**
+ * @brief 上传类接口的准入检查，此时还没有读请求体
+ *
+ * @param reserved (out) 预留的在途字节数，处理完后归还
+ *
+ * @return 接收返回true，拒绝时已写好响应并返回false
+ */
+static bool admitBody(const CgiRoute *route, CgiContext *ctx,
+                      long *reserved) {
+  *reserved = 0;
+  if (!admissionApplies(route->path)) {
+    return true;
+  }
+  const char *header_user = FCGX_GetParam("HTTP_X_USER", request.envp);
+  const char *header_token = FCGX_GetParam("HTTP_X_TOKEN", request.envp);
+  const char *content_length = FCGX_GetParam("CONTENT_LENGTH", request.envp);
+  string_view user, token;
+  admissionCredentials(*ctx->query, header_user ? header_user : "",
+                       header_token ? header_token : "", &user, &token);
+  AdmitResult result = admissionCheck(
+      admissionLength(content_length ? content_length : ""), user, token,
+      ctx->redis, reserved);
+  if (result == ADMIT_OK) {
+    return true;
+  }
+  std::string out;
+  appendAdmitReject(&out, result);
+  FCGX_PutStr(out.data(), (int)out.size(), request.out);
+  return false;
+}
+
+/**
+ * @brief 打开处理函数共用的mysql/redis连接
+ *
+ * @return 0成功，-1失败
+ */
+int openCgiContext(CgiContext *ctx) {
+  ctx->query = nullptr;
+  ctx->mysql_pool = nullptr;
+  ctx->trace = nullptr;
+  ctx->meta = nullptr;
+  ctx->tokens = nullptr;
+  ctx->blobs = nullptr;
+  ctx->shares = nullptr;
+  ctx->redis = redisConn();
+  ctx->mysql = mysqlConn();
+  if (ctx->mysql == nullptr || ctx->redis == nullptr) {
+    LOG_ERROR(SERVER_LOG_MODULE, SERVER_LOG_PROC,
+              "mysqlConn or redisConn failed!\n");
+    return -1;
+  }
+  // 设置数据库编码，主要处理中文编码问题
+  if (mysql_query(ctx->mysql, "set names utf8") != 0) {
+    LOG_ERROR(SERVER_LOG_MODULE, SERVER_LOG_PROC, "set names utf8 failed!\n");
+    mysql_close(ctx->mysql);
+    return -1;
+  }
+  ctx->meta = new MysqlMetaStore(ctx->mysql);
+  ctx->tokens = new RedisTokenStore(ctx->redis);
+  ctx->blobs = new FdfsBlobStore;
+  ctx->shares = new RedisShareIndex(ctx->redis);
+  return 0;
+}
+
+void closeCgiContext(CgiContext *ctx) {
+  delete ctx->shares;
+  delete ctx->blobs;
+  delete ctx->tokens;
+  delete ctx->meta;
+  delete ctx->redis;
+  mysql_close(ctx->mysql);
+}
+
+void abortCgiResponse() { response_aborted = true; }
+
+bool takeCgiAbort() {
+  bool aborted = response_aborted;
+  response_aborted = false;
+  return aborted;
+}
+
+// 定时任务
+static const int CGI_TIMER_MAX = 8;
+struct CgiTimerEntry {
+  CgiTimer timer;
+  int interval_s;
+  time_t next;  // 下次运行的时间
+};
+static CgiTimerEntry cgi_timers[CGI_TIMER_MAX];
+static int cgi_timer_count = 0;
+static std::thread cgi_timer_thread;
+static std::mutex cgi_timer_lock;
+static std::condition_variable cgi_timer_cond;
+static bool cgi_timer_stop = false;
+
+int addCgiTimer(CgiTimer timer, int interval_s) {
+  for (int i = 0; i < cgi_timer_count; i++) {
+    if (cgi_timers[i].timer == timer) {
+      return 0;
+    }
+  }
+  if (cgi_timer_count >= CGI_TIMER_MAX) {
+    LOG_ERROR(SERVER_LOG_MODULE, SERVER_LOG_PROC, "too many timers\n");
+    return -1;
+  }
+  // 第一次在线程启动后立即运行
+  cgi_timers[cgi_timer_count++] = {timer, interval_s > 0 ? interval_s : 1, 0};
+  return 0;
+}
+
+/**
+ * @brief 定时任务线程：每秒检查一次，到期的任务依次运行
+ */
+static void runCgiTimers() {
+  CgiContext ctx;
+  if (openCgiContext(&ctx) != 0) {
+    LOG_ERROR(SERVER_LOG_MODULE, SERVER_LOG_PROC, "timer context failed!\n");
+    return;
+  }
+  std::unique_lock<std::mutex> lock(cgi_timer_lock);
+  while (!cgi_timer_stop) {
+    time_t now = time(nullptr);
+    for (int i = 0; i < cgi_timer_count; i++) {
+      CgiTimerEntry &t = cgi_timers[i];
+      if (now >= t.next) {
+        t.next = now + t.interval_s;
+        lock.unlock();
+        t.timer(&ctx, false);
+        lock.lock();
+      }
+    }
+    cgi_timer_cond.wait_for(lock, std::chrono::seconds(1));
+  }
+  lock.unlock();
+  // 退出前最后一次
+  for (int i = 0; i < cgi_timer_count; i++) {
+    cgi_timers[i].timer(&ctx, true);
+  }
+  closeCgiContext(&ctx);
+}
+
+int startCgiTimers() {
+  if (cgi_timer_count == 0 || cgi_timer_thread.joinable()) {
+    return 0;
+  }
+  cgi_timer_stop = false;
+  // 新线程继承屏蔽所有信号的掩码，SIGTERM只递送给处理请求的线程
+  sigset_t all, old;
+  sigfillset(&all);
+  pthread_sigmask(SIG_SETMASK, &all, &old);
+  try {
+    cgi_timer_thread = std::thread(runCgiTimers);
+  } catch (const std::system_error &e) {
+    LOG_ERROR(SERVER_LOG_MODULE, SERVER_LOG_PROC, "timer thread: %s\n",
+              e.what());
+  }
+  pthread_sigmask(SIG_SETMASK, &old, nullptr);
+  return cgi_timer_thread.joinable() ? 0 : -1;
+}
+
+void stopCgiTimers() {
+  if (!cgi_timer_thread.joinable()) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(cgi_timer_lock);
+    cgi_timer_stop = true;
+  }
+  cgi_timer_cond.notify_all();
+  cgi_timer_thread.join();
+}
+
+/**
+ * @brief 初始化各接口和共享连接，然后循环接收请求并按路由分发
+ *
+ * @param routes 路由表
+ * @param count  路由个数
+ *
+ * @return 初始化失败返回-1，正常情况下不返回
+ */
+int runCgi(const CgiRoute *routes, int count) {
+  // 配置了prefork时本进程成为master，只管理worker，不处理请求
+  int ret = preforkMaster(0);
+  if (ret >= 0) {
+    return ret;
+  }
+
+  FCGX_Init();
+  request = {};
+  FCGX_InitRequest(&request, 0, FCGI_FAIL_ACCEPT_ON_INTR);
+
+  if (initCgiRoutes(routes, count) != 0) {
+    return -1;
+  }
+
+  // 所有接口共用一组连接
+  CgiContext ctx;
+  if (openCgiContext(&ctx) != 0) {
+    return -1;
+  }
+  LOG_INFO(SERVER_LOG_MODULE, SERVER_LOG_PROC, "server start, %d routes\n",
+           count);
+
+  static BodyReplay replay;
+  RequestTrace trace;
+  ctx.trace = &trace;
+
+  // SIGTERM时处理完当前请求再退出，阻塞中的accept被信号打断
+  preforkWorkerInit();
+  if (startCgiTimers() != 0) {
+    LOG_ERROR(SERVER_LOG_MODULE, SERVER_LOG_PROC, "startCgiTimers failed!\n");
+  }
+  preforkWorkerReady();
+
+  while (preforkAcceptBegin()) {
+    int accepted = FCGX_Accept_r(&request);
+    preforkAcceptEnd();
+    if (accepted == -EINTR) {
+      continue;  // 被信号打断，收到SIGTERM时循环条件退出
+    }
+    if (accepted != 0) {
+      break;
+    }
+
+    QueryParams query;
+    query.parse(FCGX_GetParam("QUERY_STRING", request.envp));
+    ctx.query = &query;
+    long reserved = 0;
+
+    const char *path = requestPath();
+    const char *request_id = FCGX_GetParam("HTTP_X_REQUEST_ID", request.envp);
+    trace.begin(request_id ? request_id : "", path);
+    const CgiRoute *route = findCgiRoute(routes, count, path, query.get("cmd"));
+    const char *content_length = FCGX_GetParam("CONTENT_LENGTH", request.envp);
+    int endpoint = cgiRouteEndpoint(route, query.get("cmd"));
+    int64_t start_us = metricsNowUs();
+    metricsRequestBegin(endpoint, content_length ? atol(content_length) : 0);
+    if (route == nullptr) {
+      LOG_WARNING(SERVER_LOG_MODULE, SERVER_LOG_PROC, "no route for %s\n",
+                  path);
+      writeNotFound(request.out);
+    } else if (!admitRequest(route, &ctx, &replay)) {
+      writeTooManyRequests(request.out);
+    } else if (admitBody(route, &ctx, &reserved)) {
+      route->handler(&ctx);
+      admissionRelease(reserved);
+    }
+    if (takeCgiAbort()) {
+      // 发出已有的输出后断开连接，不发END_REQUEST
+      FCGX_FFlush(request.out);
+      request.keepConnection = 0;
+      shutdown(request.ipcFd, SHUT_RDWR);
+    }
+    if (replay.orig != nullptr) {
+      request.in = replay.orig;  // FCGX_Finish_r释放的是原来的流
+      replay.orig = nullptr;
+    }
+
+    metricsRequestEnd(endpoint, metricsNowUs() - start_us);
+    trace.end();
+    jsonResetArena();
+    FCGX_Finish_r(&request);
+  }
+
+  stopCgiTimers();
+  closeCgiContext(&ctx);
+  return 0;
+}
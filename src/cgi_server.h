@@ -0,0 +1,120 @@
+#ifndef CGI_SERVER_H
+#define CGI_SERVER_H
+
+#include <mysql/mysql.h>
+#include <sw/redis++/redis++.h>
+
+#include "fcgiapp.h"
+#include "query_util.h"
+#include "trace_util.h"
+
+const char *const SERVER_LOG_MODULE = "cgi";
+const char *const SERVER_LOG_PROC = "server";
+
+/*
+   所有接口共用的FastCGI服务框架：
+   每个接口只实现一个处理函数，由路由表按 SCRIPT_NAME(或DOCUMENT_URI) + cmd 分发。
+   gateway_cgi 把所有接口注册在一张路由表里，一个进程共用一组mysql/redis连接、
+   一份配置和日志；原来的 login_cgi、upload_cgi 等只注册自己的一条路由，
+   编译时定义 CGI_GATEWAY 则去掉它们各自的main。
+
+   cfg.json配置了prefork.workers时，spawn-fcgi启动的进程成为master，
+   由它启动和监管worker进程，SIGUSR2热重启(prefork_util.h)。
+
+   nginx:
+   location ~ ^/(login|reg|md5|myfiles|upload|delta|dl)$ {
+       fastcgi_pass 127.0.0.1:10010;
+       include fastcgi.conf;
+   }
+*/
+
+// 当前线程正在处理的请求，处理函数通过它读写请求
+extern thread_local FCGX_Request request;
+
+class MysqlPool;
+class MetaStore;
+class TokenStore;
+class BlobStore;
+class ShareIndex;
+
+// 处理函数可以使用的共享资源
+struct CgiContext {
+  MYSQL *mysql;              // 进程共用的mysql连接
+  sw::redis::Redis *redis;   // 进程共用的redis连接
+  const QueryParams *query;  // 已解析的QUERY_STRING
+  MysqlPool *mysql_pool;     // io_uring服务端的异步mysql连接池，否则为nullptr
+  RequestTrace *trace;       // 当前请求的追踪，用TraceSpan记录各阶段耗时
+  MetaStore *meta;           // 文件元数据，基于mysql(backend_util.h)
+  TokenStore *tokens;        // 登录token，基于redis
+  BlobStore *blobs;          // 文件内容，基于fastDFS
+  ShareIndex *shares;        // 共享文件的排行，基于redis
+};
+
+// 处理一个请求，返回前需写好响应，框架负责FCGX_Finish_r
+typedef void (*CgiHandler)(CgiContext *ctx);
+
+// 进程启动时调用一次，用于读取接口自己的配置，返回非0时进程退出
+typedef int (*CgiInit)();
+
+class Task;
+struct UringRequest;
+
+// io_uring服务端(cgi_uring.h)的协程处理函数，响应写入req->out
+// 线程的json内存池(json_util.h)在每个请求结束时回收，其它协程也会在这时结束，
+// 所以从池中分配的Document、缓冲区不能跨co_await使用
+typedef Task (*UringHandler)(UringRequest *req, CgiContext *ctx);
+
+// 一条路由
+struct CgiRoute {
+  const char *path;    // 请求路径，如"/upload"
+  const char *cmd;     // QUERY_STRING中的cmd，nullptr匹配任意cmd
+  CgiHandler handler;  // 处理函数
+  CgiInit init;        // 初始化函数，可以为nullptr
+  UringHandler uring_handler;  // io_uring服务端优先使用的协程版本，可以为nullptr
+};
+
+// 查找路由，只有一条路由时直接返回它，没有匹配时返回nullptr
+const CgiRoute *findCgiRoute(const CgiRoute *routes, int count,
+                             const char *path, string_view cmd);
+
+// 调用各路由的初始化函数，同一个函数只调用一次，并打开限流表(ratelimit_util.h)、
+// 上传准入的在途字节计数(admission_util.h)和指标(metrics_util.h)，失败返回-1
+int initCgiRoutes(const CgiRoute *routes, int count);
+
+// 请求在指标中的接口编号，不是initCgiRoutes的路由表中的路由时返回-1
+// cmd为nullptr的路由按请求的cmd分开记录，不同的cmd有上限，超出的记在路由上
+int cgiRouteEndpoint(const CgiRoute *route, string_view cmd);
+
+// 打开一组mysql/redis连接并创建基于它们的meta/tokens/blobs，失败返回-1
+int openCgiContext(CgiContext *ctx);
+
+// 关闭openCgiContext打开的连接
+void closeCgiContext(CgiContext *ctx);
+
+// 响应已经开始发送后出错时调用：框架不正常结束请求，而是断开与nginx的连接，
+// nginx随即中断与客户端的连接，客户端不会把截断的响应当作完整的
+void abortCgiResponse();
+
+// 当前线程的请求是否调用过abortCgiResponse，同时清除标记，框架和测试使用
+bool takeCgiAbort();
+
+// 后台定时任务，在工作进程单独的线程中使用自己的一组连接(openCgiContext)运行，
+// 不占用处理请求的线程；进程退出(stopCgiTimers)时每个任务再以final为true
+// 调用一次，用来把进程内还没写出的数据写出
+typedef void (*CgiTimer)(CgiContext *ctx, bool final);
+
+// 在初始化函数中注册，每interval_s秒(至少1秒)调用一次，
+// 同一个函数只注册一次，注册满时返回-1
+int addCgiTimer(CgiTimer timer, int interval_s);
+
+// 启动定时任务线程，没有注册任务时不启动，失败返回-1
+int startCgiTimers();
+
+// 停止定时任务线程：等正在运行的任务返回，再以final调用每个任务后退出
+void stopCgiTimers();
+
+// 按路由表处理请求直到进程退出
+// 只有一条路由时不检查路径，直接交给该路由处理(单接口程序)
+int runCgi(const CgiRoute *routes, int count);
+
+#endif
@@ -0,0 +1,472 @@
+#include "cgi_uring.h"
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include "admission_util.h"
+#include "cgi_util.h"
+#include "json_util.h"
+#include "make_log.h"
+#include "metrics_util.h"
+#include "ratelimit_util.h"
+#include "response_util.h"
+#include "uring_mysql.h"
+
+const char *const CGI_URING_LOG_MODULE = "cgi";
+const char *const CGI_URING_LOG_PROC = "uring";
+
+// 一个事件循环线程的共享资源
+struct UringCgiThread {
+  CgiContext ctx;
+  MysqlPool mysql_pool;  // 协程处理函数使用的异步mysql连接
+};
+
+static const CgiRoute *cgi_routes = nullptr;
+static int cgi_route_count = 0;
+static int mysql_pool_size = 4;  // cfg.json中uring.mysql_conns
+
+// 交给线程池的一个同步处理函数调用，完成后写event_fd唤醒事件循环
+struct BlockingJob {
+  const CgiRoute *route;
+  UringRequest *req;
+  const QueryParams *query;
+  RequestTrace *trace;
+  int event_fd;
+};
+
+// 同步处理函数的线程池，每个线程一组mysql/redis连接
+static int blocking_pool_size = 4;  // cfg.json中uring.blocking_threads
+static std::vector<std::thread> blocking_threads;
+static std::mutex blocking_lock;
+static std::condition_variable blocking_cond;
+static std::deque<BlockingJob *> blocking_jobs;
+static bool blocking_stop = false;
+static std::atomic<int> blocking_ready{0};  // 连接已打开的线程数
+
+// 内存中的FastCGI流，供原来基于FCGX_Stream的处理函数读写
+struct MemStream {
+  FCGX_Stream stream;
+  UringRequest *req;
+  off_t off;  // 临时文件中的读取位置
+  unsigned char buf[8192];
+};
+
+static void noFill(FCGX_Stream *s) { s->isClosed = 1; }
+
+static void noEmpty(FCGX_Stream *s, int) {
+  s->wrNext = ((MemStream *)s->data)->buf;
+}
+
+// 请求体已落盘时分块读取临时文件
+static void spoolFill(FCGX_Stream *s) {
+  MemStream *m = (MemStream *)s->data;
+  ssize_t n = pread(m->req->spool_fd, m->buf, sizeof(m->buf), m->off);
+  if (n <= 0) {
+    s->isClosed = 1;
+    return;
+  }
+  m->off += n;
+  s->rdNext = s->stopUnget = m->buf;
+  s->stop = m->buf + n;
+}
+
+// 输出缓冲区满或处理结束时追加到req->out
+static void outEmpty(FCGX_Stream *s, int) {
+  MemStream *m = (MemStream *)s->data;
+  m->req->out.append((const char *)m->buf, s->wrNext - m->buf);
+  s->wrNext = m->buf;
+}
+
+static void initStream(MemStream *m, UringRequest *req, bool reader) {
+  memset(&m->stream, 0, sizeof(m->stream));
+  m->req = req;
+  m->off = 0;
+  m->stream.data = m;
+  m->stream.isReader = reader ? 1 : 0;
+  m->stream.fillBuffProc = noFill;
+  m->stream.emptyBuffProc = noEmpty;
+  if (!reader) {
+    m->stream.wrNext = m->buf;
+    m->stream.stop = m->buf + sizeof(m->buf);
+  } else if (req->spool_fd >= 0) {
+    m->stream.rdNext = m->stream.stop = m->stream.stopUnget = m->buf;
+    m->stream.fillBuffProc = spoolFill;
+  } else {
+    unsigned char *p = (unsigned char *)req->body.data();
+    m->stream.rdNext = m->stream.stopUnget = p;
+    m->stream.stop = p + req->body.size();
+  }
+}
+
+static void notFoundHandler(CgiContext *) { writeNotFound(request.out); }
+
+static const CgiRoute not_found_route = {"", nullptr, notFoundHandler,
+                                         nullptr, nullptr};
+
+/**
+ * @brief 把请求包装成FCGX_Request，同步调用原来的处理函数
+ */
+static void runBlocking(const CgiRoute *route, UringRequest *req,
+                        CgiContext *ctx) {
+  // 环境变量 NAME=VALUE，先算好总长度，保证指针不因扩容失效
+  size_t total = 0;
+  for (const auto &p : req->params) {
+    total += p.first.size() + p.second.size() + 2;
+  }
+  std::string env_buf;
+  env_buf.reserve(total);
+  std::vector<char *> envp;
+  envp.reserve(req->params.size() + 1);
+  for (const auto &p : req->params) {
+    envp.push_back(env_buf.data() + env_buf.size());
+    env_buf.append(p.first.data(), p.first.size());
+    env_buf.push_back('=');
+    env_buf.append(p.second.data(), p.second.size());
+    env_buf.push_back('\0');
+  }
+  envp.push_back(nullptr);
+
+  MemStream in, out, err;
+  initStream(&in, req, true);
+  initStream(&out, req, false);
+  initStream(&err, req, false);
+  out.stream.emptyBuffProc = outEmpty;
+
+  request = {};
+  request.requestId = req->id;
+  request.role = FCGI_ROLE_RESPONDER;
+  request.in = &in.stream;
+  request.out = &out.stream;
+  request.err = &err.stream;
+  request.envp = envp.data();
+  request.keepConnection = req->keep_conn ? 1 : 0;
+
+  route->handler(ctx);
+  outEmpty(&out.stream, 1);
+  req->abort_conn = takeCgiAbort();
+  request = {};
+}
+
+// 线程池中的一个线程：取出任务，用本线程的连接调用处理函数
+static void blockingWorker() {
+  CgiContext conns;
+  if (openCgiContext(&conns) != 0) {
+    LOG_ERROR(CGI_URING_LOG_MODULE, CGI_URING_LOG_PROC,
+              "blocking worker context failed!\n");
+    return;
+  }
+  blocking_ready++;
+  std::unique_lock<std::mutex> lock(blocking_lock);
+  while (true) {
+    blocking_cond.wait(lock,
+                       [] { return blocking_stop || !blocking_jobs.empty(); });
+    if (blocking_stop) {
+      break;
+    }
+    BlockingJob *job = blocking_jobs.front();
+    blocking_jobs.pop_front();
+    lock.unlock();
+
+    CgiContext ctx = conns;
+    ctx.query = job->query;
+    ctx.trace = job->trace;
+    runBlocking(job->route, job->req, &ctx);
+    jsonResetArena();
+    uint64_t one = 1;
+    if (write(job->event_fd, &one, sizeof(one)) != sizeof(one)) {
+      LOG_ERROR(CGI_URING_LOG_MODULE, CGI_URING_LOG_PROC,
+                "blocking job wakeup err: %s\n", strerror(errno));
+    }
+    lock.lock();
+  }
+  lock.unlock();
+  blocking_ready--;
+  closeCgiContext(&conns);
+}
+
+static void startBlockingPool() {
+  blocking_stop = false;
+  for (int i = 0; i < blocking_pool_size; i++) {
+    try {
+      blocking_threads.emplace_back(blockingWorker);
+    } catch (const std::system_error &e) {
+      LOG_ERROR(CGI_URING_LOG_MODULE, CGI_URING_LOG_PROC,
+                "blocking thread: %s\n", e.what());
+      break;
+    }
+  }
+}
+
+static void stopBlockingPool() {
+  {
+    std::lock_guard<std::mutex> lock(blocking_lock);
+    blocking_stop = true;
+  }
+  blocking_cond.notify_all();
+  for (std::thread &th : blocking_threads) {
+    th.join();
+  }
+  blocking_threads.clear();
+}
+
+/**
+ * @brief 在线程池中调用同步处理函数，事件循环线程等待期间继续处理其它请求
+ *        线程池不可用时退回到在事件循环线程中调用
+ */
+static Task runOffLoop(const CgiRoute *route, UringRequest *req,
+                       CgiContext *ctx) {
+  int efd = blocking_ready > 0 ? eventfd(0, EFD_CLOEXEC) : -1;
+  if (efd < 0) {
+    runBlocking(route, req, ctx);
+    co_return;
+  }
+  BlockingJob job = {route, req, ctx->query, ctx->trace, efd};
+  {
+    std::lock_guard<std::mutex> lock(blocking_lock);
+    blocking_jobs.push_back(&job);
+  }
+  blocking_cond.notify_one();
+
+  // job、req在任务完成前都要有效，等待出错时只能同步等
+  int res;
+  do {
+    res = co_await uringPoll(efd, POLLIN);
+  } while (res == -EINTR || res == -EAGAIN || res == -ECANCELED);
+  uint64_t value;
+  if (read(efd, &value, sizeof(value)) != sizeof(value)) {
+    LOG_ERROR(CGI_URING_LOG_MODULE, CGI_URING_LOG_PROC,
+              "blocking job wait err: %s\n", strerror(errno));
+  }
+  close(efd);
+}
+
+/**
+ * @brief 按限流策略检查请求，请求体已在内存中，直接找用户名
+ *        请求体过长或找不到用户名时拒绝
+ *
+ * @return 允许返回true，应返回429时返回false
+ */
+static bool admitRequest(const RatePolicy *policy, UringRequest *req,
+                         CgiContext *ctx) {
+  if (!rateLimitAllow(policy, req->param("REMOTE_ADDR"), "", ctx->redis)) {
+    return false;
+  }
+  if (!policy->user.enabled()) {
+    return true;
+  }
+  // 取不到用户名的请求不放行，否则填充请求体或转义用户名就能绕过
+  char user[USER_NAME_LEN];
+  if (req->spool_fd >= 0 || req->body.size() > RATELIMIT_BODY_MAX ||
+      !rateLimitScanUser(req->body.data(), req->body.size(),
+                         policy->user_field.c_str(), user, sizeof(user))) {
+    return false;
+  }
+  return rateLimitAllow(policy, "", user, ctx->redis);
+}
+
+// 请求路径，优先使用SCRIPT_NAME，nginx未设置时使用DOCUMENT_URI
+static std::string requestPath(const UringRequest *req) {
+  std::string path(req->param("SCRIPT_NAME"));
+  if (path.empty()) {
+    path = req->param("DOCUMENT_URI");
+  }
+  return path;
+}
+
+/**
+ * @brief 上传类接口的准入检查，在读请求体之前由服务端调用
+ *        预留的在途字节挂在req->hold上，请求结束时归还
+ *
+ * @return 接收返回true，拒绝时响应已写入req->out
+ */
+static bool admitCgi(UringRequest *req, void *arg) {
+  UringCgiThread *t = (UringCgiThread *)arg;
+  if (!admissionApplies(requestPath(req).c_str())) {
+    return true;
+  }
+  QueryParams query;
+  query.parse(std::string(req->param("QUERY_STRING")).c_str());
+  string_view user, token;
+  admissionCredentials(query, req->param("HTTP_X_USER"),
+                       req->param("HTTP_X_TOKEN"), &user, &token);
+  long reserved = 0;
+  AdmitResult result =
+      admissionCheck(admissionLength(req->param("CONTENT_LENGTH")), user,
+                     token, t->ctx.redis, &reserved);
+  if (result != ADMIT_OK) {
+    appendAdmitReject(&req->out, result);
+    return false;
+  }
+  if (reserved > 0) {
+    req->hold = std::shared_ptr<void>(
+        nullptr, [reserved](void *) { admissionRelease(reserved); });
+  }
+  return true;
+}
+
+/**
+ * @brief 按路由分发一个请求，优先使用协程版本的处理函数
+ */
+static Task dispatchCgi(UringRequest *req, void *arg) {
+  UringCgiThread *t = (UringCgiThread *)arg;
+  CgiContext ctx = t->ctx;  // 每个请求一份，query互不影响
+  QueryParams query;
+  query.parse(std::string(req->param("QUERY_STRING")).c_str());
+  ctx.query = &query;
+
+  // 在协程帧中，处理函数挂起期间也有效
+  RequestTrace trace;
+  ctx.trace = &trace;
+  std::string path = requestPath(req);
+  trace.begin(req->param("HTTP_X_REQUEST_ID"), path);
+  const CgiRoute *route =
+      findCgiRoute(cgi_routes, cgi_route_count, path.c_str(), query.get("cmd"));
+  if (route == nullptr) {
+    LOG_WARNING(CGI_URING_LOG_MODULE, CGI_URING_LOG_PROC, "no route for %s\n",
+                path.c_str());
+    route = &not_found_route;
+  }
+
+  int endpoint = cgiRouteEndpoint(route, query.get("cmd"));
+  int64_t start_us = metricsNowUs();
+  metricsRequestBegin(endpoint,
+                      admissionLength(req->param("CONTENT_LENGTH")));
+
+  const RatePolicy *policy = rateLimitPolicy(route->path);
+  if (policy != nullptr && !admitRequest(policy, req, &ctx)) {
+    appendTooManyRequests(&req->out);
+    metricsRequestEnd(endpoint, metricsNowUs() - start_us);
+    trace.end();
+    co_return;
+  }
+
+  if (route->uring_handler != nullptr) {
+    co_await route->uring_handler(req, &ctx);
+  } else {
+    co_await runOffLoop(route, req, &ctx);
+  }
+  metricsRequestEnd(endpoint, metricsNowUs() - start_us);
+  trace.end();
+
+  // 协程处理函数只在两次挂起之间使用json内存池(见UringHandler)，
+  // 挂起中的协程不持有池中的内存，每个请求结束都回收，负载不断时池也不会增长
+  jsonResetArena();
+}
+
+static void *initThread() {
+  UringCgiThread *t = new UringCgiThread;
+  if (openCgiContext(&t->ctx) != 0 ||
+      t->mysql_pool.init(mysql_pool_size) != 0) {
+    delete t;
+    return nullptr;
+  }
+  t->ctx.mysql_pool = &t->mysql_pool;
+  return t;
+}
+
+/**
+ * @brief  从cfg.json中读取io_uring服务端配置
+ *
+ * @param cfg (out) 配置
+ *
+ * @return 0 成功
+ */
+int getUringConfig(UringConfig *cfg) {
+  string value;
+  *cfg = UringConfig();
+  if (getCfgValue(CFG_PATH, "uring", "threads", value) == 0) {
+    cfg->threads = atoi(value.c_str());
+  }
+  if (getCfgValue(CFG_PATH, "uring", "entries", value) == 0) {
+    cfg->entries = (unsigned)atoi(value.c_str());
+  }
+  if (getCfgValue(CFG_PATH, "uring", "spool_threshold", value) == 0) {
+    cfg->spool_threshold = (size_t)atol(value.c_str());
+  }
+  getCfgValue(CFG_PATH, "uring", "spool_dir", cfg->spool_dir);
+  if (getCfgValue(CFG_PATH, "uring", "max_requests", value) == 0) {
+    cfg->max_requests = atoi(value.c_str());
+  }
+  getCfgValue(CFG_PATH, "uring", "host", cfg->host);
+  if (getCfgValue(CFG_PATH, "uring", "port", value) == 0) {
+    cfg->port = atoi(value.c_str());
+  }
+  if (cfg->threads <= 0) cfg->threads = 1;
+  if (cfg->entries == 0) cfg->entries = 256;
+
+  LOG_INFO(CGI_URING_LOG_MODULE, CGI_URING_LOG_PROC,
+           "uring threads = %d, entries = %u, spool_threshold = %zu, "
+           "max_requests = %d",
+           cfg->threads, cfg->entries, cfg->spool_threshold,
+           cfg->max_requests);
+  return 0;
+}
+
+// spawn-fcgi把监听socket放在fd 0，与libfcgi的判断方式相同
+static bool stdinIsListenSocket() {
+  int accepting = 0;
+  socklen_t len = sizeof(accepting);
+  return getsockopt(0, SOL_SOCKET, SO_ACCEPTCONN, &accepting, &len) == 0 &&
+         accepting != 0;
+}
+
+/**
+ * @brief 初始化各接口，启动io_uring服务端
+ *
+ * @param routes 路由表
+ * @param count  路由个数
+ *
+ * @return 初始化失败返回-1，正常情况下不返回
+ */
+int runUringCgi(const CgiRoute *routes, int count) {
+  if (initCgiRoutes(routes, count) != 0) {
+    return -1;
+  }
+  cgi_routes = routes;
+  cgi_route_count = count;
+
+  UringConfig cfg;
+  getUringConfig(&cfg);
+  string value;
+  if (getCfgValue(CFG_PATH, "uring", "mysql_conns", value) == 0 &&
+      atoi(value.c_str()) > 0) {
+    mysql_pool_size = atoi(value.c_str());
+  }
+  if (getCfgValue(CFG_PATH, "uring", "blocking_threads", value) == 0 &&
+      atoi(value.c_str()) >= 0) {
+    blocking_pool_size = atoi(value.c_str());
+  }
+  int listen_fd =
+      stdinIsListenSocket() ? 0 : uringListen(cfg.host.c_str(), cfg.port);
+  if (listen_fd < 0) {
+    return -1;
+  }
+
+  setLogWriter(uringLogWrite);  // 之后事件循环线程中的日志异步写入
+  if (startCgiTimers() != 0) {
+    LOG_ERROR(CGI_URING_LOG_MODULE, CGI_URING_LOG_PROC,
+              "startCgiTimers failed!\n");
+  }
+  startBlockingPool();
+  UringServer server(cfg, dispatchCgi, initThread, admitCgi);
+  server.start(listen_fd);
+  server.wait();
+  stopBlockingPool();
+  stopCgiTimers();
+  setLogWriter(nullptr);
+  return 0;
+}
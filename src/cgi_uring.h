@@ -0,0 +1,28 @@
+#ifndef CGI_URING_H
+#define CGI_URING_H
+
+#include "cgi_server.h"
+#include "uring_server.h"
+
+/*
+   在io_uring服务端上运行cgi_server的路由表：
+   路由有uring_handler时以协程方式调用；否则把请求参数和请求体包装成
+   内存中的FCGX_Stream，原来基于FCGX_GetStr/FCGX_PutStr的处理函数不用修改。
+
+   每个事件循环线程一组mysql/redis连接。原来的处理函数交给线程池同步执行
+   (cfg.json中uring.blocking_threads，默认4，每个线程一组连接，为0时在事件循环
+   线程中执行)，事件循环线程等待期间继续处理其它连接；
+   网络读写、请求体落盘和日志是异步的。协程处理函数通过ctx->mysql_pool
+   异步查询mysql(uring_mysql.h)，连接数见cfg.json中uring.mysql_conns。
+
+   监听socket：由spawn-fcgi启动时使用fd 0，否则监听cfg.json中uring的host:port。
+   nginx需要 fastcgi_keep_conn on 才会复用到本服务的连接。
+*/
+
+// 从cfg.json读取io_uring服务端配置，缺少时使用默认值
+int getUringConfig(UringConfig *cfg);
+
+// 按路由表在io_uring服务端处理请求直到进程退出，失败返回-1
+int runUringCgi(const CgiRoute *routes, int count);
+
+#endif
@@ -1,5 +1,8 @@
 #include "cgi_util.h"
 
+#include "metrics_util.h"
+#include "str_scan.h"
+
 
 /**
  * @brief  去掉一个字符串两边的空白字符
@@ -48,26 +51,12 @@ int trimSpace(char *inbuf) {
  * @returns 成功: 匹配字符串首地址 失败：NULL
  */
 char *memstr(char *full_data, int full_data_len, char *substr) {
-  int i;
-  int substr_len;
-
   if (full_data == NULL || full_data_len <= 0 || substr == NULL ||
       *substr == '\0') {
     return NULL;
   }
 
-  substr_len = strlen(substr);
-  if (full_data_len < substr_len) {
-    return NULL;
-  }
-
-  for (i = 0; i <= full_data_len - substr_len; i++) {
-    if (memcmp(full_data + i, substr, substr_len) == 0) {
-      return full_data + i;
-    }
-  }
-
-  return NULL;
+  return (char *)scanFind(full_data, full_data_len, substr, strlen(substr));
 }
 
 /**
@@ -158,54 +147,6 @@ int getCfgValue(const char *cfgpath, const char *title, const char *key,
   return 0;
 }
 
-/**
- * @brief  从请求中获取指定的参数
- *
- * @param  query 请求参数
- * @param  key 参数的键
- * @param  value 参数的值
- * @param  value_len_p 参数的值的长度
- *
- * @return 0 成功, -1 失败
- */
-int queryParseKeyValue(const char *query, const char *key, char *value,
-                          int *value_len_p) {
-  const char *temp;  // 使用nullptr代替NULL
-  const char *end;
-  int value_len;
-
-  temp = strstr(
-      query,
-      key);  // strstr()函数用于在字符串中查找指定的子字符串，如果找到则返回子字符串的首地址，否则返回NULL。
-  if (temp == nullptr)  // 使用nullptr代替NULL
-  {
-    LOG_ERROR(UTIL_LOG_MODULE, UTIL_LOG_PROC,
-              "queryParseKeyValue failed! key=%s", key);
-    return -1;
-  }
-
-  temp +=
-      strlen(key) +
-      1;  // strlen()函数用于计算字符串的长度，不包括字符串结束符'\0'。+1是为了跳过'='
-  // get value
-  end = temp;
-
-  while (*end != '\0' && *end != '#' && *end != '&') {
-    ++end;  // 找到value的结束位置
-  }
-  value_len = end - temp;
-
-  strncpy(value, temp, value_len);
-  value[value_len] =
-      '\0';  // 由于末尾是'\0'或者'\#'或者'\&',所以用'\0'覆盖表示字符串结束
-
-  if (value_len_p != nullptr) {
-    *value_len_p = value_len;
-  }
-
-  return 0;
-}
-
 /**
  * @brief  验证给定用户和 token 的有效性
  *
@@ -217,6 +158,7 @@ int queryParseKeyValue(const char *query, const char *key, char *value,
  */
 bool validateToken(sw::redis::Redis *redis, const char *user,
                     const char *token) {
+  MetricTimer timer(DEP_REDIS_VALIDATE_TOKEN);
   try {
     // 从redis中获取指定用户的token
     sw::redis::OptionalString redis_token = redis->get(user);
@@ -236,24 +178,7 @@ bool validateToken(sw::redis::Redis *redis, const char *user,
   } catch (const sw::redis::Error &e) {
     // 打印异常信息
     LOG_ERROR(UTIL_LOG_MODULE, UTIL_LOG_PROC, "Redis Error: %s\n", e.what());
+    timer.fail();
     return false;
   }
 }
-
-
-char *returnStatus(const char *status_num) {
-  Document doc;
-  doc.SetObject();
-  Document::AllocatorType &allocator = doc.GetAllocator();
-
-  doc.AddMember("code", Value(status_num, allocator).Move(), allocator);
-
-  StringBuffer buffer;
-  Writer<StringBuffer> writer(buffer);
-  doc.Accept(writer);
-
-  char *out = new char[buffer.GetSize()];
-  memcpy(out, buffer.GetString(), buffer.GetSize());
-
-  return out;
-}
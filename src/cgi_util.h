@@ -74,15 +74,8 @@ int getFileSuffix(const char *file_name, char *suffix);
 int getCfgValue(const char *cfgpath, const char *title, const char *key,
                   string &value);
 
-// 从请求中获取参数
-int queryParseKeyValue(const char *query, const char *key, char *value,
-                          int *value_len_p);
-
 // 从redis中验证token
 bool validateToken(sw::redis::Redis *redis, const char *user,
                     const char *token);
 
-// 将状态码转为json格式
-char *returnStatus(const char *status_num);
-
 #endif
@@ -0,0 +1,462 @@
+#include "compress_util.h"
+
+#include <fcntl.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zstd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "cgi_util.h"
+#include "mysql_util.h"
+
+// 压缩后不足原大小的90%才值得存压缩版本
+static const double COMPRESS_MIN_SAVING = 0.9;
+
+static int writeAll(int fd, const void *buf, size_t len) {
+  const char *p = (const char *)buf;
+  while (len > 0) {
+    ssize_t n = write(fd, p, len);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return -1;
+    }
+    p += n;
+    len -= n;
+  }
+  return 0;
+}
+
+/**
+ * @brief  从cfg.json中读取压缩配置，缺少compress配置时关闭压缩
+ *
+ * @param cfg (out) 压缩配置
+ *
+ * @return 0 成功
+ */
+int getCompressConfig(CompressConfig *cfg) {
+  string enable, level;
+
+  cfg->enable = false;
+  cfg->level = 3;
+  cfg->types = "txt,log,csv,json,xml,html,htm,md,js,css,sql,svg";
+
+  if (getCfgValue(CFG_PATH, "compress", "enable", enable) != 0) {
+    return 0;
+  }
+  cfg->enable = (enable == "1");
+  if (getCfgValue(CFG_PATH, "compress", "level", level) == 0) {
+    cfg->level = atoi(level.c_str());
+  }
+  getCfgValue(CFG_PATH, "compress", "types", cfg->types);
+
+  LOG_INFO(COMPRESS_LOG_MODULE, COMPRESS_LOG_PROC,
+           "compress enable = %d, level = %d, types = %s", cfg->enable,
+           cfg->level, cfg->types.c_str());
+  return 0;
+}
+
+/**
+ * @brief  根据文件头的magic判断是否为已压缩格式，这类文件再压缩没有收益
+ *
+ * @param head 文件头
+ * @param len  文件头长度
+ *
+ * @return true 已压缩格式
+ */
+bool isCompressedMagic(const unsigned char *head, size_t len) {
+  struct Magic {
+    size_t offset;
+    const char *bytes;
+    size_t len;
+  };
+  static const Magic magics[] = {
+      {0, "\xff\xd8\xff", 3},              // jpg
+      {0, "\x89PNG", 4},                   // png
+      {0, "GIF8", 4},                      // gif
+      {8, "WEBP", 4},                      // webp
+      {4, "ftyp", 4},                      // mp4/mov/heic
+      {0, "\x1a\x45\xdf\xa3", 4},          // mkv/webm
+      {0, "OggS", 4},                      // ogg
+      {0, "fLaC", 4},                      // flac
+      {0, "ID3", 3},                       // mp3
+      {0, "PK\x03\x04", 4},                // zip/docx/xlsx/apk/jar
+      {0, "\x1f\x8b", 2},                  // gzip
+      {0, "\x28\xb5\x2f\xfd", 4},          // zstd
+      {0, "BZh", 3},                       // bzip2
+      {0, "\xfd" "7zXZ", 5},               // xz
+      {0, "7z\xbc\xaf\x27\x1c", 6},        // 7z
+      {0, "Rar!", 4},                      // rar
+  };
+
+  for (const Magic &m : magics) {
+    if (len >= m.offset + m.len &&
+        memcmp(head + m.offset, m.bytes, m.len) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * @brief  后缀名是否在逗号分隔的类型列表中，不区分大小写
+ *
+ * @param types  类型列表，如"txt,log,csv"
+ * @param suffix 后缀名
+ */
+bool suffixInTypes(const string &types, const char *suffix) {
+  size_t suffix_len = strlen(suffix);
+  const char *p = types.c_str();
+  while (*p != '\0') {
+    const char *end = strchr(p, ',');
+    size_t n = (end == nullptr) ? strlen(p) : (size_t)(end - p);
+    if (n == suffix_len && strncasecmp(p, suffix, n) == 0) {
+      return true;
+    }
+    if (end == nullptr) break;
+    p = end + 1;
+  }
+  return false;
+}
+
+/**
+ * @brief  根据后缀名和文件头决定是否压缩
+ *
+ * @param cfg    压缩配置
+ * @param suffix 文件后缀名
+ * @param head   文件头
+ * @param len    文件头长度
+ *
+ * @return true 压缩
+ */
+bool shouldCompress(const CompressConfig *cfg, const char *suffix,
+                    const char *head, size_t len) {
+  if (!cfg->enable || len == 0) {
+    return false;
+  }
+
+  if (!suffixInTypes(cfg->types, suffix)) {
+    return false;
+  }
+
+  // 后缀名可能是错的，已压缩的内容直接跳过
+  return !isCompressedMagic((const unsigned char *)head, len);
+}
+
+/**
+ * @brief  把内存中的数据按块流式压缩写入文件
+ *         压缩后没有明显变小时，改为原样写入
+ *
+ * @param cfg     压缩配置
+ * @param data    原始数据
+ * @param len     原始数据长度
+ * @param path    输出文件
+ * @param p_codec (out) 实际使用的存储编码
+ *
+ * @return 0 成功，-1 失败
+ */
+int compressBufferToFile(const CompressConfig *cfg, const char *data,
+                         size_t len, const char *path, const char **p_codec) {
+  int fd = open(path, O_CREAT | O_WRONLY | O_TRUNC, 0644);
+  if (fd < 0) {
+    LOG_ERROR(COMPRESS_LOG_MODULE, COMPRESS_LOG_PROC, "open %s error\n", path);
+    return -1;
+  }
+
+  ZSTD_CCtx *cctx = ZSTD_createCCtx();
+  if (cctx == nullptr) {
+    close(fd);
+    return -1;
+  }
+  ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, cfg->level);
+
+  int ret = 0;
+  size_t stored = 0;
+  const size_t in_chunk = ZSTD_CStreamInSize();
+  vector<char> out_buf(ZSTD_CStreamOutSize());
+  size_t pos = 0;
+  bool done = false;
+  while (!done) {
+    size_t n = (len - pos < in_chunk) ? len - pos : in_chunk;
+    bool last = (pos + n == len);
+    ZSTD_EndDirective mode = last ? ZSTD_e_end : ZSTD_e_continue;
+    ZSTD_inBuffer input = {data + pos, n, 0};
+    bool finished = false;
+    do {
+      ZSTD_outBuffer output = {out_buf.data(), out_buf.size(), 0};
+      size_t remaining = ZSTD_compressStream2(cctx, &output, &input, mode);
+      if (ZSTD_isError(remaining)) {
+        LOG_ERROR(COMPRESS_LOG_MODULE, COMPRESS_LOG_PROC, "zstd error: %s\n",
+                  ZSTD_getErrorName(remaining));
+        ret = -1;
+        break;
+      }
+      if (writeAll(fd, out_buf.data(), output.pos) != 0) {
+        ret = -1;
+        break;
+      }
+      stored += output.pos;
+      finished = last ? (remaining == 0) : (input.pos == input.size);
+    } while (!finished);
+    if (ret != 0) break;
+
+    pos += n;
+    done = last;
+
+    // 已经超过收益阈值，不必再压缩剩下的数据
+    if (stored >= len * COMPRESS_MIN_SAVING) break;
+  }
+  ZSTD_freeCCtx(cctx);
+
+  *p_codec = CODEC_ZSTD;
+  if (ret == 0 && stored >= len * COMPRESS_MIN_SAVING) {
+    // 收益太小，原样存储
+    if (ftruncate(fd, 0) != 0 || lseek(fd, 0, SEEK_SET) != 0 ||
+        writeAll(fd, data, len) != 0) {
+      ret = -1;
+    }
+    *p_codec = CODEC_NONE;
+    stored = len;
+  }
+  close(fd);
+
+  if (ret != 0) {
+    LOG_ERROR(COMPRESS_LOG_MODULE, COMPRESS_LOG_PROC, "write %s error\n",
+              path);
+    unlink(path);
+    return -1;
+  }
+  LOG_DEBUG(COMPRESS_LOG_MODULE, COMPRESS_LOG_PROC, "%s: %zu -> %zu (%s)\n",
+            path, len, stored, *p_codec);
+  return 0;
+}
+
+/**
+ * @brief  压缩已落盘的文件(如差量重建的新文件)，先写到临时文件再替换原文件
+ *
+ * @param cfg     压缩配置
+ * @param suffix  文件后缀名
+ * @param path    本地文件
+ * @param p_codec (out) 实际使用的存储编码
+ *
+ * @return 0 成功，-1 失败
+ */
+int compressLocalFile(const CompressConfig *cfg, const char *suffix,
+                      const char *path, const char **p_codec) {
+  *p_codec = CODEC_NONE;
+  if (!cfg->enable || !suffixInTypes(cfg->types, suffix)) {
+    return 0;
+  }
+
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    LOG_ERROR(COMPRESS_LOG_MODULE, COMPRESS_LOG_PROC, "open %s error\n", path);
+    return -1;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    return -1;
+  }
+  if (st.st_size == 0) {
+    close(fd);
+    return 0;
+  }
+  void *data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    LOG_ERROR(COMPRESS_LOG_MODULE, COMPRESS_LOG_PROC, "mmap %s err: %s\n",
+              path, strerror(errno));
+    return -1;
+  }
+
+  int ret = 0;
+  if (shouldCompress(cfg, suffix, (const char *)data, st.st_size)) {
+    string tmp = string(path) + ".zst";
+    const char *codec = CODEC_NONE;
+    ret = compressBufferToFile(cfg, (const char *)data, st.st_size,
+                               tmp.c_str(), &codec);
+    if (ret == 0 && strcmp(codec, CODEC_ZSTD) == 0) {
+      if (rename(tmp.c_str(), path) != 0) {
+        LOG_ERROR(COMPRESS_LOG_MODULE, COMPRESS_LOG_PROC,
+                  "rename %s err: %s\n", tmp.c_str(), strerror(errno));
+        unlink(tmp.c_str());
+        ret = -1;
+      } else {
+        *p_codec = CODEC_ZSTD;
+      }
+    } else if (ret == 0) {
+      unlink(tmp.c_str());  // 收益太小，保留原文件
+    }
+  }
+  munmap(data, st.st_size);
+  return ret;
+}
+
+ZstdStreamDecoder::ZstdStreamDecoder()
+    : dctx_(ZSTD_createDCtx()), out_(ZSTD_DStreamOutSize()) {}
+
+ZstdStreamDecoder::~ZstdStreamDecoder() {
+  if (dctx_ != nullptr) {
+    ZSTD_freeDCtx(dctx_);
+  }
+}
+
+int ZstdStreamDecoder::feed(const char *data, size_t len,
+                            const DataSink &sink) {
+  if (dctx_ == nullptr) {
+    return -1;
+  }
+  ZSTD_inBuffer input = {data, len, 0};
+  while (input.pos < input.size) {
+    ZSTD_outBuffer output = {out_.data(), out_.size(), 0};
+    last_ = ZSTD_decompressStream(dctx_, &output, &input);
+    if (ZSTD_isError(last_)) {
+      return -1;
+    }
+    if (output.pos > 0 && sink(out_.data(), output.pos) != 0) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+int ZstdStreamDecoder::finish() const { return last_ == 0 ? 0 : -1; }
+
+/**
+ * @brief  把zstd压缩的文件流式解压到另一个文件
+ *
+ * @param src_path 压缩文件
+ * @param dst_path 输出文件
+ *
+ * @return 0 成功，-1 失败
+ */
+int decompressFile(const char *src_path, const char *dst_path) {
+  int in_fd = open(src_path, O_RDONLY);
+  if (in_fd < 0) {
+    LOG_ERROR(COMPRESS_LOG_MODULE, COMPRESS_LOG_PROC, "open %s error\n",
+              src_path);
+    return -1;
+  }
+  int out_fd = open(dst_path, O_CREAT | O_WRONLY | O_TRUNC, 0644);
+  if (out_fd < 0) {
+    LOG_ERROR(COMPRESS_LOG_MODULE, COMPRESS_LOG_PROC, "open %s error\n",
+              dst_path);
+    close(in_fd);
+    return -1;
+  }
+
+  ZstdStreamDecoder decoder;
+  DataSink sink = [out_fd](const char *data, size_t len) {
+    return writeAll(out_fd, data, len);
+  };
+  vector<char> in_buf(ZSTD_DStreamInSize());
+  int ret = 0;
+  ssize_t n;
+  while (ret == 0 && (n = read(in_fd, in_buf.data(), in_buf.size())) != 0) {
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      ret = -1;
+      break;
+    }
+    if (decoder.feed(in_buf.data(), n, sink) != 0) {
+      LOG_ERROR(COMPRESS_LOG_MODULE, COMPRESS_LOG_PROC,
+                "decompress %s error\n", src_path);
+      ret = -1;
+    }
+  }
+  if (ret == 0 && decoder.finish() != 0) {
+    LOG_ERROR(COMPRESS_LOG_MODULE, COMPRESS_LOG_PROC, "%s truncated\n",
+              src_path);
+    ret = -1;
+  }
+
+  close(in_fd);
+  close(out_fd);
+  if (ret != 0) {
+    unlink(dst_path);
+  }
+  return ret;
+}
+
+/**
+ * @brief  客户端的Accept-Encoding是否接受该编码，q=0表示明确拒绝
+ *
+ * @param accept_encoding 请求头Accept-Encoding，可以为nullptr
+ * @param codec           存储编码
+ *
+ * @return true 接受
+ */
+bool acceptsEncoding(const char *accept_encoding, const char *codec) {
+  if (accept_encoding == nullptr) {
+    return false;
+  }
+
+  size_t codec_len = strlen(codec);
+  const char *p = accept_encoding;
+  while (*p != '\0') {
+    while (*p == ' ' || *p == ',') p++;
+    const char *token = p;
+    while (*p != '\0' && *p != ',' && *p != ';' && *p != ' ') p++;
+    size_t token_len = p - token;
+
+    // 参数部分，只关心q值
+    double q = 1.0;
+    while (*p != '\0' && *p != ',') {
+      if (*p == ';') {
+        const char *param = p + 1;
+        while (*param == ' ') param++;
+        if (strncmp(param, "q=", 2) == 0) q = atof(param + 2);
+      }
+      p++;
+    }
+
+    if (token_len == codec_len && strncasecmp(token, codec, codec_len) == 0) {
+      return q > 0;
+    }
+  }
+  return false;
+}
+
+/**
+ * @brief  记录文件的存储编码
+ *
+ * @param conn  数据库连接
+ * @param md5   文件md5
+ * @param codec 存储编码
+ *
+ * @return 0 成功，-1 失败
+ */
+int saveFileCodec(MYSQL *conn, const char *md5, const char *codec) {
+  char sql_cmd[SQL_MAX_LEN] = {0};
+  sprintf(sql_cmd, "update file_info set codec = '%s' where md5 = '%s'",
+          codec, md5);
+  if (mysqlQuery(conn, sql_cmd) != 0) {
+    LOG_ERROR(COMPRESS_LOG_MODULE, COMPRESS_LOG_PROC, "%s 操作失败: %s\n",
+              sql_cmd, mysql_error(conn));
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * @brief  查询文件的存储编码
+ *
+ * @param conn  数据库连接
+ * @param md5   文件md5
+ * @param codec (out) 存储编码，没有记录时为none
+ *
+ * @return 0 成功，-1 失败
+ */
+int getFileCodec(MYSQL *conn, const char *md5, char *codec) {
+  char sql_cmd[SQL_MAX_LEN] = {0};
+  strcpy(codec, CODEC_NONE);
+  sprintf(sql_cmd, "select codec from file_info where md5 = '%s'", md5);
+  return processResultOne(conn, sql_cmd, codec) < 0 ? -1 : 0;
+}
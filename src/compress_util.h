@@ -0,0 +1,96 @@
+#ifndef COMPRESS_UTIL_H
+#define COMPRESS_UTIL_H
+
+#include <mysql/mysql.h>
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "backend_util.h"
+#include "make_log.h"
+
+using namespace std;
+
+const char *const COMPRESS_LOG_MODULE = "cgi";
+const char *const COMPRESS_LOG_PROC = "compress";
+
+/*
+   入库压缩：按文件类型对文本类文件做zstd压缩后再存入fastDFS，
+   file_info.codec 记录存储编码，NULL或'none'为原样存储。
+
+   -- alter table file_info add column codec varchar(8) default null;
+
+   cfg.json:
+   "compress": {"enable": "1", "level": "3",
+                "types": "txt,log,csv,json,xml,html,htm,md,js,css,sql,svg"}
+*/
+
+// 存储编码
+const char *const CODEC_NONE = "none";
+const char *const CODEC_ZSTD = "zstd";
+
+// 压缩配置
+struct CompressConfig {
+  bool enable;   // 是否开启入库压缩
+  int level;     // zstd压缩级别
+  string types;  // 需要压缩的后缀名，逗号分隔
+};
+
+// 从cfg.json中读取压缩配置，没有配置时关闭压缩
+int getCompressConfig(CompressConfig *cfg);
+
+// 根据文件头的magic判断是否为已压缩格式(jpg、png、mp4、zip等)
+bool isCompressedMagic(const unsigned char *head, size_t len);
+
+// 后缀名是否在逗号分隔的类型列表中
+bool suffixInTypes(const string &types, const char *suffix);
+
+// 根据后缀名和文件头决定是否压缩
+bool shouldCompress(const CompressConfig *cfg, const char *suffix,
+                    const char *head, size_t len);
+
+// 把内存中的数据流式压缩写入文件，压缩收益太小时原样写入
+int compressBufferToFile(const CompressConfig *cfg, const char *data,
+                         size_t len, const char *path, const char **p_codec);
+
+// 按后缀名和文件头决定是否压缩本地文件，压缩后替换原文件，
+// 不压缩或收益太小时原文件不变，p_codec为CODEC_NONE
+int compressLocalFile(const CompressConfig *cfg, const char *suffix,
+                      const char *path, const char **p_codec);
+
+// 把zstd压缩的文件解压到另一个文件
+int decompressFile(const char *src_path, const char *dst_path);
+
+struct ZSTD_DCtx_s;
+
+// 流式解压zstd：压缩数据分段喂入，解出的数据交给sink，内存占用固定
+class ZstdStreamDecoder {
+ public:
+  ZstdStreamDecoder();
+  ~ZstdStreamDecoder();
+  ZstdStreamDecoder(const ZstdStreamDecoder &) = delete;
+  ZstdStreamDecoder &operator=(const ZstdStreamDecoder &) = delete;
+
+  // 喂入一段压缩数据，0成功，-1数据错误或sink中止
+  int feed(const char *data, size_t len, const DataSink &sink);
+
+  // 数据全部喂入后检查，压缩帧不完整时返回-1
+  int finish() const;
+
+ private:
+  ZSTD_DCtx_s *dctx_;
+  std::vector<char> out_;
+  size_t last_ = 0;  // 上次ZSTD_decompressStream的返回值，0为帧已结束
+};
+
+// 客户端的Accept-Encoding是否接受该编码
+bool acceptsEncoding(const char *accept_encoding, const char *codec);
+
+// 记录文件的存储编码
+int saveFileCodec(MYSQL *conn, const char *md5, const char *codec);
+
+// 查询文件的存储编码
+int getFileCodec(MYSQL *conn, const char *md5, char *codec);
+
+#endif
@@ -0,0 +1,419 @@
+/**
+ * @file delta_cgi.cpp
+ * @brief 差量上传的cgi程序：返回旧版本分块签名，接收差量指令重建新文件
+ * @author ward
+ * @version 1.0
+ * @date 2023年6月2日
+ */
+
+#include <mysql/mysql.h>
+#include <sw/redis++/redis++.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <vector>
+
+#include "cgi_handlers.h"
+#include "cgi_server.h"
+#include "cgi_util.h"
+#include "compress_util.h"
+#include "delta_util.h"
+#include "fcgi_config.h"
+#include "fcgi_stdio.h"
+#include "json_util.h"
+#include "make_log.h"
+#include "mysql_util.h"
+#include "pack_util.h"
+#include "quota_util.h"
+#include "rapidjson/document.h"
+#include "rapidjson/stringbuffer.h"
+#include "rapidjson/writer.h"
+#include "response_util.h"
+#include "storage_util.h"
+
+using namespace rapidjson;
+using namespace std;
+using namespace sw::redis;
+
+// 临时文件名的序号，同一进程中多个线程同时处理请求时不重名
+static atomic<unsigned long> tmp_seq{0};
+static PackConfig pack_cfg;          // 小文件打包配置，与上传相同
+static CompressConfig compress_cfg;  // 入库压缩配置，与上传相同
+
+// 读取打包、压缩和配额配置
+int deltaInit() {
+  getPackConfig(&pack_cfg);
+  getCompressConfig(&compress_cfg);
+  quotaInit();
+  return 0;
+}
+
+// md5必须是32位十六进制，之后要拼进sql语句
+static bool isMd5(const char *md5) {
+  int i = 0;
+  for (; md5[i] != '\0'; i++) {
+    if (!isxdigit((unsigned char)md5[i])) {
+      return false;
+    }
+  }
+  return i == 32;
+}
+
+/**
+ * @brief 解析差量请求的json参数
+ *
+ * @param buf   json字符串(原地解析，内容会被修改)
+ * @param info  (out) 解析结果
+ * @param patch 是否为cmd=patch请求(需要md5、filename、blocksize)
+ *
+ * @return 0成功，-1失败
+ */
+int getDeltaInfo(char *buf, DeltaInfo *info, bool patch) {
+  info->block_size = 0;
+  const JsonField fields[] = {
+      jsonStr("user", info->user, sizeof(info->user)),
+      jsonStr("token", info->token, sizeof(info->token)),
+      jsonStr("base_md5", info->base_md5, sizeof(info->base_md5)),
+      jsonStr("md5", info->md5, sizeof(info->md5), patch),
+      jsonStr("filename", info->filename, sizeof(info->filename), patch),
+      jsonInt("blocksize", &info->block_size, patch),
+  };
+  if (jsonDecode(buf, fields, DELTA_LOG_PROC) != 0) {
+    return -1;
+  }
+  if (!isMd5(info->base_md5) || (patch && !isMd5(info->md5))) {
+    LOG_ERROR(DELTA_LOG_MODULE, DELTA_LOG_PROC, "md5格式错误\n");
+    return -1;
+  }
+  if (info->block_size != 0 && (info->block_size < DELTA_MIN_BLOCK_SIZE ||
+                                info->block_size > DELTA_MAX_BLOCK_SIZE)) {
+    LOG_ERROR(DELTA_LOG_MODULE, DELTA_LOG_PROC, "blocksize %d 超出范围",
+              info->block_size);
+    return -1;
+  }
+
+  return 0;
+}
+
+/**
+ * @brief 确认用户拥有旧版本文件，并把它从分布式存储下载到本地
+ *
+ * @param conn       数据库连接
+ * @param info       差量请求参数
+ * @param local_file 本地保存的文件名
+ * @param p_size     (out) 旧版本文件大小
+ *
+ * @return 0成功，-1失败
+ */
+int fetchBaseFile(MYSQL *conn, const DeltaInfo *info, const char *local_file,
+                  long *p_size) {
+  char sql_cmd[SQL_MAX_LEN] = {0};
+  char size[TEMP_BUF_MAX_LEN] = {0};
+
+  // 只能基于自己拥有的文件做差量
+  sprintf(sql_cmd,
+          "select md5 from user_file_list where user = '%s' and md5 = '%s'",
+          info->user, info->base_md5);
+  if (processResultOne(conn, sql_cmd, nullptr) != 2) {
+    LOG_ERROR(DELTA_LOG_MODULE, DELTA_LOG_PROC, "%s 没有文件 %s\n",
+              info->user, info->base_md5);
+    return -1;
+  }
+
+  sprintf(sql_cmd, "select size from file_info where md5 = '%s'",
+          info->base_md5);
+  if (processResultOne(conn, sql_cmd, size) != 0) {
+    LOG_ERROR(DELTA_LOG_MODULE, DELTA_LOG_PROC, "%s 查询失败\n", sql_cmd);
+    return -1;
+  }
+  *p_size = atol(size);
+
+  // 打包存储的旧版本只做一次范围读
+  return fetchStoredFile(conn, info->base_md5, local_file);
+}
+
+/**
+ * @brief 返回旧版本文件的分块签名
+ *        {"code":"020","blocksize":N,"size":S,"blocks":[{"w":弱校验和,"s":"md5"}...]}
+ *
+ * @param conn 数据库连接
+ * @param info 差量请求参数
+ *
+ * @return 0成功，-1失败
+ */
+int dealSignature(MYSQL *conn, DeltaInfo *info) {
+  char base_file[FILE_NAME_LEN] = {0};
+  long base_size = 0;
+  vector<BlockSignature> sigs;
+
+  snprintf(base_file, sizeof(base_file), "delta_base_%d_%lu", (int)getpid(),
+           tmp_seq.fetch_add(1));
+  if (fetchBaseFile(conn, info, base_file, &base_size) != 0) {
+    return -1;
+  }
+
+  if (info->block_size == 0) {
+    info->block_size = chooseBlockSize(base_size);
+  }
+  int ret = computeSignatures(base_file, info->block_size, sigs);
+  unlink(base_file);
+  if (ret != 0) {
+    return -1;
+  }
+
+  // 签名可能有上千块，序列化缓冲区也从线程内存池分配
+  PoolStringBuffer buffer(&jsonArena());
+  PoolWriter writer(buffer, &jsonArena());
+  char hex[33];
+  writer.StartObject();
+  writer.Key("code");
+  writer.String("020");
+  writer.Key("blocksize");
+  writer.Int(info->block_size);
+  writer.Key("size");
+  writer.Int64(base_size);
+  writer.Key("blocks");
+  writer.StartArray();
+  for (const BlockSignature &sig : sigs) {
+    for (int i = 0; i < 16; i++) {
+      sprintf(hex + i * 2, "%02x", sig.strong[i]);
+    }
+    writer.StartObject();
+    writer.Key("w");
+    writer.Uint(sig.weak);
+    writer.Key("s");
+    writer.String(hex, 32);
+    writer.EndObject();
+  }
+  writer.EndArray();
+  writer.EndObject();
+
+  writeBody(request.out, buffer.GetString(), buffer.GetSize());
+  LOG_INFO(DELTA_LOG_MODULE, DELTA_LOG_PROC,
+           "%s 获取 %s 的签名，共 %zu 块，块大小 %d\n", info->user,
+           info->base_md5, sigs.size(), info->block_size);
+  return 0;
+}
+
+/**
+ * @brief 新版本的md5已在file_info中时秒传(与md5_cgi的deal_md5一样)：
+ *        引用计数+1，插入用户文件列表，用户文件数+1，同样占用配额
+ *
+ * @return 0已秒传(或用户已有此文件)，1服务器上没有此文件，-1失败，-2超出配额
+ */
+static int linkExistingFile(MetaStore *meta, Redis *redis, DeltaInfo *info) {
+  int count = 0;
+  int ret = meta->fileRefCount(info->md5, &count);
+  if (ret != 0) {
+    return ret;
+  }
+  if (meta->userHasFile(info->user, info->md5, info->filename) == 1) {
+    LOG_INFO(DELTA_LOG_MODULE, DELTA_LOG_PROC, "%s[filename:%s, md5:%s]已存在\n",
+             info->user, info->filename, info->md5);
+    return 0;
+  }
+
+  long size = 0;
+  QuotaReservation quota;
+  if (quotaEnabled()) {
+    size = meta->fileSize(info->md5);
+    if (size < 0) {
+      size = 0;
+    }
+    if (quotaReserve(redis, info->user, size, &quota) == QUOTA_EXCEEDED) {
+      return -2;
+    }
+  }
+  if (meta->setFileRefCount(info->md5, count + 1) != 0) {
+    quotaRelease(redis, &quota);
+    return -1;
+  }
+  char time_str[128];
+  time_t now = time(nullptr);
+  struct tm tm_now;
+  strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M:%S",
+           localtime_r(&now, &tm_now));
+  if (meta->addUserFile(info->user, info->md5, info->filename, time_str) !=
+      0) {
+    quotaRelease(redis, &quota);
+    return -1;
+  }
+  quotaCommit(redis, &quota, info->user, size);
+  if (meta->incUserFileCount(info->user) != 0) {
+    return -1;
+  }
+  LOG_INFO(DELTA_LOG_MODULE, DELTA_LOG_PROC, "%s 差量秒传[%s, md5：%s]\n",
+           info->user, info->filename, info->md5);
+  return 0;
+}
+
+/**
+ * @brief 根据差量指令重建新文件，再按正常上传流程(storeLocalFile)
+ *        压缩、打包或单独存入分布式存储
+ *        新文件与普通上传一样占用配额：重建之前按指令流算出的大小预留，
+ *        入库后提交，失败时释放
+ *        新版本的md5已在服务器上时不重建，直接秒传
+ *
+ * @param ctx       请求上下文
+ * @param info      差量请求参数
+ * @param delta     差量指令流
+ * @param delta_len 差量指令流长度
+ *
+ * @return 0成功，-1失败，-2超出配额
+ */
+int dealPatch(CgiContext *ctx, DeltaInfo *info, const char *delta,
+              size_t delta_len) {
+  int ret = 0;
+  char base_file[FILE_NAME_LEN] = {0};
+  char new_file[FILE_NAME_LEN + 32] = {0};
+  char real_md5[33] = {0};
+  long base_size = 0;
+  long size = 0;
+
+  if (strchr(info->filename, '/') != nullptr) {
+    LOG_ERROR(DELTA_LOG_MODULE, DELTA_LOG_PROC, "非法文件名 %s\n",
+              info->filename);
+    return -1;
+  }
+
+  Redis *redis = ctx->redis;
+  ret = linkExistingFile(ctx->meta, redis, info);
+  if (ret != 1) {
+    return ret;
+  }
+  ret = 0;
+
+  unsigned long seq = tmp_seq.fetch_add(1);
+  snprintf(base_file, sizeof(base_file), "delta_base_%d_%lu", (int)getpid(),
+           seq);
+  // 保留原文件名，上传到fastDFS后的file_id沿用其后缀
+  snprintf(new_file, sizeof(new_file), "%d_%lu_%s", (int)getpid(), seq,
+           info->filename);
+
+  if (fetchBaseFile(ctx->mysql, info, base_file, &base_size) != 0) {
+    return -1;
+  }
+
+  QuotaReservation quota;  // 配额预留，入库成功后提交
+  do {
+    long expect = deltaOutputSize(base_size, info->block_size, delta,
+                                  delta_len);
+    if (expect < 0) {
+      LOG_ERROR(DELTA_LOG_MODULE, DELTA_LOG_PROC, "差量指令不合法\n");
+      ret = -1;
+      break;
+    }
+    if (quotaReserve(redis, info->user, expect, &quota) == QUOTA_EXCEEDED) {
+      LOG_INFO(DELTA_LOG_MODULE, DELTA_LOG_PROC, "%s 超出配额，文件 %ld 字节\n",
+               info->user, expect);
+      ret = -2;
+      break;
+    }
+
+    if (applyDelta(base_file, info->block_size, delta, delta_len, new_file,
+                   &size) != 0) {
+      ret = -1;
+      break;
+    }
+
+    // 重建结果必须与客户端声明的md5一致
+    if (md5File(new_file, real_md5) != 0 ||
+        strcasecmp(real_md5, info->md5) != 0) {
+      LOG_ERROR(DELTA_LOG_MODULE, DELTA_LOG_PROC,
+                "md5不一致: 声明 %s, 实际 %s\n", info->md5, real_md5);
+      ret = -1;
+      break;
+    }
+    LOG_INFO(DELTA_LOG_MODULE, DELTA_LOG_PROC,
+             "%s 差量重建[%s, 大小：%ld, 差量：%zu]\n", info->user,
+             info->filename, size, delta_len);
+
+    if (storeLocalFile(ctx->mysql, ctx->meta, ctx->blobs, ctx->trace,
+                       &pack_cfg, &compress_cfg, info->user, info->filename,
+                       info->md5, size, new_file) < 0) {
+      ret = -1;
+      break;
+    }
+    quotaCommit(redis, &quota, info->user, size);
+  } while (false);
+
+  quotaRelease(redis, &quota);  // 失败时释放，已提交时不做任何事
+  unlink(base_file);
+  unlink(new_file);
+  return ret;
+}
+
+// 处理一个差量同步请求
+void deltaHandler(CgiContext *ctx) {
+  string_view cmd = ctx->query->get("cmd");
+  LOG_INFO(DELTA_LOG_MODULE, DELTA_LOG_PROC, "cmd = %.*s\n", (int)cmd.size(),
+           cmd.data());
+
+  const char *contentLength = FCGX_GetParam("CONTENT_LENGTH", request.envp);
+  int len = (contentLength == nullptr) ? 0 : atoi(contentLength);
+
+  if (len <= 0) {
+    writeNoData(request.out);
+    LOG_WARNING(DELTA_LOG_MODULE, DELTA_LOG_PROC,
+                "len = 0, No data from standard input\n");
+    return;
+  }
+
+  string body(len, '\0');
+  if (FCGX_GetStr(body.data(), len, request.in) != len) {
+    LOG_ERROR(DELTA_LOG_MODULE, DELTA_LOG_PROC,
+              "FCGX_GetStr(body, len, request.in) err\n");
+    writeStatus(request.out, cmd == "patch" ? "009" : "021");
+    return;
+  }
+
+  DeltaInfo info;
+  const char *out = nullptr;
+  if (cmd == "sig") {
+    // 1、获取旧版本的分块签名，post数据为json
+    if (getDeltaInfo(body.data(), &info, false) != 0) {
+      out = "021";
+    } else if (!validateToken(ctx->redis, info.user, info.token)) {
+      out = "111";
+    } else if (dealSignature(ctx->mysql, &info) != 0) {
+      out = "021";
+    }
+  } else if (cmd == "patch") {
+    // 2、上传差量，post数据为 json头 + "\r\n" + 差量指令流
+    size_t header_end = body.find("\r\n");
+    if (header_end == string::npos) {
+      out = "009";
+    } else {
+      body[header_end] = '\0';
+      if (getDeltaInfo(body.data(), &info, true) != 0) {
+        out = "009";
+      } else if (!validateToken(ctx->redis, info.user, info.token)) {
+        out = "111";
+      } else {
+        int ret = dealPatch(ctx, &info, body.data() + header_end + 2,
+                            body.size() - header_end - 2);
+        out = ret == 0 ? "008" : ret == -2 ? "010" : "009";
+      }
+    }
+  } else {
+    out = "021";
+  }
+
+  if (out != nullptr) {
+    writeStatus(request.out, out);
+    LOG_INFO(DELTA_LOG_MODULE, DELTA_LOG_PROC, "code = %s\n", out);
+  }
+}
+
+#ifndef CGI_GATEWAY
+int main() {
+  const CgiRoute route = {"/delta", nullptr, deltaHandler, deltaInit};
+  return runCgi(&route, 1);
+}
+#endif
@@ -0,0 +1,412 @@
+#include "delta_util.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+#include "fastcommon/md5.h"
+#include "make_log.h"
+
+// 按大端序读写4字节整数
+static void putUint32(string &out, uint32_t v) {
+  char b[4] = {(char)(v >> 24), (char)(v >> 16), (char)(v >> 8), (char)v};
+  out.append(b, 4);
+}
+
+static uint32_t getUint32(const char *p) {
+  const unsigned char *u = (const unsigned char *)p;
+  return ((uint32_t)u[0] << 24) | ((uint32_t)u[1] << 16) |
+         ((uint32_t)u[2] << 8) | (uint32_t)u[3];
+}
+
+static void md5Buffer(const unsigned char *buf, size_t len,
+                      unsigned char digest[16]) {
+  MD5_CTX ctx;
+  my_md5_init(&ctx);
+  my_md5_update(&ctx, buf, (unsigned int)len);
+  my_md5_final(digest, &ctx);
+}
+
+// 写满len个字节，被信号中断时重试
+static int writeAll(int fd, const char *buf, size_t len) {
+  while (len > 0) {
+    ssize_t n = write(fd, buf, len);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return -1;
+    }
+    buf += n;
+    len -= n;
+  }
+  return 0;
+}
+
+/**
+ * @brief  计算一个分块的弱校验和
+ *         a = sum(buf[i]), b = sum((len - i) * buf[i])，各取低16位
+ *
+ * @param buf 分块数据
+ * @param len 分块长度
+ *
+ * @return 弱校验和 (b << 16 | a)
+ */
+uint32_t weakChecksum(const unsigned char *buf, size_t len) {
+  uint32_t a = 0;
+  uint32_t b = 0;
+  for (size_t i = 0; i < len; i++) {
+    a += buf[i];
+    b += (uint32_t)(len - i) * buf[i];
+  }
+  return ((b & 0xffff) << 16) | (a & 0xffff);
+}
+
+/**
+ * @brief  窗口向后滑动一个字节，O(1)更新弱校验和
+ *
+ * @param sum       当前窗口的弱校验和
+ * @param block_len 窗口长度
+ * @param out       移出窗口的字节
+ * @param in        移入窗口的字节
+ *
+ * @return 新窗口的弱校验和
+ */
+uint32_t rollWeakChecksum(uint32_t sum, size_t block_len, unsigned char out,
+                          unsigned char in) {
+  uint32_t a = sum & 0xffff;
+  uint32_t b = sum >> 16;
+  a = (a - out + in) & 0xffff;
+  b = (b - (uint32_t)block_len * out + a) & 0xffff;
+  return (b << 16) | a;
+}
+
+/**
+ * @brief  根据文件大小选择分块大小，取 sqrt(size) 并按8字节对齐
+ *
+ * @param file_size 文件大小
+ *
+ * @return 分块大小
+ */
+int chooseBlockSize(long file_size) {
+  long bs = (long)sqrt((double)file_size) & ~7L;
+  if (bs < DELTA_MIN_BLOCK_SIZE) bs = DELTA_MIN_BLOCK_SIZE;
+  if (bs > DELTA_MAX_BLOCK_SIZE) bs = DELTA_MAX_BLOCK_SIZE;
+  return (int)bs;
+}
+
+/**
+ * @brief  计算文件每个分块的签名，最后一个分块可能不满
+ *
+ * @param path       文件路径
+ * @param block_size 分块大小
+ * @param sigs       (out) 分块签名
+ *
+ * @return 0 成功，-1 失败
+ */
+int computeSignatures(const char *path, int block_size,
+                      vector<BlockSignature> &sigs) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    LOG_ERROR(DELTA_LOG_MODULE, DELTA_LOG_PROC, "open %s error\n", path);
+    return -1;
+  }
+
+  vector<unsigned char> buf(block_size);
+  sigs.clear();
+  while (true) {
+    // 读满一个分块
+    size_t got = 0;
+    while (got < (size_t)block_size) {
+      ssize_t n = read(fd, buf.data() + got, block_size - got);
+      if (n < 0 && errno == EINTR) continue;
+      if (n < 0) {
+        LOG_ERROR(DELTA_LOG_MODULE, DELTA_LOG_PROC, "read %s error\n", path);
+        close(fd);
+        return -1;
+      }
+      if (n == 0) break;
+      got += n;
+    }
+    if (got == 0) break;
+
+    BlockSignature sig;
+    sig.weak = weakChecksum(buf.data(), got);
+    md5Buffer(buf.data(), got, sig.strong);
+    sigs.push_back(sig);
+
+    if (got < (size_t)block_size) break;
+  }
+
+  close(fd);
+  return 0;
+}
+
+/**
+ * @brief  根据旧版本的签名生成新文件的差量指令流(客户端使用)
+ *         弱校验和逐字节滚动查表，命中后再用md5确认
+ *
+ * @param sigs       旧版本的分块签名
+ * @param block_size 分块大小
+ * @param new_path   新文件路径
+ * @param delta      (out) 差量指令流
+ *
+ * @return 0 成功，-1 失败
+ */
+int generateDelta(const vector<BlockSignature> &sigs, int block_size,
+                  const char *new_path, string &delta) {
+  int fd = open(new_path, O_RDONLY);
+  if (fd < 0) {
+    LOG_ERROR(DELTA_LOG_MODULE, DELTA_LOG_PROC, "open %s error\n", new_path);
+    return -1;
+  }
+  struct stat st;
+  if (fstat(fd, &st) < 0) {
+    close(fd);
+    return -1;
+  }
+  vector<unsigned char> data(st.st_size);
+  size_t got = 0;
+  while (got < data.size()) {
+    ssize_t n = read(fd, data.data() + got, data.size() - got);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) break;
+    got += n;
+  }
+  close(fd);
+  if (got != data.size()) {
+    LOG_ERROR(DELTA_LOG_MODULE, DELTA_LOG_PROC, "read %s error\n", new_path);
+    return -1;
+  }
+
+  // 弱校验和 -> 块号；不满的最后一块md5不会与满块窗口相同，不会误匹配
+  unordered_multimap<uint32_t, uint32_t> table;
+  for (size_t i = 0; i < sigs.size(); i++) {
+    table.emplace(sigs[i].weak, (uint32_t)i);
+  }
+
+  const size_t n = data.size();
+  const size_t bs = block_size;
+  size_t i = 0;
+  size_t lit_start = 0;
+  bool have_sum = false;
+  uint32_t sum = 0;
+
+  auto flushLiteral = [&](size_t end) {
+    if (end > lit_start) {
+      delta.push_back(DELTA_OP_LITERAL);
+      putUint32(delta, (uint32_t)(end - lit_start));
+      delta.append((const char *)data.data() + lit_start, end - lit_start);
+    }
+  };
+
+  delta.clear();
+  while (i + bs <= n) {
+    if (!have_sum) {
+      sum = weakChecksum(data.data() + i, bs);
+      have_sum = true;
+    }
+
+    long match = -1;
+    auto range = table.equal_range(sum);
+    if (range.first != range.second) {
+      unsigned char strong[16];
+      md5Buffer(data.data() + i, bs, strong);
+      for (auto it = range.first; it != range.second; ++it) {
+        if (memcmp(sigs[it->second].strong, strong, 16) == 0) {
+          match = it->second;
+          break;
+        }
+      }
+    }
+
+    if (match >= 0) {
+      flushLiteral(i);
+      delta.push_back(DELTA_OP_COPY);
+      putUint32(delta, (uint32_t)match);
+      i += bs;
+      lit_start = i;
+      have_sum = false;
+      continue;
+    }
+
+    if (i + bs < n) {
+      sum = rollWeakChecksum(sum, bs, data[i], data[i + bs]);
+    }
+    i++;
+  }
+  flushLiteral(n);
+
+  return 0;
+}
+
+/**
+ * @brief  按差量指令流算出新文件的大小，用于重建之前预留配额
+ *         引用的块号超出旧版本时返回-1，与applyDelta失败的情况一致
+ *
+ * @param base_size  旧版本文件大小
+ * @param block_size 分块大小
+ * @param delta      差量指令流
+ * @param delta_len  差量指令流长度
+ *
+ * @return 新文件大小，指令流不合法时返回-1
+ */
+long deltaOutputSize(long base_size, int block_size, const char *delta,
+                     size_t delta_len) {
+  long total = 0;
+  size_t pos = 0;
+  while (pos < delta_len) {
+    char op = delta[pos++];
+    if (delta_len - pos < 4) {
+      return -1;
+    }
+    uint32_t arg = getUint32(delta + pos);
+    pos += 4;
+    if (op == DELTA_OP_COPY) {
+      long off = (long)arg * block_size;
+      if (off >= base_size) {
+        return -1;
+      }
+      total += std::min((long)block_size, base_size - off);
+    } else if (op == DELTA_OP_LITERAL) {
+      if (delta_len - pos < arg) {
+        return -1;
+      }
+      pos += arg;
+      total += arg;
+    } else {
+      return -1;
+    }
+  }
+  return total;
+}
+
+/**
+ * @brief  根据旧版本文件和差量指令流重建新文件
+ *
+ * @param base_path  旧版本文件路径
+ * @param block_size 分块大小
+ * @param delta      差量指令流
+ * @param delta_len  差量指令流长度
+ * @param out_path   重建的新文件路径
+ * @param p_size     (out) 新文件大小
+ *
+ * @return 0 成功，-1 失败
+ */
+int applyDelta(const char *base_path, int block_size, const char *delta,
+               size_t delta_len, const char *out_path, long *p_size) {
+  int ret = 0;
+  int base_fd = -1;
+  int out_fd = -1;
+  long total = 0;
+  size_t pos = 0;
+  vector<char> buf(block_size);
+
+  base_fd = open(base_path, O_RDONLY);
+  if (base_fd < 0) {
+    LOG_ERROR(DELTA_LOG_MODULE, DELTA_LOG_PROC, "open %s error\n", base_path);
+    return -1;
+  }
+  out_fd = open(out_path, O_CREAT | O_WRONLY | O_TRUNC, 0644);
+  if (out_fd < 0) {
+    LOG_ERROR(DELTA_LOG_MODULE, DELTA_LOG_PROC, "open %s error\n", out_path);
+    close(base_fd);
+    return -1;
+  }
+
+  while (pos < delta_len) {
+    char op = delta[pos++];
+    if (delta_len - pos < 4) {
+      LOG_ERROR(DELTA_LOG_MODULE, DELTA_LOG_PROC, "truncated delta op\n");
+      ret = -1;
+      break;
+    }
+    uint32_t arg = getUint32(delta + pos);
+    pos += 4;
+
+    if (op == DELTA_OP_COPY) {
+      ssize_t n = pread(base_fd, buf.data(), block_size,
+                        (off_t)arg * block_size);
+      if (n <= 0 || writeAll(out_fd, buf.data(), n) != 0) {
+        LOG_ERROR(DELTA_LOG_MODULE, DELTA_LOG_PROC,
+                  "copy block %u failed\n", arg);
+        ret = -1;
+        break;
+      }
+      total += n;
+    } else if (op == DELTA_OP_LITERAL) {
+      if (delta_len - pos < arg) {
+        LOG_ERROR(DELTA_LOG_MODULE, DELTA_LOG_PROC, "truncated literal\n");
+        ret = -1;
+        break;
+      }
+      if (writeAll(out_fd, delta + pos, arg) != 0) {
+        LOG_ERROR(DELTA_LOG_MODULE, DELTA_LOG_PROC, "write %s error\n",
+                  out_path);
+        ret = -1;
+        break;
+      }
+      pos += arg;
+      total += arg;
+    } else {
+      LOG_ERROR(DELTA_LOG_MODULE, DELTA_LOG_PROC, "unknown delta op %d\n",
+                op);
+      ret = -1;
+      break;
+    }
+  }
+
+  close(base_fd);
+  close(out_fd);
+  if (ret != 0) {
+    unlink(out_path);
+    return ret;
+  }
+
+  if (p_size != nullptr) {
+    *p_size = total;
+  }
+  return 0;
+}
+
+/**
+ * @brief  计算文件的md5
+ *
+ * @param path    文件路径
+ * @param md5_hex (out) 32位十六进制md5，至少33字节
+ *
+ * @return 0 成功，-1 失败
+ */
+int md5File(const char *path, char *md5_hex) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    LOG_ERROR(DELTA_LOG_MODULE, DELTA_LOG_PROC, "open %s error\n", path);
+    return -1;
+  }
+
+  MD5_CTX ctx;
+  my_md5_init(&ctx);
+  unsigned char buf[64 * 1024];
+  ssize_t n;
+  while ((n = read(fd, buf, sizeof(buf))) != 0) {
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      close(fd);
+      return -1;
+    }
+    my_md5_update(&ctx, buf, (unsigned int)n);
+  }
+  close(fd);
+
+  unsigned char digest[16];
+  my_md5_final(digest, &ctx);
+  for (int i = 0; i < 16; i++) {
+    sprintf(md5_hex + i * 2, "%02x", digest[i]);
+  }
+  md5_hex[32] = '\0';
+  return 0;
+}
@@ -0,0 +1,58 @@
+#ifndef DELTA_UTIL_H
+#define DELTA_UTIL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+const char *const DELTA_LOG_MODULE = "cgi";
+const char *const DELTA_LOG_PROC = "delta";
+
+// 分块大小的上下限
+const int DELTA_MIN_BLOCK_SIZE = 2048;
+const int DELTA_MAX_BLOCK_SIZE = 128 * 1024;
+
+// 差量指令：引用旧版本的一个分块 / 携带一段新数据
+const char DELTA_OP_COPY = 'C';     // 'C' + 4字节块号(大端)
+const char DELTA_OP_LITERAL = 'L';  // 'L' + 4字节长度(大端) + 数据
+
+// 单个分块的签名：弱校验和(可滚动) + 强校验和(md5)
+struct BlockSignature {
+  uint32_t weak;
+  unsigned char strong[16];
+};
+
+// 计算一个分块的弱校验和(rsync滚动校验和)
+uint32_t weakChecksum(const unsigned char *buf, size_t len);
+
+// 窗口向后滑动一个字节，更新弱校验和
+uint32_t rollWeakChecksum(uint32_t sum, size_t block_len, unsigned char out,
+                          unsigned char in);
+
+// 根据文件大小选择分块大小
+int chooseBlockSize(long file_size);
+
+// 计算文件每个分块的签名
+int computeSignatures(const char *path, int block_size,
+                      vector<BlockSignature> &sigs);
+
+// 根据旧版本的签名，生成新文件的差量指令流
+int generateDelta(const vector<BlockSignature> &sigs, int block_size,
+                  const char *new_path, string &delta);
+
+// 不重建文件，只按指令流算出新文件的大小，指令流不合法时返回-1
+long deltaOutputSize(long base_size, int block_size, const char *delta,
+                     size_t delta_len);
+
+// 根据旧版本文件和差量指令流，重建新文件
+int applyDelta(const char *base_path, int block_size, const char *delta,
+               size_t delta_len, const char *out_path, long *p_size);
+
+// 计算文件的md5，以32位十六进制字符串输出
+int md5File(const char *path, char *md5_hex);
+
+#endif
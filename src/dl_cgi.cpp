@@ -0,0 +1,770 @@
+/**
+ * @file dl_cgi.cpp
+ * @brief 下载的cgi程序：验证权限后用X-Accel-Redirect交给nginx发送文件
+ * @author ward
+ * @version 1.0
+ * @date 2023年6月28日
+ */
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "admission_util.h"
+#include "backend_util.h"
+#include "cache_util.h"
+#include "cgi_server.h"
+#include "cgi_util.h"
+#include "compress_util.h"
+#include "json_util.h"
+#include "link_util.h"
+#include "make_log.h"
+#include "pv_util.h"
+#include "range_util.h"
+#include "response_util.h"
+#include "zip_util.h"
+
+using namespace std;
+
+/*
+   GET /dl?user=xxx&token=xxx&md5=xxx&filename=xxx[&owner=xxx]
+   user/token也可以放在X-User/X-Token请求头中。
+   owner为文件的主人，默认是user自己；下载别人的文件时该文件需已共享。
+
+   权限和文件位置按(owner, md5, filename)在进程内缓存cache_ttl_s秒，
+   命中时一次下载只有token验证和一次内存查找。响应只有响应头：
+   X-Accel-Redirect指向nginx的internal location，由nginx用sendfile发送，
+   文件内容不经过cgi。zstd压缩存储的文件在客户端接受zstd时原样发送，
+   nginx按X-File-Encoding加上Content-Encoding。
+
+   Range/If-Range/多段请求：交给nginx的文件由nginx的static模块处理
+   (Accept-Ranges、206、multipart/byteranges)，客户端可以多连接分段并行下载、
+   断点续传，每一段只是一次普通的下载请求。
+
+   nginx不能从打包容器(pack_util.h)的中间开始发送，也不能解压，所以打包的小文件
+   和客户端不接受zstd的压缩文件仍由cgi取到本地后发送，Range在cgi中处理
+   (range_util.h)：打包的文件只从容器中取出请求的段覆盖的部分，ETag为md5。
+
+   本机开了磁盘缓存(cache_util.h)时先查缓存：缓存里是解码后的原始内容，
+   命中的文件(包括打包和压缩的)都由nginx从缓存目录发送，Range也由nginx处理；
+   没有命中但访问够频繁的文件取入缓存后同样交给nginx。
+   客户端接受zstd的压缩文件仍直接从storage发送压缩的内容，不经过缓存。
+
+   location /dl_internal/group1/M00/ {
+       internal;
+       alias /home/ward/fastdfs/storage/data/;
+       sendfile on;
+       add_header Content-Encoding $upstream_http_x_file_encoding;
+   }
+
+   POST /dl?cmd=zip 把自己的多个文件打包成一个zip下载
+   {"user":"mike","token":"xxx","name":"photos.zip",
+    "files":[{"md5":"xxx","filename":"a.jpg"}, ...]}
+   所有文件的权限和位置先查好，有不存在的返回404；之后边从storage取边生成
+   ZIP64归档(zip_util.h)发送，不落临时文件，内存占用与总大小无关。
+   响应头先发出去，X-Accel-Buffering: no 让nginx不缓冲整个响应。
+   zip_deflate_types中的类型和压缩存储的文件用deflate压缩，其余原样存储；
+   全部原样存储时可以预先算出Content-Length。
+   发送中途storage出错时只能中断连接(abortCgiResponse)：不发END_REQUEST就断开，
+   nginx随即中断与客户端的连接，客户端不会把截断的归档当作下载完成。
+
+   GET /dl?link=<code> 用分享短链接下载(link_util.h)，不需要登录；
+   不存在、过期和次数用完都返回404。发送方式与上面相同，
+   从头开始的请求计一次链接点击和一次文件下载量。
+
+   "dl": {"internal_location": "/dl_internal/", "cache_ttl_s": 10,
+          "cache_size": 10000, "pv_flush_s": 5, "zip_max_files": 1000,
+          "zip_level": 6, "zip_deflate_types":
+          "txt,log,csv,json,xml,html,htm,md,js,css,sql,svg"}
+*/
+
+const char *const DL_LOG_MODULE = "cgi";
+const char *const DL_LOG_PROC = "dl";
+
+// 下载配置
+struct DlConfig {
+  string internal_location = "/dl_internal/";  // nginx的internal location
+  int cache_ttl_s = 10;      // 文件位置的缓存时间，0为不缓存
+  size_t cache_size = 10000; // 缓存的最大条数
+  int pv_flush_s = 5;        // 下载量的推送间隔(pv_util.h)
+  int zip_max_files = 1000;  // 打包下载最多的文件数
+  int zip_level = 6;         // deflate压缩级别
+  // 打包时用deflate压缩的文件类型
+  string zip_deflate_types =
+      "txt,log,csv,json,xml,html,htm,md,js,css,sql,svg";
+};
+
+// 打包下载请求体的最大长度
+const int ZIP_BODY_MAX = 256 * 1024;
+
+static DlConfig dl_cfg;
+
+// 文件位置的进程内缓存，过期或满了整体清理
+class LocationCache {
+ public:
+  bool get(const string &key, FileLocation *loc) {
+    lock_guard<mutex> lock(mutex_);
+    auto it = map_.find(key);
+    if (it == map_.end() || it->second.expire < time(nullptr)) {
+      return false;
+    }
+    *loc = it->second.loc;
+    return true;
+  }
+
+  void put(const string &key, const FileLocation &loc) {
+    if (dl_cfg.cache_ttl_s <= 0) {
+      return;
+    }
+    time_t now = time(nullptr);
+    lock_guard<mutex> lock(mutex_);
+    if (map_.size() >= dl_cfg.cache_size) {
+      for (auto it = map_.begin(); it != map_.end();) {
+        it = it->second.expire < now ? map_.erase(it) : next(it);
+      }
+      if (map_.size() >= dl_cfg.cache_size) {
+        map_.clear();
+      }
+    }
+    map_[key] = Entry{loc, now + dl_cfg.cache_ttl_s};
+  }
+
+ private:
+  struct Entry {
+    FileLocation loc;
+    time_t expire;
+  };
+  mutex mutex_;
+  unordered_map<string, Entry> map_;
+};
+
+static LocationCache location_cache;
+static atomic<unsigned long> tmp_seq{0};
+
+// 后台定时任务：到了推送间隔时推送下载量和链接点击量，退出时全部推送；
+// 到了间隔时校正本地缓存的索引
+static void dlTimer(CgiContext *ctx, bool final) {
+  pvFlush(ctx->meta, ctx->redis, final, ctx->shares);
+  linkFlush(ctx->meta, ctx->redis, final);
+  if (!final) {
+    cacheMaintain();
+  }
+}
+
+// 从cfg.json读取下载配置
+int dlInit() {
+  dl_cfg = DlConfig();
+  string value;
+  if (getCfgValue(CFG_PATH, "dl", "internal_location", value) == 0 &&
+      !value.empty()) {
+    dl_cfg.internal_location = value;
+    if (value.back() != '/') {
+      dl_cfg.internal_location += '/';
+    }
+  }
+  if (getCfgValue(CFG_PATH, "dl", "cache_ttl_s", value) == 0) {
+    dl_cfg.cache_ttl_s = atoi(value.c_str());
+  }
+  if (getCfgValue(CFG_PATH, "dl", "cache_size", value) == 0 &&
+      atol(value.c_str()) > 0) {
+    dl_cfg.cache_size = atol(value.c_str());
+  }
+  if (getCfgValue(CFG_PATH, "dl", "pv_flush_s", value) == 0) {
+    dl_cfg.pv_flush_s = atoi(value.c_str());
+  }
+  if (getCfgValue(CFG_PATH, "dl", "zip_max_files", value) == 0 &&
+      atoi(value.c_str()) > 0) {
+    dl_cfg.zip_max_files = atoi(value.c_str());
+  }
+  if (getCfgValue(CFG_PATH, "dl", "zip_level", value) == 0) {
+    dl_cfg.zip_level = atoi(value.c_str());
+  }
+  if (getCfgValue(CFG_PATH, "dl", "zip_deflate_types", value) == 0) {
+    dl_cfg.zip_deflate_types = value;
+  }
+  pvInit(dl_cfg.pv_flush_s);
+  cacheInit(cacheConfig());
+  linkInit(linkConfig());
+  addCgiTimer(dlTimer, 1);
+  LOG_INFO(DL_LOG_MODULE, DL_LOG_PROC,
+           "internal_location = %s, cache_ttl_s = %d, pv_flush_s = %d\n",
+           dl_cfg.internal_location.c_str(), dl_cfg.cache_ttl_s,
+           dl_cfg.pv_flush_s);
+  return 0;
+}
+
+// 复制参数并以'\0'结尾，为空或放不下时返回false
+static bool copyParam(string_view value, char *dst, size_t size) {
+  if (value.empty() || value.size() >= size) {
+    return false;
+  }
+  memcpy(dst, value.data(), value.size());
+  dst[value.size()] = '\0';
+  return true;
+}
+
+// Content-Disposition中的文件名，按RFC 5987百分号编码
+static string dispositionHeader(const char *filename) {
+  static const char hex[] = "0123456789ABCDEF";
+  string header = "Content-Disposition: attachment; filename*=UTF-8''";
+  for (const unsigned char *p = (const unsigned char *)filename; *p; p++) {
+    if (isalnum(*p) || strchr("!#$&+-.^_`|~", *p) != nullptr) {
+      header += (char)*p;
+    } else {
+      header += '%';
+      header += hex[*p >> 4];
+      header += hex[*p & 0xf];
+    }
+  }
+  header += "\r\n";
+  return header;
+}
+
+/**
+ * @brief 交给nginx发送：响应只有响应头
+ *
+ * @param uri      nginx的internal uri
+ * @param filename 文件名
+ * @param encoding 文件的编码，为空时是原始内容
+ */
+static void sendRedirect(const string &uri, const char *filename,
+                         const string &encoding) {
+  string header = "X-Accel-Redirect: " + uri + "\r\n";
+  if (!encoding.empty()) {
+    header += "X-File-Encoding: " + encoding + "\r\n";
+  }
+  header += "Content-Type: application/octet-stream\r\n";
+  header += dispositionHeader(filename);
+  header += "\r\n";
+  FCGX_PutStr(header.data(), (int)header.size(), request.out);
+}
+
+// 从fd的off处发送len字节，失败返回false
+static bool sendFileRange(int fd, off_t off, long len) {
+  char buf[64 * 1024];
+  while (len > 0) {
+    ssize_t n = pread(fd, buf, len < (long)sizeof(buf) ? len : sizeof(buf),
+                      off);
+    if (n <= 0 || FCGX_PutStr(buf, (int)n, request.out) != n) {
+      return false;
+    }
+    off += n;
+    len -= n;
+  }
+  return true;
+}
+
+/**
+ * @brief 取出文件的原始内容：打包的只取容器中的一段，压缩的解压
+ *
+ * @return 0成功，-1失败
+ */
+static int fetchOriginal(BlobStore *blobs, const FileLocation *loc,
+                         const char *path) {
+  bool compressed = loc->codec == CODEC_ZSTD;
+  char stored[64];
+  snprintf(stored, sizeof(stored), "dl_%d_%lu.stored", (int)getpid(),
+           tmp_seq.fetch_add(1));
+  const char *dst = compressed ? stored : path;
+  if (blobs->download(loc->fileid.c_str(), loc->pack_offset, loc->pack_length,
+                      dst) != 0) {
+    LOG_ERROR(DL_LOG_MODULE, DL_LOG_PROC, "download %s failed\n",
+              loc->fileid.c_str());
+    unlink(dst);
+    return -1;
+  }
+  if (compressed) {
+    int ret = decompressFile(stored, path);
+    unlink(stored);
+    return ret == 0 ? 0 : -1;
+  }
+  return 0;
+}
+
+/**
+ * @brief 查本机的磁盘缓存，没有命中且接纳时取入
+ *
+ * @param cached (out) 命中时为缓存文件名
+ */
+static CacheResult cacheLookup(BlobStore *blobs, const FileLocation *loc,
+                               const char *md5, string *cached) {
+  if (!cacheEnabled()) {
+    return CACHE_BYPASS;
+  }
+  // 同一个容器中的文件由位置区分
+  string key = loc->fileid;
+  if (loc->pack_offset >= 0) {
+    key += "@" + to_string(loc->pack_offset);
+  }
+  string path;
+  CacheResult ret = cacheGet(
+      key, loc->size, md5,
+      [blobs, loc](const char *dst) { return fetchOriginal(blobs, loc, dst); },
+      &path);
+  if (ret == CACHE_HIT) {
+    *cached = cacheName(key);
+  }
+  return ret;
+}
+
+/**
+ * @brief nginx发送不了的文件：取到本地、解码后由cgi发送，支持Range
+ *        打包的文件只从容器中取出请求的段覆盖的部分，压缩的文件需整个解压
+ *
+ * @param blobs    文件内容
+ * @param loc      文件位置
+ * @param filename 文件名
+ * @param etag     ETag，If-Range与它比较
+ *
+ * @return 0成功，-1失败(还没有写出任何响应)
+ */
+static int sendLocal(BlobStore *blobs, const FileLocation *loc,
+                     const char *filename, const string &etag) {
+  const long size = loc->size;
+  vector<ByteRange> ranges;
+  RangeResult rr =
+      parseRange(FCGX_GetParam("HTTP_RANGE", request.envp),
+                 FCGX_GetParam("HTTP_IF_RANGE", request.envp), etag, size,
+                 &ranges);
+  if (rr == RANGE_UNSATISFIABLE) {
+    string header = "Status: 416 Range Not Satisfiable\r\nContent-Range: "
+                    "bytes */" +
+                    to_string(size) + "\r\n\r\n";
+    FCGX_PutStr(header.data(), (int)header.size(), request.out);
+    return 0;
+  }
+  if (rr == RANGE_NONE) {
+    ranges.assign(1, ByteRange{0, size - 1});
+  }
+
+  char local[64];
+  unsigned long seq = tmp_seq.fetch_add(1);
+  snprintf(local, sizeof(local), "dl_%d_%lu.tmp", (int)getpid(), seq);
+
+  // 本地文件从文件中的base处开始
+  FileLocation span = *loc;
+  long base = 0;
+  if (loc->codec != CODEC_ZSTD && loc->pack_offset >= 0 && size > 0) {
+    base = ranges.front().start;
+    span.pack_offset += base;
+    span.pack_length = ranges.back().end + 1 - base;
+  }
+  if (fetchOriginal(blobs, &span, local) != 0) {
+    return -1;
+  }
+
+  int fd = open(local, O_RDONLY);
+  unlink(local);
+  if (fd < 0) {
+    return -1;
+  }
+
+  string header = "Accept-Ranges: bytes\r\nETag: " + etag + "\r\n" +
+                  dispositionHeader(filename);
+  bool ok = true;
+  if (rr == RANGE_NONE || ranges.size() == 1) {
+    const ByteRange &r = ranges.front();
+    if (rr == RANGE_OK) {
+      header = "Status: 206 Partial Content\r\nContent-Range: " +
+               contentRange(r, size) + "\r\n" + header;
+    }
+    header += "Content-Type: application/octet-stream\r\nContent-Length: " +
+              to_string(size > 0 ? r.length() : 0) + "\r\n\r\n";
+    FCGX_PutStr(header.data(), (int)header.size(), request.out);
+    ok = size == 0 || sendFileRange(fd, r.start - base, r.length());
+  } else {
+    // 多段：multipart/byteranges，先算出总长度
+    char boundary[40];
+    snprintf(boundary, sizeof(boundary), "filehub_%d_%lu", (int)getpid(),
+             seq);
+    vector<string> part_headers;
+    long total = 0;
+    for (const ByteRange &r : ranges) {
+      part_headers.push_back(string("\r\n--") + boundary +
+                             "\r\nContent-Type: application/octet-stream"
+                             "\r\nContent-Range: " +
+                             contentRange(r, size) + "\r\n\r\n");
+      total += part_headers.back().size() + r.length();
+    }
+    string tail = string("\r\n--") + boundary + "--\r\n";
+    total += tail.size();
+    header = "Status: 206 Partial Content\r\n" + header +
+             "Content-Type: multipart/byteranges; boundary=" + boundary +
+             "\r\nContent-Length: " + to_string(total) + "\r\n\r\n";
+    FCGX_PutStr(header.data(), (int)header.size(), request.out);
+    for (size_t i = 0; i < ranges.size() && ok; i++) {
+      FCGX_PutStr(part_headers[i].data(), (int)part_headers[i].size(),
+                  request.out);
+      ok = sendFileRange(fd, ranges[i].start - base, ranges[i].length());
+    }
+    FCGX_PutStr(tail.data(), (int)tail.size(), request.out);
+  }
+  close(fd);
+  if (!ok) {
+    LOG_ERROR(DL_LOG_MODULE, DL_LOG_PROC, "send %s failed\n", filename);
+  }
+  return 0;
+}
+
+// 文件位置，先查进程内缓存；0找到，1不存在，-1出错
+static int findLocation(MetaStore *meta, const char *owner, const char *md5,
+                        const char *filename, FileLocation *loc) {
+  string key = string(owner) + '\n' + md5 + '\n' + filename;
+  if (location_cache.get(key, loc)) {
+    return 0;
+  }
+  int ret = meta->fileLocation(owner, md5, filename, loc);
+  if (ret == 0) {
+    location_cache.put(key, *loc);
+  }
+  return ret;
+}
+
+// 打包下载的一个文件
+struct ZipItem {
+  string md5;
+  string filename;
+  string name;  // 归档中的文件名，重名的加上序号
+  FileLocation loc;
+};
+
+// 重名的文件改为"a (1).txt"
+static string uniqueName(const string &filename,
+                         unordered_set<string> *used) {
+  string name = filename;
+  size_t dot = filename.rfind('.');
+  if (dot == 0 || dot == string::npos) {
+    dot = filename.size();
+  }
+  for (int i = 1; !used->insert(name).second; i++) {
+    name = filename.substr(0, dot) + " (" + to_string(i) + ")" +
+           filename.substr(dot);
+  }
+  return name;
+}
+
+/**
+ * @brief 读取并解析打包下载的请求体
+ *
+ * @return 0成功，-1格式错误
+ */
+static int readZipRequest(char *user, char *token, string *name,
+                          vector<ZipItem> *items) {
+  const char *content_length = FCGX_GetParam("CONTENT_LENGTH", request.envp);
+  int len = content_length == nullptr ? 0 : atoi(content_length);
+  if (len <= 0 || len > ZIP_BODY_MAX) {
+    LOG_ERROR(DL_LOG_MODULE, DL_LOG_PROC, "zip body len = %d\n", len);
+    return -1;
+  }
+  vector<char> buf(len + 1);
+  if (FCGX_GetStr(buf.data(), len, request.in) != len) {
+    return -1;
+  }
+  buf[len] = '\0';
+
+  JsonPool &pool = jsonArena();
+  PoolDocument doc(&pool, 1024, &pool);
+  doc.ParseInsitu(buf.data());
+  if (doc.HasParseError() || !doc.IsObject()) {
+    LOG_ERROR(DL_LOG_MODULE, DL_LOG_PROC, "zip json parse err, offset %zu\n",
+              doc.GetErrorOffset());
+    return -1;
+  }
+  auto str = [&doc](const char *key, char *dst, size_t size) {
+    auto it = doc.FindMember(key);
+    return it != doc.MemberEnd() && it->value.IsString() &&
+           copyParam(string_view(it->value.GetString(),
+                                 it->value.GetStringLength()),
+                     dst, size);
+  };
+  auto files = doc.FindMember("files");
+  if (!str("user", user, USER_NAME_LEN) || !str("token", token, TOKEN_LEN) ||
+      files == doc.MemberEnd() || !files->value.IsArray() ||
+      files->value.Size() == 0 ||
+      (int)files->value.Size() > dl_cfg.zip_max_files) {
+    return -1;
+  }
+  char zip_name[FILE_NAME_LEN] = {0};
+  *name = str("name", zip_name, sizeof(zip_name)) ? zip_name : "files.zip";
+
+  unordered_set<string> used;
+  for (auto f = files->value.Begin(); f != files->value.End(); ++f) {
+    if (!f->IsObject()) return -1;
+    auto md5 = f->FindMember("md5");
+    auto filename = f->FindMember("filename");
+    if (md5 == f->MemberEnd() || !md5->value.IsString() ||
+        md5->value.GetStringLength() == 0 ||
+        md5->value.GetStringLength() >= (size_t)MD5_LEN ||
+        filename == f->MemberEnd() || !filename->value.IsString() ||
+        filename->value.GetStringLength() == 0 ||
+        filename->value.GetStringLength() >= (size_t)FILE_NAME_LEN) {
+      return -1;
+    }
+    ZipItem item;
+    item.md5 = md5->value.GetString();
+    item.filename = filename->value.GetString();
+    item.name = uniqueName(item.filename, &used);
+    items->push_back(std::move(item));
+  }
+  return 0;
+}
+
+// 打包下载：验证并查好所有文件后边取边生成zip发送
+static void zipHandler(CgiContext *ctx) {
+  char user[USER_NAME_LEN] = {0};
+  char token[TOKEN_LEN] = {0};
+  string zip_name;
+  vector<ZipItem> items;
+  if (readZipRequest(user, token, &zip_name, &items) != 0) {
+    writeStatus(request.out, "016");
+    return;
+  }
+  if (!ctx->tokens->validate(user, token)) {
+    LOG_ERROR(DL_LOG_MODULE, DL_LOG_PROC, "%s token验证失败\n", user);
+    writeStatus(request.out, "111");
+    return;
+  }
+
+  // 只能打包自己的文件；先全部查好，开始发送后就不能再返回错误码了
+  bool all_stored = true;
+  vector<ZipStoredEntry> stored;
+  vector<bool> deflate(items.size());
+  for (size_t i = 0; i < items.size(); i++) {
+    ZipItem &item = items[i];
+    int ret = findLocation(ctx->meta, user, item.md5.c_str(),
+                           item.filename.c_str(), &item.loc);
+    if (ret < 0) {
+      writeStatus(request.out, "016");
+      return;
+    }
+    if (ret == 1) {
+      writeNotFound(request.out);
+      return;
+    }
+    const char *dot = strrchr(item.filename.c_str(), '.');
+    deflate[i] = item.loc.codec == CODEC_ZSTD ||
+                 (dot != nullptr &&
+                  suffixInTypes(dl_cfg.zip_deflate_types, dot + 1));
+    all_stored = all_stored && !deflate[i];
+    stored.push_back(ZipStoredEntry{item.name, (uint64_t)item.loc.size});
+  }
+
+  string header = "Content-Type: application/zip\r\n"
+                  "X-Accel-Buffering: no\r\n" +
+                  dispositionHeader(zip_name.c_str());
+  if (all_stored) {
+    header += "Content-Length: " + to_string(ZipWriter::storedSize(stored)) +
+              "\r\n";
+  }
+  header += "\r\n";
+  FCGX_PutStr(header.data(), (int)header.size(), request.out);
+  FCGX_FFlush(request.out);
+
+  ZipWriter zip(
+      [](const char *data, size_t len) {
+        return FCGX_PutStr(data, (int)len, request.out) == (int)len ? 0 : -1;
+      },
+      dl_cfg.zip_level);
+  DataSink to_zip = [&zip](const char *data, size_t len) {
+    return zip.write(data, len);
+  };
+  time_t now = time(nullptr);
+  for (size_t i = 0; i < items.size(); i++) {
+    const ZipItem &item = items[i];
+    const FileLocation &loc = item.loc;
+    int ret = zip.begin(item.name, deflate[i], loc.size, now);
+    if (ret == 0 && loc.codec == CODEC_ZSTD) {
+      ZstdStreamDecoder decoder;
+      ret = ctx->blobs->stream(
+          loc.fileid.c_str(), loc.pack_offset, loc.pack_length,
+          [&decoder, &to_zip](const char *data, size_t len) {
+            return decoder.feed(data, len, to_zip);
+          });
+      if (ret == 0) ret = decoder.finish();
+    } else if (ret == 0) {
+      ret = ctx->blobs->stream(loc.fileid.c_str(), loc.pack_offset,
+                               loc.pack_length, to_zip);
+    }
+    if (ret != 0 || zip.end() != 0) {
+      // 响应已经开始，只能中断连接，不能让客户端收到一个截断的归档
+      LOG_ERROR(DL_LOG_MODULE, DL_LOG_PROC, "%s zip %s failed\n", user,
+                item.filename.c_str());
+      abortCgiResponse();
+      return;
+    }
+    pvRecord(user, item.md5.c_str(), item.filename.c_str());
+  }
+  if (zip.finish() != 0) {
+    LOG_ERROR(DL_LOG_MODULE, DL_LOG_PROC, "%s zip finish failed\n", user);
+    abortCgiResponse();
+    return;
+  }
+  LOG_INFO(DL_LOG_MODULE, DL_LOG_PROC, "%s zip %zu files, %llu bytes\n", user,
+           items.size(), (unsigned long long)zip.written());
+}
+
+/**
+ * @brief 发送一个文件：能交给nginx的只发响应头，其余由cgi取到本地后发送
+ *
+ * @return 0成功，-1失败(还没有写响应)
+ */
+static int sendFile(CgiContext *ctx, FileLocation *loc, const char *md5,
+                    const char *filename, const string &etag) {
+  const char *accept = FCGX_GetParam("HTTP_ACCEPT_ENCODING", request.envp);
+  bool plain = loc->codec.empty() || loc->codec == CODEC_NONE;
+  bool encoded = !plain && acceptsEncoding(accept, loc->codec.c_str());
+  string cached;
+  if (loc->pack_offset < 0 && encoded) {
+    sendRedirect(dl_cfg.internal_location + loc->fileid, filename,
+                 loc->codec);
+  } else if (cacheLookup(ctx->blobs, loc, md5, &cached) == CACHE_HIT) {
+    sendRedirect(cacheLocation() + cached, filename, "");
+  } else if (loc->pack_offset < 0 && plain) {
+    sendRedirect(dl_cfg.internal_location + loc->fileid, filename, "");
+  } else if (sendLocal(ctx->blobs, loc, filename, etag) != 0) {
+    return -1;
+  }
+  return 0;
+}
+
+// 分段并行下载和续传时每一段都是一个请求，只有从头开始的请求计一次下载
+static bool countsAsDownload(const string &etag, long size) {
+  vector<ByteRange> ranges;
+  RangeResult rr =
+      parseRange(FCGX_GetParam("HTTP_RANGE", request.envp),
+                 FCGX_GetParam("HTTP_IF_RANGE", request.envp), etag, size,
+                 &ranges);
+  return rr == RANGE_NONE || (rr == RANGE_OK && ranges.front().start == 0);
+}
+
+// 分享链接的下载：不需要登录，不区分不存在、过期和次数用完
+static void linkDownload(CgiContext *ctx) {
+  char code[LINK_CODE_LEN + 1] = {0};
+  if (!copyParam(ctx->query->get("link"), code, sizeof(code))) {
+    writeNotFound(request.out);
+    return;
+  }
+  ShareLink link;
+  int ret = linkResolve(ctx->meta, ctx->redis, code, &link);
+  if (ret < 0) {
+    writeStatus(request.out, "016");
+    return;
+  }
+  FileLocation loc;
+  if (ret == 0) {
+    ret = findLocation(ctx->meta, link.user.c_str(), link.md5.c_str(),
+                       link.filename.c_str(), &loc);
+  }
+  if (ret < 0) {
+    writeStatus(request.out, "016");
+    return;
+  }
+  const string etag = "\"" + link.md5 + "\"";
+  // 每个请求都检查次数，只有从头开始的计数
+  bool counted = ret == 0 && countsAsDownload(etag, loc.size);
+  if (ret == 1 || linkHit(ctx->redis, link, counted) != 0) {
+    writeNotFound(request.out);
+    return;
+  }
+  if (sendFile(ctx, &loc, link.md5.c_str(), link.filename.c_str(), etag) !=
+      0) {
+    writeStatus(request.out, "016");
+    return;
+  }
+  LOG_INFO(DL_LOG_MODULE, DL_LOG_PROC, "link %s download %s/%s\n", code,
+           link.user.c_str(), link.filename.c_str());
+  if (counted) {
+    pvRecord(link.user.c_str(), link.md5.c_str(), link.filename.c_str());
+  }
+}
+
+// 处理一个下载请求
+void dlHandler(CgiContext *ctx) {
+  char cmd[16] = {0};
+  ctx->query->copy("cmd", cmd, sizeof(cmd));
+  if (strcmp(cmd, "zip") == 0) {
+    zipHandler(ctx);
+    return;
+  }
+  if (ctx->query->has("link")) {
+    linkDownload(ctx);
+    return;
+  }
+  char user[USER_NAME_LEN] = {0};
+  char token[TOKEN_LEN] = {0};
+  char owner[USER_NAME_LEN] = {0};
+  char md5[MD5_LEN] = {0};
+  char filename[FILE_NAME_LEN] = {0};
+
+  string_view user_view, token_view;
+  const char *header_user = FCGX_GetParam("HTTP_X_USER", request.envp);
+  const char *header_token = FCGX_GetParam("HTTP_X_TOKEN", request.envp);
+  admissionCredentials(*ctx->query, header_user ? header_user : "",
+                       header_token ? header_token : "", &user_view,
+                       &token_view);
+  if (!copyParam(user_view, user, sizeof(user)) ||
+      !copyParam(token_view, token, sizeof(token)) ||
+      !copyParam(ctx->query->get("md5"), md5, sizeof(md5)) ||
+      !copyParam(ctx->query->get("filename"), filename, sizeof(filename))) {
+    writeStatus(request.out, "016");
+    return;
+  }
+  if (!copyParam(ctx->query->get("owner"), owner, sizeof(owner))) {
+    strcpy(owner, user);
+  }
+
+  if (!ctx->tokens->validate(user, token)) {
+    LOG_ERROR(DL_LOG_MODULE, DL_LOG_PROC, "%s token验证失败\n", user);
+    writeStatus(request.out, "111");
+    return;
+  }
+
+  FileLocation loc;
+  int ret = findLocation(ctx->meta, owner, md5, filename, &loc);
+  if (ret < 0) {
+    writeStatus(request.out, "016");
+    return;
+  }
+  if (ret == 1) {
+    writeNotFound(request.out);
+    return;
+  }
+  // 别人的文件只能下载已共享的，不区分不存在和没有权限
+  if (strcmp(owner, user) != 0 && !loc.shared) {
+    writeNotFound(request.out);
+    return;
+  }
+
+  // 内容由md5决定，md5就是强ETag
+  const string etag = string("\"") + md5 + "\"";
+  if (sendFile(ctx, &loc, md5, filename, etag) != 0) {
+    writeStatus(request.out, "016");
+    return;
+  }
+  LOG_INFO(DL_LOG_MODULE, DL_LOG_PROC, "%s download %s/%s\n", user, owner,
+           filename);
+
+  // 下载量记在文件主人的文件上
+  if (countsAsDownload(etag, loc.size)) {
+    pvRecord(owner, md5, filename);
+  }
+}
+
+
+#ifndef CGI_GATEWAY
+int main() {
+  const CgiRoute route = {"/dl", nullptr, dlHandler, dlInit};
+  return runCgi(&route, 1);
+}
+#endif
@@ -0,0 +1,577 @@
+/**
+ * @file fake_util.cpp
+ * @brief 内存中的元数据、token、文件内容和FastCGI请求，处理函数脱离服务单独运行
+ * @author ward
+ * @version 1.0
+ * @date 2023年6月24日
+ */
+
+#include "fake_util.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#include "cgi_util.h"
+#include "compress_util.h"
+
+//==================== 元数据 ====================
+
+// 结果集，各字段的字符串归自己所有
+class FakeRows : public MetaRows {
+ public:
+  void add(const std::vector<std::string> &fields) {
+    fields_.insert(fields_.end(), fields.begin(), fields.end());
+  }
+
+  // 字段全部加入后生成每行的指针数组
+  void finish() {
+    ptrs_.resize(fields_.size());
+    for (size_t i = 0; i < fields_.size(); i++) {
+      ptrs_[i] = fields_[i].data();
+    }
+  }
+
+  size_t size() const override { return fields_.size() / FILE_ROW_FIELDS; }
+
+  char **next() override {
+    if (pos_ >= ptrs_.size()) {
+      return nullptr;
+    }
+    char **row = ptrs_.data() + pos_;
+    pos_ += FILE_ROW_FIELDS;
+    return row;
+  }
+
+ private:
+  std::vector<std::string> fields_;
+  std::vector<char *> ptrs_;
+  size_t pos_ = 0;
+};
+
+int FakeMetaStore::fileRefCount(const char *md5, int *count) {
+  if (fail_) return -1;
+  auto it = files_.find(md5);
+  if (it == files_.end()) {
+    return 1;
+  }
+  *count = it->second.count;
+  return 0;
+}
+
+long FakeMetaStore::fileSize(const char *md5) {
+  auto it = files_.find(md5);
+  return fail_ || it == files_.end() ? -1 : it->second.size;
+}
+
+int FakeMetaStore::setFileRefCount(const char *md5, int count) {
+  auto it = files_.find(md5);
+  if (fail_ || it == files_.end()) return -1;
+  it->second.count = count;
+  return 0;
+}
+
+int FakeMetaStore::addFileInfo(const char *md5, const char *fileid,
+                               const char *url, long size, const char *type) {
+  // md5是主键，重复插入失败
+  if (fail_ || files_.count(md5) != 0) return -1;
+  files_[md5] = File{fileid, url, size, type, 1};
+  return 0;
+}
+
+int FakeMetaStore::userHasFile(const char *user, const char *md5,
+                               const char *filename) {
+  if (fail_) return -1;
+  auto it = user_files_.find(user);
+  if (it == user_files_.end()) {
+    return 0;
+  }
+  for (const UserFile &f : it->second) {
+    if (f.md5 == md5 && f.filename == filename) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+int FakeMetaStore::addUserFile(const char *user, const char *md5,
+                               const char *filename,
+                               const char *create_time) {
+  if (fail_) return -1;
+  user_files_[user].push_back(UserFile{md5, filename, create_time, 0});
+  return 0;
+}
+
+int FakeMetaStore::userFileCount(const char *user, long *count) {
+  if (fail_) return -1;
+  auto it = counts_.find(user);
+  if (it == counts_.end()) {
+    return 1;
+  }
+  *count = it->second;
+  return 0;
+}
+
+int FakeMetaStore::incUserFileCount(const char *user) {
+  if (fail_) return -1;
+  counts_[user]++;
+  return 0;
+}
+
+std::unique_ptr<MetaRows> FakeMetaStore::listUserFiles(const char *cmd,
+                                                       const char *user,
+                                                       int start, int count) {
+  if (fail_) return nullptr;
+  bool by_pv = strcmp(cmd, "pvasc") == 0 || strcmp(cmd, "pvdesc") == 0;
+  if (!by_pv && strcmp(cmd, "normal") != 0) {
+    return nullptr;
+  }
+
+  std::unique_ptr<FakeRows> rows(new FakeRows);
+  auto it = user_files_.find(user);
+  if (it != user_files_.end()) {
+    // 与file_info连接，再按下载量排序，最后取一页
+    std::vector<std::pair<const UserFile *, const File *>> list;
+    for (const UserFile &f : it->second) {
+      auto file = files_.find(f.md5);
+      if (file != files_.end()) {
+        list.emplace_back(&f, &file->second);
+      }
+    }
+    if (by_pv) {
+      bool asc = strcmp(cmd, "pvasc") == 0;
+      std::stable_sort(list.begin(), list.end(),
+                       [asc](const auto &a, const auto &b) {
+                         return asc ? a.first->pv < b.first->pv
+                                    : a.first->pv > b.first->pv;
+                       });
+    }
+    for (int i = std::max(start, 0);
+         i < (int)list.size() && i < start + count; i++) {
+      const UserFile *f = list[i].first;
+      const File *file = list[i].second;
+      bool raw = file->pack_offset < 0 && file->codec == CODEC_NONE;
+      rows->add({user, f->md5, f->create_time, f->filename,
+                 f->shared ? "1" : "0", std::to_string(f->pv),
+                 raw ? file->url : "", std::to_string(file->size),
+                 file->type});
+    }
+  }
+  rows->finish();
+  return std::unique_ptr<MetaRows>(rows.release());
+}
+
+int FakeMetaStore::fileLocation(const char *user, const char *md5,
+                                const char *filename, FileLocation *loc) {
+  if (fail_) return -1;
+  if (userHasFile(user, md5, filename) != 1 || files_.count(md5) == 0) {
+    return 1;
+  }
+  const File &file = files_[md5];
+  loc->fileid = file.fileid;
+  loc->size = file.size;
+  loc->codec = file.codec;
+  loc->pack_offset = file.pack_offset;
+  loc->pack_length = file.pack_length;
+  for (const UserFile &f : user_files_[user]) {
+    if (f.md5 == md5 && f.filename == filename) {
+      loc->shared = f.shared;
+    }
+  }
+  return 0;
+}
+
+int FakeMetaStore::addFilePv(const std::vector<FilePv> &pvs) {
+  if (fail_) return -1;
+  for (const FilePv &pv : pvs) {
+    for (UserFile &f : user_files_[pv.user]) {
+      if (f.md5 == pv.md5 && f.filename == pv.filename) {
+        f.pv += pv.count;
+      }
+    }
+  }
+  return 0;
+}
+
+int FakeMetaStore::addShareLink(const ShareLink &link) {
+  if (fail_) return -1;
+  return links_.emplace(link.code, link).second ? 0 : 1;
+}
+
+int FakeMetaStore::shareLink(const char *code, ShareLink *link) {
+  if (fail_) return -1;
+  link_lookups_++;
+  auto it = links_.find(code);
+  if (it == links_.end()) {
+    return 1;
+  }
+  *link = it->second;
+  return 0;
+}
+
+int FakeMetaStore::addShareLinkHits(
+    const std::vector<std::pair<std::string, long>> &hits) {
+  if (fail_) return -1;
+  for (const auto &hit : hits) {
+    auto it = links_.find(hit.first);
+    if (it != links_.end()) {
+      it->second.hits += hit.second;
+    }
+  }
+  return 0;
+}
+
+ShareLink *FakeMetaStore::link(const char *code) {
+  auto it = links_.find(code);
+  return it == links_.end() ? nullptr : &it->second;
+}
+
+const FakeMetaStore::File *FakeMetaStore::file(const char *md5) const {
+  auto it = files_.find(md5);
+  return it == files_.end() ? nullptr : &it->second;
+}
+
+FakeMetaStore::File *FakeMetaStore::file(const char *md5) {
+  auto it = files_.find(md5);
+  return it == files_.end() ? nullptr : &it->second;
+}
+
+int FakeMetaStore::setShared(const char *user, const char *md5,
+                             const char *filename, bool shared,
+                             long share_time) {
+  if (fail_) return -1;
+  for (UserFile &f : user_files_[user]) {
+    if (f.md5 == md5 && f.filename == filename) {
+      f.shared = shared;
+      f.share_time = shared ? share_time : 0;
+      return 0;
+    }
+  }
+  return -1;
+}
+
+// 用户文件与file_info连接成共享列表的一项
+static SharedFile makeShared(const std::string &user,
+                             const FakeMetaStore::UserFile &f,
+                             const FakeMetaStore::File &file) {
+  SharedFile s;
+  s.user = user;
+  s.md5 = f.md5;
+  s.filename = f.filename;
+  s.share_time = f.shared ? f.share_time : 0;
+  s.pv = f.pv;
+  s.size = file.size;
+  s.type = file.type;
+  return s;
+}
+
+int FakeMetaStore::sharedFile(const char *user, const char *md5,
+                              const char *filename, SharedFile *file) {
+  if (fail_) return -1;
+  auto info = files_.find(md5);
+  if (info == files_.end()) {
+    return 1;
+  }
+  for (const UserFile &f : user_files_[user]) {
+    if (f.md5 == md5 && f.filename == filename) {
+      *file = makeShared(user, f, info->second);
+      return 0;
+    }
+  }
+  return 1;
+}
+
+int FakeMetaStore::sharedFiles(std::vector<SharedFile> *files) {
+  if (fail_) return -1;
+  for (const auto &kv : user_files_) {
+    for (const UserFile &f : kv.second) {
+      auto info = files_.find(f.md5);
+      if (f.shared && info != files_.end()) {
+        files->push_back(makeShared(kv.first, f, info->second));
+      }
+    }
+  }
+  return 0;
+}
+
+const std::vector<FakeMetaStore::UserFile> *FakeMetaStore::userFiles(
+    const char *user) const {
+  auto it = user_files_.find(user);
+  return it == user_files_.end() ? nullptr : &it->second;
+}
+
+//==================== token ====================
+
+bool FakeTokenStore::validate(const char *user, const char *token) {
+  auto it = tokens_.find(user);
+  return it != tokens_.end() && it->second == token;
+}
+
+//==================== 共享排行 ====================
+
+static std::string shareKey(const std::string &user, const std::string &md5,
+                            const std::string &filename) {
+  return user + '\n' + md5 + '\n' + filename;
+}
+
+int FakeShareIndex::add(const std::vector<SharedFile> &files) {
+  if (fail_) return -1;
+  for (const SharedFile &f : files) {
+    files_[shareKey(f.user, f.md5, f.filename)] = f;
+  }
+  return 0;
+}
+
+int FakeShareIndex::remove(const char *user, const char *md5,
+                           const char *filename) {
+  if (fail_) return -1;
+  files_.erase(shareKey(user, md5, filename));
+  return 0;
+}
+
+int FakeShareIndex::list(bool by_pv, long start, long count,
+                         std::vector<SharedFile> *files, long *total) {
+  if (fail_) return -1;
+  if (!built_) {
+    return 1;
+  }
+  // 与redis的ZREVRANGE相同：分数相同的按member倒序
+  std::vector<std::pair<std::string, const SharedFile *>> list;
+  for (const auto &kv : files_) {
+    list.emplace_back(kv.first, &kv.second);
+  }
+  std::sort(list.begin(), list.end(), [by_pv](const auto &a, const auto &b) {
+    long sa = by_pv ? a.second->pv : a.second->share_time;
+    long sb = by_pv ? b.second->pv : b.second->share_time;
+    return sa != sb ? sa > sb : a.first > b.first;
+  });
+  *total = (long)list.size();
+  for (long i = std::max(start, 0L); i < (long)list.size() && i < start + count;
+       i++) {
+    files->push_back(*list[i].second);
+  }
+  return 0;
+}
+
+int FakeShareIndex::addPv(const std::vector<FilePv> &pvs) {
+  if (fail_) return -1;
+  for (const FilePv &pv : pvs) {
+    auto it = files_.find(shareKey(pv.user, pv.md5, pv.filename));
+    if (it != files_.end()) {
+      it->second.pv += pv.count;
+    }
+  }
+  return 0;
+}
+
+bool FakeShareIndex::claimSync(int) { return !fail_; }
+
+void FakeShareIndex::releaseSync() { releases_++; }
+
+int FakeShareIndex::replace(const std::vector<SharedFile> &files) {
+  if (fail_) return -1;
+  files_.clear();
+  built_ = true;
+  syncs_++;
+  return add(files);
+}
+
+void FakeShareIndex::clear() {
+  files_.clear();
+  built_ = false;
+}
+
+//==================== 文件内容 ====================
+
+int FakeBlobStore::upload(const char *filename, char *fileid) {
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    return -1;
+  }
+  struct stat st;
+  fstat(fd, &st);
+  std::string data(st.st_size, '\0');
+  ssize_t n = read(fd, data.data(), data.size());
+  close(fd);
+  if (n != (ssize_t)data.size()) {
+    return -1;
+  }
+  snprintf(fileid, TEMP_BUF_MAX_LEN, "group1/M00/00/00/fake%ld", ++seq_);
+  blobs_[fileid] = std::move(data);
+  return 0;
+}
+
+int FakeBlobStore::fileUrl(const char *fileid, char *url) {
+  if (blobs_.count(fileid) == 0) {
+    return -1;
+  }
+  snprintf(url, FILE_URL_LEN, "http://127.0.0.1:80/%s", fileid);
+  return 0;
+}
+
+int FakeBlobStore::download(const char *fileid, long offset, long length,
+                            const char *local_file) {
+  auto it = blobs_.find(fileid);
+  if (it == blobs_.end()) {
+    return -1;
+  }
+  const std::string &data = it->second;
+  if (offset < 0) {
+    offset = 0;
+    length = data.size();
+  } else if (offset + length > (long)data.size()) {
+    return -1;
+  }
+  int fd = open(local_file, O_CREAT | O_WRONLY | O_TRUNC, 0644);
+  if (fd < 0) {
+    return -1;
+  }
+  ssize_t n = write(fd, data.data() + offset, length);
+  close(fd);
+  if (n != length) {
+    return -1;
+  }
+  downloads_++;
+  return 0;
+}
+
+int FakeBlobStore::stream(const char *fileid, long offset, long length,
+                          const DataSink &sink) {
+  auto it = blobs_.find(fileid);
+  if (it == blobs_.end()) {
+    return -1;
+  }
+  const std::string &data = it->second;
+  if (offset < 0) {
+    offset = 0;
+    length = data.size();
+  } else if (offset + length > (long)data.size()) {
+    return -1;
+  }
+  // 分成小块交给sink，和线上一样一个文件要多次回调
+  const long chunk = 4096;
+  for (long pos = 0; pos < length; pos += chunk) {
+    long n = length - pos < chunk ? length - pos : chunk;
+    if (sink(data.data() + offset + pos, n) != 0) {
+      return -1;
+    }
+  }
+  downloads_++;
+  return 0;
+}
+
+const std::string *FakeBlobStore::blob(const char *fileid) const {
+  auto it = blobs_.find(fileid);
+  return it == blobs_.end() ? nullptr : &it->second;
+}
+
+//==================== 请求 ====================
+
+FakeRequest::FakeRequest() : saved_(request) { reset("/", "", ""); }
+
+FakeRequest::~FakeRequest() { request = saved_; }
+
+// 请求体已全部在内存中，读完即结束
+void FakeRequest::fillIn(FCGX_Stream *s) { s->isClosed = 1; }
+
+// 输出缓冲区满或处理结束时追加到响应
+void FakeRequest::emptyOut(FCGX_Stream *s, int) {
+  FakeRequest *r = (FakeRequest *)s->data;
+  r->out_.append((const char *)r->out_buf_, s->wrNext - r->out_buf_);
+  s->wrNext = r->out_buf_;
+}
+
+// 错误输出直接丢弃
+void FakeRequest::discardErr(FCGX_Stream *s, int) {
+  s->wrNext = ((FakeRequest *)s->data)->err_buf_;
+}
+
+void FakeRequest::reset(const char *path, const char *query,
+                        std::string body) {
+  body_ = std::move(body);
+  env_.clear();
+  env_.push_back(std::string("REQUEST_METHOD=POST"));
+  env_.push_back(std::string("SCRIPT_NAME=") + path);
+  env_.push_back(std::string("DOCUMENT_URI=") + path);
+  env_.push_back(std::string("QUERY_STRING=") + query);
+  env_.push_back("CONTENT_LENGTH=" + std::to_string(body_.size()));
+  env_.push_back(std::string("REMOTE_ADDR=127.0.0.1"));
+  query_.parse(query);
+  bindEnv();
+  rewind();
+}
+
+void FakeRequest::param(const char *name, const char *value) {
+  env_.push_back(std::string(name) + "=" + value);
+  bindEnv();
+}
+
+void FakeRequest::bindEnv() {
+  envp_.clear();
+  for (std::string &e : env_) {
+    envp_.push_back(e.data());
+  }
+  envp_.push_back(nullptr);
+  request.envp = envp_.data();  // 扩容后指针会变
+}
+
+void FakeRequest::rewind() {
+  out_.clear();
+  memset(&in_, 0, sizeof(in_));
+  in_.isReader = 1;
+  in_.rdNext = in_.stopUnget = (unsigned char *)body_.data();
+  in_.stop = in_.rdNext + body_.size();
+  in_.fillBuffProc = fillIn;
+  in_.data = this;
+
+  memset(&out_stream_, 0, sizeof(out_stream_));
+  out_stream_.wrNext = out_buf_;
+  out_stream_.stop = out_buf_ + sizeof(out_buf_);
+  out_stream_.emptyBuffProc = emptyOut;
+  out_stream_.data = this;
+
+  memset(&err_, 0, sizeof(err_));
+  err_.wrNext = err_buf_;
+  err_.stop = err_buf_ + sizeof(err_buf_);
+  err_.emptyBuffProc = discardErr;
+  err_.data = this;
+
+  request = {};
+  request.role = 1;  // FCGI_RESPONDER
+  request.in = &in_;
+  request.out = &out_stream_;
+  request.err = &err_;
+  request.envp = envp_.data();
+}
+
+void FakeRequest::flush() { emptyOut(&out_stream_, 1); }
+
+std::string FakeRequest::code() const {
+  size_t pos = out_.find("\"code\":\"");
+  if (pos == std::string::npos) {
+    return "";
+  }
+  pos += 8;
+  return out_.substr(pos, out_.find('"', pos) - pos);
+}
+
+CgiContext fakeCgiContext(MetaStore *meta, TokenStore *tokens,
+                          BlobStore *blobs, ShareIndex *shares) {
+  CgiContext ctx = {};
+  ctx.meta = meta;
+  ctx.tokens = tokens;
+  ctx.blobs = blobs;
+  ctx.shares = shares;
+  return ctx;
+}
+
+void fakeRun(CgiHandler handler, CgiContext *ctx, FakeRequest *req) {
+  ctx->query = req->query();
+  handler(ctx);
+  req->flush();
+  req->aborted_ = takeCgiAbort();
+}
@@ -0,0 +1,221 @@
+#ifndef FAKE_UTIL_H
+#define FAKE_UTIL_H
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "backend_util.h"
+#include "cgi_server.h"
+
+/*
+   内存中的依赖(backend_util.h)和请求，处理函数不需要mysql、redis、fastDFS
+   和web服务器就能运行，用于测试、基准测试和perf：
+
+     FakeMetaStore meta;
+     FakeTokenStore tokens;
+     FakeBlobStore blobs;
+     CgiContext ctx = fakeCgiContext(&meta, &tokens, &blobs);
+     tokens.put("mike", "xxx");
+     // 需要共享排行时：FakeShareIndex shares; ctx.shares = &shares;
+
+     FakeRequest req;
+     req.reset("/md5", "", "{\"user\":\"mike\",\"token\":\"xxx\",...}");
+     fakeRun(md5Handler, &ctx, &req);   // req.out()为响应头 + body
+     req.rewind();                       // 同一个请求再来一次
+
+   FakeRequest存在期间当前线程的request指向它的内存流，析构时恢复。
+   ctx中的mysql、redis为nullptr，还没迁移到接口上的依赖(配额、打包)需保持关闭。
+*/
+
+// 文件元数据：file_info、user_file_list、user_file_count三张表
+class FakeMetaStore : public MetaStore {
+ public:
+  struct File {
+    std::string fileid;
+    std::string url;
+    long size;
+    std::string type;
+    int count;
+    std::string codec = "none";
+    long pack_offset = -1;
+    long pack_length = 0;
+  };
+  struct UserFile {
+    std::string md5;
+    std::string filename;
+    std::string create_time;
+    long pv;
+    bool shared = false;
+    long share_time = 0;
+  };
+
+  int fileRefCount(const char *md5, int *count) override;
+  long fileSize(const char *md5) override;
+  int setFileRefCount(const char *md5, int count) override;
+  int addFileInfo(const char *md5, const char *fileid, const char *url,
+                  long size, const char *type) override;
+  int userHasFile(const char *user, const char *md5,
+                  const char *filename) override;
+  int addUserFile(const char *user, const char *md5, const char *filename,
+                  const char *create_time) override;
+  int userFileCount(const char *user, long *count) override;
+  int incUserFileCount(const char *user) override;
+  std::unique_ptr<MetaRows> listUserFiles(const char *cmd, const char *user,
+                                          int start, int count) override;
+  int fileLocation(const char *user, const char *md5, const char *filename,
+                   FileLocation *loc) override;
+  int addFilePv(const std::vector<FilePv> &pvs) override;
+  // 没有此文件时返回-1
+  int setShared(const char *user, const char *md5, const char *filename,
+                bool shared, long share_time) override;
+  int sharedFile(const char *user, const char *md5, const char *filename,
+                 SharedFile *file) override;
+  int sharedFiles(std::vector<SharedFile> *files) override;
+  int addShareLink(const ShareLink &link) override;
+  int shareLink(const char *code, ShareLink *link) override;
+  int addShareLinkHits(
+      const std::vector<std::pair<std::string, long>> &hits) override;
+
+  // 为true时所有操作都失败，用于测试出错的分支
+  void setFail(bool fail) { fail_ = fail; }
+
+  const File *file(const char *md5) const;
+  File *file(const char *md5);
+  const std::vector<UserFile> *userFiles(const char *user) const;
+
+  // 分享链接，不存在时返回nullptr
+  ShareLink *link(const char *code);
+  // shareLink的调用次数
+  long linkLookups() const { return link_lookups_; }
+
+ private:
+  std::unordered_map<std::string, File> files_;
+  std::unordered_map<std::string, std::vector<UserFile>> user_files_;
+  std::unordered_map<std::string, long> counts_;
+  std::unordered_map<std::string, ShareLink> links_;
+  long link_lookups_ = 0;
+  bool fail_ = false;
+};
+
+class FakeTokenStore : public TokenStore {
+ public:
+  bool validate(const char *user, const char *token) override;
+
+  void put(const char *user, const char *token) { tokens_[user] = token; }
+
+ private:
+  std::unordered_map<std::string, std::string> tokens_;
+};
+
+// 共享排行保存在内存中，list时现排序
+class FakeShareIndex : public ShareIndex {
+ public:
+  int add(const std::vector<SharedFile> &files) override;
+  int remove(const char *user, const char *md5,
+             const char *filename) override;
+  int list(bool by_pv, long start, long count, std::vector<SharedFile> *files,
+           long *total) override;
+  int addPv(const std::vector<FilePv> &pvs) override;
+  bool claimSync(int interval_s) override;
+  void releaseSync() override;
+  int replace(const std::vector<SharedFile> &files) override;
+
+  // 为true时所有操作都失败，用于测试出错的分支
+  void setFail(bool fail) { fail_ = fail; }
+  // 清空排行，相当于redis重启
+  void clear();
+  // replace的次数
+  long syncs() const { return syncs_; }
+  // releaseSync的次数
+  long releases() const { return releases_; }
+
+ private:
+  std::unordered_map<std::string, SharedFile> files_;
+  bool built_ = false;
+  bool fail_ = false;
+  long syncs_ = 0;
+  long releases_ = 0;
+};
+
+// 文件内容保存在内存中，id为 group1/M00/00/00/fake<序号>
+class FakeBlobStore : public BlobStore {
+ public:
+  int upload(const char *filename, char *fileid) override;
+  int fileUrl(const char *fileid, char *url) override;
+  int download(const char *fileid, long offset, long length,
+               const char *local_file) override;
+  int stream(const char *fileid, long offset, long length,
+             const DataSink &sink) override;
+
+  // 已上传的内容，不存在时返回nullptr
+  const std::string *blob(const char *fileid) const;
+  size_t size() const { return blobs_.size(); }
+  // 成功的download次数
+  long downloads() const { return downloads_; }
+
+ private:
+  std::unordered_map<std::string, std::string> blobs_;
+  long seq_ = 0;
+  long downloads_ = 0;
+};
+
+// 内存中的FastCGI请求
+class FakeRequest {
+ public:
+  FakeRequest();
+  ~FakeRequest();
+  FakeRequest(const FakeRequest &) = delete;
+  FakeRequest &operator=(const FakeRequest &) = delete;
+
+  // 准备一个POST请求，设置SCRIPT_NAME、QUERY_STRING、CONTENT_LENGTH，清空响应
+  // 大的请求体可以std::move进来，避免多一份拷贝
+  void reset(const char *path, const char *query, std::string body);
+
+  // 追加一个参数(如HTTP_X_USER)，下次reset时清除
+  void param(const char *name, const char *value);
+
+  // 从头重放同一个请求，清空响应
+  void rewind();
+
+  // 响应(响应头 + body)
+  const std::string &out() const { return out_; }
+
+  // 响应body中的"code"，没有时返回空串
+  std::string code() const;
+
+  const QueryParams *query() const { return &query_; }
+
+  // 处理函数是否调用了abortCgiResponse
+  bool aborted() const { return aborted_; }
+
+ private:
+  friend void fakeRun(CgiHandler handler, CgiContext *ctx, FakeRequest *req);
+  static void fillIn(FCGX_Stream *s);
+  static void emptyOut(FCGX_Stream *s, int close);
+  static void discardErr(FCGX_Stream *s, int close);
+  void bindEnv();
+  void flush();
+
+  std::string body_;
+  std::string out_;
+  std::vector<std::string> env_;
+  std::vector<char *> envp_;
+  QueryParams query_;
+  FCGX_Stream in_;
+  FCGX_Stream out_stream_;
+  FCGX_Stream err_;
+  unsigned char out_buf_[8192];
+  unsigned char err_buf_[256];
+  FCGX_Request saved_;
+  bool aborted_ = false;
+};
+
+// 只有meta/tokens/blobs/shares的上下文，mysql、redis为nullptr
+CgiContext fakeCgiContext(MetaStore *meta, TokenStore *tokens,
+                          BlobStore *blobs, ShareIndex *shares = nullptr);
+
+// 用内存中的请求调用处理函数，响应写入req->out()
+void fakeRun(CgiHandler handler, CgiContext *ctx, FakeRequest *req);
+
+#endif
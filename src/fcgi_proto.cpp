@@ -0,0 +1,143 @@
+#include "fcgi_proto.h"
+
+#include <cstring>
+
+using namespace std;
+
+/**
+ * @brief 从buf开头解析一条记录
+ *
+ * @param buf 接收缓冲区
+ * @param len 缓冲区中的数据长度
+ * @param rec 解析出的记录，data指向buf
+ *
+ * @return 整条记录(含填充)的长度，数据不完整返回0，版本错误返回-1
+ */
+long fcgiParseRecord(const char *buf, size_t len, FcgiRecord *rec) {
+  if (len < FCGI_HEADER_LEN) {
+    return 0;
+  }
+  const unsigned char *h = (const unsigned char *)buf;
+  if (h[0] != FCGI_PROTO_VERSION) {
+    return -1;
+  }
+  uint32_t content_len = (h[4] << 8) | h[5];
+  size_t total = FCGI_HEADER_LEN + content_len + h[6];
+  if (len < total) {
+    return 0;
+  }
+  rec->type = h[1];
+  rec->id = (uint16_t)((h[2] << 8) | h[3]);
+  rec->data = buf + FCGI_HEADER_LEN;
+  rec->len = content_len;
+  return (long)total;
+}
+
+// 读取名值对中的一个长度，成功返回0
+static int readLength(const unsigned char *&p, const unsigned char *end,
+                      uint32_t *n) {
+  if (p >= end) {
+    return -1;
+  }
+  if ((*p & 0x80) == 0) {
+    *n = *p++;
+    return 0;
+  }
+  if (end - p < 4) {
+    return -1;
+  }
+  *n = ((uint32_t)(p[0] & 0x7f) << 24) | ((uint32_t)p[1] << 16) |
+       ((uint32_t)p[2] << 8) | p[3];
+  p += 4;
+  return 0;
+}
+
+/**
+ * @brief 解析名值对，名和值指向buf
+ *
+ * @return 0成功，-1格式错误
+ */
+int fcgiParseParams(const char *buf, size_t len, FcgiParams *params) {
+  const unsigned char *p = (const unsigned char *)buf;
+  const unsigned char *end = p + len;
+  while (p < end) {
+    uint32_t name_len, value_len;
+    if (readLength(p, end, &name_len) != 0 ||
+        readLength(p, end, &value_len) != 0) {
+      return -1;
+    }
+    if ((size_t)(end - p) < (size_t)name_len + value_len) {
+      return -1;
+    }
+    const char *name = (const char *)p;
+    const char *value = name + name_len;
+    params->emplace_back(string_view(name, name_len),
+                         string_view(value, value_len));
+    p += name_len + value_len;
+  }
+  return 0;
+}
+
+static void appendLength(string *out, size_t n) {
+  if (n < 128) {
+    out->push_back((char)n);
+    return;
+  }
+  out->push_back((char)(((n >> 24) & 0x7f) | 0x80));
+  out->push_back((char)((n >> 16) & 0xff));
+  out->push_back((char)((n >> 8) & 0xff));
+  out->push_back((char)(n & 0xff));
+}
+
+void fcgiAppendParam(string *out, string_view name, string_view value) {
+  appendLength(out, name.size());
+  appendLength(out, value.size());
+  out->append(name.data(), name.size());
+  out->append(value.data(), value.size());
+}
+
+/**
+ * @brief 追加一条记录，内容按8字节对齐填充
+ */
+void fcgiAppendRecord(string *out, uint8_t type, uint16_t id, const char *data,
+                      size_t len) {
+  uint8_t padding = (uint8_t)((8 - (len & 7)) & 7);
+  char header[FCGI_HEADER_LEN] = {
+      (char)FCGI_PROTO_VERSION,  (char)type,
+      (char)(id >> 8),           (char)(id & 0xff),
+      (char)(len >> 8),          (char)(len & 0xff),
+      (char)padding,             0,
+  };
+  out->append(header, FCGI_HEADER_LEN);
+  if (len > 0) {
+    out->append(data, len);
+  }
+  out->append(padding, '\0');
+}
+
+void fcgiAppendStream(string *out, uint8_t type, uint16_t id, const char *data,
+                      size_t len) {
+  out->reserve(out->size() + len + (len / FCGI_MAX_CONTENT + 1) * 16);
+  while (len > 0) {
+    size_t n = len < FCGI_MAX_CONTENT ? len : FCGI_MAX_CONTENT;
+    fcgiAppendRecord(out, type, id, data, n);
+    data += n;
+    len -= n;
+  }
+}
+
+void fcgiAppendBeginRequest(string *out, uint16_t id, uint16_t role,
+                            uint8_t flags) {
+  char body[8] = {(char)(role >> 8), (char)(role & 0xff), (char)flags};
+  fcgiAppendRecord(out, FCGI_TYPE_BEGIN_REQUEST, id, body, sizeof(body));
+}
+
+void fcgiAppendEndRequest(string *out, uint16_t id, uint32_t app_status,
+                          uint8_t proto_status) {
+  char body[8] = {
+      (char)(app_status >> 24),         (char)((app_status >> 16) & 0xff),
+      (char)((app_status >> 8) & 0xff), (char)(app_status & 0xff),
+      (char)proto_status,
+  };
+  fcgiAppendRecord(out, FCGI_TYPE_END_REQUEST, id, body, sizeof(body));
+}
@@ -0,0 +1,82 @@
+#ifndef FCGI_PROTO_H
+#define FCGI_PROTO_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+/*
+   FastCGI记录协议的编解码，不依赖libfcgi，供io_uring服务端使用。
+
+   每条记录 = 8字节头 + 内容 + 填充:
+   version(1) type(1) requestId(2) contentLength(2) paddingLength(1) reserved(1)
+   名值对的长度小于128时用1字节，否则用4字节(最高位置1)。
+*/
+
+const uint8_t FCGI_PROTO_VERSION = 1;
+const size_t FCGI_HEADER_LEN = 8;
+const size_t FCGI_MAX_CONTENT = 65535;
+
+// 记录类型
+const uint8_t FCGI_TYPE_BEGIN_REQUEST = 1;
+const uint8_t FCGI_TYPE_ABORT_REQUEST = 2;
+const uint8_t FCGI_TYPE_END_REQUEST = 3;
+const uint8_t FCGI_TYPE_PARAMS = 4;
+const uint8_t FCGI_TYPE_STDIN = 5;
+const uint8_t FCGI_TYPE_STDOUT = 6;
+const uint8_t FCGI_TYPE_STDERR = 7;
+const uint8_t FCGI_TYPE_DATA = 8;
+const uint8_t FCGI_TYPE_GET_VALUES = 9;
+const uint8_t FCGI_TYPE_GET_VALUES_RESULT = 10;
+const uint8_t FCGI_TYPE_UNKNOWN = 11;
+
+// BEGIN_REQUEST中的角色和标志
+const uint16_t FCGI_ROLE_RESPONDER = 1;
+const uint8_t FCGI_FLAG_KEEP_CONN = 1;
+
+// END_REQUEST中的协议状态
+const uint8_t FCGI_STATUS_REQUEST_COMPLETE = 0;
+const uint8_t FCGI_STATUS_CANT_MPX_CONN = 1;
+const uint8_t FCGI_STATUS_OVERLOADED = 2;
+const uint8_t FCGI_STATUS_UNKNOWN_ROLE = 3;
+
+// 一条完整的记录，data指向输入缓冲区
+struct FcgiRecord {
+  uint8_t type;
+  uint16_t id;
+  const char *data;
+  uint32_t len;
+};
+
+typedef std::vector<std::pair<std::string_view, std::string_view>> FcgiParams;
+
+// 从buf开头解析一条记录，返回整条记录(含填充)的长度，数据不完整返回0，版本错误返回-1
+long fcgiParseRecord(const char *buf, size_t len, FcgiRecord *rec);
+
+// 解析名值对追加到params，返回0，格式错误返回-1
+int fcgiParseParams(const char *buf, size_t len, FcgiParams *params);
+
+// 追加一个名值对(编码PARAMS或GET_VALUES_RESULT的内容)
+void fcgiAppendParam(std::string *out, std::string_view name,
+                     std::string_view value);
+
+// 追加一条记录，len不能超过FCGI_MAX_CONTENT
+void fcgiAppendRecord(std::string *out, uint8_t type, uint16_t id,
+                      const char *data, size_t len);
+
+// 追加流数据(STDOUT/STDIN/PARAMS)，超过单条记录长度时拆成多条，len为0时不追加
+void fcgiAppendStream(std::string *out, uint8_t type, uint16_t id,
+                      const char *data, size_t len);
+
+// 追加BEGIN_REQUEST记录
+void fcgiAppendBeginRequest(std::string *out, uint16_t id, uint16_t role,
+                            uint8_t flags);
+
+// 追加END_REQUEST记录
+void fcgiAppendEndRequest(std::string *out, uint16_t id, uint32_t app_status,
+                          uint8_t proto_status);
+
+#endif
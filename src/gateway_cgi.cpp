@@ -0,0 +1,34 @@
+/**
+ * @file gateway_cgi.cpp
+ * @brief  所有接口合并在一个进程中的FastCGI网关
+ * @author ward
+ * @version 2.0
+ * @date 2023年5月1日
+ */
+#include "cgi_handlers.h"
+#include "cgi_server.h"
+#ifdef CGI_URING
+#include "cgi_uring.h"
+#endif
+
+// 路由表：路径 + cmd -> 处理函数，cmd为nullptr的路由处理该路径的所有cmd
+static const CgiRoute routes[] = {
+    {"/login", nullptr, loginHandler, nullptr},
+    {"/reg", nullptr, regHandler, nullptr},
+    {"/md5", nullptr, md5Handler, md5Init},
+    {"/myfiles", nullptr, myfilesHandler, nullptr, MYFILES_URING_HANDLER},
+    {"/upload", nullptr, uploadHandler, uploadInit},
+    {"/delta", nullptr, deltaHandler, deltaInit},
+    {"/dl", nullptr, dlHandler, dlInit},
+    {"/metrics", nullptr, metricsHandler, nullptr},
+    {"/sharefiles", nullptr, sharefilesHandler, sharefilesInit},
+};
+
+int main() {
+#ifdef CGI_URING
+  // 定义CGI_URING时使用io_uring服务端，一个进程多个事件循环线程
+  return runUringCgi(routes, sizeof(routes) / sizeof(routes[0]));
+#else
+  return runCgi(routes, sizeof(routes) / sizeof(routes[0]));
+#endif
+}
@@ -0,0 +1,96 @@
+#include "json_util.h"
+
+#include <cstring>
+
+#include "make_log.h"
+
+const char *const JSON_LOG_MODULE = "cgi";
+
+/**
+ * @brief  获取当前线程的json内存池，第一块内存是线程局部的静态缓冲区
+ *
+ * @return 内存池
+ */
+JsonPool &jsonArena() {
+  alignas(16) thread_local char buffer[JSON_ARENA_SIZE];
+  thread_local JsonPool pool(buffer, sizeof(buffer));
+  return pool;
+}
+
+/**
+ * @brief  回收当前线程内存池，超出初始块后申请的内存块归还系统
+ */
+void jsonResetArena() { jsonArena().Clear(); }
+
+/**
+ * @brief  把一个json值绑定到字段的目标
+ *
+ * @return 0 成功, -1 类型错误或超长
+ */
+static int bindField(const Value &v, const JsonField &field) {
+  switch (field.type) {
+    case JsonFieldType::STRING: {
+      if (!v.IsString() || v.GetStringLength() >= field.size) {
+        return -1;
+      }
+      char *dst = (char *)field.dst;
+      memcpy(dst, v.GetString(), v.GetStringLength());
+      dst[v.GetStringLength()] = '\0';
+      return 0;
+    }
+    case JsonFieldType::INT:
+      if (!v.IsInt()) {
+        return -1;
+      }
+      *(int *)field.dst = v.GetInt();
+      return 0;
+    case JsonFieldType::LONG:
+      if (!v.IsInt64()) {
+        return -1;
+      }
+      *(long *)field.dst = (long)v.GetInt64();
+      return 0;
+  }
+  return -1;
+}
+
+/**
+ * @brief  原地解析json并按字段表绑定
+ *
+ * @param buf      以'\0'结尾的json字符串，解析后内容会被修改
+ * @param fields   字段表
+ * @param count    字段个数
+ * @param log_proc 日志文件名，出错时写入调用者的日志
+ *
+ * @return 0 成功, -1 失败
+ */
+int jsonDecode(char *buf, const JsonField *fields, size_t count,
+               const char *log_proc) {
+  JsonPool &pool = jsonArena();
+  PoolDocument doc(&pool, 1024, &pool);
+  doc.ParseInsitu(buf);
+  if (doc.HasParseError() || !doc.IsObject()) {
+    LOG_ERROR(JSON_LOG_MODULE, log_proc, "JSON 解析失败！offset: %zu\n",
+              doc.GetErrorOffset());
+    return -1;
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    const JsonField &field = fields[i];
+    Value::ConstMemberIterator it = doc.FindMember(field.name);
+    if (it == doc.MemberEnd()) {
+      if (field.required) {
+        LOG_ERROR(JSON_LOG_MODULE, log_proc, "缺少字段：%s\n", field.name);
+        return -1;
+      }
+      continue;
+    }
+    if (bindField(it->value, field) != 0) {
+      LOG_ERROR(JSON_LOG_MODULE, log_proc, "类型错误或过长的字段：%s\n",
+                field.name);
+      return -1;
+    }
+  }
+
+  return 0;
+}
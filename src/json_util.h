@@ -0,0 +1,76 @@
+#ifndef JSON_UTIL_H
+#define JSON_UTIL_H
+
+#include <cstddef>
+
+#include "rapidjson/document.h"
+#include "rapidjson/stringbuffer.h"
+#include "rapidjson/writer.h"
+
+using namespace rapidjson;
+
+/*
+   请求json的解码层：
+   1. 每个线程一块固定的内存池(JsonPool)，Document的节点、解析栈、
+      序列化缓冲区都从池中分配，请求结束时jsonResetArena()整体回收，
+      常规大小的请求不再调用malloc
+   2. 已读入的请求体用ParseInsitu原地解析，字符串不再拷贝一次
+   3. 字段用JsonField表声明式绑定到结构体成员，统一做类型和长度检查
+
+   const JsonField fields[] = {
+       jsonStr("user", info.user, sizeof(info.user)),
+       jsonInt("start", &info.start),
+   };
+   jsonDecode(buf, fields, "myfiles");
+*/
+
+// 每个线程内存池初始块的大小，超出时才向系统申请新块
+const size_t JSON_ARENA_SIZE = 64 * 1024;
+
+typedef MemoryPoolAllocator<> JsonPool;
+typedef GenericDocument<UTF8<>, JsonPool, JsonPool> PoolDocument;
+typedef GenericStringBuffer<UTF8<>, JsonPool> PoolStringBuffer;
+typedef Writer<PoolStringBuffer, UTF8<>, UTF8<>, JsonPool> PoolWriter;
+
+// 当前线程的json内存池
+JsonPool &jsonArena();
+
+// 请求处理结束后回收当前线程内存池中的所有分配
+void jsonResetArena();
+
+// 字段类型
+enum class JsonFieldType { STRING, INT, LONG };
+
+// 一个待绑定的字段
+struct JsonField {
+  const char *name;    // json中的键
+  JsonFieldType type;  // 字段类型
+  void *dst;           // 绑定的目标，STRING为char[]，INT为int*，LONG为long*
+  size_t size;         // STRING目标缓冲区大小(包含'\0')
+  bool required;       // 是否必填，选填字段缺失时目标保持不变
+};
+
+inline JsonField jsonStr(const char *name, char *dst, size_t size,
+                         bool required = true) {
+  return {name, JsonFieldType::STRING, dst, size, required};
+}
+
+inline JsonField jsonInt(const char *name, int *dst, bool required = true) {
+  return {name, JsonFieldType::INT, dst, 0, required};
+}
+
+inline JsonField jsonLong(const char *name, long *dst, bool required = true) {
+  return {name, JsonFieldType::LONG, dst, 0, required};
+}
+
+// 原地解析以'\0'结尾的buf(内容会被修改)，并把字段绑定到目标
+// 返回0成功，-1 json格式错误或字段缺失、类型错误、超长
+int jsonDecode(char *buf, const JsonField *fields, size_t count,
+               const char *log_proc);
+
+template <size_t N>
+int jsonDecode(char *buf, const JsonField (&fields)[N], const char *log_proc) {
+  return jsonDecode(buf, fields, N, log_proc);
+}
+
+#endif
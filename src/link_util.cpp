@@ -0,0 +1,374 @@
+/**
+ * @file link_util.cpp
+ * @brief 分享短链接：生成、分层缓存的解析、批量的点击计数
+ * @author ward
+ * @version 1.0
+ * @date 2023年7月10日
+ */
+
+#include "link_util.h"
+
+#include <sys/random.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <ctime>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+#include "cgi_util.h"
+#include "make_log.h"
+#include "pv_util.h"
+
+static const char LINK_KEY_PREFIX[] = "link:";
+static const char LINK_USED_PREFIX[] = "link:used:";
+
+// 不过期的链接，已用次数在redis中保留的时间
+static const long LINK_USED_TTL_S = 30L * 86400;
+
+static const char BASE62[] =
+    "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz";
+
+/*
+   有次数限制的链接记一次点击
+   KEYS[1] link:used:<code>  ARGV[1] 已落库的点击量  ARGV[2] 最多次数
+   ARGV[3] 过期时间(秒)
+   返回1计入，0次数已用完
+*/
+static const char USED_LUA[] = R"(
+if redis.call('EXISTS', KEYS[1]) == 0 then
+  redis.call('SET', KEYS[1], ARGV[1], 'EX', ARGV[3])
+end
+if redis.call('INCR', KEYS[1]) > tonumber(ARGV[2]) then
+  redis.call('DECR', KEYS[1])
+  return 0
+end
+return 1
+)";
+
+static int linkSave(MetaStore *meta, const CounterBatch::CountList &hits);
+
+static CounterBatch link_batch("link", linkSave);
+
+// 进程内的LRU，存在和不存在的code都缓存
+class LinkCache {
+ public:
+  void reset(size_t capacity, int ttl_s) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    capacity_ = capacity;
+    ttl_s_ = ttl_s;
+    lru_.clear();
+    map_.clear();
+  }
+
+  // 命中时found为链接是否存在
+  bool get(const std::string &code, ShareLink *link, bool *found) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = map_.find(code);
+    if (it == map_.end()) {
+      return false;
+    }
+    if (it->second->expire < time(nullptr)) {
+      lru_.erase(it->second);
+      map_.erase(it);
+      return false;
+    }
+    lru_.splice(lru_.begin(), lru_, it->second);  // 移到最前
+    *found = it->second->found;
+    if (it->second->found) {
+      *link = it->second->link;
+    }
+    return true;
+  }
+
+  void put(const std::string &code, const ShareLink &link, bool found) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (capacity_ == 0 || ttl_s_ <= 0) {
+      return;
+    }
+    auto it = map_.find(code);
+    if (it != map_.end()) {
+      lru_.erase(it->second);
+      map_.erase(it);
+    }
+    lru_.push_front(Entry{code, link, found, time(nullptr) + ttl_s_});
+    map_[code] = lru_.begin();
+    if (lru_.size() > capacity_) {
+      map_.erase(lru_.back().code);
+      lru_.pop_back();
+    }
+  }
+
+  // 推送出去的点击量加到缓存的链接上，次数限制按新的点击量判断
+  void addHits(const CounterBatch::Counts &hits) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const auto &kv : hits) {
+      auto it = map_.find(kv.first);
+      if (it != map_.end() && it->second->found) {
+        it->second->link.hits += kv.second;
+      }
+    }
+  }
+
+ private:
+  struct Entry {
+    std::string code;
+    ShareLink link;
+    bool found;
+    time_t expire;
+  };
+  std::mutex mutex_;
+  std::list<Entry> lru_;
+  std::unordered_map<std::string, std::list<Entry>::iterator> map_;
+  // linkInit之前按默认配置
+  size_t capacity_ = LinkConfig().cache_size;
+  int ttl_s_ = LinkConfig().cache_ttl_s;
+};
+
+static LinkCache link_cache;
+static LinkConfig link_cfg;
+
+LinkConfig linkConfig() {
+  LinkConfig cfg;
+  std::string value;
+  if (getCfgValue(CFG_PATH, "link", "cache_size", value) == 0) {
+    cfg.cache_size = atol(value.c_str());
+  }
+  if (getCfgValue(CFG_PATH, "link", "cache_ttl_s", value) == 0) {
+    cfg.cache_ttl_s = atoi(value.c_str());
+  }
+  if (getCfgValue(CFG_PATH, "link", "redis_ttl_s", value) == 0 &&
+      atoi(value.c_str()) > 0) {
+    cfg.redis_ttl_s = atoi(value.c_str());
+  }
+  if (getCfgValue(CFG_PATH, "link", "negative_ttl_s", value) == 0 &&
+      atoi(value.c_str()) > 0) {
+    cfg.negative_ttl_s = atoi(value.c_str());
+  }
+  if (getCfgValue(CFG_PATH, "link", "flush_s", value) == 0) {
+    cfg.flush_s = atoi(value.c_str());
+  }
+  return cfg;
+}
+
+void linkInit(const LinkConfig &cfg) {
+  link_cfg = cfg;
+  link_cache.reset(cfg.cache_size, cfg.cache_ttl_s);
+  link_batch.setInterval(cfg.flush_s);
+}
+
+std::string linkCode() {
+  // 62 * 4 = 248，大于等于248的字节丢弃，每个字符均匀分布
+  std::string code;
+  unsigned char buf[32];
+  while ((int)code.size() < LINK_CODE_LEN) {
+    if (getrandom(buf, sizeof(buf), 0) != (ssize_t)sizeof(buf)) {
+      continue;
+    }
+    for (unsigned char b : buf) {
+      if (b < 248 && (int)code.size() < LINK_CODE_LEN) {
+        code += BASE62[b % 62];
+      }
+    }
+  }
+  return code;
+}
+
+// code只能是LINK_CODE_LEN个base62字符，其余的不用查
+static bool validCode(const char *code) {
+  int n = 0;
+  for (; code[n] != '\0'; n++) {
+    char c = code[n];
+    if (!((c >= '0' && c <= '9') || (c >= 'A' && c <= 'Z') ||
+          (c >= 'a' && c <= 'z'))) {
+      return false;
+    }
+  }
+  return n == LINK_CODE_LEN;
+}
+
+// redis中的值：user\n md5\n filename\n 过期时间\n 最多次数\n 点击量，不存在为空串
+static std::string encodeLink(const ShareLink &link) {
+  return link.user + '\n' + link.md5 + '\n' + link.filename + '\n' +
+         std::to_string(link.expire_time) + '\n' +
+         std::to_string(link.max_downloads) + '\n' + std::to_string(link.hits);
+}
+
+static bool decodeLink(const std::string &value, ShareLink *link) {
+  size_t pos[5];
+  size_t p = 0;
+  for (int i = 0; i < 5; i++) {
+    p = value.find('\n', p);
+    if (p == std::string::npos) {
+      return false;
+    }
+    pos[i] = p++;
+  }
+  link->user = value.substr(0, pos[0]);
+  link->md5 = value.substr(pos[0] + 1, pos[1] - pos[0] - 1);
+  link->filename = value.substr(pos[1] + 1, pos[2] - pos[1] - 1);
+  link->expire_time = atol(value.c_str() + pos[2] + 1);
+  link->max_downloads = atol(value.c_str() + pos[3] + 1);
+  link->hits = atol(value.c_str() + pos[4] + 1);
+  return true;
+}
+
+// 写入redis，过期的链接不超过它的过期时间
+static void redisPut(sw::redis::Redis *redis, const std::string &code,
+                     const ShareLink *link) {
+  long ttl = link != nullptr ? link_cfg.redis_ttl_s : link_cfg.negative_ttl_s;
+  if (link != nullptr && link->expire_time > 0) {
+    long left = link->expire_time - (long)time(nullptr);
+    if (left <= 0) {
+      return;
+    }
+    ttl = std::min(ttl, left);
+  }
+  try {
+    redis->set(LINK_KEY_PREFIX + code,
+               link != nullptr ? encodeLink(*link) : std::string(),
+               std::chrono::seconds(ttl));
+  } catch (const sw::redis::Error &e) {
+    LOG_ERROR(LINK_LOG_MODULE, LINK_LOG_PROC, "set err: %s\n", e.what());
+  }
+}
+
+int linkCreate(MetaStore *meta, sw::redis::Redis *redis, ShareLink *link) {
+  link->hits = 0;
+  // 16位base62重复的概率可以忽略，仍然换code重试几次
+  for (int i = 0; i < 3; i++) {
+    link->code = linkCode();
+    int ret = meta->addShareLink(*link);
+    if (ret < 0) {
+      return -1;
+    }
+    if (ret == 0) {
+      // 链接通常刚生成就被大量点击，先放进redis
+      if (redis != nullptr) {
+        redisPut(redis, link->code, link);
+      }
+      return 0;
+    }
+  }
+  LOG_ERROR(LINK_LOG_MODULE, LINK_LOG_PROC, "code collided 3 times\n");
+  return -1;
+}
+
+// 查redis，1命中(found为是否存在)，0没有，-1失败
+static int redisGet(sw::redis::Redis *redis, const std::string &code,
+                    ShareLink *link, bool *found) {
+  sw::redis::OptionalString value;
+  try {
+    value = redis->get(LINK_KEY_PREFIX + code);
+  } catch (const sw::redis::Error &e) {
+    LOG_ERROR(LINK_LOG_MODULE, LINK_LOG_PROC, "get err: %s\n", e.what());
+    return -1;
+  }
+  if (!value) {
+    return 0;
+  }
+  *found = !value->empty() && decodeLink(*value, link);
+  if (*found) {
+    link->code = code;
+  }
+  return 1;
+}
+
+int linkResolve(MetaStore *meta, sw::redis::Redis *redis, const char *code,
+                ShareLink *link) {
+  if (!validCode(code)) {
+    return 1;
+  }
+  std::string key(code);
+  bool found = false;
+  if (!link_cache.get(key, link, &found)) {
+    int ret = redis != nullptr ? redisGet(redis, key, link, &found) : 0;
+    if (ret <= 0) {
+      // redis没有或出错，查mysql
+      ret = meta->shareLink(code, link);
+      if (ret < 0) {
+        return -1;
+      }
+      found = ret == 0;
+      if (redis != nullptr) {
+        redisPut(redis, key, found ? link : nullptr);
+      }
+    }
+    link_cache.put(key, *link, found);
+  }
+  if (!found) {
+    return 1;
+  }
+  if (link->expire_time > 0 && link->expire_time <= (long)time(nullptr)) {
+    return 1;
+  }
+  return 0;
+}
+
+// 已用次数：redis中的link:used:<code>，没有时为已落库的点击量；-1失败
+static long usedCount(sw::redis::Redis *redis, const ShareLink &link) {
+  try {
+    sw::redis::OptionalString used = redis->get(LINK_USED_PREFIX + link.code);
+    return used ? atol(used->c_str()) : link.hits;
+  } catch (const sw::redis::Error &e) {
+    LOG_ERROR(LINK_LOG_MODULE, LINK_LOG_PROC, "used err: %s\n", e.what());
+    return -1;
+  }
+}
+
+int linkHit(sw::redis::Redis *redis, const ShareLink &link, bool count) {
+  if (link.max_downloads > 0) {
+    long long ok = -1;
+    if (redis != nullptr && count) {
+      long ttl = LINK_USED_TTL_S;
+      if (link.expire_time > 0) {
+        ttl = std::max(link.expire_time - (long)time(nullptr), 1L);
+      }
+      try {
+        ok = redis->eval<long long>(
+            USED_LUA, {LINK_USED_PREFIX + link.code},
+            {std::to_string(link.hits), std::to_string(link.max_downloads),
+             std::to_string(ttl)});
+      } catch (const sw::redis::Error &e) {
+        LOG_ERROR(LINK_LOG_MODULE, LINK_LOG_PROC, "used err: %s\n", e.what());
+      }
+    } else if (redis != nullptr) {
+      // 不计数的续传，用掉最后一次的下载仍可以继续
+      long used = usedCount(redis, link);
+      if (used >= 0) {
+        ok = used <= link.max_downloads;
+      }
+    }
+    if (ok < 0) {
+      // 没有redis，按已知的点击量判断
+      long used = link.hits + link_batch.pending(link.code);
+      ok = count ? used < link.max_downloads : used <= link.max_downloads;
+    }
+    if (ok == 0) {
+      return 1;
+    }
+  }
+  if (count) {
+    link_batch.add(link.code);
+  }
+  return 0;
+}
+
+// 点击量写入mysql，返回写入的链接数，失败返回-1
+static int linkSave(MetaStore *meta, const CounterBatch::CountList &hits) {
+  if (meta->addShareLinkHits(hits) != 0) {
+    return -1;
+  }
+  return (int)hits.size();
+}
+
+int linkFlush(MetaStore *meta, sw::redis::Redis *redis, bool force) {
+  CounterBatch::Counts pushed;
+  int ret = link_batch.flush(meta, redis, force, &pushed);
+  link_cache.addHits(pushed);
+  return ret;
+}
@@ -0,0 +1,93 @@
+#ifndef LINK_UTIL_H
+#define LINK_UTIL_H
+
+#include <sw/redis++/redis++.h>
+
+#include <cstddef>
+
+#include "backend_util.h"
+
+/*
+   分享短链接：POST /sharefiles?cmd=link 为自己的文件生成code，
+   任何人用 GET /dl?link=<code> 下载，不需要登录。
+
+   code为16个base62字符，来自getrandom，约95位，不能猜出或遍历。
+   链接可以有过期时间和最多下载次数，记录在mysql的share_link表：
+   create table share_link (
+     code char(16) not null primary key,
+     user varchar(128) not null,
+     md5 varchar(256) not null,
+     filename varchar(256) not null,
+     create_time timestamp default current_timestamp,
+     expire_time bigint not null default 0,    -- unix秒，0为不过期
+     max_downloads bigint not null default 0,  -- 0为不限
+     hits bigint not null default 0
+   );
+
+   下载时解析code：进程内LRU -> redis link:<code> -> mysql，查到后回填前面两层。
+   不存在的code也缓存(redis中为空串，negative_ttl_s秒)，扫code的请求不会到mysql；
+   社交网络上传开的链接，每个进程只在LRU过期时查一次redis，
+   redis中过期后整个集群只有少数几次查mysql。
+
+   点击量用CounterBatch(pv_util.h)批量落库：进程内计数 -> redis link:pending
+   -> 每flush_s秒一个事务更新share_link.hits。
+   有次数限制的链接每次点击在redis中INCR link:used:<code>，超过次数的拒绝，
+   计数第一次使用时从mysql的hits初始化；redis为nullptr或出错时按
+   LRU中的hits加上本进程还没推送的计数判断，是近似的。
+
+   "link": {"cache_size": 10000, "cache_ttl_s": 60, "redis_ttl_s": 86400,
+            "negative_ttl_s": 60, "flush_s": 5}
+*/
+
+const char *const LINK_LOG_MODULE = "cgi";
+const char *const LINK_LOG_PROC = "link";
+
+// code的长度
+const int LINK_CODE_LEN = 16;
+
+struct LinkConfig {
+  size_t cache_size = 10000;  // 进程内LRU的条数，0为不缓存
+  int cache_ttl_s = 60;       // LRU中的一条最多使用多久
+  int redis_ttl_s = 86400;    // redis中link:<code>的过期时间
+  int negative_ttl_s = 60;    // 不存在的code在redis中的缓存时间
+  int flush_s = 5;            // 点击量的推送间隔
+};
+
+// 从cfg.json的"link"读取配置，没有的项用默认值
+LinkConfig linkConfig();
+
+// 设置配置并清空LRU
+void linkInit(const LinkConfig &cfg);
+
+// 新的随机code，LINK_CODE_LEN个base62字符
+std::string linkCode();
+
+/**
+ * @brief 为link->user的文件生成分享链接，code写回link->code
+ *
+ * @return 0成功，-1失败
+ */
+int linkCreate(MetaStore *meta, sw::redis::Redis *redis, ShareLink *link);
+
+/**
+ * @brief 解析code：进程内LRU -> redis -> mysql
+ *
+ * @return 0链接有效，1不存在或已过期，-1失败
+ */
+int linkResolve(MetaStore *meta, sw::redis::Redis *redis, const char *code,
+                ShareLink *link);
+
+/**
+ * @brief 检查次数限制，count时记一次点击
+ *        续传等不从头开始的请求count为false，只检查不计数；
+ *        用掉最后一次的那个下载仍可以续传
+ *
+ * @return 0可以下载(count时已计入)，1次数已用完
+ */
+int linkHit(sw::redis::Redis *redis, const ShareLink &link, bool count);
+
+// 到了推送间隔时推送本进程的点击量并尝试落库，force时立即进行
+// 返回写入mysql的链接数，没有写入返回0，失败返回-1
+int linkFlush(MetaStore *meta, sw::redis::Redis *redis, bool force);
+
+#endif
@@ -16,11 +16,16 @@
 #include <random>
 #include <sstream>
 
+#include "cgi_handlers.h"
+#include "cgi_server.h"
 #include "cgi_util.h"
 #include "fcgi_config.h"
 #include "fcgi_stdio.h"
+#include "json_util.h"
 #include "make_log.h"
+#include "metrics_util.h"
 #include "mysql_util.h"
+#include "response_util.h"
 #include "rapidjson/document.h"
 #include "rapidjson/istreamwrapper.h"
 #include "rapidjson/stringbuffer.h"
@@ -34,32 +39,13 @@ using namespace rapidjson;
 using namespace sw::redis;
 
 // 解析json包，获得包括用户名、密码
-int getLoginInfo(char *login_buf, char *user, char *pwd) {
-  // 解析json包
-  Document doc;
-  doc.Parse(login_buf);
-
-  if (!doc.IsObject()) {
-    LOG_ERROR(LOGIN_LOG_MODULE, LOGIN_LOG_PROC, "JSON 解析失败！");
-    return -1;
-  }
-
-  // 用户
-  if (!doc.HasMember("userName") || !doc["userName"].IsString()) {
-    LOG_ERROR(LOGIN_LOG_MODULE, LOGIN_LOG_PROC,
-              "缺少或类型错误的字段：userName");
-    return -1;
-  }
-  strcpy(user, doc["userName"].GetString());
-
-  // 密码
-  if (!doc.HasMember("passWord") || !doc["passWord"].IsString()) {
-    LOG_ERROR(LOGIN_LOG_MODULE, LOGIN_LOG_PROC,
-              "缺少或类型错误的字段：passWord");
-    return -1;
-  }
-  strcpy(pwd, doc["passWord"].GetString());
-  return 0;
+int getLoginInfo(char *login_buf, char *user, size_t user_size, char *pwd,
+                 size_t pwd_size) {
+  const JsonField fields[] = {
+      jsonStr("userName", user, user_size),  // 用户
+      jsonStr("passWord", pwd, pwd_size),    // 密码
+  };
+  return jsonDecode(login_buf, fields, LOGIN_LOG_PROC);
 }
 
 // 查询数据库，验证用户名和密码是否正确
@@ -129,6 +115,7 @@ int setToken(Redis *redis, char *user, char token[], size_t token_len) {
            new_token.c_str());
 
   // 如果连接失败，抛出异常
+  MetricTimer timer(DEP_REDIS_SET_TOKEN);
   try {
     // 将user和token作为键值对存入redis数据库中
     redis->setex(user, 86400, new_token);  // 设置过期时间为24小时
@@ -139,106 +126,98 @@ int setToken(Redis *redis, char *user, char token[], size_t token_len) {
   } catch (const Error &e) {
     // 打印异常信息
     LOG_ERROR(LOGIN_LOG_MODULE, LOGIN_LOG_PROC, "Redis Error: %s\n", e.what());
+    timer.fail();
     return -1;
   }
 
   return 0;
 }
 
-char *returnLoginStatus(const char *status_num, const char *token) {
-  Document doc;
-  doc.SetObject();
-  Document::AllocatorType &allocator = doc.GetAllocator();
-  doc.AddMember("code", Value(status_num, allocator).Move(), allocator);
-  doc.AddMember("token", Value(token, allocator).Move(), allocator);
-  StringBuffer buffer;
-  Writer<StringBuffer> writer(buffer);
-  doc.Accept(writer);
-  char *result =
-      strdup(buffer.GetString());  // 动态分配内存,strdup用于复制字符串
-  return result;
+// 登陆失败和token生成失败的响应是固定的
+const char LOGIN_FAIL_BODY[] = "{\"code\":\"001\",\"token\":\"fail\"}";
+const char LOGIN_TOKEN_ERR_BODY[] =
+    "{\"code\":\"002\",\"token\":\"setToken failed!\"}";
+
+// 返回登陆成功和token，json在线程内存池中序列化
+int returnLoginStatus(FCGX_Stream *out, const char *status_num,
+                      const char *token) {
+  JsonPool &pool = jsonArena();
+  PoolStringBuffer buffer(&pool);
+  PoolWriter writer(buffer, &pool);
+  writer.StartObject();
+  writer.Key("code");
+  writer.String(status_num);
+  writer.Key("token");
+  writer.String(token);
+  writer.EndObject();
+  LOG_INFO(LOGIN_LOG_MODULE, LOGIN_LOG_PROC, "out = %s\n", buffer.GetString());
+  return writeBody(out, buffer.GetString(), buffer.GetSize());
 }
 
-int main() {
-  FCGX_Init();
-  FCGX_Request request;
-  FCGX_InitRequest(&request, 0, 0);
-  LOG_INFO(LOGIN_LOG_MODULE, LOGIN_LOG_PROC, "login server start");
-
-  // 建立redis和mysql的连接
-  auto redisconn = redisConn();
-  auto mysqlconn = mysqlConn();
-  if (mysqlconn == nullptr || redisconn == nullptr) {
-    LOG_ERROR(LOGIN_LOG_MODULE, LOGIN_LOG_PROC, "mysql or redis init error");
-    return -1;
-  }
-
-  while (FCGX_Accept_r(&request) == 0) {
-    char *contentLength = FCGX_GetParam("CONTENT_LENGTH", request.envp);
-    int len;
-
-    FCGX_FPrintF(
-        request.out,
-        "Content-type: text/html\r\n\r\n");  // 告诉web服务器，返回的数据类型是html
+// 处理一个登陆请求
+void loginHandler(CgiContext *ctx) {
+  char *contentLength = FCGX_GetParam("CONTENT_LENGTH", request.envp);
+  int len;
 
-    if (contentLength == nullptr) {
-      len = 0;
-      FCGX_FPrintF(
-          request.out,
-          "No data from standard input.<p>\n");  // 这是标准输出，会返回给web服务器
-      LOG_INFO(LOGIN_LOG_MODULE, LOGIN_LOG_PROC, "len = %d", len);
-    } else {
-      // 获取登陆用户信息
-      len = atoi(contentLength);
-      char buf[4 * 1024] = {0};
-      int ret = 0;
-      char *out = nullptr;
-
-      ret = FCGX_GetStr(buf, len, request.in);  // 从标准输入(web服务器)读取内容
-      if (ret == 0) {
-        LOG_ERROR(LOGIN_LOG_MODULE, LOGIN_LOG_PROC, "FCGX_GetStr() err");
-        continue;
-      }
-      LOG_INFO(LOGIN_LOG_MODULE, LOGIN_LOG_PROC, "buf = %s", buf);
-
-      // 获取登陆用户的信息
-      char user[512] = {0};
-      char pwd[512] = {0};
-      getLoginInfo(buf, user, pwd);
-      LOG_INFO(LOGIN_LOG_MODULE, LOGIN_LOG_PROC, "user = %s, pwd = %s\n", user,
-               pwd);
-
-      // 登陆密码验证，成功返回0，失败返回-1
-      ret = checkUserPwd(mysqlconn, user, pwd);
-      if (ret == 0)  // 登陆成功
-      {
-        char token[1024] = {0};
-        // 生成token字符串
-
-        if (setToken(redisconn, user, token, sizeof(token)) == -1) {
-          // 如果生成token失败，返回错误信息
-          LOG_ERROR(LOGIN_LOG_MODULE, LOGIN_LOG_PROC, "setToken failed!");
-          out = returnLoginStatus("002", "setToken failed!");
-        } else {
-          LOG_INFO(LOGIN_LOG_MODULE, LOGIN_LOG_PROC, "token = %s", token);
-          // 返回前端登陆情况， 000代表成功
-          out = returnLoginStatus("000", token);
-        }
+  if (contentLength == nullptr) {
+    len = 0;
+    writeNoData(request.out);  // 响应头和提示一次写入，返回给web服务器
+    LOG_INFO(LOGIN_LOG_MODULE, LOGIN_LOG_PROC, "len = %d", len);
+  } else {
+    // 获取登陆用户信息
+    len = atoi(contentLength);
+    char buf[4 * 1024] = {0};
+    int ret = 0;
+
+    if (len >= (int)sizeof(buf)) {
+      LOG_ERROR(LOGIN_LOG_MODULE, LOGIN_LOG_PROC, "len = %d too long", len);
+      writeBody(request.out, LOGIN_FAIL_BODY, sizeof(LOGIN_FAIL_BODY) - 1);
+      return;
+    }
+    ret = FCGX_GetStr(buf, len, request.in);  // 从标准输入(web服务器)读取内容
+    if (ret == 0) {
+      LOG_ERROR(LOGIN_LOG_MODULE, LOGIN_LOG_PROC, "FCGX_GetStr() err");
+      writeBody(request.out, LOGIN_FAIL_BODY, sizeof(LOGIN_FAIL_BODY) - 1);
+      return;
+    }
+    LOG_INFO(LOGIN_LOG_MODULE, LOGIN_LOG_PROC, "buf = %s", buf);
+
+    // 获取登陆用户的信息
+    char user[512] = {0};
+    char pwd[512] = {0};
+    ret = getLoginInfo(buf, user, sizeof(user), pwd, sizeof(pwd));
+    LOG_INFO(LOGIN_LOG_MODULE, LOGIN_LOG_PROC, "user = %s, pwd = %s\n", user,
+             pwd);
+
+    // 登陆密码验证，成功返回0，失败返回-1，解析失败按登陆失败处理
+    if (ret == 0) {
+      ret = checkUserPwd(ctx->mysql, user, pwd);
+    }
+    if (ret == 0)  // 登陆成功
+    {
+      char token[1024] = {0};
+      // 生成token字符串
+
+      if (setToken(ctx->redis, user, token, sizeof(token)) == -1) {
+        // 如果生成token失败，返回错误信息
+        LOG_ERROR(LOGIN_LOG_MODULE, LOGIN_LOG_PROC, "setToken failed!");
+        writeBody(request.out, LOGIN_TOKEN_ERR_BODY,
+                  sizeof(LOGIN_TOKEN_ERR_BODY) - 1);
       } else {
-        // 返回前端登陆情况， 001代表失败
-        out = returnLoginStatus("001", "fail");
-      }
-      if (out != nullptr) {
-        FCGX_FPrintF(request.out, "%s", out);
-        LOG_INFO(LOGIN_LOG_MODULE, LOGIN_LOG_PROC, "out = %s\n", out);
-        free(out);
+        LOG_INFO(LOGIN_LOG_MODULE, LOGIN_LOG_PROC, "token = %s", token);
+        // 返回前端登陆情况， 000代表成功
+        returnLoginStatus(request.out, "000", token);
       }
+    } else {
+      // 返回前端登陆情况， 001代表失败
+      writeBody(request.out, LOGIN_FAIL_BODY, sizeof(LOGIN_FAIL_BODY) - 1);
     }
-
-    FCGX_Finish_r(&request);
   }
+}
 
-  delete redisconn;
-  mysql_close(mysqlconn);
-  return 0;
+#ifndef CGI_GATEWAY
+int main() {
+  const CgiRoute route = {"/login", nullptr, loginHandler, nullptr};
+  return runCgi(&route, 1);
 }
+#endif
@@ -2,6 +2,9 @@
 
 namespace fs = std::filesystem;
 std::mutex log_lock;
+static LogWriter log_writer = nullptr;
+
+void setLogWriter(LogWriter writer) { log_writer = writer; }
 
 /**
  * @brief 将日志信息写入到文件中
@@ -58,7 +61,7 @@ void dumpmsg_to_file(const char *module_name, const char *proc_name,
   char fmtmesg[4096] = {0};
   va_list ap;
   va_start(ap, fmt);
-  vsprintf(fmtmesg, fmt, ap);
+  vsnprintf(fmtmesg, sizeof(fmtmesg), fmt, ap);  // 超长的消息截断
   va_end(ap);
 
   make_path(std::string(module_name),
@@ -70,10 +73,25 @@ void dumpmsg_to_file(const char *module_name, const char *proc_name,
              std::to_string(now_tm->tm_mday) + "/" + std::string(proc_name) +
              "-" + std::to_string(now_tm->tm_mday) + ".log";
 
+  appendLogFile(filepath, buf_stream.str());
+}
+
+/**
+ * @brief 把一行追加到文件，设置了日志写入函数时交给它
+ *
+ * @param path 文件路径
+ * @param msg  一行内容，含换行符
+ */
+void appendLogFile(const std::string &path, const std::string &msg) {
+  if (log_writer != nullptr) {
+    log_writer(path, msg);
+    return;
+  }
+
   std::lock_guard<std::mutex> lock(
       log_lock);  // lock_guard可以自动加锁和解锁，在作用域结束时自动解锁
-  std::ofstream outfile(filepath, std::ios_base::app);  // 以追加的方式打开文件
-  outfile << buf_stream.str();
+  std::ofstream outfile(path, std::ios_base::app);  // 以追加的方式打开文件
+  outfile << msg;
 }
 
 /**
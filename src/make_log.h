@@ -20,6 +20,15 @@ void dumpmsg_to_file(const char *module_name, const char *proc_name,
 
 void make_path(const std::string &module_name, const std::string &proc_name);
 
+// 日志写入函数，path为日志文件，msg为格式化好的一行日志
+typedef void (*LogWriter)(const std::string &path, const std::string &msg);
+
+// 把一行追加到path，与日志使用同样的写入方式
+void appendLogFile(const std::string &path, const std::string &msg);
+
+// 替换日志的写入方式(如io_uring异步写)，需在启动线程前设置，nullptr恢复同步写
+void setLogWriter(LogWriter writer);
+
 //`do-while(false)`循环是一种技巧，可以将多个语句组成一个单独的块，并在不引入新的作用域的情况下将它们组合在一起。
 // 在宏中使用这个技巧可以避免出现因宏展开而引入的副作用。
 // 具体而言，`do-while(false)`循环可以确保宏中的所有语句被视为单个语句，从而可以避免生成空语句的警告。
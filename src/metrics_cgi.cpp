@@ -0,0 +1,28 @@
+/**
+ * @file metrics_cgi.cpp
+ * @brief 指标的cgi程序：按Prometheus文本格式返回本机所有进程合并后的指标
+ * @author ward
+ * @version 1.0
+ * @date 2023年6月20日
+ */
+
+#include <string>
+
+#include "cgi_server.h"
+#include "metrics_util.h"
+
+static const char METRICS_HEADER[] =
+    "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n\r\n";
+
+void metricsHandler(CgiContext *) {
+  std::string out(METRICS_HEADER, sizeof(METRICS_HEADER) - 1);
+  metricsRender(&out);
+  FCGX_PutStr(out.data(), (int)out.size(), request.out);
+}
+
+#ifndef CGI_GATEWAY
+int main() {
+  const CgiRoute route = {"/metrics", nullptr, metricsHandler, nullptr};
+  return runCgi(&route, 1);
+}
+#endif
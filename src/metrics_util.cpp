@@ -0,0 +1,460 @@
+#include "metrics_util.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <cstdarg>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+
+#include "make_log.h"
+
+static const char *const dep_names[DEP_COUNT] = {
+    "mysql", "redis_validate_token", "redis_set_token", "storage_upload",
+    "storage_pack",
+};
+
+// 直方图，最后一个桶为超出范围的(+Inf)，count为各桶之和
+struct Hist {
+  std::atomic<uint64_t> buckets[METRICS_BUCKETS + 1];
+  std::atomic<uint64_t> sum_us;
+};
+
+// 一个线程的指标
+struct Shard {
+  std::atomic<int> pid;  // 0为空闲，-1为正在初始化，否则为所属进程
+  Hist requests[METRICS_MAX_ENDPOINTS];
+  std::atomic<uint64_t> bytes[METRICS_MAX_ENDPOINTS];
+  std::atomic<int64_t> inflight[METRICS_MAX_ENDPOINTS];
+  Hist deps[DEP_COUNT];
+  std::atomic<uint64_t> dep_errors[DEP_COUNT];
+};
+
+struct Endpoint {
+  char path[32];
+  char cmd[16];
+};
+
+struct Shared {
+  std::atomic<int> lock;  // 持有锁的进程，登记接口、回收分片和抓取时持有
+  std::atomic<int> endpoint_count;
+  Endpoint endpoints[METRICS_MAX_ENDPOINTS];
+  Shard retired;  // 已退出进程的计数
+  Shard shards[METRICS_SHARDS];
+};
+
+static Shared *shared = nullptr;
+static pid_t proc_pid = 0;   // 本进程，fork后在子进程中更新
+static int generation = 0;   // 每次metricsOpen加1，线程据此重新占用分片
+thread_local Shard *my_shard = nullptr;
+thread_local pid_t my_pid = 0;
+thread_local int my_generation = 0;
+
+// 分片只有一个写者，不需要原子的读改写
+static inline void add(std::atomic<uint64_t> &a, uint64_t n) {
+  a.store(a.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+static inline void add(std::atomic<int64_t> &a, int64_t n) {
+  a.store(a.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+static bool processAlive(int pid) {
+  return kill(pid, 0) == 0 || errno != ESRCH;
+}
+
+static void lockShared() {
+  int expected = 0;
+  while (!shared->lock.compare_exchange_weak(expected, proc_pid)) {
+    // 持有锁的进程崩溃时接手
+    if (expected != 0 && !processAlive(expected) &&
+        shared->lock.compare_exchange_strong(expected, proc_pid)) {
+      return;
+    }
+    expected = 0;
+    sched_yield();
+  }
+}
+
+static void unlockShared() { shared->lock.store(0); }
+
+static void childAfterFork() { proc_pid = getpid(); }
+
+/**
+ * @brief 打开共享内存，新建时全为0
+ *
+ * @param shm_name 共享内存名，如"/filehub_metrics"
+ *
+ * @return 0 成功，-1 失败
+ */
+int metricsOpen(const char *shm_name) {
+  int fd = shm_open(shm_name, O_RDWR | O_CREAT, 0600);
+  if (fd < 0) {
+    LOG_ERROR(METRICS_LOG_MODULE, METRICS_LOG_PROC, "shm_open %s err: %s\n",
+              shm_name, strerror(errno));
+    return -1;
+  }
+  if (ftruncate(fd, (off_t)sizeof(Shared)) != 0) {
+    LOG_ERROR(METRICS_LOG_MODULE, METRICS_LOG_PROC, "ftruncate err: %s\n",
+              strerror(errno));
+    close(fd);
+    return -1;
+  }
+  void *p = mmap(nullptr, sizeof(Shared), PROT_READ | PROT_WRITE, MAP_SHARED,
+                 fd, 0);
+  close(fd);
+  if (p == MAP_FAILED) {
+    LOG_ERROR(METRICS_LOG_MODULE, METRICS_LOG_PROC, "mmap err: %s\n",
+              strerror(errno));
+    return -1;
+  }
+
+  static bool atfork = false;
+  if (!atfork) {
+    pthread_atfork(nullptr, nullptr, childAfterFork);
+    atfork = true;
+  }
+  if (shared != nullptr) {
+    munmap(shared, sizeof(Shared));
+  }
+  shared = (Shared *)p;
+  proc_pid = getpid();
+  generation++;
+  return 0;
+}
+
+static void zeroShard(Shard *s) {
+  for (Hist &h : s->requests) {
+    for (auto &b : h.buckets) b.store(0);
+    h.sum_us.store(0);
+  }
+  for (auto &b : s->bytes) b.store(0);
+  for (auto &n : s->inflight) n.store(0);
+  for (Hist &h : s->deps) {
+    for (auto &b : h.buckets) b.store(0);
+    h.sum_us.store(0);
+  }
+  for (auto &e : s->dep_errors) e.store(0);
+}
+
+static void foldHist(Hist *to, const Hist &from) {
+  for (int i = 0; i <= METRICS_BUCKETS; i++) {
+    add(to->buckets[i], from.buckets[i].load());
+  }
+  add(to->sum_us, from.sum_us.load());
+}
+
+/**
+ * @brief 把已退出进程的分片并入retired后回收，需持有锁
+ *
+ * @return 回收的分片数
+ */
+static int reclaimShards() {
+  int n = 0;
+  for (Shard &s : shared->shards) {
+    int pid = s.pid.load();
+    if (pid <= 0 || processAlive(pid)) {
+      continue;
+    }
+    for (int i = 0; i < METRICS_MAX_ENDPOINTS; i++) {
+      foldHist(&shared->retired.requests[i], s.requests[i]);
+      add(shared->retired.bytes[i], s.bytes[i].load());
+    }
+    for (int i = 0; i < DEP_COUNT; i++) {
+      foldHist(&shared->retired.deps[i], s.deps[i]);
+      add(shared->retired.dep_errors[i], s.dep_errors[i].load());
+    }
+    zeroShard(&s);  // 在途数随进程一起消失
+    s.pid.store(0);
+    n++;
+  }
+  return n;
+}
+
+static Shard *claimShard() {
+  for (int round = 0; round < 2; round++) {
+    for (Shard &s : shared->shards) {
+      int expected = 0;
+      if (s.pid.compare_exchange_strong(expected, -1)) {
+        zeroShard(&s);
+        s.pid.store(proc_pid);
+        return &s;
+      }
+    }
+    lockShared();
+    int n = reclaimShards();
+    unlockShared();
+    if (n == 0) {
+      break;
+    }
+  }
+  LOG_ERROR(METRICS_LOG_MODULE, METRICS_LOG_PROC, "no free metrics shard\n");
+  return nullptr;
+}
+
+// 本线程的分片，第一次使用或fork后占用一个
+static Shard *shard() {
+  if (shared == nullptr) {
+    return nullptr;
+  }
+  if (my_pid != proc_pid || my_generation != generation) {
+    my_shard = claimShard();
+    my_pid = proc_pid;
+    my_generation = generation;
+  }
+  return my_shard;
+}
+
+/**
+ * @brief 登记一个接口，已登记过时返回原来的编号
+ *
+ * @param path 请求路径
+ * @param cmd  QUERY_STRING中的cmd，nullptr为任意cmd
+ *
+ * @return 接口编号，没有打开共享内存或已满时返回-1
+ */
+int metricsEndpoint(const char *path, const char *cmd) {
+  if (shared == nullptr) {
+    return -1;
+  }
+  if (cmd == nullptr) {
+    cmd = "";
+  }
+  lockShared();
+  int count = shared->endpoint_count.load();
+  int id = -1;
+  for (int i = 0; i < count && id < 0; i++) {
+    const Endpoint &e = shared->endpoints[i];
+    if (strncmp(e.path, path, sizeof(e.path) - 1) == 0 &&
+        strncmp(e.cmd, cmd, sizeof(e.cmd) - 1) == 0) {
+      id = i;
+    }
+  }
+  if (id < 0 && count < METRICS_MAX_ENDPOINTS) {
+    Endpoint &e = shared->endpoints[count];
+    snprintf(e.path, sizeof(e.path), "%s", path);
+    snprintf(e.cmd, sizeof(e.cmd), "%s", cmd);
+    shared->endpoint_count.store(count + 1);
+    id = count;
+  }
+  unlockShared();
+  return id;
+}
+
+int64_t metricsBucketUpper(int i) {
+  if (i <= 0) {
+    return 16;
+  }
+  int octave = 4 + (i - 1) / 4;
+  int sub = (i - 1) % 4;
+  return (1LL << octave) + (sub + 1) * (1LL << (octave - 2));
+}
+
+int metricsBucket(int64_t us) {
+  if (us < 16) {
+    return 0;
+  }
+  int octave = 63 - __builtin_clzll((unsigned long long)us);
+  if (octave >= 26) {
+    return METRICS_BUCKETS;
+  }
+  int sub = (int)((us >> (octave - 2)) & 3);
+  return 1 + (octave - 4) * 4 + sub;
+}
+
+static void observe(Hist *h, int64_t us) {
+  if (us < 0) {
+    us = 0;
+  }
+  add(h->buckets[metricsBucket(us)], 1);
+  add(h->sum_us, (uint64_t)us);
+}
+
+void metricsRequestBegin(int endpoint, long bytes) {
+  Shard *s = shard();
+  if (s == nullptr || endpoint < 0 || endpoint >= METRICS_MAX_ENDPOINTS) {
+    return;
+  }
+  add(s->inflight[endpoint], 1);
+  if (bytes > 0) {
+    add(s->bytes[endpoint], (uint64_t)bytes);
+  }
+}
+
+void metricsRequestEnd(int endpoint, int64_t us) {
+  Shard *s = shard();
+  if (s == nullptr || endpoint < 0 || endpoint >= METRICS_MAX_ENDPOINTS) {
+    return;
+  }
+  add(s->inflight[endpoint], -1);
+  observe(&s->requests[endpoint], us);
+}
+
+void metricsDep(MetricDep dep, int64_t us, bool ok) {
+  Shard *s = shard();
+  if (s == nullptr || dep < 0 || dep >= DEP_COUNT) {
+    return;
+  }
+  observe(&s->deps[dep], us);
+  if (!ok) {
+    add(s->dep_errors[dep], 1);
+  }
+}
+
+int64_t metricsNowUs() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+// 合并后的直方图
+struct HistTotal {
+  uint64_t buckets[METRICS_BUCKETS + 1];
+  uint64_t sum_us;
+  uint64_t count;
+};
+
+struct Totals {
+  HistTotal requests[METRICS_MAX_ENDPOINTS];
+  uint64_t bytes[METRICS_MAX_ENDPOINTS];
+  int64_t inflight[METRICS_MAX_ENDPOINTS];
+  HistTotal deps[DEP_COUNT];
+  uint64_t dep_errors[DEP_COUNT];
+};
+
+static void sumHist(HistTotal *to, const Hist &from) {
+  for (int i = 0; i <= METRICS_BUCKETS; i++) {
+    uint64_t n = from.buckets[i].load(std::memory_order_relaxed);
+    to->buckets[i] += n;
+    to->count += n;
+  }
+  to->sum_us += from.sum_us.load(std::memory_order_relaxed);
+}
+
+static void sumShard(Totals *t, const Shard &s, bool live) {
+  for (int i = 0; i < METRICS_MAX_ENDPOINTS; i++) {
+    sumHist(&t->requests[i], s.requests[i]);
+    t->bytes[i] += s.bytes[i].load(std::memory_order_relaxed);
+    if (live) {
+      t->inflight[i] += s.inflight[i].load(std::memory_order_relaxed);
+    }
+  }
+  for (int i = 0; i < DEP_COUNT; i++) {
+    sumHist(&t->deps[i], s.deps[i]);
+    t->dep_errors[i] += s.dep_errors[i].load(std::memory_order_relaxed);
+  }
+}
+
+static void appendf(std::string *out, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+static void appendf(std::string *out, const char *fmt, ...) {
+  char buf[512];
+  va_list ap;
+  va_start(ap, fmt);
+  int n = vsnprintf(buf, sizeof(buf), fmt, ap);
+  va_end(ap);
+  if (n > 0) {
+    out->append(buf, n < (int)sizeof(buf) ? n : sizeof(buf) - 1);
+  }
+}
+
+// name_bucket/_sum/_count，labels为不带花括号的标签
+static void appendHist(std::string *out, const char *name,
+                       const std::string &labels, const HistTotal &h) {
+  uint64_t cumulative = 0;
+  for (int i = 0; i < METRICS_BUCKETS; i++) {
+    cumulative += h.buckets[i];
+    appendf(out, "%s_bucket{%s,le=\"%.6g\"} %llu\n", name, labels.c_str(),
+            metricsBucketUpper(i) / 1e6, (unsigned long long)cumulative);
+  }
+  appendf(out, "%s_bucket{%s,le=\"+Inf\"} %llu\n", name, labels.c_str(),
+          (unsigned long long)h.count);
+  appendf(out, "%s_sum{%s} %.6f\n", name, labels.c_str(), h.sum_us / 1e6);
+  appendf(out, "%s_count{%s} %llu\n", name, labels.c_str(),
+          (unsigned long long)h.count);
+}
+
+/**
+ * @brief 合并所有分片，按Prometheus文本格式输出
+ */
+void metricsRender(std::string *out) {
+  if (shared == nullptr) {
+    return;
+  }
+  std::unique_ptr<Totals> t(new Totals());
+  Endpoint endpoints[METRICS_MAX_ENDPOINTS];
+
+  // 持锁合并，与回收互斥，退出进程的计数不会被算两次或漏掉
+  // 先回收已退出进程的分片，它们的在途数不再计入
+  lockShared();
+  reclaimShards();
+  int count = shared->endpoint_count.load();
+  memcpy(endpoints, shared->endpoints, sizeof(endpoints));
+  sumShard(t.get(), shared->retired, false);
+  for (const Shard &s : shared->shards) {
+    if (s.pid.load() > 0) {
+      sumShard(t.get(), s, true);
+    }
+  }
+  unlockShared();
+
+  std::string labels[METRICS_MAX_ENDPOINTS];
+  for (int i = 0; i < count; i++) {
+    labels[i] = std::string("endpoint=\"") + endpoints[i].path +
+                "\",cmd=\"" + endpoints[i].cmd + "\"";
+  }
+
+  out->append(
+      "# HELP filehub_requests_total Requests handled, by endpoint and cmd.\n"
+      "# TYPE filehub_requests_total counter\n");
+  for (int i = 0; i < count; i++) {
+    appendf(out, "filehub_requests_total{%s} %llu\n", labels[i].c_str(),
+            (unsigned long long)t->requests[i].count);
+  }
+  out->append(
+      "# HELP filehub_request_bytes_total Request body bytes received.\n"
+      "# TYPE filehub_request_bytes_total counter\n");
+  for (int i = 0; i < count; i++) {
+    appendf(out, "filehub_request_bytes_total{%s} %llu\n", labels[i].c_str(),
+            (unsigned long long)t->bytes[i]);
+  }
+  out->append(
+      "# HELP filehub_inflight_requests Requests being handled.\n"
+      "# TYPE filehub_inflight_requests gauge\n");
+  for (int i = 0; i < count; i++) {
+    appendf(out, "filehub_inflight_requests{%s} %lld\n", labels[i].c_str(),
+            (long long)t->inflight[i]);
+  }
+  out->append(
+      "# HELP filehub_request_duration_seconds Request latency.\n"
+      "# TYPE filehub_request_duration_seconds histogram\n");
+  for (int i = 0; i < count; i++) {
+    appendHist(out, "filehub_request_duration_seconds", labels[i],
+               t->requests[i]);
+  }
+
+  out->append(
+      "# HELP filehub_dependency_duration_seconds MySQL, Redis and storage "
+      "call latency.\n"
+      "# TYPE filehub_dependency_duration_seconds histogram\n");
+  for (int i = 0; i < DEP_COUNT; i++) {
+    appendHist(out, "filehub_dependency_duration_seconds",
+               std::string("dep=\"") + dep_names[i] + "\"", t->deps[i]);
+  }
+  out->append(
+      "# HELP filehub_dependency_errors_total Failed dependency calls.\n"
+      "# TYPE filehub_dependency_errors_total counter\n");
+  for (int i = 0; i < DEP_COUNT; i++) {
+    appendf(out, "filehub_dependency_errors_total{dep=\"%s\"} %llu\n",
+            dep_names[i], (unsigned long long)t->dep_errors[i]);
+  }
+}
@@ -0,0 +1,93 @@
+#ifndef METRICS_UTIL_H
+#define METRICS_UTIL_H
+
+#include <cstdint>
+#include <string>
+
+/*
+   进程内的指标，/metrics按Prometheus文本格式输出：
+   - filehub_requests_total、filehub_request_duration_seconds(直方图)、
+     filehub_request_bytes_total、filehub_inflight_requests，按接口路径和cmd
+   - filehub_dependency_duration_seconds(直方图)、filehub_dependency_errors_total，
+     按依赖：mysql查询、redis的token读写、存储上传
+
+   每个线程写自己的分片，一个分片只有一个写者，不加锁也不用原子的读改写。
+   分片放在共享内存中，prefork的各worker、io_uring的各线程、单接口的各程序
+   写同一块共享内存，抓取时合并，任何一个进程都能返回整台机器的数据。
+   进程退出后它的分片并入retired分片再回收，计数不会回退。
+
+   直方图为HDR式的对数-线性分桶：每个2的幂区间再分4个桶，
+   覆盖16us ~ 67s，桶的相对宽度不超过25%，p99的误差在一个桶以内。
+
+   nginx只允许内网访问：
+   location = /metrics {
+       allow 127.0.0.1;
+       deny all;
+       fastcgi_pass 127.0.0.1:10010;
+       include fastcgi.conf;
+   }
+*/
+
+const char *const METRICS_LOG_MODULE = "cgi";
+const char *const METRICS_LOG_PROC = "metrics";
+
+const char *const METRICS_SHM_NAME = "/filehub_metrics";
+
+const int METRICS_MAX_ENDPOINTS = 32;  // 接口(路径 + cmd)数上限
+const int METRICS_SHARDS = 128;        // 同时写指标的线程数上限
+const int METRICS_BUCKETS = 89;        // 直方图的有限桶数，超出的只计入+Inf
+
+// 记录耗时的外部依赖
+enum MetricDep {
+  DEP_MYSQL = 0,             // mysql查询，包括processResultOne
+  DEP_REDIS_VALIDATE_TOKEN,  // validateToken
+  DEP_REDIS_SET_TOKEN,       // setToken
+  DEP_STORAGE_UPLOAD,        // 上传到fastDFS
+  DEP_STORAGE_PACK,          // 追加到小文件容器
+  DEP_COUNT,
+};
+
+// 打开(不存在时创建)共享内存，失败时之后的记录都不做任何事，返回-1
+int metricsOpen(const char *shm_name = METRICS_SHM_NAME);
+
+// 登记一个接口，返回编号，所有进程同一个接口编号相同，已满时返回-1
+int metricsEndpoint(const char *path, const char *cmd);
+
+// 请求开始：在途数 + 1，累计请求体字节数
+void metricsRequestBegin(int endpoint, long bytes);
+
+// 请求结束：在途数 - 1，记录请求数和耗时
+void metricsRequestEnd(int endpoint, int64_t us);
+
+// 记录一次依赖调用
+void metricsDep(MetricDep dep, int64_t us, bool ok);
+
+// 单调时钟的微秒数
+int64_t metricsNowUs();
+
+// 合并所有分片，按Prometheus文本格式(0.0.4)追加到out
+void metricsRender(std::string *out);
+
+// 直方图第i个桶的上界(us)，供测试和输出使用
+int64_t metricsBucketUpper(int i);
+
+// 耗时对应的桶，超出最后一个桶时返回METRICS_BUCKETS
+int metricsBucket(int64_t us);
+
+// 记录一次依赖调用的计时器，析构时记录，调用失败时先调用fail()
+class MetricTimer {
+ public:
+  explicit MetricTimer(MetricDep dep) : dep_(dep), start_(metricsNowUs()) {}
+  ~MetricTimer() { metricsDep(dep_, metricsNowUs() - start_, ok_); }
+  MetricTimer(const MetricTimer &) = delete;
+  MetricTimer &operator=(const MetricTimer &) = delete;
+
+  void fail() { ok_ = false; }
+
+ private:
+  MetricDep dep_;
+  int64_t start_;
+  bool ok_ = true;
+};
+
+#endif
@@ -15,8 +15,17 @@
 #include <mysql/mysql.h>
 #include <sw/redis++/redis++.h>
 #include "make_log.h"
+#include "backend_util.h"
+#include "cgi_handlers.h"
+#include "cgi_server.h"
 #include "cgi_util.h"
+#include "json_util.h"
 #include "mysql_util.h"
+#include "response_util.h"
+#ifdef CGI_URING
+#include "uring_mysql.h"
+#include "uring_server.h"
+#endif
 #include <sys/time.h>
 #include "rapidjson/document.h"
 #include "rapidjson/writer.h"
@@ -29,8 +38,7 @@ using namespace sw::redis;
 #define MYFILES_LOG_MODULE "cgi"
 #define MYFILES_LOG_PROC "myfiles"
 
-thread_local FCGX_Request
-    request; // 定义线程局部变量
+void return_myfiles_status(long num, int token_flag);
 
 /**
  * @brief 从客户端请求中获取用户信息
@@ -45,29 +53,11 @@ int get_count_info(char *buf, char *user, char *token)
 {
   // | url      | [http://127.0.0.1:80/myfiles?cmd=count]
   // | post数据  | {   "user": "xxx",   "token": "xxxx"   } |
-  Document doc;
-  doc.Parse(buf);
-  if (!doc.IsObject())
-  {
-    LOG_ERROR(MYFILES_LOG_MODULE, MYFILES_LOG_PROC, "JSON 解析失败！");
-    return -1;
-  }
-
-  if (!doc.HasMember("user") || !doc["user"].IsString())
-  {
-    LOG_ERROR(MYFILES_LOG_MODULE, MYFILES_LOG_PROC, "缺少或类型错误的字段：userName");
-    return -1;
-  }
-  strcpy(user, doc["user"].GetString());
-
-  if (!doc.HasMember("token") || !doc["token"].IsString())
-  {
-    LOG_ERROR(MYFILES_LOG_MODULE, MYFILES_LOG_PROC, "缺少或类型错误的字段：token");
-    return -1;
-  }
-  strcpy(token, doc["token"].GetString());
-
-  return 0;
+  const JsonField fields[] = {
+      jsonStr("user", user, USER_NAME_LEN),
+      jsonStr("token", token, TOKEN_LEN),
+  };
+  return jsonDecode(buf, fields, MYFILES_LOG_PROC);
 }
 
 /**
@@ -85,154 +75,54 @@ int get_fileslist_info(char *buf, char *user, char *token, int &start, int &coun
 {
   // | url      | [http://127.0.0.1:80/myfiles?cmd=count]
   // | post数据  | {   "user": "yoyo"  "token" : xxxx  "start" : 0 "count" : 10  } |
-  Document doc;
-  doc.Parse(buf);
-
-  if (!doc.IsObject())
-  {
-    LOG_ERROR(MYFILES_LOG_MODULE, MYFILES_LOG_PROC, "JSON 解析失败！");
-    return -1;
-  }
-
-  if (!doc.HasMember("user") || !doc["user"].IsString())
-  {
-    LOG_ERROR(MYFILES_LOG_MODULE, MYFILES_LOG_PROC, "缺少或类型错误的字段：userName");
-    return -1;
-  }
-  strcpy(user, doc["user"].GetString());
-
-  if (!doc.HasMember("token") || !doc["token"].IsString())
-  {
-    LOG_ERROR(MYFILES_LOG_MODULE, MYFILES_LOG_PROC, "缺少或类型错误的字段：token");
-    return -1;
-  }
-  strcpy(token, doc["token"].GetString());
-
-  if (!doc.HasMember("start") || !doc["start"].IsInt())
-  {
-    LOG_ERROR(MYFILES_LOG_MODULE, MYFILES_LOG_PROC, "缺少或类型错误的字段：start");
-    return -1;
-  }
-  start = doc["start"].GetInt();
-
-  if (!doc.HasMember("count") || !doc["count"].IsInt())
-  {
-    LOG_ERROR(MYFILES_LOG_MODULE, MYFILES_LOG_PROC, "缺少或类型错误的字段：count\n");
-    return -1;
-  }
-  count = doc["count"].GetInt();
-
-  return 0;
+  const JsonField fields[] = {
+      jsonStr("user", user, USER_NAME_LEN),
+      jsonStr("token", token, TOKEN_LEN),
+      jsonInt("start", &start),
+      jsonInt("count", &count),
+  };
+  return jsonDecode(buf, fields, MYFILES_LOG_PROC);
 }
 
 /**
  * @brief 从数据库中获取用户文件个数
  *
- * @param conn 数据库连接
+ * @param meta 元数据存储
  * @param user 用户名
  *
  * @return long 用户文件个数
  */
-long get_user_files_count(MYSQL *conn, char *user)
+long get_user_files_count(MetaStore *meta, char *user)
 {
-  char sql_cmd[SQL_MAX_LEN] = {0};
-  sprintf(sql_cmd, "select count from user_file_count where user=\"%s\"", user);
-
-  char tmp[512] = {0};
-  // 返回值： 0成功并保存记录集，1没有记录集，2有记录集但是没有保存，-1失败
-  int ret2 = process_result_one(conn, sql_cmd, tmp); // 指向sql语句
-  if (ret2 != 0)
+  long nums = 0;
+  // 返回值： 0成功，1没有记录，-1失败
+  if (meta->userFileCount(user, &nums) != 0)
   {
-    LOG_ERROR(MYFILES_LOG_MODULE, MYFILES_LOG_PROC, "%s 操作失败\n", sql_cmd);
+    LOG_ERROR(MYFILES_LOG_MODULE, MYFILES_LOG_PROC, "%s 查询文件数量失败\n", user);
   }
 
-  long nums = atol(tmp); // 字符串转长整形
   LOG_ERROR(MYFILES_LOG_MODULE, MYFILES_LOG_PROC, "User files's num = %ld\n", nums);
   return nums;
 }
 
 /**
- * @brief 从数据库中获取用户文件列表
- *
- * @param conn 数据库连接
- * @param cmd 指令
- * @param user 用户名
- * @param start 起始位置
- * @param count 个数
+ * @brief 把文件列表结果集序列化为json
  *
- * @return int 0成功，-1失败
+ * @param rows 结果集
+ * @param buffer (out) 序列化结果
  */
-int get_user_filelist(MYSQL *conn, char *cmd, char *user, int start, int count)
+static void filelist_to_json(MetaRows *rows, PoolStringBuffer &buffer)
 {
-  // 成功,返回文件列表信息
-  // 失败：{"code": "015"}
-  char sql_cmd[SQL_MAX_LEN] = {0};
-  rapidjson::Document root;
+  JsonPool &pool = jsonArena(); // 列表的节点和序列化缓冲区都从线程内存池分配
+  PoolDocument root(&pool, 1024, &pool);
+  root.SetObject();
   rapidjson::Value array(rapidjson::kArrayType);
-  rapidjson::StringBuffer buffer;
-  rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
-  MYSQL_RES *res_set = NULL;
+  PoolWriter writer(buffer, &pool);
 
-  if (conn == NULL)
-  {
-    // 验证数据库连接
-    LOG_ERROR(MYFILES_LOG_MODULE, MYFILES_LOG_PROC, "msql_conn err\n");
-    return_myfiles_status(0, -1);
-    return -1;
-  }
+  char **row;
 
-  // 多表指定行范围查询
-  if (strcmp(cmd, "normal") == 0) // 获取用户文件信息
-  {
-    // sql语句
-    sprintf(sql_cmd,
-            "select user_file_list.*, file_info.url, file_info.size, file_info.type from file_info, user_file_list where user = '%s' and file_info.md5 = user_file_list.md5 limit %d, %d",
-            user, start, count);
-  }
-  else if (strcmp(cmd, "pvasc") == 0) // 按下载量升序
-  {
-    // sql语句
-    sprintf(sql_cmd,
-            "select user_file_list.*, file_info.url, file_info.size, file_info.type from file_info, user_file_list where user = '%s' and file_info.md5 = user_file_list.md5  order by pv asc limit %d, %d",
-            user, start, count);
-  }
-  else if (strcmp(cmd, "pvdesc") == 0) // 按下载量降序
-  {
-    // sql语句
-    sprintf(sql_cmd,
-            "select user_file_list.*, file_info.url, file_info.size, file_info.type from file_info, user_file_list where user = '%s' and file_info.md5 = user_file_list.md5 order by pv desc limit %d, %d",
-            user, start, count);
-  }
-  LOG_ERROR(MYFILES_LOG_MODULE, MYFILES_LOG_PROC, "sql_cmd = %s \n", sql_cmd);
-  if (mysql_query(conn, sql_cmd) != 0)
-  {
-    LOG_ERROR(MYFILES_LOG_MODULE, MYFILES_LOG_PROC, "%s 操作失败：%s\n", sql_cmd, mysql_error(conn));
-    return_myfiles_status(-1, -1);
-    return -1;
-  }
-
-  res_set = mysql_store_result(conn); // 获取结果集
-  if (res_set == NULL)
-  {
-    LOG_ERROR(MYFILES_LOG_MODULE, MYFILES_LOG_PROC, "smysql_store_result error: %s!\n", mysql_error(conn));
-    return_myfiles_status(-1, -1);
-    return -1;
-  }
-
-  ulong line = 0;
-  line = mysql_num_rows(res_set); // 返回结果集中的行数
-  if (line == 0)                  // 没有结果
-  {
-    LOG_ERROR(MYFILES_LOG_MODULE, MYFILES_LOG_PROC, "mysql_num_rows(res_set) failed：%s\n", mysql_error(conn));
-    return_myfiles_status(-1, -1);
-    return -1;
-  }
-
-  MYSQL_ROW row;
-
-  // mysql_fetch_row从使用mysql_store_result得到的结果结构中提取一行，并把它放到一个行结构中。
-  // 当数据用完或发生错误时返回NULL.
-  while ((row = mysql_fetch_row(res_set)) != NULL)
+  // 逐行取出，数据用完时返回NULL
+  while ((row = rows->next()) != NULL)
   {
     rapidjson::Value item(rapidjson::kObjectType);
     /*
@@ -285,11 +175,17 @@ int get_user_filelist(MYSQL *conn, char *cmd, char *user, int start, int count)
       item.AddMember("pv", atol(row[5]), root.GetAllocator());
     }
 
-    //-- url 文件url
-    if (row[6] != NULL)
+    //-- url 文件url，打包和压缩存储的文件在storage上不是文件本身，给/dl的下载地址
+    if (row[6] != NULL && row[6][0] != '\0')
     {
       item.AddMember("url", rapidjson::Value().SetString(row[6], root.GetAllocator()), root.GetAllocator());
     }
+    else if (row[0] != NULL && row[1] != NULL && row[3] != NULL)
+    {
+      std::string url;
+      dlUrl(row[0], row[1], row[3], &url);
+      item.AddMember("url", rapidjson::Value().SetString(url.data(), (rapidjson::SizeType)url.size(), root.GetAllocator()), root.GetAllocator());
+    }
 
     //-- size 文件大小, 以字节为单位
     if (row[7] != NULL)
@@ -310,17 +206,63 @@ int get_user_filelist(MYSQL *conn, char *cmd, char *user, int start, int count)
   root.Accept(writer);
 
   LOG_INFO(MYFILES_LOG_MODULE, MYFILES_LOG_PROC, "查询结果：%s\n", buffer.GetString());
-  FCGX_FPrintF(request.out, buffer.GetString()); // 向nginx返回结果
+}
+
+/**
+ * @brief 从数据库中获取用户文件列表
+ *
+ * @param meta 元数据存储
+ * @param cmd 指令
+ * @param user 用户名
+ * @param start 起始位置
+ * @param count 个数
+ *
+ * @return int 0成功，-1失败
+ */
+int get_user_filelist(MetaStore *meta, char *cmd, char *user, int start, int count)
+{
+  // 成功,返回文件列表信息
+  // 失败：{"code": "015"}
+  std::unique_ptr<MetaRows> rows = meta->listUserFiles(cmd, user, start, count);
+  if (rows == nullptr)
+  {
+    LOG_ERROR(MYFILES_LOG_MODULE, MYFILES_LOG_PROC, "%s 获取文件列表失败, cmd = %s\n", user, cmd);
+    return_myfiles_status(-1, -1);
+    return -1;
+  }
 
-  // 完成所有对数据的操作后，调用mysql_free_result来善后处理
-  if (res_set != NULL)
+  if (rows->size() == 0) // 没有结果
   {
-    mysql_free_result(res_set);
+    LOG_ERROR(MYFILES_LOG_MODULE, MYFILES_LOG_PROC, "%s 没有文件, start = %d\n", user, start);
+    return_myfiles_status(-1, -1);
+    return -1;
   }
 
+  PoolStringBuffer buffer(&jsonArena());
+  filelist_to_json(rows.get(), buffer);
+  writeBody(request.out, buffer.GetString(), buffer.GetSize()); // 向nginx返回结果
   return 0;
 }
 
+/**
+ * @brief 把处理结果序列化为json
+ *
+ * @param num 用户文件个数
+ * @param token_flag 验证标志：0为验证失败，1为验证成功，-1为获取文件列表失败
+ * @param buffer (out) 序列化结果
+ */
+static void myfiles_status_json(long num, int token_flag, PoolStringBuffer &buffer)
+{
+  PoolWriter writer(buffer, &jsonArena());
+  writer.StartObject();
+  writer.Key("num");
+  writer.Int64(num);
+  writer.Key("token");
+  writer.String(token_flag == 1 ? "110" : token_flag == -1 ? "015"
+                                                           : "111"); // 验证成功110，失败111
+  writer.EndObject();
+}
+
 /**
  * @brief 向客户端返回处理结果
  *
@@ -329,117 +271,230 @@ int get_user_filelist(MYSQL *conn, char *cmd, char *user, int start, int count)
  */
 void return_myfiles_status(long num, int token_flag)
 {
-  Document doc;
-  doc.SetObject();
-  Document::AllocatorType &allocator = doc.GetAllocator();
-  doc.AddMember("num", num, allocator);
-  doc.AddMember("token", token_flag == 1 ? "110" : token_flag == -1 ? "015"
-                                                                    : "111",
-                allocator); // 验证成功110，失败111
-  StringBuffer buffer;
-  Writer<StringBuffer> writer(buffer);
-  doc.Accept(writer);
-  char *out = strdup(buffer.GetString()); // 动态分配内存,strdup用于复制字符串
-  if (out != nullptr)
-  {
-    FCGX_FPrintF(request.out, out);
-    free(out);
-  }
+  // 序列化缓冲区从线程内存池分配，响应头和body一次写入
+  PoolStringBuffer buffer(&jsonArena());
+  myfiles_status_json(num, token_flag, buffer);
+  writeBody(request.out, buffer.GetString(), buffer.GetSize());
 }
 
-int main()
+// 处理一个文件列表请求
+void myfilesHandler(CgiContext *ctx)
 {
+  char cmd[20] = {0};
+  char user[USER_NAME_LEN] = {0};
+  char token[TOKEN_LEN] = {0};
+  ctx->query->copy("cmd", cmd, sizeof(cmd)); // 请求参数已由框架解析
+  LOG_INFO(MYFILES_LOG_MODULE, MYFILES_LOG_PROC, "cmd = %s\n", cmd);
 
-  FCGX_Init();  // 初始化 FastCGI 环境
-  request = {}; // 在主线程中初始化线程局部变量
-  FCGX_InitRequest(&request, 0, 0);
-
-  // 使用redis-plus-plus库提供的函数连接redis数据库，返回一个Redis对象
-  Redis *redisconn = redis_conn();
+  const char *contentLength = FCGX_GetParam("CONTENT_LENGTH", request.envp);
+  int len = (contentLength == nullptr) ? 0 : atoi(contentLength);
 
-  // 建立一个数据库连接,避免每次注册都要建立连接
-  MYSQL *mysqlconn = NULL;
-  mysqlconn = mysql_conn();
-  if (mysqlconn == nullptr || redisconn == nullptr)
+  if (len <= 0)
   {
-    LOG_ERROR(MYFILES_LOG_MODULE, MYFILES_LOG_PROC, "mysql_conn or redis_conn failed!");
-    return -1;
+    writeNoData(request.out);
+    LOG_WARNING(MYFILES_LOG_MODULE, MYFILES_LOG_PROC, "len = 0, No data from standard input\n");
   }
-
-  while (FCGX_Accept_r(&request) == 0)
+  else
   {
-    char cmd[20];
-    char user[USER_NAME_LEN];
-    char token[TOKEN_LEN];
-    char *query = FCGX_GetParam("QUERY_STRING", request.envp); // 从环境变量中获取请求参数
-
-    query_parse_key_value(query, "cmd", cmd, nullptr);
-    LOG_INFO(MYFILES_LOG_MODULE, MYFILES_LOG_PROC, "cmd = %s\n", cmd);
-
-    const char *contentLength = FCGX_GetParam("CONTENT_LENGTH", request.envp);
-    int len = (contentLength == nullptr) ? 0 : atoi(contentLength);
+    char buf[4 * 1024] = {0};
+    if (len >= (int)sizeof(buf))
+    {
+      LOG_ERROR(MYFILES_LOG_MODULE, MYFILES_LOG_PROC, "len = %d too long\n", len);
+      return_myfiles_status(-1, -1);
+      return;
+    }
+    int ret = FCGX_GetStr(buf, len, request.in); // 从标准输入(web服务器)读取内容
+    if (ret == 0)
+    {
+      LOG_ERROR(MYFILES_LOG_MODULE, MYFILES_LOG_PROC, "FCGX_GetStr(file_buf, len, request.in) err\n");
+      return_myfiles_status(-1, -1);
+      return;
+    }
 
-    FCGX_FPrintF(request.out, "Content-type: text/html\r\n\r\n");
+    LOG_DEBUG(MYFILES_LOG_MODULE, MYFILES_LOG_PROC, "buf = %s\n", buf);
 
-    if (len <= 0)
+    // 1、统计用户文件个数并返回
+    if (strcmp(cmd, "count") == 0)
     {
-      FCGX_FPrintF(request.out, "No data from standard input.<p>\n");
-      LOG_WARNING(MYFILES_LOG_MODULE, MYFILES_LOG_PROC, "len = 0, No data from standard input\n");
+      get_count_info(buf, user, token);
+      if (ctx->tokens->validate(user, token))
+      {
+        // token验证成功，返回用户文件个数
+        return_myfiles_status(get_user_files_count(ctx->meta, user), 1);
+      }
+      else
+      {
+        // token验证失败，返回错误码'111'
+        return_myfiles_status(-1, 0);
+      }
     }
+    // 2、获取用户文件信息并返回
+    // 获取用户文件信息 127.0.0.1:80/myfiles&cmd=normal
+    // 按下载量升序 127.0.0.1:80/myfiles?cmd=pvasc
+    // 按下载量降序127.0.0.1:80/myfiles?cmd=pvdesc
     else
     {
-      char buf[4 * 1024] = {0};
-      int ret = FCGX_GetStr(buf, len, request.in); // 从标准输入(web服务器)读取内容
-      if (ret == 0)
-      {
-        LOG_ERROR(MYFILES_LOG_MODULE, MYFILES_LOG_PROC, "FCGX_GetStr(file_buf, len, request.in) err\n");
-        continue;
-      }
-
-      LOG_DEBUG(MYFILES_LOG_MODULE, MYFILES_LOG_PROC, "buf = %s\n", buf);
+      int start = 0; // 文件起点
+      int count = 0; // 文件个数
+      get_fileslist_info(buf, user, token, start, count);
+      LOG_INFO(MYFILES_LOG_MODULE, MYFILES_LOG_PROC, "user = %s, token = %s, start = %d, count = %d\n", user,
+               token, start, count);
 
-      // 1、统计用户文件个数并返回
-      if (strcmp(cmd, "count") == 0)
+      if (ctx->tokens->validate(user, token))
       {
-        get_count_info(buf, user, token);
-        if (validate_token(redisconn, user, token))
-        {
-          // token验证成功，返回用户文件个数
-          return_myfiles_status(get_user_files_count(mysqlconn, user), 0);
-        }
-        else
-        {
-          // token验证失败，返回错误码'111'
-          return_myfiles_status(-1, 1);
-        }
+        // token验证成功，返回用户文件信息
+        get_user_filelist(ctx->meta, cmd, user, start, count);
       }
-      // 2、获取用户文件信息并返回
-      // 获取用户文件信息 127.0.0.1:80/myfiles&cmd=normal
-      // 按下载量升序 127.0.0.1:80/myfiles?cmd=pvasc
-      // 按下载量降序127.0.0.1:80/myfiles?cmd=pvdesc
       else
       {
-        int start; // 文件起点
-        int count; // 文件个数
-        get_fileslist_info(buf, user, token, start, count);
-        LOG_INFO(MYFILES_LOG_MODULE, MYFILES_LOG_PROC, "user = %s, token = %s, start = %d, count = %d\n", user,
-                 token, start, count);
-
-        if (validate_token(redisconn, user, token))
-        {
-          // token验证成功，返回用户文件信息
-          get_user_filelist(mysqlconn, cmd, user, start, count);
-        }
-        else
-        {
-          // token验证失败，返回错误码'111'
-          return_myfiles_status(-1, 0);
-        }
+        // token验证失败，返回错误码'111'
+        return_myfiles_status(-1, 0);
       }
     }
+  }
+}
 
-    FCGX_Finish_r(&request);
+#ifdef CGI_URING
+// 向客户端返回处理结果(io_uring服务端)
+static void reply_myfiles_status(UringRequest *req, long num, int token_flag)
+{
+  PoolStringBuffer buffer(&jsonArena());
+  myfiles_status_json(num, token_flag, buffer);
+  appendBody(&req->out, buffer.GetString(), buffer.GetSize());
+}
+
+/**
+ * @brief 从数据库中获取用户文件个数，查询期间让出事件循环
+ *
+ * @param pool 当前线程的mysql连接池
+ * @param user 用户名
+ * @param nums (out) 用户文件个数
+ */
+static Task get_user_files_count_async(MysqlPool *pool, const char *user, long *nums)
+{
+  char sql_cmd[SQL_MAX_LEN] = {0};
+  sprintf(sql_cmd, "select count from user_file_count where user=\"%s\"", user);
+
+  char tmp[512] = {0};
+  int ret2 = 0;
+  {
+    MysqlLease lease = co_await pool->acquire();
+    co_await processResultOneAsync(lease.conn(), sql_cmd, tmp, &ret2);
+  }
+  if (ret2 != 0)
+  {
+    LOG_ERROR(MYFILES_LOG_MODULE, MYFILES_LOG_PROC, "%s 操作失败\n", sql_cmd);
   }
 
-  return 0;
+  *nums = atol(tmp);
+  LOG_INFO(MYFILES_LOG_MODULE, MYFILES_LOG_PROC, "User files's num = %ld\n", *nums);
+}
+
+/**
+ * @brief 从数据库中获取用户文件列表并写入响应，查询期间让出事件循环
+ *
+ * @param req 请求
+ * @param pool 当前线程的mysql连接池
+ * @param cmd 指令
+ * @param user 用户名
+ * @param start 起始位置
+ * @param count 个数
+ */
+static Task get_user_filelist_async(UringRequest *req, MysqlPool *pool, const char *cmd, const char *user,
+                                    int start, int count)
+{
+  char sql_cmd[SQL_MAX_LEN] = {0};
+  if (makeFileListSql(sql_cmd, cmd, user, start, count) != 0)
+  {
+    reply_myfiles_status(req, -1, -1);
+    co_return;
+  }
+
+  MYSQL_RES *res_set = NULL;
+  int ret = 0;
+  {
+    // 结果集已全部读到客户端内存，取回后连接即可归还
+    MysqlLease lease = co_await pool->acquire();
+    co_await mysqlQueryAsync(lease.conn(), sql_cmd, &res_set, &ret);
+  }
+  if (ret != 0 || mysql_num_rows(res_set) == 0)
+  {
+    LOG_ERROR(MYFILES_LOG_MODULE, MYFILES_LOG_PROC, "%s 没有结果或查询失败\n", sql_cmd);
+    if (res_set != NULL)
+    {
+      mysql_free_result(res_set);
+    }
+    reply_myfiles_status(req, -1, -1);
+    co_return;
+  }
+
+  PoolStringBuffer buffer(&jsonArena());
+  MysqlRows rows(res_set);
+  filelist_to_json(&rows, buffer);
+  appendBody(&req->out, buffer.GetString(), buffer.GetSize());
+}
+
+// 处理一个文件列表请求(io_uring服务端)：与myfilesHandler相同，mysql查询是异步的
+Task myfilesUringHandler(UringRequest *req, CgiContext *ctx)
+{
+  char cmd[20] = {0};
+  char user[USER_NAME_LEN] = {0};
+  char token[TOKEN_LEN] = {0};
+  ctx->query->copy("cmd", cmd, sizeof(cmd));
+  LOG_INFO(MYFILES_LOG_MODULE, MYFILES_LOG_PROC, "cmd = %s\n", cmd);
+
+  if (req->body_len == 0)
+  {
+    appendNoData(&req->out);
+    LOG_WARNING(MYFILES_LOG_MODULE, MYFILES_LOG_PROC, "len = 0, No data from standard input\n");
+    co_return;
+  }
+
+  char buf[4 * 1024] = {0};
+  if (req->body_len >= sizeof(buf) || req->spool_fd >= 0)
+  {
+    LOG_ERROR(MYFILES_LOG_MODULE, MYFILES_LOG_PROC, "len = %zu too long\n", req->body_len);
+    reply_myfiles_status(req, -1, -1);
+    co_return;
+  }
+  memcpy(buf, req->body.data(), req->body.size());
+
+  // redis的token验证仍是同步的，通常在本机，耗时远小于mysql查询
+  if (strcmp(cmd, "count") == 0)
+  {
+    get_count_info(buf, user, token);
+    if (ctx->tokens->validate(user, token))
+    {
+      long nums = 0;
+      co_await get_user_files_count_async(ctx->mysql_pool, user, &nums);
+      reply_myfiles_status(req, nums, 1);
+    }
+    else
+    {
+      reply_myfiles_status(req, -1, 0);
+    }
+  }
+  else
+  {
+    int start = 0;
+    int count = 0;
+    get_fileslist_info(buf, user, token, start, count);
+    if (ctx->tokens->validate(user, token))
+    {
+      co_await get_user_filelist_async(req, ctx->mysql_pool, cmd, user, start, count);
+    }
+    else
+    {
+      reply_myfiles_status(req, -1, 0);
+    }
+  }
+}
+#endif
+
+#ifndef CGI_GATEWAY
+int main()
+{
+  const CgiRoute route = {"/myfiles", nullptr, myfilesHandler, nullptr};
+  return runCgi(&route, 1);
 }
+#endif
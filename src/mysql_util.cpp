@@ -1,5 +1,7 @@
 #include "mysql_util.h"
 
+#include "metrics_util.h"
+
 /**
  * @brief 连接redis
  *
@@ -110,6 +112,23 @@ MYSQL *mysqlConn() {
   return conn;
 }
 
+/**
+ * @brief 执行sql语句，耗时计入mysql依赖的直方图
+ *
+ * @param conn 数据库连接
+ * @param sql_cmd sql语句
+ *
+ * @return 同mysql_query，0成功
+ */
+int mysqlQuery(MYSQL *conn, const char *sql_cmd) {
+  MetricTimer timer(DEP_MYSQL);
+  int ret = mysql_query(conn, sql_cmd);
+  if (ret != 0) {
+    timer.fail();
+  }
+  return ret;
+}
+
 /**
  * @brief 处理数据库查询结果，结果集保存在buf，只处理一条记录，一个字段,
  * 如果buf为nullptr，无需保存结果集，只做判断有没有此记录
@@ -125,7 +144,7 @@ int processResultOne(MYSQL *conn, const char *sql_cmd, char *buf) {
   int ret = 0;
 
   do {
-    if (mysql_query(conn, sql_cmd) != 0) {
+    if (mysqlQuery(conn, sql_cmd) != 0) {
       // 执行sql语句，执行成功返回0
       LOG_ERROR(MYSQL_LOG_MODULE, MYSQL_LOG_PROC,
                 "mysql_query error! sql_cmd=%s", sql_cmd);
@@ -30,6 +30,9 @@ MYSQL *mysqlConn();
 // 连接redis
 sw::redis::Redis *redisConn();
 
+// 执行sql语句，同mysql_query，并记录耗时(metrics_util.h)
+int mysqlQuery(MYSQL *conn, const char *sql_cmd);
+
 // 处理数据库查询结果，结果集保存在buf，只处理一条记录，一个字段,
 // 如果buf为nullptr，无需保存结果集，只做判断有没有此记录
 int processResultOne(MYSQL *conn, const char *sql_cmd, char *buf);
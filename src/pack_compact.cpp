@@ -0,0 +1,232 @@
+/**
+ * @file pack_compact.cpp
+ * @brief 小文件容器压缩任务：把已写满容器中仍被引用的文件搬到新容器，回收已删除文件占用的空间
+ *        file_info.count 减为0的文件视为已删除，由crontab定期执行
+ * @author ward
+ * @version 1.0
+ * @date 2023年6月5日
+ */
+
+#include <fcntl.h>
+#include <mysql/mysql.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "cgi_util.h"
+#include "make_log.h"
+#include "mysql_util.h"
+#include "pack_util.h"
+#include "storage_util.h"
+
+using namespace std;
+
+// 容器中仍被引用的文件
+struct PackEntry {
+  string md5;
+  long offset;
+  long length;
+};
+
+/**
+ * @brief 把容器中的一段拷贝成单独的本地文件
+ *
+ * @param src_fd     容器本地文件
+ * @param offset     起始偏移
+ * @param length     长度
+ * @param local_file 输出文件名
+ *
+ * @return 0成功，-1失败
+ */
+int extractEntry(int src_fd, long offset, long length, const char *local_file) {
+  int fd = open(local_file, O_CREAT | O_WRONLY | O_TRUNC, 0644);
+  if (fd < 0) {
+    LOG_ERROR(PACK_LOG_MODULE, PACK_LOG_PROC, "open %s error\n", local_file);
+    return -1;
+  }
+
+  char buf[64 * 1024];
+  while (length > 0) {
+    size_t want = length < (long)sizeof(buf) ? length : sizeof(buf);
+    ssize_t n = pread(src_fd, buf, want, offset);
+    if (n <= 0 || write(fd, buf, n) != n) {
+      LOG_ERROR(PACK_LOG_MODULE, PACK_LOG_PROC, "extract %s error\n",
+                local_file);
+      close(fd);
+      return -1;
+    }
+    offset += n;
+    length -= n;
+  }
+
+  close(fd);
+  return 0;
+}
+
+/**
+ * @brief 压缩一个已写满的容器
+ *
+ * @param conn    数据库连接
+ * @param cfg     打包配置
+ * @param id      容器编号
+ * @param fileid  容器文件id
+ * @param size    容器大小
+ *
+ * @return 0成功(或无需压缩)，-1失败
+ */
+int compactContainer(MYSQL *conn, const PackConfig *cfg, long id,
+                     const char *fileid, long size) {
+  char sql_cmd[SQL_MAX_LEN] = {0};
+  char tmp[TEMP_BUF_MAX_LEN] = {0};
+  char local_file[FILE_NAME_LEN] = {0};
+  char part_file[FILE_NAME_LEN] = {0};
+  MYSQL_RES *res_set = nullptr;
+  MYSQL_ROW row;
+  vector<PackEntry> entries;
+  int ret = 0;
+
+  // 统计仍被引用的字节数
+  sprintf(sql_cmd,
+          "select sum(pack_length) from file_info where file_id = '%s' and "
+          "pack_offset is not null and count > 0",
+          fileid);
+  if (processResultOne(conn, sql_cmd, tmp) < 0) {
+    return -1;
+  }
+  long live = atol(tmp);
+  if (size > 0 && live >= cfg->compact_ratio * size) {
+    LOG_DEBUG(PACK_LOG_MODULE, PACK_LOG_PROC, "%s live %ld/%ld, 无需压缩\n",
+              fileid, live, size);
+    return 0;
+  }
+
+  sprintf(sql_cmd,
+          "select md5, pack_offset, pack_length from file_info where file_id "
+          "= '%s' and pack_offset is not null and count > 0",
+          fileid);
+  if (mysql_query(conn, sql_cmd) != 0 ||
+      (res_set = mysql_store_result(conn)) == nullptr) {
+    LOG_ERROR(PACK_LOG_MODULE, PACK_LOG_PROC, "%s 操作失败: %s\n", sql_cmd,
+              mysql_error(conn));
+    return -1;
+  }
+  while ((row = mysql_fetch_row(res_set)) != nullptr) {
+    entries.push_back({row[0], atol(row[1]), atol(row[2])});
+  }
+  mysql_free_result(res_set);
+
+  snprintf(local_file, sizeof(local_file), "compact_%ld", id);
+  snprintf(part_file, sizeof(part_file), "compact_%ld_part", id);
+  if (!entries.empty() && downloadFromStorage(fileid, local_file) != 0) {
+    return -1;
+  }
+
+  int src_fd = entries.empty() ? -1 : open(local_file, O_RDONLY);
+  for (const PackEntry &e : entries) {
+    char new_fileid[TEMP_BUF_MAX_LEN] = {0};
+    char new_url[FILE_URL_LEN] = {0};
+    long new_offset = 0;
+    long new_length = 0;
+
+    // 搬到当前可追加的容器
+    if (src_fd < 0 ||
+        extractEntry(src_fd, e.offset, e.length, part_file) != 0 ||
+        packToStorage(conn, cfg, part_file, new_fileid, new_url, &new_offset,
+                      &new_length) != 0) {
+      ret = -1;
+      break;
+    }
+    sprintf(sql_cmd,
+            "update file_info set file_id = '%s', url = '%s', pack_offset = "
+            "%ld, pack_length = %ld where md5 = '%s'",
+            new_fileid, new_url, new_offset, new_length, e.md5.c_str());
+    if (mysql_query(conn, sql_cmd) != 0) {
+      LOG_ERROR(PACK_LOG_MODULE, PACK_LOG_PROC, "%s 操作失败: %s\n", sql_cmd,
+                mysql_error(conn));
+      ret = -1;
+      break;
+    }
+  }
+  if (src_fd >= 0) {
+    close(src_fd);
+  }
+  unlink(local_file);
+  unlink(part_file);
+  if (ret != 0) {
+    // 已搬走的文件索引已更新，下次执行时继续
+    return ret;
+  }
+
+  // 清理已删除的文件记录，删除旧容器
+  sprintf(sql_cmd,
+          "delete from file_info where file_id = '%s' and pack_offset is not "
+          "null and count <= 0",
+          fileid);
+  if (mysql_query(conn, sql_cmd) != 0) {
+    LOG_ERROR(PACK_LOG_MODULE, PACK_LOG_PROC, "%s 操作失败: %s\n", sql_cmd,
+              mysql_error(conn));
+    return -1;
+  }
+  if (deleteFromStorage(fileid) != 0) {
+    return -1;
+  }
+  sprintf(sql_cmd, "delete from pack_container where id = %ld", id);
+  if (mysql_query(conn, sql_cmd) != 0) {
+    LOG_ERROR(PACK_LOG_MODULE, PACK_LOG_PROC, "%s 操作失败: %s\n", sql_cmd,
+              mysql_error(conn));
+    return -1;
+  }
+
+  LOG_INFO(PACK_LOG_MODULE, PACK_LOG_PROC,
+           "容器 %s 压缩完成，搬移 %zu 个文件，回收 %ld 字节\n", fileid,
+           entries.size(), size - live);
+  return 0;
+}
+
+int main() {
+  MYSQL *conn = mysqlConn();
+  if (conn == nullptr) {
+    LOG_ERROR(PACK_LOG_MODULE, PACK_LOG_PROC, "mysqlConn failed!");
+    return -1;
+  }
+
+  PackConfig cfg;
+  getPackConfig(&cfg);
+
+  struct Container {
+    long id;
+    string fileid;
+    long size;
+  };
+  vector<Container> containers;
+
+  MYSQL_RES *res_set = nullptr;
+  MYSQL_ROW row;
+  if (mysql_query(conn,
+                  "select id, file_id, size from pack_container where "
+                  "status = 1") != 0 ||
+      (res_set = mysql_store_result(conn)) == nullptr) {
+    LOG_ERROR(PACK_LOG_MODULE, PACK_LOG_PROC, "查询容器失败: %s\n",
+              mysql_error(conn));
+    mysql_close(conn);
+    return -1;
+  }
+  while ((row = mysql_fetch_row(res_set)) != nullptr) {
+    containers.push_back({atol(row[0]), row[1], atol(row[2])});
+  }
+  mysql_free_result(res_set);
+
+  int failed = 0;
+  for (const Container &c : containers) {
+    if (compactContainer(conn, &cfg, c.id, c.fileid.c_str(), c.size) != 0) {
+      failed++;
+    }
+  }
+
+  mysql_close(conn);
+  return failed == 0 ? 0 : -1;
+}
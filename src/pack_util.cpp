@@ -0,0 +1,404 @@
+#include "pack_util.h"
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include "compress_util.h"
+#include "metrics_util.h"
+#include "storage_util.h"
+#include "trace_util.h"
+
+/**
+ * @brief  从cfg.json中读取打包配置，缺少pack配置时关闭打包
+ *
+ * @param cfg (out) 打包配置
+ *
+ * @return 0 成功，-1 失败
+ */
+int getPackConfig(PackConfig *cfg) {
+  string enable, threshold, container_size, compact_ratio, lease_s;
+
+  cfg->enable = false;
+  cfg->threshold = 64 * 1024;
+  cfg->container_size = 64 * 1024 * 1024;
+  cfg->compact_ratio = 0.5;
+  cfg->lease_s = 300;
+
+  if (getCfgValue(CFG_PATH, "pack", "enable", enable) != 0) {
+    return 0;
+  }
+  cfg->enable = (enable == "1");
+  if (getCfgValue(CFG_PATH, "pack", "threshold", threshold) == 0) {
+    cfg->threshold = atol(threshold.c_str());
+  }
+  if (getCfgValue(CFG_PATH, "pack", "container_size", container_size) == 0) {
+    cfg->container_size = atol(container_size.c_str());
+  }
+  if (getCfgValue(CFG_PATH, "pack", "compact_ratio", compact_ratio) == 0) {
+    cfg->compact_ratio = atof(compact_ratio.c_str());
+  }
+  if (getCfgValue(CFG_PATH, "pack", "lease_s", lease_s) == 0 &&
+      atoi(lease_s.c_str()) > 0) {
+    cfg->lease_s = atoi(lease_s.c_str());
+  }
+
+  if (cfg->threshold <= 0 || cfg->container_size < cfg->threshold) {
+    LOG_ERROR(PACK_LOG_MODULE, PACK_LOG_PROC,
+              "pack threshold %ld / container_size %ld 配置错误",
+              cfg->threshold, cfg->container_size);
+    cfg->enable = false;
+    return -1;
+  }
+
+  LOG_INFO(PACK_LOG_MODULE, PACK_LOG_PROC,
+           "pack enable = %d, threshold = %ld, container_size = %ld",
+           cfg->enable, cfg->threshold, cfg->container_size);
+  return 0;
+}
+
+/**
+ * @brief  文件是否应该打包
+ *
+ * @param cfg  打包配置
+ * @param size 文件大小
+ *
+ * @return true 打包，false 单独存储
+ */
+bool shouldPack(const PackConfig *cfg, long size) {
+  return cfg->enable && size > 0 && size <= cfg->threshold;
+}
+
+/**
+ * @brief  租用一个放得下size字节的容器：短事务中加行锁选出容器并标记为status=2，
+ *         提交后行锁即释放，追加在事务之外进行
+ *
+ * @return 1 租到，0 没有可用的容器，-1 失败
+ */
+static int claimContainer(MYSQL *conn, const PackConfig *cfg, long size,
+                          long *id, char *fileid, char *fdfs_file_url,
+                          long *known_size) {
+  char sql_cmd[SQL_MAX_LEN] = {0};
+  MYSQL_RES *res_set = nullptr;
+  MYSQL_ROW row;
+  int ret = 0;
+
+  if (mysqlQuery(conn, "start transaction") != 0) {
+    LOG_ERROR(PACK_LOG_MODULE, PACK_LOG_PROC, "start transaction: %s\n",
+              mysql_error(conn));
+    return -1;
+  }
+  do {
+    // 租约过期的容器，上一个上传已经失败或崩溃，可以接手
+    sprintf(sql_cmd,
+            "select id, file_id, url, size from pack_container where "
+            "(status = 0 or (status = 2 and lease_until < now())) and "
+            "size + %ld <= %ld order by id desc limit 1 for update",
+            size, cfg->container_size);
+    if (mysqlQuery(conn, sql_cmd) != 0 ||
+        (res_set = mysql_store_result(conn)) == nullptr) {
+      LOG_ERROR(PACK_LOG_MODULE, PACK_LOG_PROC, "查询容器失败: %s\n",
+                mysql_error(conn));
+      ret = -1;
+      break;
+    }
+    if ((row = mysql_fetch_row(res_set)) != nullptr) {
+      *id = atol(row[0]);
+      strcpy(fileid, row[1]);
+      strcpy(fdfs_file_url, row[2]);
+      *known_size = atol(row[3]);
+      ret = 1;
+    }
+    mysql_free_result(res_set);
+    if (ret == 0) {
+      break;
+    }
+
+    sprintf(sql_cmd,
+            "update pack_container set status = 2, lease_until = "
+            "date_add(now(), interval %d second) where id = %ld",
+            cfg->lease_s, *id);
+    if (mysqlQuery(conn, sql_cmd) != 0) {
+      LOG_ERROR(PACK_LOG_MODULE, PACK_LOG_PROC, "%s 操作失败: %s\n",
+                sql_cmd, mysql_error(conn));
+      ret = -1;
+    }
+  } while (false);
+
+  if (ret < 0) {
+    mysqlQuery(conn, "rollback");
+    return -1;
+  }
+  if (mysqlQuery(conn, "commit") != 0) {
+    LOG_ERROR(PACK_LOG_MODULE, PACK_LOG_PROC, "commit: %s\n",
+              mysql_error(conn));
+    return -1;
+  }
+  return ret;
+}
+
+/**
+ * @brief  归还租用的容器，记下新的大小；剩余空间放不下最大的小文件时标记为写满
+ *         归还失败时容器在租约到期后由其他上传接手，已追加的文件不受影响
+ */
+static void releaseContainer(MYSQL *conn, const PackConfig *cfg, long id,
+                             long size) {
+  char sql_cmd[SQL_MAX_LEN] = {0};
+  sprintf(sql_cmd,
+          "update pack_container set size = %ld, status = %d, lease_until = "
+          "null where id = %ld and status = 2",
+          size, size + cfg->threshold > cfg->container_size ? 1 : 0, id);
+  if (mysqlQuery(conn, sql_cmd) != 0) {
+    LOG_ERROR(PACK_LOG_MODULE, PACK_LOG_PROC, "%s 操作失败: %s\n", sql_cmd,
+              mysql_error(conn));
+  }
+}
+
+/**
+ * @brief  把本地小文件追加到可追加的容器中
+ *         容器由claimContainer租用，同一时刻只有一个上传在追加；
+ *         偏移取追加后容器的实际大小减去文件大小，不依赖数据库中的size
+ *
+ * @param conn          数据库连接
+ * @param cfg           打包配置
+ * @param filename      本地文件名
+ * @param fileid        (out) 容器的文件id
+ * @param fdfs_file_url (out) 容器的完整url
+ * @param p_offset      (out) 文件在容器中的偏移
+ * @param p_length      (out) 文件在容器中的长度
+ *
+ * @return 0 成功，-1 失败
+ */
+int packToStorage(MYSQL *conn, const PackConfig *cfg, const char *filename,
+                  char *fileid, char *fdfs_file_url, long *p_offset,
+                  long *p_length) {
+  char sql_cmd[SQL_MAX_LEN] = {0};
+  long container_id = -1;
+  long known_size = 0;
+  MetricTimer timer(DEP_STORAGE_PACK);
+
+  // 以本地文件的实际大小为准
+  struct stat st;
+  if (stat(filename, &st) != 0) {
+    LOG_ERROR(PACK_LOG_MODULE, PACK_LOG_PROC, "stat %s error\n", filename);
+    timer.fail();
+    return -1;
+  }
+  long size = st.st_size;
+  *p_length = size;
+
+  int ret = claimContainer(conn, cfg, size, &container_id, fileid,
+                           fdfs_file_url, &known_size);
+  if (ret < 0) {
+    timer.fail();
+    return -1;
+  }
+
+  if (ret == 1) {
+    // 追加后的实际大小减去文件大小即偏移；追加失败时按实际大小归还
+    long real_size = -1;
+    ret = appendToStorage(fileid, filename);
+    if (appenderSize(fileid, &real_size) != 0) {
+      // 不知道实际大小，保持租约，到期后由其他上传接手
+      ret = -1;
+    } else if (ret == 0 && real_size - size < known_size) {
+      // 比数据库记录的还小，说明有别的进程在动这个容器
+      LOG_ERROR(PACK_LOG_MODULE, PACK_LOG_PROC,
+                "容器 %s 大小 %ld 小于记录的 %ld\n", fileid, real_size,
+                known_size);
+      ret = -1;
+    } else {
+      releaseContainer(conn, cfg, container_id, real_size);
+    }
+    if (ret != 0) {
+      timer.fail();
+      return -1;
+    }
+    *p_offset = real_size - size;
+  } else {
+    // 没有空闲的容器，以该文件为起点新建容器，新的行不需要锁
+    fileid[0] = '\0';
+    fdfs_file_url[0] = '\0';
+    if (uploadAppenderToStorage(filename, fileid) != 0 ||
+        makeFileUrl(fileid, fdfs_file_url) != 0) {
+      timer.fail();
+      return -1;
+    }
+    *p_offset = 0;
+    sprintf(sql_cmd,
+            "insert into pack_container (file_id, url, size, status) values "
+            "('%s', '%s', %ld, %d)",
+            fileid, fdfs_file_url, size,
+            size + cfg->threshold > cfg->container_size ? 1 : 0);
+    if (mysqlQuery(conn, sql_cmd) != 0) {
+      LOG_ERROR(PACK_LOG_MODULE, PACK_LOG_PROC, "%s 操作失败: %s\n", sql_cmd,
+                mysql_error(conn));
+      deleteFromStorage(fileid);
+      timer.fail();
+      return -1;
+    }
+  }
+
+  LOG_INFO(PACK_LOG_MODULE, PACK_LOG_PROC, "%s 打包到 %s, offset = %ld\n",
+           filename, fileid, *p_offset);
+  return 0;
+}
+
+/**
+ * @brief  记录文件在容器中的位置
+ *
+ * @param conn   数据库连接
+ * @param md5    文件md5
+ * @param offset 文件在容器中的偏移
+ * @param length 文件在容器中的长度
+ *
+ * @return 0 成功，-1 失败
+ */
+int savePackIndex(MYSQL *conn, const char *md5, long offset, long length) {
+  char sql_cmd[SQL_MAX_LEN] = {0};
+  sprintf(sql_cmd,
+          "update file_info set pack_offset = %ld, pack_length = %ld where md5 "
+          "= '%s'",
+          offset, length, md5);
+  if (mysqlQuery(conn, sql_cmd) != 0) {
+    LOG_ERROR(PACK_LOG_MODULE, PACK_LOG_PROC, "%s 操作失败: %s\n", sql_cmd,
+              mysql_error(conn));
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * @brief  按md5把存储中的文件取到本地，得到的是解码后的原始内容
+ *         单独存储的文件整体下载，打包的文件按(offset, length)做一次范围读，
+ *         压缩存储的文件下载后再解压
+ *
+ * @param conn       数据库连接
+ * @param md5        文件md5
+ * @param local_file 本地保存的文件名
+ *
+ * @return 0 成功，-1 失败
+ */
+int fetchStoredFile(MYSQL *conn, const char *md5, const char *local_file) {
+  char sql_cmd[SQL_MAX_LEN] = {0};
+  MYSQL_RES *res_set = nullptr;
+  MYSQL_ROW row;
+  string fileid;
+  long offset = -1;
+  long length = 0;
+  bool compressed = false;
+
+  sprintf(sql_cmd,
+          "select file_id, pack_offset, pack_length, codec from file_info "
+          "where md5 = '%s'",
+          md5);
+  if (mysqlQuery(conn, sql_cmd) != 0 ||
+      (res_set = mysql_store_result(conn)) == nullptr) {
+    LOG_ERROR(PACK_LOG_MODULE, PACK_LOG_PROC, "%s 操作失败: %s\n", sql_cmd,
+              mysql_error(conn));
+    return -1;
+  }
+  if ((row = mysql_fetch_row(res_set)) == nullptr || row[0] == nullptr) {
+    LOG_ERROR(PACK_LOG_MODULE, PACK_LOG_PROC, "没有文件 %s\n", md5);
+    mysql_free_result(res_set);
+    return -1;
+  }
+  fileid = row[0];
+  if (row[1] != nullptr && row[2] != nullptr) {
+    offset = atol(row[1]);
+    length = atol(row[2]);
+  }
+  compressed = (row[3] != nullptr && strcmp(row[3], CODEC_ZSTD) == 0);
+  mysql_free_result(res_set);
+
+  // 压缩存储的先下载到临时文件
+  string stored_file = compressed ? string(local_file) + ".zst" : local_file;
+  int ret = (offset < 0)
+                ? downloadFromStorage(fileid.c_str(), stored_file.c_str())
+                : downloadRangeFromStorage(fileid.c_str(), offset, length,
+                                           stored_file.c_str());
+  if (ret != 0 || !compressed) {
+    return ret;
+  }
+
+  ret = decompressFile(stored_file.c_str(), local_file);
+  unlink(stored_file.c_str());
+  return ret;
+}
+
+/**
+ * @brief  把本地文件存入分布式存储并写入mysql，各阶段记在trace中
+ *
+ * @param conn         数据库连接，打包和存储编码用
+ * @param meta         元数据存储
+ * @param blobs        单独存储的文件上传到这里
+ * @param trace        当前请求的追踪，可以为nullptr
+ * @param pack_cfg     小文件打包配置
+ * @param compress_cfg 入库压缩配置
+ * @param user         用户名
+ * @param filename     文件名
+ * @param md5          文件md5
+ * @param size         文件原始大小
+ * @param local_file   本地文件，压缩时被替换为压缩后的内容
+ *
+ * @returns 0 成功，-1 失败
+ */
+int storeLocalFile(MYSQL *conn, MetaStore *meta, BlobStore *blobs,
+                   RequestTrace *trace, const PackConfig *pack_cfg,
+                   const CompressConfig *compress_cfg, const char *user,
+                   const char *filename, const char *md5, long size,
+                   const char *local_file) {
+  char fileid[TEMP_BUF_MAX_LEN] = {0};     // 文件上传到fastDFS后的文件id
+  char fdfs_file_url[FILE_URL_LEN] = {0};  // 文件的完整url
+  long pack_offset = -1;  // 打包时文件在容器中的偏移，-1为单独存储
+  long pack_length = 0;   // 打包时文件在容器中的长度
+  const char *codec = CODEC_NONE;  // 文件的存储编码
+
+  // 文本类文件压缩后再存储，已压缩的格式按magic跳过
+  {
+    TraceSpan span(trace, "compress");
+    char suffix[SUFFIX_LEN] = {0};
+    getFileSuffix(filename, suffix);
+    if (compressLocalFile(compress_cfg, suffix, local_file, &codec) != 0) {
+      return -1;
+    }
+  }
+
+  if (shouldPack(pack_cfg, size)) {
+    // 小文件追加到容器中，file_id和url为容器的
+    TraceSpan span(trace, "pack");
+    if (packToStorage(conn, pack_cfg, local_file, fileid, fdfs_file_url,
+                      &pack_offset, &pack_length) < 0) {
+      return -1;
+    }
+  } else {
+    {
+      TraceSpan span(trace, "fdfs_upload");
+      if (blobs->upload(local_file, fileid) < 0) {
+        return -1;
+      }
+    }
+    TraceSpan span(trace, "file_url");
+    if (blobs->fileUrl(fileid, fdfs_file_url) < 0) {
+      return -1;
+    }
+  }
+
+  TraceSpan span(trace, "mysql");
+  if (storeFileinfoToMysql(meta, user, filename, md5, size, fileid,
+                           fdfs_file_url) < 0) {
+    return -1;
+  }
+  if (pack_offset >= 0 &&
+      savePackIndex(conn, md5, pack_offset, pack_length) < 0) {
+    return -1;
+  }
+  if (strcmp(codec, CODEC_NONE) != 0 && saveFileCodec(conn, md5, codec) < 0) {
+    return -1;
+  }
+  return 0;
+}
@@ -0,0 +1,83 @@
+#ifndef PACK_UTIL_H
+#define PACK_UTIL_H
+
+#include <mysql/mysql.h>
+
+#include "backend_util.h"
+#include "cgi_util.h"
+#include "compress_util.h"
+#include "make_log.h"
+#include "mysql_util.h"
+
+const char *const PACK_LOG_MODULE = "cgi";
+const char *const PACK_LOG_PROC = "pack";
+
+/*
+   小文件打包：小于阈值的文件追加到fastDFS的appender容器文件中，
+   file_info.file_id 保存容器的文件id，(pack_offset, pack_length) 为文件在容器中的位置，
+   未打包的文件这两列为NULL。
+
+   -- alter table file_info add column pack_offset bigint default null,
+   --                       add column pack_length bigint default null;
+
+   -- =============================================== 容器文件表
+   -- id 容器编号
+   -- file_id 容器在fastDFS中的文件id
+   -- url 容器的完整url
+   -- size 容器已知的大小，只用于挑选放得下的容器
+   -- status 0为可追加，1为已写满，2为正在被一个上传追加
+   -- lease_until status为2时的租约到期时间，到期后其他上传可以接手
+   -- create table pack_container (id int auto_increment primary key,
+   --   file_id varchar(256) not null, url varchar(512) not null,
+   --   size bigint not null default 0, status int not null default 0,
+   --   lease_until datetime default null);
+   -- alter table pack_container add column lease_until datetime default null;
+
+   追加时先用一个短事务把容器标记为status=2(租约)，提交后再调用fdfs工具，
+   行锁不跨fork/exec；同一时刻一个容器只有一个上传在追加，其他上传换一个容器
+   或新建容器。文件的偏移取追加后storage上容器的实际大小减去文件大小，
+   数据库中的size即使因为失败或崩溃没有更新，下一个文件的偏移也不会错。
+
+   cfg.json:
+   "pack": {"enable": "1", "threshold": "65536",
+            "container_size": "67108864", "compact_ratio": "0.5",
+            "lease_s": "300"}
+*/
+
+// 打包配置
+struct PackConfig {
+  bool enable;           // 是否开启打包
+  long threshold;        // 小于等于该大小的文件才打包
+  long container_size;   // 单个容器文件的大小上限
+  double compact_ratio;  // 容器有效数据占比低于该值时压缩
+  int lease_s;           // 追加容器的租约，需长于一次追加的耗时
+};
+
+// 从cfg.json中读取打包配置，没有配置时关闭打包
+int getPackConfig(PackConfig *cfg);
+
+// 文件是否应该打包
+bool shouldPack(const PackConfig *cfg, long size);
+
+// 把本地小文件追加到容器中，得到容器的文件id、url以及文件在容器中的位置
+int packToStorage(MYSQL *conn, const PackConfig *cfg, const char *filename,
+                  char *fileid, char *fdfs_file_url, long *p_offset,
+                  long *p_length);
+
+// 记录文件在容器中的位置
+int savePackIndex(MYSQL *conn, const char *md5, long offset, long length);
+
+// 按md5把存储中的文件取到本地并解码，打包的文件只做一次范围读
+int fetchStoredFile(MYSQL *conn, const char *md5, const char *local_file);
+
+class RequestTrace;
+
+// 上传和差量重建的新文件共用的入库流程：入库压缩 -> 打包或单独存储 ->
+// file_info、user_file_list、打包位置和存储编码写入mysql
+int storeLocalFile(MYSQL *conn, MetaStore *meta, BlobStore *blobs,
+                   RequestTrace *trace, const PackConfig *pack_cfg,
+                   const CompressConfig *compress_cfg, const char *user,
+                   const char *filename, const char *md5, long size,
+                   const char *local_file);
+
+#endif
@@ -0,0 +1,499 @@
+#include "prefork_util.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "cgi_util.h"
+#include "make_log.h"
+
+// master通过环境变量告诉exec后的worker自己的身份
+#define PREFORK_WORKER_ENV "FILEHUB_WORKER"
+#define PREFORK_READY_ENV "FILEHUB_READY_FD"
+
+// worker连续运行超过这个时间后，崩溃计数清零
+static const long PREFORK_STABLE_MS = 10000;
+
+// 一个worker进程
+struct PreforkWorker {
+  pid_t pid;
+  int slot;         // 第几个worker，决定绑定的CPU
+  int generation;   // 第几代，热重启时加1
+  bool draining;    // 已发送SIGTERM，退出后不再重启
+  long started_ms;  // 启动时间
+  long kill_ms;     // 超过这个时间还没退出则SIGKILL，0表示不限
+};
+
+// 一个worker位置的重启状态
+struct PreforkSlot {
+  int crashes = 0;     // 连续崩溃次数
+  long respawn_ms = 0; // 计划重启的时间，0表示不需要重启
+};
+
+static volatile sig_atomic_t worker_draining = 0;
+
+static long nowMs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+}
+
+static int cfgInt(const char *key, int def) {
+  string value;
+  if (getCfgValue(CFG_PATH, "prefork", key, value) != 0) {
+    return def;
+  }
+  return atoi(value.c_str());
+}
+
+/**
+ * @brief  从cfg.json中读取prefork配置
+ *
+ * @param cfg (out) 配置
+ *
+ * @return 0 成功
+ */
+int getPreforkConfig(PreforkConfig *cfg) {
+  *cfg = PreforkConfig();
+  cfg->workers = cfgInt("workers", cfg->workers);
+  cfg->backoff_min_ms = cfgInt("backoff_min_ms", cfg->backoff_min_ms);
+  cfg->backoff_max_ms = cfgInt("backoff_max_ms", cfg->backoff_max_ms);
+  cfg->ready_timeout_s = cfgInt("ready_timeout_s", cfg->ready_timeout_s);
+  cfg->drain_timeout_s = cfgInt("drain_timeout_s", cfg->drain_timeout_s);
+  string value;
+  if (getCfgValue(CFG_PATH, "prefork", "pin_cpu", value) == 0) {
+    cfg->pin_cpu = value != "0" && value != "false";
+  }
+  if (cfg->backoff_min_ms <= 0) cfg->backoff_min_ms = 1;
+  if (cfg->backoff_max_ms < cfg->backoff_min_ms) {
+    cfg->backoff_max_ms = cfg->backoff_min_ms;
+  }
+  return 0;
+}
+
+class PreforkMaster {
+ public:
+  PreforkMaster(const PreforkConfig &cfg, int listen_fd, const char *exe)
+      : cfg_(cfg), listen_fd_(listen_fd), exe_(exe), slots_(cfg.workers) {}
+
+  int run();
+
+ private:
+  pid_t spawn(int slot, int generation, int ready_fd);
+  int startGeneration(int generation);
+  void hotRestart();
+  void reap();
+  void respawnDue(long now);
+  void killOverdue(long now);
+  void drainAll(int generation);
+  long nextWakeup(long now) const;
+
+  PreforkConfig cfg_;
+  int listen_fd_;
+  std::string exe_;
+  std::vector<PreforkSlot> slots_;
+  std::vector<PreforkWorker> workers_;
+  std::vector<int> cpus_;  // master可用的CPU
+  int generation_ = 0;
+  bool stopping_ = false;
+};
+
+/**
+ * @brief  fork一个worker并exec磁盘上的程序
+ *
+ * @param slot       worker位置
+ * @param generation 第几代
+ * @param ready_fd   初始化完成后写一个字节的管道，-1表示不需要通知
+ *
+ * @return worker的pid，失败返回-1
+ */
+pid_t PreforkMaster::spawn(int slot, int generation, int ready_fd) {
+  pid_t pid = fork();
+  if (pid < 0) {
+    LOG_ERROR(PREFORK_LOG_MODULE, PREFORK_LOG_PROC, "fork err: %s\n",
+              strerror(errno));
+    return -1;
+  }
+
+  if (pid == 0) {
+    // exec会继承信号掩码，先恢复
+    sigset_t none;
+    sigemptyset(&none);
+    sigprocmask(SIG_SETMASK, &none, nullptr);
+
+    if (cfg_.pin_cpu && !cpus_.empty()) {
+      cpu_set_t set;
+      CPU_ZERO(&set);
+      CPU_SET(cpus_[slot % cpus_.size()], &set);
+      sched_setaffinity(0, sizeof(set), &set);
+    }
+    if (listen_fd_ != 0) {
+      dup2(listen_fd_, 0);  // libfcgi在fd 0上accept
+    }
+    char buf[16];
+    snprintf(buf, sizeof(buf), "%d", slot);
+    setenv(PREFORK_WORKER_ENV, buf, 1);
+    if (ready_fd >= 0) {
+      fcntl(ready_fd, F_SETFD, 0);  // 管道默认CLOEXEC，只让这一端传给worker
+      snprintf(buf, sizeof(buf), "%d", ready_fd);
+      setenv(PREFORK_READY_ENV, buf, 1);
+    } else {
+      unsetenv(PREFORK_READY_ENV);
+    }
+    char *const argv[] = {(char *)exe_.c_str(), nullptr};
+    execv(exe_.c_str(), argv);
+    _exit(127);
+  }
+
+  PreforkWorker w;
+  w.pid = pid;
+  w.slot = slot;
+  w.generation = generation;
+  w.draining = false;
+  w.started_ms = nowMs();
+  w.kill_ms = 0;
+  workers_.push_back(w);
+  LOG_INFO(PREFORK_LOG_MODULE, PREFORK_LOG_PROC,
+           "worker %d started, slot = %d, generation = %d\n", (int)pid, slot,
+           generation);
+  return pid;
+}
+
+/**
+ * @brief  启动一整代worker，等待它们初始化完成
+ *
+ * @return 初始化完成的worker个数
+ */
+int PreforkMaster::startGeneration(int generation) {
+  int fds[2];
+  if (pipe2(fds, O_CLOEXEC) != 0) {
+    LOG_ERROR(PREFORK_LOG_MODULE, PREFORK_LOG_PROC, "pipe2 err: %s\n",
+              strerror(errno));
+    return 0;
+  }
+  for (int i = 0; i < cfg_.workers; i++) {
+    spawn(i, generation, fds[1]);
+  }
+  close(fds[1]);
+
+  // 每个worker就绪时写一个字节；所有worker的写端都关闭后读到EOF
+  int ready = 0;
+  long deadline = nowMs() + cfg_.ready_timeout_s * 1000L;
+  while (ready < cfg_.workers) {
+    long left = deadline - nowMs();
+    if (left <= 0) {
+      break;
+    }
+    struct pollfd pfd = {fds[0], POLLIN, 0};
+    int n = poll(&pfd, 1, (int)left);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      break;
+    }
+    char buf[64];
+    ssize_t len = read(fds[0], buf, sizeof(buf));
+    if (len <= 0) {
+      break;
+    }
+    ready += (int)len;
+  }
+  close(fds[0]);
+  return ready;
+}
+
+/**
+ * @brief  热重启：新一代worker全部就绪后，让旧的worker处理完请求退出
+ */
+void PreforkMaster::hotRestart() {
+  int generation = generation_ + 1;
+  LOG_INFO(PREFORK_LOG_MODULE, PREFORK_LOG_PROC,
+           "hot restart, generation %d -> %d\n", generation_, generation);
+  int ready = startGeneration(generation);
+
+  if (ready < cfg_.workers) {
+    // 新程序起不来时保留旧的worker
+    LOG_ERROR(PREFORK_LOG_MODULE, PREFORK_LOG_PROC,
+              "hot restart failed, %d/%d workers ready, keep generation %d\n",
+              ready, cfg_.workers, generation_);
+    drainAll(generation);
+    return;
+  }
+
+  int old = generation_;
+  generation_ = generation;
+  for (PreforkSlot &s : slots_) {
+    s = PreforkSlot();
+  }
+  drainAll(old);
+}
+
+/**
+ * @brief  给worker发SIGTERM，它们处理完当前请求后退出
+ *
+ * @param generation 只处理这一代，-1表示全部
+ */
+void PreforkMaster::drainAll(int generation) {
+  long kill_ms = nowMs() + cfg_.drain_timeout_s * 1000L;
+  for (PreforkWorker &w : workers_) {
+    if (w.draining || (generation != -1 && w.generation != generation)) {
+      continue;
+    }
+    w.draining = true;
+    w.kill_ms = kill_ms;
+    kill(w.pid, SIGTERM);
+  }
+}
+
+// 回收退出的worker，当前一代的worker异常退出时安排重启
+void PreforkMaster::reap() {
+  int status;
+  pid_t pid;
+  while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+    size_t i = 0;
+    while (i < workers_.size() && workers_[i].pid != pid) {
+      i++;
+    }
+    if (i == workers_.size()) {
+      continue;
+    }
+    PreforkWorker w = workers_[i];
+    workers_.erase(workers_.begin() + i);
+
+    if (WIFSIGNALED(status)) {
+      LOG_INFO(PREFORK_LOG_MODULE, PREFORK_LOG_PROC,
+               "worker %d killed by signal %d\n", (int)pid, WTERMSIG(status));
+    } else {
+      LOG_INFO(PREFORK_LOG_MODULE, PREFORK_LOG_PROC,
+               "worker %d exited, status = %d\n", (int)pid,
+               WEXITSTATUS(status));
+    }
+    if (w.draining || stopping_ || w.generation != generation_) {
+      continue;
+    }
+
+    // 指数退避：第n次连续崩溃后等待 min * 2^n，运行够久则清零
+    long now = nowMs();
+    PreforkSlot &s = slots_[w.slot];
+    if (now - w.started_ms > PREFORK_STABLE_MS) {
+      s.crashes = 0;
+    }
+    long delay = cfg_.backoff_min_ms;
+    for (int k = 0; k < s.crashes && delay < cfg_.backoff_max_ms; k++) {
+      delay *= 2;
+    }
+    if (delay > cfg_.backoff_max_ms) delay = cfg_.backoff_max_ms;
+    s.crashes++;
+    s.respawn_ms = now + delay;
+    LOG_ERROR(PREFORK_LOG_MODULE, PREFORK_LOG_PROC,
+              "worker slot %d crashed %d times, restart in %ld ms\n", w.slot,
+              s.crashes, delay);
+  }
+}
+
+void PreforkMaster::respawnDue(long now) {
+  for (size_t i = 0; i < slots_.size(); i++) {
+    if (slots_[i].respawn_ms != 0 && slots_[i].respawn_ms <= now) {
+      slots_[i].respawn_ms = 0;
+      spawn((int)i, generation_, -1);
+    }
+  }
+}
+
+void PreforkMaster::killOverdue(long now) {
+  for (PreforkWorker &w : workers_) {
+    if (w.kill_ms != 0 && w.kill_ms <= now) {
+      LOG_ERROR(PREFORK_LOG_MODULE, PREFORK_LOG_PROC,
+                "worker %d drain timeout, SIGKILL\n", (int)w.pid);
+      kill(w.pid, SIGKILL);
+      w.kill_ms = 0;
+    }
+  }
+}
+
+// 距离下一个定时事件的毫秒数，最长1秒
+long PreforkMaster::nextWakeup(long now) const {
+  long next = now + 1000;
+  for (const PreforkSlot &s : slots_) {
+    if (s.respawn_ms != 0 && s.respawn_ms < next) next = s.respawn_ms;
+  }
+  for (const PreforkWorker &w : workers_) {
+    if (w.kill_ms != 0 && w.kill_ms < next) next = w.kill_ms;
+  }
+  return next > now ? next - now : 0;
+}
+
+/**
+ * @brief  master主循环：信号全部阻塞，用sigtimedwait同步处理，
+ *         不在信号处理函数中做任何事情
+ *
+ * @return 进程退出码
+ */
+int PreforkMaster::run() {
+  sigset_t set;
+  sigemptyset(&set);
+  sigaddset(&set, SIGCHLD);
+  sigaddset(&set, SIGUSR2);
+  sigaddset(&set, SIGTERM);
+  sigaddset(&set, SIGINT);
+  sigprocmask(SIG_BLOCK, &set, nullptr);
+  signal(SIGCHLD, SIG_DFL);  // SIG_IGN时子进程会被自动回收，收不到SIGCHLD
+
+  cpu_set_t allowed;
+  if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+    for (int i = 0; i < CPU_SETSIZE; i++) {
+      if (CPU_ISSET(i, &allowed)) cpus_.push_back(i);
+    }
+  }
+
+  generation_ = 1;
+  int ready = startGeneration(generation_);
+  LOG_INFO(PREFORK_LOG_MODULE, PREFORK_LOG_PROC,
+           "master %d started, %d/%d workers ready\n", (int)getpid(), ready,
+           cfg_.workers);
+
+  while (!stopping_ || !workers_.empty()) {
+    long now = nowMs();
+    long wait_ms = nextWakeup(now);
+    struct timespec ts = {wait_ms / 1000, (wait_ms % 1000) * 1000000L};
+    int sig = sigtimedwait(&set, nullptr, &ts);
+
+    if (sig == SIGCHLD) {
+      reap();
+    } else if (sig == SIGUSR2 && !stopping_) {
+      hotRestart();
+      reap();  // 热重启期间退出的worker
+    } else if (sig == SIGTERM || sig == SIGINT) {
+      if (!stopping_) {
+        LOG_INFO(PREFORK_LOG_MODULE, PREFORK_LOG_PROC,
+                 "master stopping, draining %zu workers\n", workers_.size());
+      }
+      stopping_ = true;
+      drainAll(-1);
+    }
+
+    now = nowMs();
+    if (!stopping_) {
+      respawnDue(now);
+    }
+    killOverdue(now);
+  }
+
+  LOG_INFO(PREFORK_LOG_MODULE, PREFORK_LOG_PROC, "master exit\n");
+  return 0;
+}
+
+/**
+ * @brief  当前进程是master时管理worker直到退出
+ *
+ * @param listen_fd 监听socket
+ *
+ * @return 进程退出码，当前进程应该自己处理请求时返回-1
+ */
+int preforkMaster(int listen_fd) {
+  if (getenv(PREFORK_WORKER_ENV) != nullptr) {
+    return -1;
+  }
+
+  int accepting = 0;
+  socklen_t len = sizeof(accepting);
+  if (getsockopt(listen_fd, SOL_SOCKET, SO_ACCEPTCONN, &accepting, &len) !=
+          0 ||
+      accepting == 0) {
+    return -1;
+  }
+
+  PreforkConfig cfg;
+  getPreforkConfig(&cfg);
+  if (cfg.workers <= 0) {
+    return -1;
+  }
+
+  return runPrefork(cfg, listen_fd);
+}
+
+/**
+ * @brief  以master方式运行
+ *
+ * @param cfg       prefork配置
+ * @param listen_fd 监听socket，worker中为fd 0
+ *
+ * @return 进程退出码
+ */
+int runPrefork(const PreforkConfig &cfg, int listen_fd) {
+  // 记下程序路径，热重启时exec同一路径上的新程序
+  char exe[4096];
+  ssize_t n = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+  if (n <= 0) {
+    LOG_ERROR(PREFORK_LOG_MODULE, PREFORK_LOG_PROC, "readlink err: %s\n",
+              strerror(errno));
+    return 1;
+  }
+  exe[n] = '\0';
+
+  PreforkMaster master(cfg, listen_fd, exe);
+  return master.run();
+}
+
+static void onSigterm(int) { worker_draining = 1; }
+
+static void maskSigterm(int how) {
+  sigset_t set;
+  sigemptyset(&set);
+  sigaddset(&set, SIGTERM);
+  sigprocmask(how, &set, nullptr);
+}
+
+/**
+ * @brief  worker安装SIGTERM处理函数并先屏蔽SIGTERM
+ *         不使用SA_RESTART，阻塞中的accept被信号打断后返回
+ *         (不用FCGX_ShutdownPending：它会让之后所有的读写失败，
+ *          正好在这时accept到的请求会被丢掉)
+ */
+void preforkWorkerInit() {
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = onSigterm;
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGTERM, &sa, nullptr);
+  maskSigterm(SIG_BLOCK);
+
+  // pkill -USR2 会同时发给worker，只有master处理热重启
+  signal(SIGUSR2, SIG_IGN);
+}
+
+bool preforkAcceptBegin() {
+  maskSigterm(SIG_UNBLOCK);  // 处理请求期间到达的SIGTERM在这里递送
+  return worker_draining == 0;
+}
+
+void preforkAcceptEnd() { maskSigterm(SIG_BLOCK); }
+
+void preforkWorkerReady() {
+  const char *env = getenv(PREFORK_READY_ENV);
+  if (env == nullptr) {
+    return;
+  }
+  int fd = atoi(env);
+  char c = 1;
+  if (write(fd, &c, 1) != 1) {
+    LOG_ERROR(PREFORK_LOG_MODULE, PREFORK_LOG_PROC, "ready write err: %s\n",
+              strerror(errno));
+  }
+  close(fd);
+  unsetenv(PREFORK_READY_ENV);
+}
+
+bool preforkDraining() { return worker_draining != 0; }
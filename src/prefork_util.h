@@ -0,0 +1,61 @@
+#ifndef PREFORK_UTIL_H
+#define PREFORK_UTIL_H
+
+/*
+   prefork的master/worker进程管理：
+   spawn-fcgi只启动一个进程(-F 1)，它成为master，持有监听socket(fd 0)，
+   按cfg.json中prefork.workers启动N个worker。worker由fork + exec磁盘上的
+   程序得到，继承fd 0后和原来一样调用FCGX_Accept_r。
+
+   - worker绑定到master可用的CPU上(prefork.pin_cpu)
+   - worker异常退出时按指数退避重新启动，连续崩溃不会打满CPU
+   - master收到SIGUSR2时热重启：用磁盘上的新程序启动一代新的worker，
+     全部初始化完成(连上mysql/redis)后，再给旧的worker发SIGTERM；
+     旧worker处理完手上的请求才退出。监听socket一直由master持有，
+     部署期间不会拒绝连接；新worker启动失败时保留旧worker
+   - master收到SIGTERM/SIGINT时让所有worker处理完当前请求后退出
+
+   部署：编译到临时文件后mv覆盖原程序，再 kill -USR2 <master pid>
+*/
+
+const char *const PREFORK_LOG_MODULE = "cgi";
+const char *const PREFORK_LOG_PROC = "prefork";
+
+// prefork配置，cfg.json中的prefork
+struct PreforkConfig {
+  int workers = 0;              // worker进程数，0表示不使用prefork
+  bool pin_cpu = true;          // 每个worker绑定一个CPU
+  int backoff_min_ms = 100;     // 崩溃后第一次重启前的等待
+  int backoff_max_ms = 10000;   // 重启等待的上限
+  int ready_timeout_s = 30;     // 热重启时等待新worker初始化的时间
+  int drain_timeout_s = 60;     // 旧worker处理完请求的最长时间，超时后SIGKILL
+};
+
+// 从cfg.json读取prefork配置，缺少时使用默认值
+int getPreforkConfig(PreforkConfig *cfg);
+
+// 以master方式运行，管理cfg.workers个worker直到收到SIGTERM/SIGINT，返回进程退出码
+int runPrefork(const PreforkConfig &cfg, int listen_fd);
+
+// 在处理请求之前调用：
+// 当前是master时一直管理worker直到收到退出信号，返回进程退出码(>=0)；
+// 当前是worker、没有配置prefork或listen_fd不是监听socket时返回-1，
+// 调用者继续在本进程处理请求
+int preforkMaster(int listen_fd);
+
+// worker安装SIGTERM处理函数(不使用SA_RESTART)，阻塞中的accept被打断返回EINTR，
+// libfcgi需要FCGX_InitRequest时带FCGI_FAIL_ACCEPT_ON_INTR
+void preforkWorkerInit();
+
+// SIGTERM只在等待新请求时递送，处理请求期间屏蔽，不会打断请求中的读写：
+// accept之前调用preforkAcceptBegin，返回false时应退出；accept返回后调用preforkAcceptEnd
+bool preforkAcceptBegin();
+void preforkAcceptEnd();
+
+// worker初始化完成，通知master(热重启时master等待所有新worker就绪)
+void preforkWorkerReady();
+
+// worker收到了SIGTERM，处理完当前请求后应退出
+bool preforkDraining();
+
+#endif
@@ -0,0 +1,251 @@
+/**
+ * @file pv_util.cpp
+ * @brief 文件下载量的批量统计：进程内计数 -> redis -> mysql
+ * @author ward
+ * @version 1.0
+ * @date 2023年6月28日
+ */
+
+#include "pv_util.h"
+
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <ctime>
+#include <iterator>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "make_log.h"
+
+/*
+   推送：把本进程的计数累加到<name>:pending
+   KEYS[1] <name>:pending  ARGV 依次为 field、次数
+*/
+static const char PUSH_LUA[] = R"(
+for i = 1, #ARGV, 2 do
+  redis.call('HINCRBY', KEYS[1], ARGV[i], ARGV[i + 1])
+end
+return 1
+)";
+
+/*
+   取出待落库的计数，上一轮没有落库成功的<name>:flushing优先
+   KEYS[1] <name>:pending  KEYS[2] <name>:flushing
+   返回 field、次数 交替的数组
+*/
+static const char TAKE_LUA[] = R"(
+if redis.call('EXISTS', KEYS[2]) == 0 then
+  if redis.call('EXISTS', KEYS[1]) == 0 then
+    return {}
+  end
+  redis.call('RENAME', KEYS[1], KEYS[2])
+end
+return redis.call('HGETALL', KEYS[2])
+)";
+
+CounterBatch::CounterBatch(const char *name, SaveFn save)
+    : pending_key_(std::string(name) + ":pending"),
+      flushing_key_(std::string(name) + ":flushing"),
+      lock_key_(std::string(name) + ":lock"),
+      save_(save) {}
+
+void CounterBatch::setInterval(int flush_interval_s) {
+  std::lock_guard<std::mutex> lock(lock_);
+  interval_s_ = flush_interval_s;
+}
+
+void CounterBatch::add(const std::string &field, long n) {
+  std::lock_guard<std::mutex> lock(lock_);
+  counts_[field] += n;
+}
+
+long CounterBatch::pending(const std::string &field) {
+  std::lock_guard<std::mutex> lock(lock_);
+  auto it = counts_.find(field);
+  return it == counts_.end() ? 0 : it->second;
+}
+
+// 推送或落库失败，计数放回，下一轮再试
+void CounterBatch::restore(const Counts &counts) {
+  std::lock_guard<std::mutex> lock(lock_);
+  for (const auto &kv : counts) {
+    counts_[kv.first] += kv.second;
+  }
+}
+
+int CounterBatch::flush(MetaStore *meta, sw::redis::Redis *redis, bool force,
+                        Counts *pushed) {
+  Counts counts;
+  int interval_s;
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    time_t now = time(nullptr);
+    if (!force && now - last_flush_ < interval_s_) {
+      return 0;
+    }
+    last_flush_ = now;
+    interval_s = interval_s_ > 0 ? interval_s_ : 1;
+    counts.swap(counts_);
+  }
+
+  if (redis == nullptr) {
+    if (counts.empty()) {
+      return 0;
+    }
+    int n = save_(meta, CountList(counts.begin(), counts.end()));
+    if (n < 0) {
+      restore(counts);
+    } else if (pushed != nullptr) {
+      pushed->swap(counts);
+    }
+    return n;
+  }
+
+  if (!counts.empty()) {
+    std::vector<std::string> keys = {pending_key_};
+    std::vector<std::string> args;
+    args.reserve(counts.size() * 2);
+    for (const auto &kv : counts) {
+      args.push_back(kv.first);
+      args.push_back(std::to_string(kv.second));
+    }
+    try {
+      redis->eval<long long>(PUSH_LUA, keys.begin(), keys.end(), args.begin(),
+                             args.end());
+    } catch (const sw::redis::Error &e) {
+      LOG_ERROR(PV_LOG_MODULE, PV_LOG_PROC, "%s push err: %s\n",
+                pending_key_.c_str(), e.what());
+      restore(counts);
+      return -1;
+    }
+    if (pushed != nullptr) {
+      pushed->swap(counts);
+    }
+  }
+
+  // 每个间隔只有一个进程落库；落库比间隔还慢时下一轮可能重复计入同一批
+  std::vector<std::string> taken;
+  try {
+    if (!redis->set(lock_key_, std::to_string(getpid()),
+                    std::chrono::seconds(interval_s),
+                    sw::redis::UpdateType::NOT_EXIST)) {
+      return 0;
+    }
+    redis->eval(TAKE_LUA, {pending_key_, flushing_key_}, {},
+                std::back_inserter(taken));
+  } catch (const sw::redis::Error &e) {
+    LOG_ERROR(PV_LOG_MODULE, PV_LOG_PROC, "%s take err: %s\n",
+              pending_key_.c_str(), e.what());
+    return -1;
+  }
+  if (taken.empty()) {
+    return 0;
+  }
+
+  CountList list;
+  for (size_t i = 0; i + 1 < taken.size(); i += 2) {
+    list.emplace_back(taken[i], atol(taken[i + 1].c_str()));
+  }
+  int n = save_(meta, list);
+  if (n < 0) {
+    LOG_ERROR(PV_LOG_MODULE, PV_LOG_PROC, "save %zu of %s failed\n",
+              list.size(), pending_key_.c_str());
+    return -1;
+  }
+  try {
+    redis->del(flushing_key_);
+  } catch (const sw::redis::Error &e) {
+    LOG_ERROR(PV_LOG_MODULE, PV_LOG_PROC, "del err: %s\n", e.what());
+  }
+  LOG_INFO(PV_LOG_MODULE, PV_LOG_PROC, "flushed %d of %s\n", n,
+           pending_key_.c_str());
+  return n;
+}
+
+//==================== 下载量 ====================
+
+static int pvSave(MetaStore *meta, const CounterBatch::CountList &counts);
+
+static CounterBatch pv_batch("pv", pvSave);
+
+void pvInit(int flush_interval_s) { pv_batch.setInterval(flush_interval_s); }
+
+static std::string pvField(const char *user, const char *md5,
+                           const char *filename) {
+  std::string field(user);
+  field += '\n';
+  field += md5;
+  field += '\n';
+  field += filename;
+  return field;
+}
+
+// field拆回user、md5、filename，格式不对时返回false
+static bool parsePvField(const std::string &field, long count, FilePv *pv) {
+  size_t p1 = field.find('\n');
+  size_t p2 = p1 == std::string::npos ? p1 : field.find('\n', p1 + 1);
+  if (p2 == std::string::npos || count <= 0) {
+    return false;
+  }
+  pv->user = field.substr(0, p1);
+  pv->md5 = field.substr(p1 + 1, p2 - p1 - 1);
+  pv->filename = field.substr(p2 + 1);
+  pv->count = count;
+  return true;
+}
+
+void pvRecord(const char *user, const char *md5, const char *filename) {
+  pv_batch.add(pvField(user, md5, filename));
+}
+
+// 推送出去的计数累加到共享排行，失败只记日志，定期同步时会纠正
+static void pvShare(ShareIndex *shares, const CounterBatch::Counts &counts) {
+  if (shares == nullptr || counts.empty()) {
+    return;
+  }
+  std::vector<FilePv> pvs;
+  for (const auto &kv : counts) {
+    FilePv pv;
+    if (parsePvField(kv.first, kv.second, &pv)) {
+      pvs.push_back(std::move(pv));
+    }
+  }
+  if (shares->addPv(pvs) != 0) {
+    LOG_WARNING(PV_LOG_MODULE, PV_LOG_PROC, "add %zu pv to shares failed\n",
+                pvs.size());
+  }
+}
+
+/**
+ * @brief 计数写入mysql
+ *
+ * @return 写入的文件数，失败返回-1
+ */
+static int pvSave(MetaStore *meta, const CounterBatch::CountList &counts) {
+  std::vector<FilePv> pvs;
+  for (const auto &kv : counts) {
+    FilePv pv;
+    if (parsePvField(kv.first, kv.second, &pv)) {
+      pvs.push_back(std::move(pv));
+    } else {
+      LOG_WARNING(PV_LOG_MODULE, PV_LOG_PROC, "bad pv field [%s]\n",
+                  kv.first.c_str());
+    }
+  }
+  if (meta->addFilePv(pvs) != 0) {
+    return -1;
+  }
+  return (int)pvs.size();
+}
+
+int pvFlush(MetaStore *meta, sw::redis::Redis *redis, bool force,
+            ShareIndex *shares) {
+  CounterBatch::Counts pushed;
+  int n = pv_batch.flush(meta, redis, force, &pushed);
+  pvShare(shares, pushed);
+  return n;
+}
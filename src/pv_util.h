@@ -0,0 +1,97 @@
+#ifndef PV_UTIL_H
+#define PV_UTIL_H
+
+#include <sw/redis++/redis++.h>
+
+#include <ctime>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "backend_util.h"
+
+/*
+   文件下载量(user_file_list.pv)的批量统计：
+   每次下载只在进程内计数；下载接口的后台定时任务(cgi_server.h的addCgiTimer)
+   每秒检查一次，距上次推送超过flush_interval_s时，把本进程的计数
+   用一次EVAL累加到redis的hash pv:pending(field为 user\n md5\n filename)。
+   推送后抢 pv:lock(SET NX EX flush_interval_s)，抢到的进程把pv:pending
+   改名为pv:flushing取出，在一个事务中更新mysql，成功后删除pv:flushing；
+   更新失败时pv:flushing保留，下一轮先处理它。
+   所以无论多少worker，mysql每flush_interval_s最多一个事务。
+
+   推送的同时把计数累加到共享排行(share_util.h)的share:pv，公开列表的下载量
+   不必等落库；没有共享的文件被忽略。
+   请求中只计数，不访问redis和mysql；进程退出时定时任务立即推送剩下的计数，
+   这时锁被别的进程持有的话计数留在pv:pending，由下一次抢到锁的进程落库。
+   redis为nullptr时直接把进程内的计数写入MetaStore。
+
+   以上流程在CounterBatch中，分享链接的点击量(link_util.h)也用它批量落库，
+   redis中的key以各自的名字为前缀(pv:、link:)。
+
+   "dl": {"pv_flush_s": 5}
+*/
+
+const char *const PV_LOG_MODULE = "cgi";
+const char *const PV_LOG_PROC = "pv";
+
+// 进程内计数 -> redis的<name>:pending -> mysql的批量统计
+class CounterBatch {
+ public:
+  typedef std::unordered_map<std::string, long> Counts;
+  typedef std::vector<std::pair<std::string, long>> CountList;
+  // 一批计数写入mysql，返回写入的条数，失败返回-1
+  typedef int (*SaveFn)(MetaStore *meta, const CountList &counts);
+
+  CounterBatch(const char *name, SaveFn save);
+
+  // 设置推送间隔(秒)，<= 0时每次flush都推送
+  void setInterval(int flush_interval_s);
+
+  // 计数
+  void add(const std::string &field, long n = 1);
+
+  // 本进程还没推送的计数
+  long pending(const std::string &field);
+
+  /**
+   * @brief 到了推送间隔时推送本进程的计数，抢到锁的进程把redis中的计数落库
+   *
+   * @param meta   落库使用的元数据存储
+   * @param redis  redis连接，nullptr时直接落库
+   * @param force  不管间隔立即推送和落库
+   * @param pushed (out) 可为nullptr，本次成功推送(或直接落库)的计数
+   *
+   * @return 写入mysql的条数，没有写入返回0，失败返回-1
+   */
+  int flush(MetaStore *meta, sw::redis::Redis *redis, bool force,
+            Counts *pushed = nullptr);
+
+ private:
+  void restore(const Counts &counts);
+
+  const std::string pending_key_;
+  const std::string flushing_key_;
+  const std::string lock_key_;
+  SaveFn save_;
+  std::mutex lock_;
+  Counts counts_;  // 本进程还没推送的计数
+  int interval_s_ = 5;
+  time_t last_flush_ = 0;
+};
+
+// 设置推送间隔(秒)，<= 0时每次下载都推送
+void pvInit(int flush_interval_s);
+
+// 记一次下载
+void pvRecord(const char *user, const char *md5, const char *filename);
+
+// 到了推送间隔时推送本进程的计数并尝试落库，force时立即进行
+// shares不为nullptr时推送的计数同时累加到共享排行
+// 返回写入mysql的文件数，没有写入返回0，失败返回-1
+int pvFlush(MetaStore *meta, sw::redis::Redis *redis, bool force,
+            ShareIndex *shares = nullptr);
+
+#endif
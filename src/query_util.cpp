@@ -0,0 +1,193 @@
+#include "query_util.h"
+
+#include <cstring>
+
+#include "make_log.h"
+#include "str_scan.h"
+
+const char *const QUERY_LOG_MODULE = "cgi";
+const char *const QUERY_LOG_PROC = "query";
+
+static int hexValue(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+/**
+ * @brief  原地百分号解码，"%2F"解码为'/'，'+'解码为空格
+ *
+ * @param buf 待解码数据，解码结果写回buf
+ * @param len 数据长度
+ *
+ * @return 解码后的长度
+ */
+size_t urlDecodeInPlace(char *buf, size_t len) {
+  size_t i = 0;
+  size_t j = 0;
+  while (i < len) {
+    if (buf[i] == '+') {
+      buf[j++] = ' ';
+      i++;
+    } else if (buf[i] == '%' && i + 2 < len &&
+               hexValue(buf[i + 1]) >= 0 && hexValue(buf[i + 2]) >= 0) {
+      buf[j++] = (char)(hexValue(buf[i + 1]) * 16 + hexValue(buf[i + 2]));
+      i += 3;
+    } else {
+      buf[j++] = buf[i++];
+    }
+  }
+  return j;
+}
+
+void urlEncode(string_view src, string *dst) {
+  static const char hex[] = "0123456789ABCDEF";
+  for (unsigned char c : src) {
+    if ((c >= '0' && c <= '9') || (c >= 'A' && c <= 'Z') ||
+        (c >= 'a' && c <= 'z') || c == '-' || c == '.' || c == '_' ||
+        c == '~') {
+      *dst += (char)c;
+    } else {
+      *dst += '%';
+      *dst += hex[c >> 4];
+      *dst += hex[c & 0xf];
+    }
+  }
+}
+
+void dlUrl(string_view owner, string_view md5, string_view filename,
+           string *dst) {
+  *dst += "/dl?owner=";
+  urlEncode(owner, dst);
+  *dst += "&md5=";
+  urlEncode(md5, dst);
+  *dst += "&filename=";
+  urlEncode(filename, dst);
+}
+
+uint32_t QueryParams::hashKey(string_view key) {
+  // FNV-1a
+  uint32_t h = 2166136261u;
+  for (char c : key) {
+    h ^= (unsigned char)c;
+    h *= 16777619u;
+  }
+  return h;
+}
+
+/**
+ * @brief  解析QUERY_STRING，拷贝到内部缓冲区后原地解析
+ *
+ * @param query 请求参数，可以为nullptr
+ *
+ * @return 参数个数，query过长时返回-1
+ */
+int QueryParams::parse(const char *query) {
+  count_ = 0;
+  if (query == nullptr) {
+    return 0;
+  }
+
+  size_t len = strlen(query);
+  if (len >= sizeof(buf_)) {
+    LOG_ERROR(QUERY_LOG_MODULE, QUERY_LOG_PROC, "query too long: %zu\n", len);
+    return -1;
+  }
+  memcpy(buf_, query, len + 1);
+  return parseInPlace(buf_, len);
+}
+
+/**
+ * @brief  原地解析 key1=value1&key2=value2，'#'之后的内容忽略
+ *
+ * @param buf 可写的数据
+ * @param len 数据长度
+ *
+ * @return 参数个数
+ */
+int QueryParams::parseInPlace(char *buf, size_t len) {
+  count_ = 0;
+  if (buf == nullptr) {
+    return 0;
+  }
+
+  const char *hash = scanChr(buf, len, '#');
+  char *end = hash == nullptr ? buf + len : buf + (hash - buf);
+
+  char *p = buf;
+  while (p < end) {
+    char *amp = (char *)scanChr(p, end - p, '&');
+    if (amp == nullptr) {
+      amp = end;
+    }
+
+    char *eq = (char *)memchr(p, '=', amp - p);
+    char *key_end = eq == nullptr ? amp : eq;
+    size_t key_len = urlDecodeInPlace(p, key_end - p);
+    if (key_len > 0) {
+      if (count_ == QUERY_MAX_PARAMS) {
+        LOG_WARNING(QUERY_LOG_MODULE, QUERY_LOG_PROC,
+                    "too many params, drop the rest\n");
+        break;
+      }
+      Param &param = params_[count_++];
+      param.key = string_view(p, key_len);
+      param.hash = hashKey(param.key);
+      if (eq == nullptr) {
+        param.value = string_view(amp, 0);
+      } else {
+        size_t value_len = urlDecodeInPlace(eq + 1, amp - eq - 1);
+        param.value = string_view(eq + 1, value_len);
+      }
+    }
+    p = amp + 1;
+  }
+
+  return count_;
+}
+
+/**
+ * @brief  获取参数值，同名参数取第一个
+ *
+ * @param key 参数名
+ *
+ * @return 参数值，不存在时返回data()为nullptr的string_view
+ */
+string_view QueryParams::get(string_view key) const {
+  uint32_t h = hashKey(key);
+  for (int i = 0; i < count_; i++) {
+    if (params_[i].hash == h && params_[i].key == key) {
+      return params_[i].value;
+    }
+  }
+  return string_view();
+}
+
+bool QueryParams::has(string_view key) const {
+  return get(key).data() != nullptr;
+}
+
+/**
+ * @brief  把参数值拷贝到调用者的缓冲区
+ *
+ * @param key        参数名
+ * @param value      输出缓冲区
+ * @param value_size 缓冲区大小(包含'\0')
+ *
+ * @return 0 成功, -1 参数不存在或缓冲区不够
+ */
+int QueryParams::copy(string_view key, char *value, size_t value_size) const {
+  string_view v = get(key);
+  if (v.data() == nullptr || v.size() >= value_size) {
+    LOG_ERROR(QUERY_LOG_MODULE, QUERY_LOG_PROC, "get param %.*s failed\n",
+              (int)key.size(), key.data());
+    if (value_size > 0) {
+      value[0] = '\0';
+    }
+    return -1;
+  }
+  memcpy(value, v.data(), v.size());
+  value[v.size()] = '\0';
+  return 0;
+}
@@ -0,0 +1,74 @@
+#ifndef QUERY_UTIL_H
+#define QUERY_UTIL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+using namespace std;
+
+// 单个请求最多保存的参数个数，超出的参数丢弃
+const int QUERY_MAX_PARAMS = 16;
+
+// QUERY_STRING拷贝到内部缓冲区的最大长度
+const int QUERY_BUF_LEN = 2048;
+
+/*
+   QUERY_STRING / application/x-www-form-urlencoded 解析器
+   一次扫描切分出 key=value 对并原地做百分号解码('+'解码为空格)，
+   结果以string_view保存在定长表中，整个过程不做堆分配。
+   key按全名精确匹配，不会出现"cmd"匹配到"xcmd="的问题。
+
+   QueryParams params;
+   params.parse(FCGX_GetParam("QUERY_STRING", request.envp));
+   string_view cmd = params.get("cmd");
+*/
+class QueryParams {
+ public:
+  QueryParams() : count_(0) {}
+
+  // 解析QUERY_STRING，先拷贝到内部缓冲区，不修改环境变量
+  // 返回解析出的参数个数，query过长时返回-1
+  int parse(const char *query);
+
+  // 原地解析可写的请求体(如urlencoded表单)，buf在params使用期间需保持有效
+  int parseInPlace(char *buf, size_t len);
+
+  // 获取参数值，不存在时返回空的string_view(data()为nullptr)
+  string_view get(string_view key) const;
+
+  // 参数是否存在(值可以为空)
+  bool has(string_view key) const;
+
+  // 把参数值拷贝到value并以'\0'结尾，不存在或放不下时返回-1
+  int copy(string_view key, char *value, size_t value_size) const;
+
+  int size() const { return count_; }
+
+ private:
+  struct Param {
+    uint32_t hash;
+    string_view key;
+    string_view value;
+  };
+
+  static uint32_t hashKey(string_view key);
+
+  Param params_[QUERY_MAX_PARAMS];
+  int count_;
+  char buf_[QUERY_BUF_LEN];
+};
+
+// 原地百分号解码，返回解码后的长度；非法的%序列原样保留
+size_t urlDecodeInPlace(char *buf, size_t len);
+
+// 百分号编码后追加到dst，字母数字和"-._~"保持原样，用于拼接查询参数
+void urlEncode(string_view src, string *dst);
+
+// /dl的下载地址 /dl?owner=xxx&md5=xxx&filename=xxx 追加到dst，
+// 客户端加上自己的user/token下载
+void dlUrl(string_view owner, string_view md5, string_view filename,
+           string *dst);
+
+#endif
@@ -0,0 +1,34 @@
+/**
+ * @file quota_reconcile.cpp
+ * @brief 配额对账任务：按 user_file_list × file_info.size 校正redis中各用户的已用字节，
+ *        由crontab定期执行
+ * @author ward
+ * @version 1.0
+ * @date 2023年6月20日
+ */
+
+#include <mysql/mysql.h>
+#include <sw/redis++/redis++.h>
+
+#include "make_log.h"
+#include "mysql_util.h"
+#include "quota_util.h"
+
+int main() {
+  MYSQL *conn = mysqlConn();
+  sw::redis::Redis *redis = redisConn();
+  if (conn == nullptr || redis == nullptr) {
+    LOG_ERROR(QUOTA_LOG_MODULE, QUOTA_LOG_PROC, "mysqlConn or redisConn failed!");
+    if (conn != nullptr) {
+      mysql_close(conn);
+    }
+    delete redis;
+    return -1;
+  }
+
+  int users = quotaReconcile(conn, redis);
+
+  delete redis;
+  mysql_close(conn);
+  return users < 0 ? -1 : 0;
+}
@@ -0,0 +1,386 @@
+#include "quota_util.h"
+
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+
+#include "cgi_util.h"
+#include "make_log.h"
+#include "rapidjson/document.h"
+#include "rapidjson/istreamwrapper.h"
+
+static QuotaConfig quota_cfg;
+static std::atomic<unsigned long> resv_seq{0};
+
+// 对账的轮次，对账开始时加1，之后的提交记在各用户的delta中
+static const char QUOTA_EPOCH_KEY[] = "quota:epoch";
+
+/*
+   预留：先回收过期的预留，再检查 used + reserved + size <= limit
+   KEYS[1] quota:{user}  KEYS[2] quota:{user}:resv
+   ARGV[1] size  ARGV[2] 成员  ARGV[3] 有效期(ms)  ARGV[4] 默认配额
+   返回1成功，0超出配额
+*/
+static const char RESERVE_LUA[] = R"(
+redis.replicate_commands()
+local t = redis.call('TIME')
+local now = t[1] * 1000 + math.floor(t[2] / 1000)
+local expired = redis.call('ZRANGEBYSCORE', KEYS[2], '-inf', now)
+if #expired > 0 then
+  local freed = 0
+  for _, m in ipairs(expired) do
+    freed = freed + tonumber(string.match(m, ':(%d+)$'))
+  end
+  redis.call('ZREMRANGEBYSCORE', KEYS[2], '-inf', now)
+  redis.call('HINCRBY', KEYS[1], 'reserved', -freed)
+end
+local v = redis.call('HMGET', KEYS[1], 'used', 'reserved', 'limit')
+local used = tonumber(v[1]) or 0
+local reserved = tonumber(v[2]) or 0
+local limit = tonumber(v[3]) or tonumber(ARGV[4])
+local size = tonumber(ARGV[1])
+if limit > 0 and used + reserved + size > limit then
+  return 0
+end
+redis.call('HINCRBY', KEYS[1], 'reserved', size)
+redis.call('ZADD', KEYS[2], now + tonumber(ARGV[3]), ARGV[2])
+return 1
+)";
+
+/*
+   提交：预留还在时释放，再按实际大小计入used；
+   对账期间的提交同时记入delta，对账时加回
+   KEYS[1] quota:{user}  KEYS[2] quota:{user}:resv
+   ARGV[1] 成员(没有预留时为空)  ARGV[2] 预留的字节数  ARGV[3] 实际字节数
+   ARGV[4] 提交前读到的epoch
+   quota:epoch在另一个slot，不放进脚本的KEYS，redis cluster上不会CROSSSLOT；
+   读epoch和提交之间开始的对账已经包含这次提交，delta记在旧epoch下被忽略，
+   结果仍然正确
+*/
+static const char COMMIT_LUA[] = R"(
+if ARGV[1] ~= '' and redis.call('ZREM', KEYS[2], ARGV[1]) == 1 then
+  redis.call('HINCRBY', KEYS[1], 'reserved', -tonumber(ARGV[2]))
+end
+local size = tonumber(ARGV[3])
+redis.call('HINCRBY', KEYS[1], 'used', size)
+local epoch = ARGV[4]
+if redis.call('HGET', KEYS[1], 'epoch') == epoch then
+  redis.call('HINCRBY', KEYS[1], 'delta', size)
+else
+  redis.call('HSET', KEYS[1], 'epoch', epoch, 'delta', size)
+end
+return 1
+)";
+
+/*
+   释放：预留还在(没有过期被回收)时才减reserved
+   KEYS[1] quota:{user}  KEYS[2] quota:{user}:resv
+   ARGV[1] 成员  ARGV[2] 字节数
+*/
+static const char RELEASE_LUA[] = R"(
+if redis.call('ZREM', KEYS[2], ARGV[1]) == 1 then
+  redis.call('HINCRBY', KEYS[1], 'reserved', -tonumber(ARGV[2]))
+end
+return 1
+)";
+
+/*
+   对账：used = mysql中的用量 + 本轮对账开始后提交的字节，
+   reserved按未过期的预留重新求和，返回校正前的used
+   KEYS[1] quota:{user}  KEYS[2] quota:{user}:resv
+   ARGV[1] mysql中的用量  ARGV[2] 本轮epoch
+*/
+static const char RECONCILE_LUA[] = R"(
+redis.replicate_commands()
+local t = redis.call('TIME')
+local now = t[1] * 1000 + math.floor(t[2] / 1000)
+redis.call('ZREMRANGEBYSCORE', KEYS[2], '-inf', now)
+local reserved = 0
+for _, m in ipairs(redis.call('ZRANGE', KEYS[2], 0, -1)) do
+  reserved = reserved + tonumber(string.match(m, ':(%d+)$'))
+end
+local v = redis.call('HMGET', KEYS[1], 'used', 'epoch', 'delta')
+local used = tonumber(ARGV[1])
+if v[2] == ARGV[2] then
+  used = used + (tonumber(v[3]) or 0)
+end
+redis.call('HSET', KEYS[1], 'used', used, 'reserved', reserved)
+return tonumber(v[1]) or 0
+)";
+
+static std::string quotaKey(const char *user) {
+  return std::string("quota:{") + user + "}";
+}
+
+static std::string resvKey(const char *user) {
+  return std::string("quota:{") + user + "}:resv";
+}
+
+// 数字可以写成数字或字符串
+static double cfgNumber(const rapidjson::Value &v, const char *key,
+                        double def) {
+  if (!v.IsObject() || !v.HasMember(key)) {
+    return def;
+  }
+  const rapidjson::Value &x = v[key];
+  if (x.IsNumber()) return x.GetDouble();
+  if (x.IsString()) return atof(x.GetString());
+  if (x.IsBool()) return x.GetBool() ? 1 : 0;
+  return def;
+}
+
+/**
+ * @brief  从cfg.json中读取配额配置
+ *
+ * @param cfg (out) 配置
+ *
+ * @return 0 成功(包括没有quota配置)，-1 打开配置文件失败
+ */
+int getQuotaConfig(QuotaConfig *cfg) {
+  *cfg = QuotaConfig();
+  std::ifstream ifs(CFG_PATH);
+  if (!ifs.is_open()) {
+    LOG_ERROR(QUOTA_LOG_MODULE, QUOTA_LOG_PROC, "Failed to open cfg.json");
+    return -1;
+  }
+  rapidjson::IStreamWrapper isw(ifs);
+  rapidjson::Document doc;
+  doc.ParseStream(isw);
+  if (doc.HasParseError() || !doc.IsObject() || !doc.HasMember("quota")) {
+    return 0;
+  }
+  const rapidjson::Value &q = doc["quota"];
+  cfg->enabled = cfgNumber(q, "enabled", 0) != 0;
+  cfg->default_limit =
+      (long)cfgNumber(q, "default_limit", (double)cfg->default_limit);
+  cfg->reserve_timeout_s =
+      (int)cfgNumber(q, "reserve_timeout_s", cfg->reserve_timeout_s);
+  if (cfg->reserve_timeout_s <= 0) {
+    cfg->reserve_timeout_s = 600;
+  }
+  return 0;
+}
+
+int quotaInit() {
+  QuotaConfig cfg;
+  if (getQuotaConfig(&cfg) != 0) {
+    return -1;
+  }
+  quotaInit(cfg);
+  return 0;
+}
+
+void quotaInit(const QuotaConfig &cfg) {
+  quota_cfg = cfg;
+  if (cfg.enabled) {
+    LOG_INFO(QUOTA_LOG_MODULE, QUOTA_LOG_PROC,
+             "quota default_limit = %ld, reserve_timeout_s = %d\n",
+             cfg.default_limit, cfg.reserve_timeout_s);
+  }
+}
+
+bool quotaEnabled() { return quota_cfg.enabled; }
+
+/**
+ * @brief  为user预留size字节
+ *
+ * @param redis      redis连接
+ * @param user       用户名
+ * @param size       预留的字节数
+ * @param resv (out) 预留，成功时交给quotaCommit或quotaRelease
+ *
+ * @return QUOTA_OK 可以上传，QUOTA_EXCEEDED 超出配额
+ */
+QuotaResult quotaReserve(sw::redis::Redis *redis, const char *user, long size,
+                         QuotaReservation *resv) {
+  *resv = QuotaReservation();
+  if (!quota_cfg.enabled || redis == nullptr) {
+    return QUOTA_OK;
+  }
+  if (size < 0) {
+    size = 0;
+  }
+
+  // 编号在所有进程中唯一：pid + 进程内序号 + 时间
+  struct timeval tv;
+  gettimeofday(&tv, nullptr);
+  char member[96];
+  snprintf(member, sizeof(member), "%d.%lu.%ld:%ld", (int)getpid(),
+           resv_seq.fetch_add(1), (long)tv.tv_sec, size);
+  std::string key = quotaKey(user);
+  std::string rkey = resvKey(user);
+  std::string size_str = std::to_string(size);
+  std::string timeout = std::to_string(quota_cfg.reserve_timeout_s * 1000L);
+  std::string limit = std::to_string(quota_cfg.default_limit);
+
+  try {
+    long long ok = redis->eval<long long>(
+        RESERVE_LUA, {key, rkey}, {size_str, member, timeout, limit});
+    if (ok == 0) {
+      LOG_WARNING(QUOTA_LOG_MODULE, QUOTA_LOG_PROC,
+                  "%s quota exceeded, size = %ld\n", user, size);
+      return QUOTA_EXCEEDED;
+    }
+  } catch (const sw::redis::Error &e) {
+    // 用量以mysql为准，redis出错时不拦截上传，由对账补上
+    LOG_ERROR(QUOTA_LOG_MODULE, QUOTA_LOG_PROC, "reserve err: %s\n",
+              e.what());
+    return QUOTA_OK;
+  }
+  resv->user = user;
+  resv->member = member;
+  resv->size = size;
+  return QUOTA_OK;
+}
+
+/**
+ * @brief  上传成功后提交，按实际大小计入已用
+ *
+ * @param redis       redis连接
+ * @param resv        quotaReserve得到的预留，没有预留时只计入已用
+ * @param user        用户名
+ * @param actual_size 文件实际大小
+ *
+ * @return 0 成功，-1 失败(对账时校正)
+ */
+int quotaCommit(sw::redis::Redis *redis, QuotaReservation *resv,
+                const char *user, long actual_size) {
+  if (!quota_cfg.enabled || redis == nullptr) {
+    return 0;
+  }
+  std::string key = quotaKey(user);
+  std::string rkey = resvKey(user);
+  std::string resv_size = std::to_string(resv->size);
+  std::string size = std::to_string(actual_size);
+  int ret = 0;
+  try {
+    sw::redis::OptionalString epoch = redis->get(QUOTA_EPOCH_KEY);
+    redis->eval<long long>(COMMIT_LUA, {key, rkey},
+                           {resv->member, resv_size, size,
+                            epoch ? *epoch : std::string("0")});
+  } catch (const sw::redis::Error &e) {
+    LOG_ERROR(QUOTA_LOG_MODULE, QUOTA_LOG_PROC, "commit err: %s\n", e.what());
+    ret = -1;
+  }
+  *resv = QuotaReservation();
+  return ret;
+}
+
+/**
+ * @brief  上传失败时释放预留，出错时等预留过期
+ */
+void quotaRelease(sw::redis::Redis *redis, QuotaReservation *resv) {
+  if (!resv->active() || redis == nullptr) {
+    return;
+  }
+  std::string key = quotaKey(resv->user.c_str());
+  std::string rkey = resvKey(resv->user.c_str());
+  std::string size = std::to_string(resv->size);
+  try {
+    redis->eval<long long>(RELEASE_LUA, {key, rkey}, {resv->member, size});
+  } catch (const sw::redis::Error &e) {
+    LOG_ERROR(QUOTA_LOG_MODULE, QUOTA_LOG_PROC, "release err: %s\n",
+              e.what());
+  }
+  *resv = QuotaReservation();
+}
+
+static long hashNumber(sw::redis::Redis *redis, const std::string &key,
+                       const char *field, long def) {
+  sw::redis::OptionalString v = redis->hget(key, field);
+  return v ? atol(v->c_str()) : def;
+}
+
+int quotaUsage(sw::redis::Redis *redis, const char *user, long *used,
+               long *reserved, long *limit) {
+  std::string key = quotaKey(user);
+  try {
+    *used = hashNumber(redis, key, "used", 0);
+    *reserved = hashNumber(redis, key, "reserved", 0);
+    *limit = hashNumber(redis, key, "limit", quota_cfg.default_limit);
+  } catch (const sw::redis::Error &e) {
+    LOG_ERROR(QUOTA_LOG_MODULE, QUOTA_LOG_PROC, "usage err: %s\n", e.what());
+    return -1;
+  }
+  return 0;
+}
+
+int quotaSetLimit(sw::redis::Redis *redis, const char *user, long limit) {
+  std::string key = quotaKey(user);
+  try {
+    if (limit < 0) {
+      redis->hdel(key, "limit");
+    } else {
+      redis->hset(key, "limit", std::to_string(limit));
+    }
+  } catch (const sw::redis::Error &e) {
+    LOG_ERROR(QUOTA_LOG_MODULE, QUOTA_LOG_PROC, "set limit err: %s\n",
+              e.what());
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * @brief  按 user_file_list × file_info.size 校正redis中各用户的已用字节
+ *         先开始新一轮epoch再查询mysql，查询期间的提交记在delta中加回，
+ *         不会被覆盖；查询之前入库、之后才提交的上传会多算一次，下一轮对账时消除
+ *
+ * @return 校正的用户数，失败返回-1
+ */
+int quotaReconcile(MYSQL *conn, sw::redis::Redis *redis) {
+  long long epoch = 0;
+  try {
+    epoch = redis->incr(QUOTA_EPOCH_KEY);
+  } catch (const sw::redis::Error &e) {
+    LOG_ERROR(QUOTA_LOG_MODULE, QUOTA_LOG_PROC, "incr epoch err: %s\n",
+              e.what());
+    return -1;
+  }
+
+  const char *sql =
+      "select user_file_list.user, sum(file_info.size) from user_file_list, "
+      "file_info where file_info.md5 = user_file_list.md5 group by "
+      "user_file_list.user";
+  MYSQL_RES *res_set = nullptr;
+  if (mysql_query(conn, sql) != 0 ||
+      (res_set = mysql_store_result(conn)) == nullptr) {
+    LOG_ERROR(QUOTA_LOG_MODULE, QUOTA_LOG_PROC, "%s 操作失败: %s\n", sql,
+              mysql_error(conn));
+    return -1;
+  }
+
+  std::string epoch_str = std::to_string(epoch);
+  int users = 0, drifted = 0;
+  MYSQL_ROW row;
+  while ((row = mysql_fetch_row(res_set)) != nullptr) {
+    if (row[0] == nullptr) {
+      continue;
+    }
+    std::string key = quotaKey(row[0]);
+    std::string rkey = resvKey(row[0]);
+    std::string used = row[1] == nullptr ? "0" : row[1];
+    try {
+      long long old = redis->eval<long long>(RECONCILE_LUA, {key, rkey},
+                                             {used, epoch_str});
+      if (old != atoll(used.c_str())) {
+        drifted++;
+        LOG_INFO(QUOTA_LOG_MODULE, QUOTA_LOG_PROC,
+                 "%s used %lld -> %s (+ commits during reconcile)\n", row[0],
+                 old, used.c_str());
+      }
+      users++;
+    } catch (const sw::redis::Error &e) {
+      LOG_ERROR(QUOTA_LOG_MODULE, QUOTA_LOG_PROC, "reconcile %s err: %s\n",
+                row[0], e.what());
+    }
+  }
+  mysql_free_result(res_set);
+  LOG_INFO(QUOTA_LOG_MODULE, QUOTA_LOG_PROC,
+           "reconciled %d users, %d drifted\n", users, drifted);
+  return users;
+}
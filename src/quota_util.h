@@ -0,0 +1,85 @@
+#ifndef QUOTA_UTIL_H
+#define QUOTA_UTIL_H
+
+#include <mysql/mysql.h>
+#include <sw/redis++/redis++.h>
+
+#include <string>
+
+/*
+   按字节的用户存储配额：
+   上传开始前在redis上用Lua脚本原子地预留文件大小(已用 + 预留 + size <= 配额)，
+   存储和入库成功后提交为已用，失败时释放；进程崩溃没有释放的预留
+   在reserve_timeout_s后由下一次预留自动回收。每次检查都是一次EVAL，
+   与用户的文件数无关。
+
+   redis中每个用户两个key：
+   quota:{user}       hash  used 已用  reserved 预留中  limit 单独设置的配额
+                            epoch/delta 对账期间提交的字节
+   quota:{user}:resv  zset  预留编号:字节数 -> 过期时间(ms)
+
+   mysql中 user_file_list × file_info.size 是用量的准确值，quota_reconcile
+   定期(crontab)按它校正redis中的used，redis数据丢失或计数漂移后自动恢复。
+
+   "quota": {
+     "enabled": true,
+     "default_limit": 10737418240,
+     "reserve_timeout_s": 600
+   }
+   default_limit为0时不限制，只统计用量。
+*/
+
+const char *const QUOTA_LOG_MODULE = "cgi";
+const char *const QUOTA_LOG_PROC = "quota";
+
+struct QuotaConfig {
+  bool enabled = false;         // 是否启用配额
+  long default_limit = 0;       // 没有单独设置时的配额(字节)，0为不限
+  int reserve_timeout_s = 600;  // 预留的有效期
+};
+
+enum QuotaResult {
+  QUOTA_OK = 0,
+  QUOTA_EXCEEDED = 1,  // 超出配额，{"code":"010"}
+};
+
+// 一次预留，提交或释放之前有效
+struct QuotaReservation {
+  std::string user;
+  std::string member;  // zset中的成员"编号:字节数"
+  long size = 0;
+
+  bool active() const { return !member.empty(); }
+};
+
+// 从cfg.json读取配额配置，缺少时不启用
+int getQuotaConfig(QuotaConfig *cfg);
+
+// 读取配置，进程启动时调用一次
+int quotaInit();
+void quotaInit(const QuotaConfig &cfg);
+
+bool quotaEnabled();
+
+// 为user预留size字节，没有启用或redis出错时不预留(resv->active()为false)并返回QUOTA_OK
+QuotaResult quotaReserve(sw::redis::Redis *redis, const char *user, long size,
+                         QuotaReservation *resv);
+
+// 上传成功：释放预留并按实际大小计入已用，没有预留时也计入
+int quotaCommit(sw::redis::Redis *redis, QuotaReservation *resv,
+                const char *user, long actual_size);
+
+// 上传失败：释放预留
+void quotaRelease(sw::redis::Redis *redis, QuotaReservation *resv);
+
+// 查询用量，limit为生效的配额(0为不限)，失败返回-1
+int quotaUsage(sw::redis::Redis *redis, const char *user, long *used,
+               long *reserved, long *limit);
+
+// 单独设置用户的配额，limit < 0 时恢复为默认配额
+int quotaSetLimit(sw::redis::Redis *redis, const char *user, long limit);
+
+// 按mysql校正所有用户的已用字节，返回校正的用户数，失败返回-1
+int quotaReconcile(MYSQL *conn, sw::redis::Redis *redis);
+
+#endif
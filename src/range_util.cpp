@@ -0,0 +1,134 @@
+/**
+ * @file range_util.cpp
+ * @brief HTTP Range / If-Range请求头的解析
+ * @author ward
+ * @version 1.0
+ * @date 2023年7月2日
+ */
+
+#include "range_util.h"
+
+#include <algorithm>
+#include <cctype>
+#include <climits>
+#include <cstring>
+
+// 解析非负整数，没有数字或溢出时返回-1
+static long parseNumber(const char **p) {
+  const char *s = *p;
+  long n = 0;
+  if (!isdigit((unsigned char)*s)) {
+    return -1;
+  }
+  while (isdigit((unsigned char)*s)) {
+    if (n > (LONG_MAX - 9) / 10) {
+      return -1;
+    }
+    n = n * 10 + (*s - '0');
+    s++;
+  }
+  *p = s;
+  return n;
+}
+
+static const char *skipSpace(const char *p) {
+  while (*p == ' ' || *p == '\t') p++;
+  return p;
+}
+
+RangeResult parseRange(const char *range, const char *if_range,
+                       const std::string &etag, long size,
+                       std::vector<ByteRange> *ranges) {
+  ranges->clear();
+  if (range == nullptr) {
+    return RANGE_NONE;
+  }
+  // If-Range只认强ETag，日期或不一致时返回整个文件
+  if (if_range != nullptr && etag != skipSpace(if_range)) {
+    return RANGE_NONE;
+  }
+
+  const char *p = skipSpace(range);
+  if (strncmp(p, "bytes=", 6) != 0) {
+    return RANGE_NONE;  // 不认识的单位按没有Range处理
+  }
+  p += 6;
+
+  bool any = false;  // 是否有语法正确的段
+  while (true) {
+    p = skipSpace(p);
+    long start, end;
+    if (*p == '-') {
+      // 最后n字节
+      p++;
+      long n = parseNumber(&p);
+      if (n < 0) return RANGE_NONE;
+      any = true;
+      if (n == 0 || size == 0) {
+        start = -1;
+        end = -1;
+      } else {
+        start = n >= size ? 0 : size - n;
+        end = size - 1;
+      }
+    } else {
+      start = parseNumber(&p);
+      if (start < 0 || *p != '-') return RANGE_NONE;
+      p++;
+      if (isdigit((unsigned char)*p)) {
+        end = parseNumber(&p);
+        if (end < 0 || end < start) return RANGE_NONE;
+        if (end >= size) end = size - 1;
+      } else {
+        end = size - 1;
+      }
+      any = true;
+      if (start >= size) {
+        start = -1;
+        end = -1;
+      }
+    }
+    if (start >= 0) {
+      if ((int)ranges->size() >= RANGE_MAX_PARTS) {
+        ranges->clear();
+        return RANGE_NONE;
+      }
+      ranges->push_back(ByteRange{start, end});
+    }
+
+    p = skipSpace(p);
+    if (*p == '\0') break;
+    if (*p != ',') return RANGE_NONE;
+    p++;
+  }
+
+  if (!any) {
+    return RANGE_NONE;
+  }
+  if (ranges->empty()) {
+    return RANGE_UNSATISFIABLE;
+  }
+
+  // 排序后合并重叠和相邻的段
+  std::sort(ranges->begin(), ranges->end(),
+            [](const ByteRange &a, const ByteRange &b) {
+              return a.start < b.start;
+            });
+  size_t n = 0;
+  for (size_t i = 1; i < ranges->size(); i++) {
+    ByteRange &last = (*ranges)[n];
+    const ByteRange &r = (*ranges)[i];
+    if (r.start <= last.end + 1) {
+      last.end = std::max(last.end, r.end);
+    } else {
+      (*ranges)[++n] = r;
+    }
+  }
+  ranges->resize(n + 1);
+  return RANGE_OK;
+}
+
+std::string contentRange(const ByteRange &r, long size) {
+  return "bytes " + std::to_string(r.start) + "-" + std::to_string(r.end) +
+         "/" + std::to_string(size);
+}
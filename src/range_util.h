@@ -0,0 +1,51 @@
+#ifndef RANGE_UTIL_H
+#define RANGE_UTIL_H
+
+#include <string>
+#include <vector>
+
+/*
+   HTTP Range请求(RFC 7233)，只支持bytes单位：
+     Range: bytes=0-499        前500字节
+     Range: bytes=500-         从500到结尾
+     Range: bytes=-500         最后500字节
+     Range: bytes=0-0,-1       多段，响应为multipart/byteranges
+   If-Range与当前ETag不一致(文件已变)或是日期时忽略Range，返回整个文件。
+   重叠或相邻的段合并；段数超过RANGE_MAX_PARTS时按没有Range处理，
+   防止用大量小段放大响应。
+*/
+
+// 一个请求最多的段数
+const int RANGE_MAX_PARTS = 16;
+
+// 闭区间[start, end]
+struct ByteRange {
+  long start;
+  long end;
+
+  long length() const { return end - start + 1; }
+};
+
+enum RangeResult {
+  RANGE_NONE = 0,           // 没有Range或忽略，返回整个文件(200)
+  RANGE_OK = 1,             // 返回ranges中的段(206)
+  RANGE_UNSATISFIABLE = 2,  // 所有段都超出文件(416)
+};
+
+/**
+ * @brief 解析Range请求头
+ *
+ * @param range    请求头Range，可以为nullptr
+ * @param if_range 请求头If-Range，可以为nullptr
+ * @param etag     文件当前的ETag(带引号)
+ * @param size     文件大小
+ * @param ranges   (out) 按起点排序、合并后的段
+ */
+RangeResult parseRange(const char *range, const char *if_range,
+                       const std::string &etag, long size,
+                       std::vector<ByteRange> *ranges);
+
+// 206响应的Content-Range的值，如"bytes 0-499/1234"
+std::string contentRange(const ByteRange &r, long size);
+
+#endif
@@ -0,0 +1,512 @@
+#include "ratelimit_util.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+
+#include "cgi_util.h"
+#include "make_log.h"
+#include "rapidjson/document.h"
+#include "rapidjson/istreamwrapper.h"
+#include "str_scan.h"
+
+// 表满时每个key最多探测的桶数
+static const int RATE_PROBES = 8;
+
+static RateLimitConfig rate_cfg;
+static RateTable rate_table;
+static bool rate_ready = false;
+
+/*
+   redis上的令牌桶，时间取redis服务器的TIME，各台机器的时钟不必一致。
+   KEYS[1] 桶  ARGV[1] rate  ARGV[2] burst  返回1允许，0拒绝
+*/
+static const char RATE_LUA[] = R"(
+redis.replicate_commands()
+local t = redis.call('TIME')
+local now = t[1] * 1000 + math.floor(t[2] / 1000)
+local rate = tonumber(ARGV[1])
+local burst = tonumber(ARGV[2])
+local v = redis.call('HMGET', KEYS[1], 'tokens', 'ts')
+local tokens = tonumber(v[1])
+if tokens == nil then
+  tokens = burst
+else
+  tokens = math.min(burst, tokens + (now - tonumber(v[2])) * rate / 1000)
+end
+local ok = 0
+if tokens >= 1 then
+  tokens = tokens - 1
+  ok = 1
+end
+redis.call('HSET', KEYS[1], 'tokens', tokens, 'ts', now)
+redis.call('PEXPIRE', KEYS[1], math.ceil(burst / rate * 1000) + 1000)
+return ok
+)";
+
+RateTable::~RateTable() {
+  if (table_ != nullptr) {
+    munmap(table_, map_len_);
+  }
+}
+
+/**
+ * @brief  打开共享内存表，名字带上桶数，修改slots后使用新的表
+ *
+ * @param name  共享内存名，如"/filehub_ratelimit"
+ * @param slots 桶数，向上取整为2的幂
+ *
+ * @return 0 成功，-1 失败
+ */
+int RateTable::open(const char *name, size_t slots) {
+  size_t n = 1024;
+  while (n < slots) {
+    n <<= 1;
+  }
+  char shm_name[256];
+  snprintf(shm_name, sizeof(shm_name), "%s_%zu", name, n);
+
+  int fd = shm_open(shm_name, O_RDWR | O_CREAT, 0600);
+  if (fd < 0) {
+    LOG_ERROR(RATELIMIT_LOG_MODULE, RATELIMIT_LOG_PROC,
+              "shm_open %s err: %s\n", shm_name, strerror(errno));
+    return -1;
+  }
+  // 新建的共享内存全为0，即所有桶为空；多个进程同时ftruncate到同一长度没有影响
+  size_t len = n * sizeof(Slot);
+  if (ftruncate(fd, (off_t)len) != 0) {
+    LOG_ERROR(RATELIMIT_LOG_MODULE, RATELIMIT_LOG_PROC, "ftruncate err: %s\n",
+              strerror(errno));
+    close(fd);
+    return -1;
+  }
+  void *p = mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED) {
+    LOG_ERROR(RATELIMIT_LOG_MODULE, RATELIMIT_LOG_PROC, "mmap err: %s\n",
+              strerror(errno));
+    return -1;
+  }
+  if (table_ != nullptr) {
+    munmap(table_, map_len_);
+  }
+  table_ = (Slot *)p;
+  mask_ = n - 1;
+  map_len_ = len;
+  return 0;
+}
+
+/**
+ * @brief  找到key的桶，没有时占用一个空桶；探测范围内都被占用时，
+ *         回收其中最久没有更新的桶(并发回收时两个key可能短暂共用一个桶，
+ *         只影响计数精度)
+ */
+RateTable::Slot *RateTable::find(uint64_t key, uint32_t now_ms) {
+  Slot *victim = nullptr;
+  uint32_t victim_age = 0;
+  for (int i = 0; i < RATE_PROBES; i++) {
+    Slot *s = &table_[(key + i) & mask_];
+    uint64_t k = s->key.load(std::memory_order_acquire);
+    if (k == key) {
+      return s;
+    }
+    if (k == 0) {
+      if (s->key.compare_exchange_strong(k, key)) {
+        return s;
+      }
+      if (k == key) {
+        return s;  // 另一个进程刚占用了这个桶
+      }
+      continue;
+    }
+    uint32_t age = now_ms - (uint32_t)(s->state.load() >> 32);
+    if (victim == nullptr || age > victim_age) {
+      victim = s;
+      victim_age = age;
+    }
+  }
+  if (victim == nullptr) {
+    // 探测到的空桶都被其它key抢先占用，回收第一个桶
+    victim = &table_[key & mask_];
+  }
+  victim->key.store(key, std::memory_order_release);
+  victim->state.store(0);
+  return victim;
+}
+
+/**
+ * @brief  取一个令牌，先按距上次更新的时间补充令牌，再扣除一个
+ *
+ * @param key    桶的key(非0)
+ * @param rate   每秒补充的令牌数
+ * @param burst  桶容量
+ * @param now_ms 当前时间(ms)，允许回绕
+ *
+ * @return 取到令牌返回true
+ */
+bool RateTable::take(uint64_t key, double rate, double burst,
+                     uint32_t now_ms) {
+  if (table_ == nullptr) {
+    return true;
+  }
+  if (now_ms == 0) {
+    now_ms = 1;  // 时间为0表示新桶
+  }
+  Slot *s = find(key, now_ms);
+  double cap = burst * 1000;
+  if (cap > 4e9) cap = 4e9;  // 令牌数只有32位
+  uint64_t old = s->state.load(std::memory_order_acquire);
+  for (;;) {
+    uint32_t ts = (uint32_t)(old >> 32);
+    double tokens;
+    if (ts == 0) {
+      tokens = cap;  // 新桶是满的
+    } else {
+      tokens = (double)(uint32_t)old + (double)(uint32_t)(now_ms - ts) * rate;
+      if (tokens > cap) tokens = cap;
+    }
+    bool ok = tokens >= 1000;
+    if (ok) {
+      tokens -= 1000;
+    }
+    uint64_t state = ((uint64_t)now_ms << 32) | (uint32_t)tokens;
+    if (s->state.compare_exchange_weak(old, state,
+                                       std::memory_order_acq_rel)) {
+      return ok;
+    }
+  }
+}
+
+// 数字可以写成数字或字符串
+static double cfgNumber(const rapidjson::Value &v, const char *key,
+                        double def) {
+  if (!v.IsObject() || !v.HasMember(key)) {
+    return def;
+  }
+  const rapidjson::Value &x = v[key];
+  if (x.IsNumber()) return x.GetDouble();
+  if (x.IsString()) return atof(x.GetString());
+  if (x.IsBool()) return x.GetBool() ? 1 : 0;
+  return def;
+}
+
+static RateRule cfgRule(const rapidjson::Value &policy, const char *key) {
+  RateRule rule;
+  if (policy.HasMember(key) && policy[key].IsObject()) {
+    rule.rate = cfgNumber(policy[key], "rate", 0);
+    rule.burst = cfgNumber(policy[key], "burst", 0);
+  }
+  return rule;
+}
+
+/**
+ * @brief  从cfg.json中读取限流配置
+ *
+ * @param cfg (out) 配置
+ *
+ * @return 0 成功(包括没有ratelimit配置)，-1 打开配置文件失败
+ */
+int getRateLimitConfig(RateLimitConfig *cfg) {
+  *cfg = RateLimitConfig();
+  std::ifstream ifs(CFG_PATH);
+  if (!ifs.is_open()) {
+    LOG_ERROR(RATELIMIT_LOG_MODULE, RATELIMIT_LOG_PROC,
+              "Failed to open cfg.json");
+    return -1;
+  }
+  rapidjson::IStreamWrapper isw(ifs);
+  rapidjson::Document doc;
+  doc.ParseStream(isw);
+  if (doc.HasParseError() || !doc.IsObject() || !doc.HasMember("ratelimit")) {
+    return 0;
+  }
+
+  const rapidjson::Value &rl = doc["ratelimit"];
+  cfg->slots = (size_t)cfgNumber(rl, "slots", (double)cfg->slots);
+  cfg->redis = cfgNumber(rl, "redis", 0) != 0;
+  if (rl.HasMember("shm_name") && rl["shm_name"].IsString()) {
+    cfg->shm_name = rl["shm_name"].GetString();
+  }
+  if (!rl.HasMember("policy") || !rl["policy"].IsObject()) {
+    return 0;
+  }
+  for (auto it = rl["policy"].MemberBegin(); it != rl["policy"].MemberEnd();
+       ++it) {
+    if (!it->value.IsObject()) {
+      continue;
+    }
+    RatePolicy p;
+    p.path = it->name.GetString();
+    if (it->value.HasMember("user_field") &&
+        it->value["user_field"].IsString()) {
+      p.user_field = it->value["user_field"].GetString();
+    }
+    p.ip = cfgRule(it->value, "ip");
+    p.user = cfgRule(it->value, "user");
+    if (p.ip.enabled() || p.user.enabled()) {
+      cfg->policies.push_back(p);
+    }
+  }
+  return 0;
+}
+
+int rateLimitInit() {
+  RateLimitConfig cfg;
+  if (getRateLimitConfig(&cfg) != 0) {
+    return -1;
+  }
+  return rateLimitInit(cfg);
+}
+
+int rateLimitInit(const RateLimitConfig &cfg) {
+  rate_cfg = cfg;
+  rate_ready = false;
+  if (cfg.policies.empty()) {
+    return 0;
+  }
+  if (rate_table.open(cfg.shm_name.c_str(), cfg.slots) != 0) {
+    return -1;
+  }
+  rate_ready = true;
+  for (const RatePolicy &p : cfg.policies) {
+    LOG_INFO(RATELIMIT_LOG_MODULE, RATELIMIT_LOG_PROC,
+             "%s: ip %.2f/s burst %.0f, user(%s) %.2f/s burst %.0f\n",
+             p.path.c_str(), p.ip.rate, p.ip.burst, p.user_field.c_str(),
+             p.user.rate, p.user.burst);
+  }
+  return 0;
+}
+
+const RatePolicy *rateLimitPolicy(const char *path) {
+  if (!rate_ready || path == nullptr) {
+    return nullptr;
+  }
+  for (const RatePolicy &p : rate_cfg.policies) {
+    if (p.path == path) {
+      return &p;
+    }
+  }
+  return nullptr;
+}
+
+// FNV-1a，key包含接口路径和维度，不同接口、IP和用户名互不影响
+static uint64_t rateKey(const std::string &path, char kind,
+                        std::string_view value) {
+  uint64_t h = 1469598103934665603ULL;
+  auto mix = [&h](const char *p, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+      h ^= (unsigned char)p[i];
+      h *= 1099511628211ULL;
+    }
+  };
+  mix(path.data(), path.size());
+  mix(&kind, 1);
+  mix(value.data(), value.size());
+  return h == 0 ? 1 : h;
+}
+
+static uint32_t nowMs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint32_t)(ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000);
+}
+
+/**
+ * @brief  redis上的全局令牌桶，redis出错时放行(本地桶已经检查过)
+ */
+static bool redisAllow(sw::redis::Redis *redis, const RatePolicy *policy,
+                       const char *kind, std::string_view value,
+                       const RateRule &rule) {
+  std::string key = "ratelimit:" + policy->path + ":" + kind + ":";
+  key.append(value.data(), value.size());
+  char rate[32], burst[32];
+  snprintf(rate, sizeof(rate), "%g", rule.rate);
+  snprintf(burst, sizeof(burst), "%g", rule.burst);
+  try {
+    return redis->eval<long long>(RATE_LUA, {key}, {rate, burst}) != 0;
+  } catch (const sw::redis::Error &e) {
+    LOG_ERROR(RATELIMIT_LOG_MODULE, RATELIMIT_LOG_PROC,
+              "redis ratelimit err: %s\n", e.what());
+    return true;
+  }
+}
+
+static bool ruleAllow(const RatePolicy *policy, char kind,
+                      const RateRule &rule, std::string_view value,
+                      sw::redis::Redis *redis, uint32_t now) {
+  if (!rule.enabled() || value.empty()) {
+    return true;
+  }
+  if (!rate_table.take(rateKey(policy->path, kind, value), rule.rate,
+                       rule.burst, now)) {
+    return false;
+  }
+  if (rate_cfg.redis && redis != nullptr) {
+    return redisAllow(redis, policy, kind == 'i' ? "ip" : "user", value,
+                      rule);
+  }
+  return true;
+}
+
+/**
+ * @brief  按策略检查一个请求，先查IP再查用户名
+ *
+ * @return 允许返回true，应返回429时返回false
+ */
+bool rateLimitAllow(const RatePolicy *policy, std::string_view ip,
+                    std::string_view user, sw::redis::Redis *redis) {
+  if (policy == nullptr) {
+    return true;
+  }
+  uint32_t now = nowMs();
+  if (!ruleAllow(policy, 'i', policy->ip, ip, redis, now)) {
+    LOG_WARNING(RATELIMIT_LOG_MODULE, RATELIMIT_LOG_PROC,
+                "%s rate limited, ip = %.*s\n", policy->path.c_str(),
+                (int)ip.size(), ip.data());
+    return false;
+  }
+  if (!ruleAllow(policy, 'u', policy->user, user, redis, now)) {
+    LOG_WARNING(RATELIMIT_LOG_MODULE, RATELIMIT_LOG_PROC,
+                "%s rate limited, user = %.*s\n", policy->path.c_str(),
+                (int)user.size(), user.data());
+    return false;
+  }
+  return true;
+}
+
+// 4位十六进制，格式不对返回-1
+static long hex4(const char *p, const char *end) {
+  if (end - p < 4) return -1;
+  long v = 0;
+  for (int i = 0; i < 4; i++) {
+    char c = p[i];
+    int d = (c >= '0' && c <= '9')   ? c - '0'
+            : (c >= 'a' && c <= 'f') ? c - 'a' + 10
+            : (c >= 'A' && c <= 'F') ? c - 'A' + 10
+                                     : -1;
+    if (d < 0) return -1;
+    v = v * 16 + d;
+  }
+  return v;
+}
+
+/**
+ * @brief  解码json字符串的值，p指向开头的'"'之后
+ *         与处理函数的json解析得到的值一致，"\u006dike"就是"mike"
+ *
+ * @return 成功返回true，格式不对或放不下时返回false
+ */
+static bool unescapeString(const char *p, const char *end, char *out,
+                           size_t size) {
+  size_t n = 0;
+  while (p < end && *p != '"') {
+    unsigned long cp;
+    if (*p != '\\') {
+      cp = (unsigned char)*p++;
+      if (n + 1 >= size) return false;
+      out[n++] = (char)cp;
+      continue;
+    }
+    if (++p == end) return false;
+    char c = *p++;
+    switch (c) {
+      case '"': case '\\': case '/': cp = c; break;
+      case 'b': cp = '\b'; break;
+      case 'f': cp = '\f'; break;
+      case 'n': cp = '\n'; break;
+      case 'r': cp = '\r'; break;
+      case 't': cp = '\t'; break;
+      case 'u': {
+        long hi = hex4(p, end);
+        if (hi < 0) return false;
+        p += 4;
+        cp = hi;
+        if (hi >= 0xD800 && hi <= 0xDBFF) {
+          // 代理对
+          long lo = (end - p >= 6 && p[0] == '\\' && p[1] == 'u')
+                        ? hex4(p + 2, end)
+                        : -1;
+          if (lo < 0xDC00 || lo > 0xDFFF) return false;
+          p += 6;
+          cp = 0x10000 + ((hi - 0xD800) << 10) + (lo - 0xDC00);
+        } else if (hi >= 0xDC00 && hi <= 0xDFFF) {
+          return false;
+        }
+        break;
+      }
+      default:
+        return false;
+    }
+    // 按UTF-8写出
+    char buf[4];
+    size_t len;
+    if (cp < 0x80) {
+      buf[0] = (char)cp;
+      len = 1;
+    } else if (cp < 0x800) {
+      buf[0] = (char)(0xC0 | (cp >> 6));
+      buf[1] = (char)(0x80 | (cp & 0x3F));
+      len = 2;
+    } else if (cp < 0x10000) {
+      buf[0] = (char)(0xE0 | (cp >> 12));
+      buf[1] = (char)(0x80 | ((cp >> 6) & 0x3F));
+      buf[2] = (char)(0x80 | (cp & 0x3F));
+      len = 3;
+    } else {
+      buf[0] = (char)(0xF0 | (cp >> 18));
+      buf[1] = (char)(0x80 | ((cp >> 12) & 0x3F));
+      buf[2] = (char)(0x80 | ((cp >> 6) & 0x3F));
+      buf[3] = (char)(0x80 | (cp & 0x3F));
+      len = 4;
+    }
+    if (n + len >= size) return false;
+    memcpy(out + n, buf, len);
+    n += len;
+  }
+  if (p == end) return false;
+  out[n] = '\0';
+  return true;
+}
+
+/**
+ * @brief  在请求体中找"field": "value"，值中的转义按json解码
+ *         "field"后面不是':'时(出现在值里)继续往后找
+ *
+ * @param body  请求体
+ * @param len   请求体长度
+ * @param field 字段名
+ * @param user  (out) 字段值
+ * @param size  user的大小(包含'\0')
+ *
+ * @return 找到返回true
+ */
+bool rateLimitScanUser(const char *body, size_t len, const char *field,
+                       char *user, size_t size) {
+  char needle[64];
+  int n = snprintf(needle, sizeof(needle), "\"%s\"", field);
+  if (n <= 0 || n >= (int)sizeof(needle)) {
+    return false;
+  }
+  const char *end = body + len;
+  const char *from = body;
+  const char *p;
+  while ((p = scanFind(from, end - from, needle, n)) != nullptr) {
+    from = p + 1;
+    p += n;
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')) p++;
+    if (p == end || *p != ':') continue;
+    p++;
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')) p++;
+    if (p == end || *p != '"') return false;
+    return unescapeString(p + 1, end, user, size) && user[0] != '\0';
+  }
+  return false;
+}
@@ -0,0 +1,117 @@
+#ifndef RATELIMIT_UTIL_H
+#define RATELIMIT_UTIL_H
+
+#include <sw/redis++/redis++.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/*
+   按客户端IP和用户名的令牌桶限流：
+   每个接口在cfg.json中配置自己的策略，超过限制的请求在解析json、
+   访问数据库之前直接返回429。
+
+   令牌桶放在共享内存(shm_open)的开放寻址表中，同一台机器上所有worker进程
+   和各个接口程序共用；每个桶是一个64位状态(上次更新时间 + 剩余令牌)，
+   用CAS更新，不加锁。表满时回收最久没有使用的桶。
+
+   多台机器部署时打开redis，本地桶先做一次快速拒绝，再由redis上的
+   Lua脚本做全局计数；redis出错时只按本地桶限流。
+
+   "ratelimit": {
+     "slots": 65536,
+     "redis": false,
+     "policy": {
+       "/login":  {"user_field": "userName",
+                   "ip":   {"rate": 1,   "burst": 20},
+                   "user": {"rate": 0.2, "burst": 5}}
+     }
+   }
+   rate为每秒补充的令牌数，burst为桶的容量(允许的突发请求数)。
+   user规则只用于请求体是json的接口：请求体超过RATELIMIT_BODY_MAX、
+   找不到用户名的请求直接返回429，不能靠填充请求体或转义用户名绕过。
+*/
+
+const char *const RATELIMIT_LOG_MODULE = "cgi";
+const char *const RATELIMIT_LOG_PROC = "ratelimit";
+
+// 为了取用户名最多读入内存的请求体长度，有user规则时更长的请求拒绝
+const size_t RATELIMIT_BODY_MAX = 4096;
+
+// 一条限流规则，rate <= 0 表示不限
+struct RateRule {
+  double rate = 0;   // 每秒补充的令牌数
+  double burst = 0;  // 桶容量
+
+  bool enabled() const { return rate > 0 && burst >= 1; }
+};
+
+// 一个接口的限流策略
+struct RatePolicy {
+  std::string path;                // 接口路径，如"/login"
+  std::string user_field = "user"; // 请求体json中用户名的字段
+  RateRule ip;                     // 按REMOTE_ADDR
+  RateRule user;                   // 按用户名
+};
+
+struct RateLimitConfig {
+  size_t slots = 65536;    // 共享内存表的桶数，取整为2的幂
+  bool redis = false;      // 是否在redis上做全局限流
+  std::string shm_name = "/filehub_ratelimit";
+  std::vector<RatePolicy> policies;
+};
+
+// 共享内存中的令牌桶表
+class RateTable {
+ public:
+  RateTable() = default;
+  ~RateTable();
+  RateTable(const RateTable &) = delete;
+  RateTable &operator=(const RateTable &) = delete;
+
+  // 打开(不存在时创建)名为name的共享内存表，成功返回0
+  int open(const char *name, size_t slots);
+
+  // 从key的桶中取一个令牌，取到返回true
+  bool take(uint64_t key, double rate, double burst, uint32_t now_ms);
+
+  size_t slots() const { return mask_ + 1; }
+
+ private:
+  struct Slot {
+    std::atomic<uint64_t> key;    // 0为空
+    std::atomic<uint64_t> state;  // 高32位：上次更新时间(ms)，低32位：千分之一令牌
+  };
+
+  Slot *find(uint64_t key, uint32_t now_ms);
+
+  Slot *table_ = nullptr;
+  size_t mask_ = 0;
+  size_t map_len_ = 0;
+};
+
+// 从cfg.json读取限流配置，没有ratelimit时policies为空
+int getRateLimitConfig(RateLimitConfig *cfg);
+
+// 读取配置并打开共享内存表，没有配置策略时不限流，失败返回-1
+int rateLimitInit();
+int rateLimitInit(const RateLimitConfig &cfg);
+
+// 接口的限流策略，没有配置时返回nullptr
+const RatePolicy *rateLimitPolicy(const char *path);
+
+// 按策略检查一个请求，ip/user为空时跳过对应规则，允许返回true
+// redis不为nullptr且配置了redis时还要通过全局限流
+bool rateLimitAllow(const RatePolicy *policy, std::string_view ip,
+                    std::string_view user, sw::redis::Redis *redis);
+
+// 在请求体中找第一个"field":"value"并解码转义，不做完整的json解析
+// 找到并能放下时返回true
+bool rateLimitScanUser(const char *body, size_t len, const char *field,
+                       char *user, size_t size);
+
+#endif
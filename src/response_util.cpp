@@ -0,0 +1,173 @@
+#include "response_util.h"
+
+#include <cstdio>
+#include <cstring>
+
+// 固定响应：响应头和body在编译期拼接成一整段
+struct StatusResponse {
+  const char *code;
+  const char *data;
+  size_t len;
+};
+
+#define STATUS_RESPONSE(c)                    \
+  { c, RESP_HEADER "{\"code\":\"" c "\"}", \
+    sizeof(RESP_HEADER "{\"code\":\"" c "\"}") - 1 }
+
+/*
+   000/001 登陆成功/失败     002/003/004 注册成功/用户已存在/失败
+   005/006/007 秒传          008/009 上传成功/失败
+   010 超出存储配额           011/012 共享成功/失败
+   013/014 取消共享成功/失败
+   015 获取文件列表失败       016 下载失败
+   021 差量签名失败
+   110/111 token验证成功/失败
+*/
+static const StatusResponse status_table[] = {
+    STATUS_RESPONSE("000"), STATUS_RESPONSE("001"), STATUS_RESPONSE("002"),
+    STATUS_RESPONSE("003"), STATUS_RESPONSE("004"), STATUS_RESPONSE("005"),
+    STATUS_RESPONSE("006"), STATUS_RESPONSE("007"), STATUS_RESPONSE("008"),
+    STATUS_RESPONSE("009"), STATUS_RESPONSE("010"), STATUS_RESPONSE("011"),
+    STATUS_RESPONSE("012"), STATUS_RESPONSE("013"), STATUS_RESPONSE("014"),
+    STATUS_RESPONSE("015"), STATUS_RESPONSE("016"), STATUS_RESPONSE("021"),
+    STATUS_RESPONSE("110"), STATUS_RESPONSE("111"),
+};
+
+static const size_t RESP_HEADER_LEN = sizeof(RESP_HEADER) - 1;
+static const char NO_DATA_RESPONSE[] =
+    RESP_HEADER "No data from standard input.<p>\n";
+static const char NOT_FOUND_RESPONSE[] =
+    "Status: 404 Not Found\r\n" RESP_HEADER;
+static const char TOO_MANY_RESPONSE[] =
+    "Status: 429 Too Many Requests\r\nRetry-After: 1\r\n" RESP_HEADER
+    "{\"code\":\"429\"}";
+static const char LENGTH_REQUIRED_RESPONSE[] =
+    "Status: 411 Length Required\r\n" RESP_HEADER "{\"code\":\"411\"}";
+static const char TOO_LARGE_RESPONSE[] =
+    "Status: 413 Payload Too Large\r\n" RESP_HEADER "{\"code\":\"413\"}";
+static const char UNAVAILABLE_RESPONSE[] =
+    "Status: 503 Service Unavailable\r\nRetry-After: 5\r\n" RESP_HEADER
+    "{\"code\":\"503\"}";
+
+static const StatusResponse *findStatus(const char *code) {
+  for (const StatusResponse &s : status_table) {
+    if (strcmp(s.code, code) == 0) {
+      return &s;
+    }
+  }
+  return nullptr;
+}
+
+/**
+ * @brief  把多段数据依次追加到FastCGI输出流
+ *
+ * @param out    输出流
+ * @param iov    数据段
+ * @param iovcnt 数据段个数
+ *
+ * @return 写入的字节数，失败返回-1
+ */
+int writeGather(FCGX_Stream *out, const struct iovec *iov, int iovcnt) {
+  int total = 0;
+  for (int i = 0; i < iovcnt; i++) {
+    if (iov[i].iov_len == 0) {
+      continue;
+    }
+    int n = FCGX_PutStr((const char *)iov[i].iov_base, (int)iov[i].iov_len,
+                        out);
+    if (n != (int)iov[i].iov_len) {
+      return -1;
+    }
+    total += n;
+  }
+  return total;
+}
+
+/**
+ * @brief  返回固定的状态码响应，不在表中的状态码现场拼接
+ *
+ * @param out  输出流
+ * @param code 状态码
+ *
+ * @return 写入的字节数，失败返回-1
+ */
+int writeStatus(FCGX_Stream *out, const char *code) {
+  const StatusResponse *s = findStatus(code);
+  if (s != nullptr) {
+    return FCGX_PutStr(s->data, (int)s->len, out) == (int)s->len ? (int)s->len
+                                                                  : -1;
+  }
+
+  char body[64];
+  int len = snprintf(body, sizeof(body), "{\"code\":\"%s\"}", code);
+  if (len < 0 || len >= (int)sizeof(body)) {
+    return -1;
+  }
+  return writeBody(out, body, len);
+}
+
+/**
+ * @brief  返回动态生成的body，响应头和body一起追加
+ *
+ * @return 写入的字节数，失败返回-1
+ */
+int writeBody(FCGX_Stream *out, const char *body, size_t len) {
+  struct iovec iov[2];
+  iov[0].iov_base = (void *)RESP_HEADER;
+  iov[0].iov_len = RESP_HEADER_LEN;
+  iov[1].iov_base = (void *)body;
+  iov[1].iov_len = len;
+  return writeGather(out, iov, 2);
+}
+
+int writeNoData(FCGX_Stream *out) {
+  int len = sizeof(NO_DATA_RESPONSE) - 1;
+  return FCGX_PutStr(NO_DATA_RESPONSE, len, out) == len ? len : -1;
+}
+
+int writeNotFound(FCGX_Stream *out) {
+  int len = sizeof(NOT_FOUND_RESPONSE) - 1;
+  return FCGX_PutStr(NOT_FOUND_RESPONSE, len, out) == len ? len : -1;
+}
+
+int writeTooManyRequests(FCGX_Stream *out) {
+  int len = sizeof(TOO_MANY_RESPONSE) - 1;
+  return FCGX_PutStr(TOO_MANY_RESPONSE, len, out) == len ? len : -1;
+}
+
+void appendStatus(std::string *out, const char *code) {
+  const StatusResponse *s = findStatus(code);
+  if (s != nullptr) {
+    out->append(s->data, s->len);
+    return;
+  }
+  out->append(RESP_HEADER "{\"code\":\"");
+  out->append(code);
+  out->append("\"}");
+}
+
+void appendBody(std::string *out, const char *body, size_t len) {
+  out->reserve(out->size() + RESP_HEADER_LEN + len);
+  out->append(RESP_HEADER, RESP_HEADER_LEN);
+  out->append(body, len);
+}
+
+void appendNoData(std::string *out) {
+  out->append(NO_DATA_RESPONSE, sizeof(NO_DATA_RESPONSE) - 1);
+}
+
+void appendTooManyRequests(std::string *out) {
+  out->append(TOO_MANY_RESPONSE, sizeof(TOO_MANY_RESPONSE) - 1);
+}
+
+void appendLengthRequired(std::string *out) {
+  out->append(LENGTH_REQUIRED_RESPONSE, sizeof(LENGTH_REQUIRED_RESPONSE) - 1);
+}
+
+void appendPayloadTooLarge(std::string *out) {
+  out->append(TOO_LARGE_RESPONSE, sizeof(TOO_LARGE_RESPONSE) - 1);
+}
+
+void appendServiceUnavailable(std::string *out) {
+  out->append(UNAVAILABLE_RESPONSE, sizeof(UNAVAILABLE_RESPONSE) - 1);
+}
@@ -0,0 +1,54 @@
+#ifndef RESPONSE_UTIL_H
+#define RESPONSE_UTIL_H
+
+#include <sys/uio.h>
+
+#include <cstddef>
+#include <string>
+
+#include "fcgiapp.h"
+
+/*
+   FastCGI响应的写出：
+   响应头和body作为一次分散写追加到FastCGI输出流的缓冲区，
+   FastCGI库只在缓冲区满或FCGX_Finish_r时才真正发送，
+   所以一个小响应只有一次内存拷贝，不再经过FCGX_FPrintF的格式化。
+
+   固定的状态码响应 {"code":"xxx"} 连同响应头在编译期拼成一整段字符串，
+   writeStatus只做一次查表和一次追加。
+*/
+
+// 所有接口使用的响应头
+#define RESP_HEADER "Content-type: text/html\r\n\r\n"
+
+// 依次把iov中的数据追加到输出流，返回写入的字节数，失败返回-1
+int writeGather(FCGX_Stream *out, const struct iovec *iov, int iovcnt);
+
+// 返回固定的状态码响应(响应头 + {"code":"xxx"})
+int writeStatus(FCGX_Stream *out, const char *code);
+
+// 返回动态生成的body(响应头 + body)
+int writeBody(FCGX_Stream *out, const char *body, size_t len);
+
+// 返回没有请求体的提示
+int writeNoData(FCGX_Stream *out);
+
+// 没有对应的接口时返回404
+int writeNotFound(FCGX_Stream *out);
+
+// 超过限流时返回429
+int writeTooManyRequests(FCGX_Stream *out);
+
+// io_uring服务端的协程处理函数把响应追加到字符串(UringRequest::out)
+void appendStatus(std::string *out, const char *code);
+void appendBody(std::string *out, const char *body, size_t len);
+void appendNoData(std::string *out);
+void appendTooManyRequests(std::string *out);
+
+// 上传准入(admission_util.h)拒绝时的响应：没有长度411、太大413、
+// 暂时放不下503(带Retry-After，客户端稍后重试)
+void appendLengthRequired(std::string *out);
+void appendPayloadTooLarge(std::string *out);
+void appendServiceUnavailable(std::string *out);
+
+#endif
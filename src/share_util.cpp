@@ -0,0 +1,71 @@
+/**
+ * @file share_util.cpp
+ * @brief 共享文件排行与mysql的定期同步
+ * @author ward
+ * @version 1.0
+ * @date 2023年7月8日
+ */
+
+#include "share_util.h"
+
+#include <ctime>
+#include <mutex>
+#include <vector>
+
+#include "make_log.h"
+
+static std::mutex share_lock;
+static int share_interval_s = 300;
+static time_t share_last_sync = 0;
+
+void shareInit(int sync_interval_s) {
+  std::lock_guard<std::mutex> lock(share_lock);
+  share_interval_s = sync_interval_s;
+}
+
+void shareSyncSoon() {
+  std::lock_guard<std::mutex> lock(share_lock);
+  share_last_sync = 0;
+}
+
+/**
+ * @brief 用mysql中所有已共享的文件重建redis中的排行
+ *
+ * @param meta   元数据存储
+ * @param shares 共享排行
+ * @param force  不管本进程的同步间隔，仍需抢到锁
+ *
+ * @return 写入排行的文件数，没有同步返回0，失败返回-1
+ */
+long shareSync(MetaStore *meta, ShareIndex *shares, bool force) {
+  int interval_s;
+  {
+    std::lock_guard<std::mutex> lock(share_lock);
+    time_t now = time(nullptr);
+    if (!force && now - share_last_sync < share_interval_s) {
+      return 0;
+    }
+    share_last_sync = now;
+    interval_s = share_interval_s > 0 ? share_interval_s : 1;
+  }
+
+  // 每个间隔只有一个进程读mysql
+  if (!shares->claimSync(interval_s)) {
+    return 0;
+  }
+  std::vector<SharedFile> files;
+  if (meta->sharedFiles(&files) != 0) {
+    LOG_ERROR(SHARE_LOG_MODULE, SHARE_LOG_PROC, "load shared files failed\n");
+    shares->releaseSync();
+    return -1;
+  }
+  if (shares->replace(files) != 0) {
+    LOG_ERROR(SHARE_LOG_MODULE, SHARE_LOG_PROC, "replace %zu shares failed\n",
+              files.size());
+    shares->releaseSync();
+    return -1;
+  }
+  LOG_INFO(SHARE_LOG_MODULE, SHARE_LOG_PROC, "synced %zu shared files\n",
+           files.size());
+  return (long)files.size();
+}
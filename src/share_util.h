@@ -0,0 +1,41 @@
+#ifndef SHARE_UTIL_H
+#define SHARE_UTIL_H
+
+#include "backend_util.h"
+
+/*
+   公开的共享文件列表(sharefiles_cgi.cpp)：
+   user_file_list.shared_status和share_time是共享状态的来源，
+   redis中另有一份排行(RedisShareIndex)，列表请求只读redis，不访问mysql：
+   - share:time  有序集合，member为 user\n md5\n filename，分数为共享时间
+   - share:pv    有序集合，分数为下载量
+   - share:info  hash，member -> 共享时间\n大小\n类型
+   - share:synced 排行已从mysql建立的标记
+   - share:dirty 共享/取消共享过的member，每次重建后清空
+   一页是一次EVAL：ZREVRANGE取名次，再取文件信息和下载量。
+
+   共享/取消共享先改mysql再改redis；下载量由pv_util推送时一并累加到share:pv。
+   每隔sync_interval_s，抢到share:lock的进程把mysql中所有已共享的文件
+   写入新的key，再用一次EVAL替换，纠正redis与mysql之间的偏差(redis写失败等)。
+   替换时pv:pending、pv:flushing中还没落库的下载量累加到新排行；
+   读mysql期间共享/取消共享的文件记在share:dirty中，以旧排行中的状态为准。
+   重建在后台定时任务(cgi_server.h的addCgiTimer)中运行，不占用请求；
+   share:synced不存在(redis重启、第一次部署)时列表请求失败，并让定时任务立即重建。
+
+   "share": {"sync_s": 300}
+*/
+
+const char *const SHARE_LOG_MODULE = "cgi";
+const char *const SHARE_LOG_PROC = "share";
+
+// 设置同步间隔(秒)，<= 0时每次调用都尝试同步
+void shareInit(int sync_interval_s);
+
+// 到了同步间隔且抢到锁时用mysql中的共享文件重建排行，force时不管间隔
+// 失败时释放锁，返回写入排行的文件数，没有同步返回0，失败返回-1
+long shareSync(MetaStore *meta, ShareIndex *shares, bool force);
+
+// 排行还没有建立，下一次shareSync不管间隔
+void shareSyncSoon();
+
+#endif
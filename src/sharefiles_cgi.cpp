@@ -0,0 +1,380 @@
+/**
+ * @file sharefiles_cgi.cpp
+ * @brief 共享文件：共享/取消共享，公开的共享列表(按下载量、按共享时间)，分享短链接
+ * @author ward
+ * @version 1.0
+ * @date 2023年7月8日
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <vector>
+
+#include "backend_util.h"
+#include "cgi_server.h"
+#include "cgi_util.h"
+#include "json_util.h"
+#include "link_util.h"
+#include "make_log.h"
+#include "query_util.h"
+#include "response_util.h"
+#include "share_util.h"
+
+using namespace std;
+
+/*
+   公开的共享列表，不需要登录，只读redis中的排行(share_util.h)：
+   GET /sharefiles?cmd=normal&start=0&count=10  按共享时间从新到旧
+   GET /sharefiles?cmd=pvdesc&start=0&count=10  按下载量降序
+   {"total":2,"files":[{"user":"mike","md5":"xxx","time":"2023-07-08 10:00:00",
+    "filename":"a.txt","share_status":1,"pv":3,"url":"xxx","size":5,
+    "type":"txt"}, ...]}
+   time为共享时间，其余字段与/myfiles的列表相同；count最大为page_max。
+   url为/dl的下载地址(/dl?owner=mike&md5=xxx&filename=a.txt)，客户端加上
+   自己的user/token下载；不公开storage上的地址，打包的文件在那里是整个容器，
+   压缩存储的文件是zstd压缩后的内容。
+   GET /sharefiles?cmd=count  {"num":2}
+   排行读不出来时返回 {"code":"015"}，排行还没有建立时也是，后台随即重建。
+
+   共享和取消共享自己的文件，先改mysql再改redis：
+   POST /sharefiles?cmd=share   {"user":"mike","token":"xxx","md5":"xxx",
+                                 "filename":"a.txt"}
+   POST /sharefiles?cmd=cancel  同上
+   011/012 共享成功/失败，013/014 取消共享成功/失败，111 token验证失败。
+   mysql已改好而redis出错时仍返回成功，排行在下一次同步时更正。
+
+   为自己的文件生成分享短链接(link_util.h)，expire_s和max_downloads可选，
+   0或不填为不限：
+   POST /sharefiles?cmd=link  {"user":"mike","token":"xxx","md5":"xxx",
+                               "filename":"a.txt","expire_s":86400,
+                               "max_downloads":100}
+   {"code":"011","link":"<code>","expire_time":1688900000}，
+   expire_time为unix秒，不过期为0；失败返回012，111 token验证失败。
+   任何人用 GET /dl?link=<code> 下载。
+
+   "share": {"sync_s": 300, "page_max": 100}
+*/
+
+const char *const SHAREFILES_LOG_MODULE = "cgi";
+const char *const SHAREFILES_LOG_PROC = "sharefiles";
+
+// 共享/取消共享的请求体上限
+static const int SHARE_BODY_MAX = 4 * 1024;
+
+static int share_page_max = 100;
+
+// 后台定时任务：到了间隔时与mysql同步，退出时不需要做什么
+static void shareTimer(CgiContext *ctx, bool final) {
+  if (final) {
+    return;
+  }
+  shareSync(ctx->meta, ctx->shares, false);
+}
+
+// 读取配置
+int sharefilesInit() {
+  int sync_s = 300;
+  share_page_max = 100;
+  string value;
+  if (getCfgValue(CFG_PATH, "share", "sync_s", value) == 0) {
+    sync_s = atoi(value.c_str());
+  }
+  if (getCfgValue(CFG_PATH, "share", "page_max", value) == 0 &&
+      atoi(value.c_str()) > 0) {
+    share_page_max = atoi(value.c_str());
+  }
+  shareInit(sync_s);
+  // 排行没有建立时shareSyncSoon，定时任务每秒检查一次
+  addCgiTimer(shareTimer, 1);
+  linkInit(linkConfig());
+  LOG_INFO(SHAREFILES_LOG_MODULE, SHAREFILES_LOG_PROC,
+           "sync_s = %d, page_max = %d\n", sync_s, share_page_max);
+  return 0;
+}
+
+// 查询参数中的非负整数，没有时为def，格式不对时返回false
+static bool queryLong(const QueryParams *query, const char *key, long def,
+                      long *value) {
+  char buf[24] = {0};
+  if (!query->has(key)) {
+    *value = def;
+    return true;
+  }
+  if (query->copy(key, buf, sizeof(buf)) != 0 || buf[0] == '\0') {
+    return false;
+  }
+  char *end = nullptr;
+  *value = strtol(buf, &end, 10);
+  return *end == '\0' && *value >= 0;
+}
+
+/**
+ * @brief 从排行读一页，排行还没有建立时让定时任务立即同步，本次失败
+ *
+ * @return 0成功，-1失败
+ */
+static int listShares(CgiContext *ctx, bool by_pv, long start, long count,
+                      vector<SharedFile> *files, long *total) {
+  int ret = ctx->shares->list(by_pv, start, count, files, total);
+  if (ret == 1) {
+    shareSyncSoon();
+  }
+  if (ret != 0) {
+    LOG_ERROR(SHAREFILES_LOG_MODULE, SHAREFILES_LOG_PROC,
+              "list shares failed, ret = %d\n", ret);
+    return -1;
+  }
+  return 0;
+}
+
+// 一页共享文件序列化为json
+static void sharesToJson(const vector<SharedFile> &files, long total,
+                         PoolStringBuffer &buffer) {
+  PoolWriter writer(buffer, &jsonArena());
+  writer.StartObject();
+  writer.Key("total");
+  writer.Int64(total);
+  writer.Key("files");
+  writer.StartArray();
+  string url;
+  for (const SharedFile &f : files) {
+    char time_str[32] = {0};
+    time_t t = f.share_time;
+    struct tm tm;
+    localtime_r(&t, &tm);
+    strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M:%S", &tm);
+
+    writer.StartObject();
+    writer.Key("user");
+    writer.String(f.user.c_str(), (rapidjson::SizeType)f.user.size());
+    writer.Key("md5");
+    writer.String(f.md5.c_str(), (rapidjson::SizeType)f.md5.size());
+    writer.Key("time");
+    writer.String(time_str);
+    writer.Key("filename");
+    writer.String(f.filename.c_str(), (rapidjson::SizeType)f.filename.size());
+    writer.Key("share_status");
+    writer.Int(1);
+    writer.Key("pv");
+    writer.Int64(f.pv);
+    url.clear();
+    dlUrl(f.user, f.md5, f.filename, &url);
+    writer.Key("url");
+    writer.String(url.c_str(), (rapidjson::SizeType)url.size());
+    writer.Key("size");
+    writer.Int64(f.size);
+    writer.Key("type");
+    writer.String(f.type.c_str(), (rapidjson::SizeType)f.type.size());
+    writer.EndObject();
+  }
+  writer.EndArray();
+  writer.EndObject();
+}
+
+// 公开的共享列表：count/normal/pvdesc
+static void listHandler(CgiContext *ctx, const char *cmd) {
+  vector<SharedFile> files;
+  long total = 0;
+  PoolStringBuffer buffer(&jsonArena());
+  if (strcmp(cmd, "count") == 0) {
+    if (listShares(ctx, false, 0, 0, &files, &total) != 0) {
+      writeStatus(request.out, "015");
+      return;
+    }
+    PoolWriter writer(buffer, &jsonArena());
+    writer.StartObject();
+    writer.Key("num");
+    writer.Int64(total);
+    writer.EndObject();
+    writeBody(request.out, buffer.GetString(), buffer.GetSize());
+    return;
+  }
+
+  long start = 0, count = 0;
+  if (!queryLong(ctx->query, "start", 0, &start) ||
+      !queryLong(ctx->query, "count", 10, &count)) {
+    writeStatus(request.out, "015");
+    return;
+  }
+  if (count > share_page_max) {
+    count = share_page_max;
+  }
+  if (listShares(ctx, strcmp(cmd, "pvdesc") == 0, start, count, &files,
+                 &total) != 0) {
+    writeStatus(request.out, "015");
+    return;
+  }
+  sharesToJson(files, total, buffer);
+  writeBody(request.out, buffer.GetString(), buffer.GetSize());
+}
+
+/**
+ * @brief 读出请求体并解析，验证token
+ *
+ * @return 0成功，-1失败(已写好响应)
+ */
+static int readRequest(CgiContext *ctx, const char *fail,
+                       const JsonField *fields, size_t n) {
+  const char *content_length = FCGX_GetParam("CONTENT_LENGTH", request.envp);
+  int len = content_length == nullptr ? 0 : atoi(content_length);
+  if (len <= 0) {
+    writeNoData(request.out);
+    return -1;
+  }
+  char buf[SHARE_BODY_MAX] = {0};
+  if (len >= (int)sizeof(buf) || FCGX_GetStr(buf, len, request.in) != len) {
+    LOG_ERROR(SHAREFILES_LOG_MODULE, SHAREFILES_LOG_PROC,
+              "bad body, len = %d\n", len);
+    writeStatus(request.out, fail);
+    return -1;
+  }
+  if (jsonDecode(buf, fields, n, SHAREFILES_LOG_PROC) != 0) {
+    writeStatus(request.out, fail);
+    return -1;
+  }
+  // 前两个字段是user和token
+  const char *user = (const char *)fields[0].dst;
+  if (!ctx->tokens->validate(user, (const char *)fields[1].dst)) {
+    LOG_ERROR(SHAREFILES_LOG_MODULE, SHAREFILES_LOG_PROC, "%s token验证失败\n",
+              user);
+    writeStatus(request.out, "111");
+    return -1;
+  }
+  return 0;
+}
+
+// 共享或取消共享自己的一个文件
+static void shareHandler(CgiContext *ctx, bool share) {
+  const char *fail = share ? "012" : "014";
+  char user[USER_NAME_LEN] = {0};
+  char token[TOKEN_LEN] = {0};
+  char md5[MD5_LEN] = {0};
+  char filename[FILE_NAME_LEN] = {0};
+  const JsonField fields[] = {
+      jsonStr("user", user, sizeof(user)),
+      jsonStr("token", token, sizeof(token)),
+      jsonStr("md5", md5, sizeof(md5)),
+      jsonStr("filename", filename, sizeof(filename)),
+  };
+  if (readRequest(ctx, fail, fields, sizeof(fields) / sizeof(fields[0])) !=
+      0) {
+    return;
+  }
+
+  SharedFile file;
+  if (ctx->meta->sharedFile(user, md5, filename, &file) != 0) {
+    LOG_ERROR(SHAREFILES_LOG_MODULE, SHAREFILES_LOG_PROC,
+              "%s 没有文件 %s 或查询失败\n", user, filename);
+    writeStatus(request.out, fail);
+    return;
+  }
+
+  if (share) {
+    // 已经共享的保留原来的共享时间
+    if (file.share_time == 0) {
+      file.share_time = time(nullptr);
+      if (ctx->meta->setShared(user, md5, filename, true, file.share_time) !=
+          0) {
+        writeStatus(request.out, fail);
+        return;
+      }
+    }
+    if (ctx->shares->add({file}) != 0) {
+      LOG_WARNING(SHAREFILES_LOG_MODULE, SHAREFILES_LOG_PROC,
+                  "%s/%s 加入排行失败，等待同步\n", user, filename);
+    }
+    writeStatus(request.out, "011");
+  } else {
+    if (ctx->meta->setShared(user, md5, filename, false, 0) != 0) {
+      writeStatus(request.out, fail);
+      return;
+    }
+    if (ctx->shares->remove(user, md5, filename) != 0) {
+      LOG_WARNING(SHAREFILES_LOG_MODULE, SHAREFILES_LOG_PROC,
+                  "%s/%s 移出排行失败，等待同步\n", user, filename);
+    }
+    writeStatus(request.out, "013");
+  }
+  LOG_INFO(SHAREFILES_LOG_MODULE, SHAREFILES_LOG_PROC, "%s %s %s\n", user,
+           share ? "share" : "cancel", filename);
+}
+
+// 为自己的一个文件生成分享短链接
+static void linkHandler(CgiContext *ctx) {
+  char user[USER_NAME_LEN] = {0};
+  char token[TOKEN_LEN] = {0};
+  char md5[MD5_LEN] = {0};
+  char filename[FILE_NAME_LEN] = {0};
+  long expire_s = 0, max_downloads = 0;
+  const JsonField fields[] = {
+      jsonStr("user", user, sizeof(user)),
+      jsonStr("token", token, sizeof(token)),
+      jsonStr("md5", md5, sizeof(md5)),
+      jsonStr("filename", filename, sizeof(filename)),
+      jsonLong("expire_s", &expire_s, false),
+      jsonLong("max_downloads", &max_downloads, false),
+  };
+  if (readRequest(ctx, "012", fields, sizeof(fields) / sizeof(fields[0])) !=
+      0) {
+    return;
+  }
+  SharedFile file;
+  if (expire_s < 0 || max_downloads < 0 ||
+      ctx->meta->sharedFile(user, md5, filename, &file) != 0) {
+    LOG_ERROR(SHAREFILES_LOG_MODULE, SHAREFILES_LOG_PROC,
+              "%s 没有文件 %s 或参数错误\n", user, filename);
+    writeStatus(request.out, "012");
+    return;
+  }
+
+  ShareLink link;
+  link.user = user;
+  link.md5 = md5;
+  link.filename = filename;
+  link.expire_time = expire_s > 0 ? (long)time(nullptr) + expire_s : 0;
+  link.max_downloads = max_downloads;
+  if (linkCreate(ctx->meta, ctx->redis, &link) != 0) {
+    writeStatus(request.out, "012");
+    return;
+  }
+  PoolStringBuffer buffer(&jsonArena());
+  PoolWriter writer(buffer, &jsonArena());
+  writer.StartObject();
+  writer.Key("code");
+  writer.String("011");
+  writer.Key("link");
+  writer.String(link.code.c_str(), (rapidjson::SizeType)link.code.size());
+  writer.Key("expire_time");
+  writer.Int64(link.expire_time);
+  writer.EndObject();
+  writeBody(request.out, buffer.GetString(), buffer.GetSize());
+  LOG_INFO(SHAREFILES_LOG_MODULE, SHAREFILES_LOG_PROC, "%s link %s -> %s\n",
+           user, link.code.c_str(), filename);
+}
+
+// 处理一个共享文件请求
+void sharefilesHandler(CgiContext *ctx) {
+  char cmd[16] = {0};
+  ctx->query->copy("cmd", cmd, sizeof(cmd));
+  if (strcmp(cmd, "share") == 0 || strcmp(cmd, "cancel") == 0) {
+    shareHandler(ctx, strcmp(cmd, "share") == 0);
+  } else if (strcmp(cmd, "link") == 0) {
+    linkHandler(ctx);
+  } else if (strcmp(cmd, "count") == 0 || strcmp(cmd, "normal") == 0 ||
+             strcmp(cmd, "pvdesc") == 0) {
+    listHandler(ctx, cmd);
+  } else {
+    writeStatus(request.out, "015");
+  }
+}
+
+#ifndef CGI_GATEWAY
+int main() {
+  const CgiRoute route = {"/sharefiles", nullptr, sharefilesHandler,
+                          sharefilesInit};
+  return runCgi(&route, 1);
+}
+#endif
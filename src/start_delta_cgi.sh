@@ -0,0 +1,20 @@
+#!/bin/bash
+
+# 编译到临时文件再替换，正在运行的进程不受影响
+g++ -std=c++17 -g delta_cgi.cpp delta_util.cpp quota_util.cpp make_log.cpp mysql_util.cpp cgi_server.cpp ratelimit_util.cpp admission_util.cpp trace_util.cpp metrics_util.cpp prefork_util.cpp cgi_util.cpp str_scan.cpp json_util.cpp response_util.cpp query_util.cpp backend_util.cpp storage_util.cpp pack_util.cpp compress_util.cpp -o delta_cgi.new -lfcgi -lmysqlclient -lredis++ -lfastcommon -lzstd -lm || exit 1
+mv delta_cgi.new delta_cgi
+
+# 已有prefork master(带delta_cgi子进程)时热重启：新worker就绪后旧worker处理完请求退出
+PID=$(pgrep -o -x delta_cgi)
+if [ -n "$PID" ] && pgrep -P "$PID" -x delta_cgi > /dev/null; then
+  echo "Hot restarting delta_cgi (master PID: $PID)"
+  kill -USR2 "$PID"
+  exit 0
+fi
+if [ -n "$PID" ]; then
+  echo "Killing existing delta_cgi process (PID: $PID)"
+  kill $(pidof delta_cgi)
+fi
+
+# spawn-fcgi只启动master，worker数见cfg.json中prefork.workers(为0时不使用prefork)
+spawn-fcgi -a 127.0.0.1 -p 10005 -f /home/ward/FileHub/src/delta_cgi
@@ -0,0 +1,21 @@
+#!/bin/bash
+
+# 编译到临时文件再替换，正在运行的进程不受影响
+# 所有接口编译进一个程序，定义CGI_GATEWAY去掉各接口自己的main
+g++ -std=c++17 -g -DCGI_GATEWAY gateway_cgi.cpp login_cgi.cpp reg_cgi.cpp md5_cgi.cpp myfiles_cgi.cpp upload_cgi.cpp quota_util.cpp delta_cgi.cpp delta_util.cpp dl_cgi.cpp pv_util.cpp link_util.cpp range_util.cpp cache_util.cpp zip_util.cpp sharefiles_cgi.cpp share_util.cpp metrics_cgi.cpp make_log.cpp mysql_util.cpp cgi_server.cpp ratelimit_util.cpp admission_util.cpp trace_util.cpp metrics_util.cpp prefork_util.cpp cgi_util.cpp str_scan.cpp json_util.cpp response_util.cpp query_util.cpp backend_util.cpp storage_util.cpp pack_util.cpp compress_util.cpp -o gateway_cgi.new -lfcgi -lmysqlclient -lredis++ -lfastcommon -lzstd -lz -lm || exit 1
+mv gateway_cgi.new gateway_cgi
+
+# 已有prefork master(带gateway_cgi子进程)时热重启：新worker就绪后旧worker处理完请求退出
+PID=$(pgrep -o -x gateway_cgi)
+if [ -n "$PID" ] && pgrep -P "$PID" -x gateway_cgi > /dev/null; then
+  echo "Hot restarting gateway_cgi (master PID: $PID)"
+  kill -USR2 "$PID"
+  exit 0
+fi
+if [ -n "$PID" ]; then
+  echo "Killing existing gateway_cgi process (PID: $PID)"
+  kill $(pidof gateway_cgi)
+fi
+
+# spawn-fcgi只启动master，worker数见cfg.json中prefork.workers(原来的 -F 4 对应 "workers": "4")
+spawn-fcgi -a 127.0.0.1 -p 10010 -f /home/ward/FileHub/src/gateway_cgi
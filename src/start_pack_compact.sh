@@ -0,0 +1,8 @@
+#!/bin/bash
+
+# 小文件容器压缩任务，建议加入crontab定期执行，如：
+# 0 3 * * * cd /home/ward/FileHub/src && ./start_pack_compact.sh
+
+g++ -std=c++17 -g pack_compact.cpp pack_util.cpp storage_util.cpp compress_util.cpp make_log.cpp mysql_util.cpp metrics_util.cpp trace_util.cpp cgi_util.cpp str_scan.cpp -o pack_compact -lmysqlclient -lredis++ -lfcgi -lzstd
+
+./pack_compact
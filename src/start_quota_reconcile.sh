@@ -0,0 +1,8 @@
+#!/bin/bash
+
+# 配额对账任务，建议加入crontab定期执行，如：
+# */10 * * * * cd /home/ward/FileHub/src && ./start_quota_reconcile.sh
+
+g++ -std=c++17 -g quota_reconcile.cpp quota_util.cpp make_log.cpp mysql_util.cpp metrics_util.cpp cgi_util.cpp str_scan.cpp -o quota_reconcile -lmysqlclient -lredis++ -lfcgi
+
+./quota_reconcile
@@ -1,13 +1,20 @@
 #!/bin/bash
 
-PID=$(pidof reg_cgi)
+# 编译到临时文件再替换，正在运行的进程不受影响
+g++ -std=c++17 -g reg_cgi.cpp make_log.cpp mysql_util.cpp cgi_server.cpp ratelimit_util.cpp admission_util.cpp trace_util.cpp metrics_util.cpp prefork_util.cpp cgi_util.cpp str_scan.cpp json_util.cpp response_util.cpp query_util.cpp backend_util.cpp storage_util.cpp -o reg_cgi.new -lfcgi -lmysqlclient -lredis++ || exit 1
+mv reg_cgi.new reg_cgi
+
+# 已有prefork master(带reg_cgi子进程)时热重启：新worker就绪后旧worker处理完请求退出
+PID=$(pgrep -o -x reg_cgi)
+if [ -n "$PID" ] && pgrep -P "$PID" -x reg_cgi > /dev/null; then
+  echo "Hot restarting reg_cgi (master PID: $PID)"
+  kill -USR2 "$PID"
+  exit 0
+fi
 if [ -n "$PID" ]; then
   echo "Killing existing reg_cgi process (PID: $PID)"
-  kill "$PID"
+  kill $(pidof reg_cgi)
 fi
 
-# Compile reg_cgi
-g++ -std=c++17 -g reg_cgi.cpp make_log.cpp mysql_util.cpp cgi_util.cpp -o reg_cgi -lfcgi -lmysqlclient -lredis++
-
-# Launch reg_cgi using spawn-fcgi
+# spawn-fcgi只启动master，worker数见cfg.json中prefork.workers(为0时不使用prefork)
 spawn-fcgi -a 127.0.0.1 -p 10000 -f /home/ward/FileHub/src/reg_cgi
@@ -1,11 +1,20 @@
 #!/bin/bash
 
-PID=$(pidof upload_cgi)
+# 编译到临时文件再替换，正在运行的进程不受影响
+g++ -std=c++17 -g upload_cgi.cpp quota_util.cpp make_log.cpp mysql_util.cpp cgi_server.cpp ratelimit_util.cpp admission_util.cpp trace_util.cpp metrics_util.cpp prefork_util.cpp cgi_util.cpp str_scan.cpp json_util.cpp response_util.cpp query_util.cpp backend_util.cpp storage_util.cpp pack_util.cpp compress_util.cpp -o upload_cgi.new -lfcgi -lmysqlclient -lredis++ -lfastcommon -lzstd -lm || exit 1
+mv upload_cgi.new upload_cgi
+
+# 已有prefork master(带upload_cgi子进程)时热重启：新worker就绪后旧worker处理完请求退出
+PID=$(pgrep -o -x upload_cgi)
+if [ -n "$PID" ] && pgrep -P "$PID" -x upload_cgi > /dev/null; then
+  echo "Hot restarting upload_cgi (master PID: $PID)"
+  kill -USR2 "$PID"
+  exit 0
+fi
 if [ -n "$PID" ]; then
   echo "Killing existing upload_cgi process (PID: $PID)"
-  kill "$PID"
+  kill $(pidof upload_cgi)
 fi
 
-g++ -std=c++17 -g upload_cgi.cpp make_log.cpp mysql_util.cpp cgi_util.cpp  -o upload_cgi -lfcgi -lmysqlclient -lredis++ -lfastcommon -lm
-
+# spawn-fcgi只启动master，worker数见cfg.json中prefork.workers(为0时不使用prefork)
 spawn-fcgi -a 127.0.0.1 -p 10002 -f /home/ward/FileHub/src/upload_cgi
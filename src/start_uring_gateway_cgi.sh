@@ -0,0 +1,14 @@
+#!/bin/bash
+
+PID=$(pidof uring_gateway_cgi)
+if [ -n "$PID" ]; then
+  echo "Killing existing uring_gateway_cgi process (PID: $PID)"
+  kill "$PID"
+fi
+
+# 所有接口编译进一个程序，使用io_uring服务端，需要C++20协程
+g++ -std=c++20 -g -DCGI_GATEWAY -DCGI_URING gateway_cgi.cpp login_cgi.cpp reg_cgi.cpp md5_cgi.cpp myfiles_cgi.cpp upload_cgi.cpp quota_util.cpp delta_cgi.cpp delta_util.cpp dl_cgi.cpp pv_util.cpp link_util.cpp range_util.cpp cache_util.cpp zip_util.cpp sharefiles_cgi.cpp share_util.cpp metrics_cgi.cpp make_log.cpp mysql_util.cpp cgi_server.cpp ratelimit_util.cpp admission_util.cpp trace_util.cpp metrics_util.cpp prefork_util.cpp cgi_uring.cpp uring_mysql.cpp uring_server.cpp uring_loop.cpp fcgi_proto.cpp cgi_util.cpp str_scan.cpp json_util.cpp response_util.cpp query_util.cpp backend_util.cpp storage_util.cpp pack_util.cpp compress_util.cpp -o uring_gateway_cgi -lfcgi -lmysqlclient -lredis++ -lfastcommon -lzstd -lz -lm -lpthread
+
+# 一个进程，线程数见cfg.json中uring.threads
+# nginx需要 fastcgi_keep_conn on 才会复用连接
+spawn-fcgi -a 127.0.0.1 -p 10011 -F 1 -f /home/ward/FileHub/src/uring_gateway_cgi
@@ -0,0 +1,503 @@
+#include "storage_util.h"
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "metrics_util.h"
+
+/**
+ * @brief 上传本地接收的文件到分布式存储
+ * @param filename 文件名
+ * @param fileid 文件id
+ * @return 0 成功，-1 失败
+ */
+// todo:添加调用api上传的方法，目前因为fdfs的变量名和chrono的变量名冲突，无法编译
+// int uploadToStorage(char *filename, char *fileid) {
+//   // 读取fdfs client 配置文件的路径
+//   string fdfs_cli_conf_path = "";
+//   getCfgValue(CFG_PATH, "dfs_path", "client", fdfs_cli_conf_path);
+//   int res = fdfs_upload_file(fdfs_cli_conf_path.c_str(), filename, fileid);
+//   // 去掉一个字符串两边的空白字符
+//   trimSpace(fileid);
+//   return res;
+// }
+
+int uploadToStorage(const char *filename, char *fileid) {
+  int ret = 0;
+  MetricTimer timer(DEP_STORAGE_UPLOAD);
+
+  pid_t pid;
+  int fd[2];
+  int status = 0;
+  // O_CLOEXEC：其它线程同时fork出的子进程不会继承管道，读端能及时读到EOF
+  if (pipe2(fd, O_CLOEXEC) < 0) {
+    LOG_DEBUG(STORAGE_LOG_MODULE, STORAGE_LOG_PROC, "pip error\n");
+    ret = -1;
+    goto END;
+  }
+
+  // 创建子进程，调用fdfs_upload_file上传文件
+  pid = fork();
+  if (pid < 0) {
+    LOG_DEBUG(STORAGE_LOG_MODULE, STORAGE_LOG_PROC, "fork error\n");
+    close(fd[0]);
+    close(fd[1]);
+    ret = -1;
+    goto END;
+  }
+
+  if (pid == 0)  // 子进程
+  {
+    // 关闭读端
+    close(fd[0]);
+
+    // 将标准输出 重定向 写管道
+    dup2(fd[1], STDOUT_FILENO);
+
+    // 读取fdfs client 配置文件的路径
+    string fdfs_cli_conf_path = "";
+    getCfgValue(CFG_PATH, "dfs_path", "client", fdfs_cli_conf_path);
+
+    execlp("fdfs_upload_file", "fdfs_upload_file", fdfs_cli_conf_path.c_str(),
+           filename, NULL);
+
+    // 执行失败
+    LOG_DEBUG(STORAGE_LOG_MODULE, STORAGE_LOG_PROC, "execlp error\n");
+    _exit(127);
+
+    close(fd[1]);
+  } else  // 父进程
+  {
+    // 关闭写端
+    close(fd[1]);
+
+    // 从管道中去读数据
+    read(fd[0], fileid, TEMP_BUF_MAX_LEN);
+    close(fd[0]);
+    trimSpace(fileid);
+
+    // 只回收自己的子进程，工具异常退出时输出不可信
+    if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) ||
+        WEXITSTATUS(status) != 0 || strlen(fileid) == 0) {
+      LOG_ERROR(STORAGE_LOG_MODULE, STORAGE_LOG_PROC,
+                "fdfs_upload_file error, status = %d\n", status);
+      ret = -1;
+      goto END;
+    }
+
+    LOG_DEBUG(STORAGE_LOG_MODULE, STORAGE_LOG_PROC, "fileid = %s\n", fileid);
+  }
+
+END:
+  LOG_DEBUG(STORAGE_LOG_MODULE, STORAGE_LOG_PROC, "\n");
+  if (ret != 0) {
+    timer.fail();
+  }
+  return ret;
+}
+
+/**
+ * @brief  调用fdfs客户端工具，工具的第一个参数固定为client配置文件路径，
+ *         工具的标准输出边读边交给sink
+ *
+ * @param tool 工具名，如 fdfs_download_file
+ * @param args 配置文件之后的参数，以nullptr结尾
+ * @param sink 接收标准输出，返回非0时结束工具
+ *
+ * @returns 0 成功，-1 失败
+ */
+static int runFdfsToolStream(const char *tool, const char *const args[],
+                             const DataSink &sink) {
+  int fd[2];
+  if (pipe2(fd, O_CLOEXEC) < 0) {
+    LOG_ERROR(STORAGE_LOG_MODULE, STORAGE_LOG_PROC, "pipe error\n");
+    return -1;
+  }
+
+  pid_t pid = fork();
+  if (pid < 0) {
+    LOG_ERROR(STORAGE_LOG_MODULE, STORAGE_LOG_PROC, "fork error\n");
+    close(fd[0]);
+    close(fd[1]);
+    return -1;
+  }
+
+  if (pid == 0)  // 子进程
+  {
+    close(fd[0]);
+    dup2(fd[1], STDOUT_FILENO);
+
+    // 读取fdfs client 配置文件的路径
+    string fdfs_cli_conf_path = "";
+    getCfgValue(CFG_PATH, "dfs_path", "client", fdfs_cli_conf_path);
+
+    vector<const char *> argv;
+    argv.push_back(tool);
+    argv.push_back(fdfs_cli_conf_path.c_str());
+    for (int i = 0; args[i] != nullptr; i++) {
+      argv.push_back(args[i]);
+    }
+    argv.push_back(nullptr);
+    execvp(tool, (char *const *)argv.data());
+
+    // 执行失败
+    LOG_ERROR(STORAGE_LOG_MODULE, STORAGE_LOG_PROC, "execvp %s error\n", tool);
+    _exit(127);
+  }
+
+  // 父进程，读取输出并等待工具结束
+  close(fd[1]);
+  bool aborted = false;
+  char buf[64 * 1024];
+  while (true) {
+    ssize_t n = read(fd[0], buf, sizeof(buf));
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) break;
+    if (sink(buf, n) != 0) {
+      aborted = true;
+      kill(pid, SIGTERM);
+      break;
+    }
+  }
+  close(fd[0]);
+
+  int status = 0;
+  if (waitpid(pid, &status, 0) < 0 || aborted || !WIFEXITED(status) ||
+      WEXITSTATUS(status) != 0) {
+    LOG_ERROR(STORAGE_LOG_MODULE, STORAGE_LOG_PROC,
+              "%s failed, status = %d%s\n", tool, status,
+              aborted ? " (aborted)" : "");
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * @brief  调用fdfs客户端工具，读取不长的标准输出
+ *
+ * @param tool    工具名，如 fdfs_download_file
+ * @param args    配置文件之后的参数，以nullptr结尾
+ * @param out     (out) 工具的标准输出，为nullptr时不读取
+ * @param out_len out缓冲区长度
+ *
+ * @returns 0 成功，-1 失败
+ */
+static int runFdfsTool(const char *tool, const char *const args[], char *out,
+                       int out_len) {
+  int got = 0;
+  int ret = runFdfsToolStream(tool, args, [&](const char *data, size_t len) {
+    if (out != nullptr && got < out_len - 1) {
+      size_t n = std::min(len, (size_t)(out_len - 1 - got));
+      memcpy(out + got, data, n);
+      got += n;
+    }
+    return 0;
+  });
+  if (out != nullptr) {
+    out[got] = '\0';
+    trimSpace(out);
+  }
+  return ret;
+}
+
+/**
+ * @brief 上传本地文件到分布式存储，作为可追加的容器文件
+ *
+ * @param filename 本地文件名
+ * @param fileid   (out) 容器文件id
+ *
+ * @return 0 成功，-1 失败
+ */
+int uploadAppenderToStorage(const char *filename, char *fileid) {
+  const char *args[] = {filename, nullptr};
+  if (runFdfsTool("fdfs_upload_appender", args, fileid, TEMP_BUF_MAX_LEN) !=
+          0 ||
+      strlen(fileid) == 0) {
+    LOG_ERROR(STORAGE_LOG_MODULE, STORAGE_LOG_PROC,
+              "fdfs_upload_appender %s error\n", filename);
+    return -1;
+  }
+  LOG_DEBUG(STORAGE_LOG_MODULE, STORAGE_LOG_PROC, "appender fileid = %s\n",
+            fileid);
+  return 0;
+}
+
+/**
+ * @brief 把本地文件追加到分布式存储中的容器文件末尾
+ *
+ * @param fileid   容器文件id
+ * @param filename 本地文件名
+ *
+ * @return 0 成功，-1 失败
+ */
+int appendToStorage(const char *fileid, const char *filename) {
+  const char *args[] = {fileid, filename, nullptr};
+  return runFdfsTool("fdfs_append_file", args, nullptr, 0);
+}
+
+/**
+ * @brief 查询容器文件在storage上的实际大小
+ *        追加是否成功、成功后文件在容器中的偏移都以它为准，不依赖数据库中的记录
+ *
+ * @param fileid 容器文件id
+ * @param size   (out) 文件大小
+ *
+ * @return 0 成功，-1 失败
+ */
+int appenderSize(const char *fileid, long *size) {
+  char out[TEMP_BUF_MAX_LEN] = {0};
+  const char *args[] = {fileid, nullptr};
+  if (runFdfsTool("fdfs_file_info", args, out, sizeof(out)) != 0) {
+    return -1;
+  }
+  const char *p = strstr(out, "file size: ");
+  if (p == nullptr) {
+    LOG_ERROR(STORAGE_LOG_MODULE, STORAGE_LOG_PROC,
+              "fdfs_file_info %s 没有file size: %s\n", fileid, out);
+    return -1;
+  }
+  char *end = nullptr;
+  *size = strtol(p + strlen("file size: "), &end, 10);
+  return end == p + strlen("file size: ") ? -1 : 0;
+}
+
+/**
+ * @brief  从分布式存储下载文件到本地
+ *
+ * @param fileid     (in)    文件分布式id路径
+ * @param local_file (in)    本地保存的文件名
+ *
+ * @returns 0 成功，-1 失败
+ */
+int downloadFromStorage(const char *fileid, const char *local_file) {
+  const char *args[] = {fileid, local_file, nullptr};
+  if (runFdfsTool("fdfs_download_file", args, nullptr, 0) != 0) {
+    unlink(local_file);
+    return -1;
+  }
+
+  LOG_DEBUG(STORAGE_LOG_MODULE, STORAGE_LOG_PROC, "download %s -> %s\n",
+            fileid, local_file);
+  return 0;
+}
+
+/**
+ * @brief  从分布式存储下载文件的一段到本地，一次范围读
+ *
+ * @param fileid     文件分布式id路径
+ * @param offset     起始偏移
+ * @param length     读取长度
+ * @param local_file 本地保存的文件名
+ *
+ * @returns 0 成功，-1 失败
+ */
+int downloadRangeFromStorage(const char *fileid, long offset, long length,
+                             const char *local_file) {
+  string offset_str = to_string(offset);
+  string length_str = to_string(length);
+  const char *args[] = {fileid, local_file, offset_str.c_str(),
+                        length_str.c_str(), nullptr};
+  if (runFdfsTool("fdfs_download_file", args, nullptr, 0) != 0) {
+    unlink(local_file);
+    return -1;
+  }
+
+  LOG_DEBUG(STORAGE_LOG_MODULE, STORAGE_LOG_PROC,
+            "download %s[%ld, +%ld] -> %s\n", fileid, offset, length,
+            local_file);
+  return 0;
+}
+
+/**
+ * @brief 边下载边把内容交给sink，不落本地文件
+ *        fdfs_download_file写到自己的标准输出，即我们读的管道
+ *
+ * @param fileid 文件id
+ * @param offset 起点，< 0时下载整个文件
+ * @param length 长度
+ * @param sink   接收文件内容，返回非0时中止下载
+ *
+ * @return 0 成功，-1 失败或中止
+ */
+int streamFromStorage(const char *fileid, long offset, long length,
+                      const DataSink &sink) {
+  string offset_str = to_string(offset < 0 ? 0 : offset);
+  string length_str = to_string(offset < 0 ? 0 : length);
+  const char *args[] = {fileid, "/dev/stdout", offset_str.c_str(),
+                        length_str.c_str(), nullptr};
+  return runFdfsToolStream("fdfs_download_file", args, sink);
+}
+
+/**
+ * @brief  删除分布式存储中的文件
+ *
+ * @param fileid 文件分布式id路径
+ *
+ * @returns 0 成功，-1 失败
+ */
+int deleteFromStorage(const char *fileid) {
+  const char *args[] = {fileid, nullptr};
+  return runFdfsTool("fdfs_delete_file", args, nullptr, 0);
+}
+
+/**
+ * @brief  封装文件存储在分布式系统中的 完整 url
+ *
+ * @param fileid        (in)    文件分布式id路径
+ * @param fdfs_file_url (out)   文件的完整url地址
+ *
+ * @returns 0 成功，-1 失败
+ */
+int makeFileUrl(const char *fileid, char *fdfs_file_url) {
+  int ret = 0;
+
+  char *p = NULL;
+  char *q = NULL;
+  char *k = NULL;
+
+  char fdfs_file_stat_buf[TEMP_BUF_MAX_LEN] = {0};
+  char fdfs_file_host_name[HOST_NAME_LEN] = {0};  // storage所在服务器ip地址
+
+  pid_t pid;
+  int fd[2];
+
+  // 无名管道的创建
+  if (pipe2(fd, O_CLOEXEC) < 0) {
+    LOG_ERROR(STORAGE_LOG_MODULE, STORAGE_LOG_PROC, "pip error\n");
+    return -1;
+  }
+
+  // 创建进程
+  pid = fork();
+  if (pid < 0)  // 进程创建失败
+  {
+    LOG_ERROR(STORAGE_LOG_MODULE, STORAGE_LOG_PROC, "fork error\n");
+    close(fd[0]);
+    close(fd[1]);
+    return -1;
+  }
+
+  if (pid == 0)  // 子进程
+  {
+    // 关闭读端
+    close(fd[0]);
+
+    // 将标准输出 重定向 写管道
+    dup2(fd[1], STDOUT_FILENO);  // dup2(fd[1], 1);
+
+    // 读取fdfs client 配置文件的路径
+    string fdfs_cli_conf_path = "";
+    getCfgValue(CFG_PATH, "dfs_path", "client", fdfs_cli_conf_path);
+
+    execlp("fdfs_file_info", "fdfs_file_info", fdfs_cli_conf_path.c_str(),
+           fileid, NULL);
+
+    // 执行失败
+    LOG_ERROR(STORAGE_LOG_MODULE, STORAGE_LOG_PROC,
+              "execlp fdfs_file_info error\n");
+    _exit(127);
+  } else  // 父进程
+  {
+    // 关闭写端
+    close(fd[1]);
+
+    // 从管道中去读数据
+    read(fd[0], fdfs_file_stat_buf, TEMP_BUF_MAX_LEN);
+    LOG_INFO(STORAGE_LOG_MODULE, STORAGE_LOG_PROC, "get file_ip [%s] succ\n",
+             fdfs_file_stat_buf);
+
+    close(fd[0]);
+
+    // 等待自己的子进程结束，回收其资源
+    int status = 0;
+    if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) ||
+        WEXITSTATUS(status) != 0) {
+      LOG_ERROR(STORAGE_LOG_MODULE, STORAGE_LOG_PROC,
+                "fdfs_file_info error, status = %d\n", status);
+      return -1;
+    }
+
+    // 拼接上传文件的完整url地址--->http://host_name/group1/M00/00/00/D12313123232312.png
+    p = strstr(fdfs_file_stat_buf, "source ip address: ");
+
+    q = p + strlen("source ip address: ");  // 这里得到的是本地ip地址
+    k = strstr(q, "\n");
+
+    strncpy(fdfs_file_host_name, q, k - q);
+    fdfs_file_host_name[k - q] = '\0';
+
+    // printf("host_name:[%s]\n", fdfs_file_host_name);
+
+    // 读取storage_web_server服务器的端口
+    string storage_web_server_port = "";
+    getCfgValue(CFG_PATH, "storage_web_server", "port",
+                storage_web_server_port);
+
+    // todo:通过配置文件的映射进行修改（fdfs_file_info返回的是内网地址，因为目前只有一个storage，直接写入）
+    strcpy(fdfs_file_host_name, "s5.s100.vip");  // 穿透地址
+    strcat(fdfs_file_url, "http://");
+    strcat(fdfs_file_url, fdfs_file_host_name);
+    strcat(fdfs_file_url, ":");
+    strcat(fdfs_file_url, storage_web_server_port.c_str());
+    strcat(fdfs_file_url, "/");
+    strcat(fdfs_file_url, fileid);
+
+    // printf("[%s]\n", fdfs_file_url);
+    LOG_INFO(STORAGE_LOG_MODULE, STORAGE_LOG_PROC, "file url is: %s\n\n",
+             fdfs_file_url);
+  }
+
+  return ret;
+}
+
+/**
+ * @brief  将文件信息写入file_info和user_file_list，并更新用户文件数量
+ *
+ * @param meta          元数据存储
+ * @param user          用户名
+ * @param filename      文件名
+ * @param md5           文件md5
+ * @param size          文件大小
+ * @param fileid        文件分布式id路径
+ * @param fdfs_file_url 文件的完整url地址
+ *
+ * @returns 0 成功，-1 失败
+ */
+int storeFileinfoToMysql(MetaStore *meta, const char *user,
+                         const char *filename, const char *md5, long size,
+                         const char *fileid, const char *fdfs_file_url) {
+  time_t now;
+  char create_time[TIME_STRING_LEN];
+  char suffix[SUFFIX_LEN];
+
+  getFileSuffix(filename, suffix);  // mp4, jpg, png
+
+  if (meta->addFileInfo(md5, fileid, fdfs_file_url, size, suffix) != 0) {
+    return -1;
+  }
+  LOG_INFO(STORAGE_LOG_MODULE, STORAGE_LOG_PROC, "%s 文件信息插入成功\n\n",
+           md5);
+
+  // 获取当前时间
+  now = time(NULL);
+  strftime(create_time, TIME_STRING_LEN - 1, "%Y-%m-%d %H:%M:%S",
+           localtime(&now));
+
+  if (meta->addUserFile(user, md5, filename, create_time) != 0) {
+    return -1;
+  }
+
+  // 更新用户文件数量
+  return meta->incUserFileCount(user);
+}
@@ -0,0 +1,48 @@
+#ifndef STORAGE_UTIL_H
+#define STORAGE_UTIL_H
+
+#include <mysql/mysql.h>
+
+#include "backend_util.h"
+#include "cgi_util.h"
+#include "make_log.h"
+#include "mysql_util.h"
+
+const char *const STORAGE_LOG_MODULE = "cgi";
+const char *const STORAGE_LOG_PROC = "storage";
+
+// 上传本地文件到分布式存储，得到文件id
+int uploadToStorage(const char *filename, char *fileid);
+
+// 上传本地文件到分布式存储，作为可追加的容器文件
+int uploadAppenderToStorage(const char *filename, char *fileid);
+
+// 把本地文件追加到容器文件末尾
+int appendToStorage(const char *fileid, const char *filename);
+
+// 容器文件在storage上的实际大小(fdfs_file_info的file size)
+int appenderSize(const char *fileid, long *size);
+
+// 从分布式存储下载文件到本地
+int downloadFromStorage(const char *fileid, const char *local_file);
+
+// 从分布式存储下载文件的一段到本地
+int downloadRangeFromStorage(const char *fileid, long offset, long length,
+                             const char *local_file);
+
+// 边下载边把内容交给sink，offset < 0时为整个文件
+int streamFromStorage(const char *fileid, long offset, long length,
+                      const DataSink &sink);
+
+// 删除分布式存储中的文件
+int deleteFromStorage(const char *fileid);
+
+// 封装文件存储在分布式系统中的完整url
+int makeFileUrl(const char *fileid, char *fdfs_file_url);
+
+// 将文件信息写入file_info和user_file_list，并更新用户文件数量
+int storeFileinfoToMysql(MetaStore *meta, const char *user,
+                         const char *filename, const char *md5, long size,
+                         const char *fileid, const char *fdfs_file_url);
+
+#endif
@@ -0,0 +1,281 @@
+#include "str_scan.h"
+
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define STR_SCAN_X86 1
+#endif
+
+/*
+   子串查找采用"首尾字节过滤"：一次比较16/32个位置的首字节和尾字节，
+   两者都相同的候选位置才做memcmp，multipart边界这种较长且少见的子串基本不会出现候选，
+   扫描速度接近内存带宽。
+*/
+
+//============================ 标量实现 ============================
+
+static const char *findScalar(const char *hay, size_t n, const char *needle,
+                              size_t m) {
+  const char *p = hay;
+  const char *end = hay + n - m + 1;
+  while (p < end) {
+    p = (const char *)memchr(p, needle[0], end - p);
+    if (p == nullptr) return nullptr;
+    if (memcmp(p + 1, needle + 1, m - 1) == 0) return p;
+    p++;
+  }
+  return nullptr;
+}
+
+static const char *chrScalar(const char *hay, size_t n, char c) {
+  return (const char *)memchr(hay, c, n);
+}
+
+static const char *anyScalar(const char *hay, size_t n, const char *delims,
+                             size_t k) {
+  bool table[256] = {false};
+  for (size_t i = 0; i < k; i++) table[(unsigned char)delims[i]] = true;
+  for (size_t i = 0; i < n; i++) {
+    if (table[(unsigned char)hay[i]]) return hay + i;
+  }
+  return nullptr;
+}
+
+#ifdef STR_SCAN_X86
+
+//============================ SSE2实现 ============================
+
+__attribute__((target("sse2"))) static const char *findSse2(
+    const char *hay, size_t n, const char *needle, size_t m) {
+  const __m128i first = _mm_set1_epi8(needle[0]);
+  const __m128i last = _mm_set1_epi8(needle[m - 1]);
+  size_t i = 0;
+  for (; i + m - 1 + 16 <= n; i += 16) {
+    __m128i blk_first = _mm_loadu_si128((const __m128i *)(hay + i));
+    __m128i blk_last = _mm_loadu_si128((const __m128i *)(hay + i + m - 1));
+    unsigned mask = _mm_movemask_epi8(_mm_and_si128(
+        _mm_cmpeq_epi8(first, blk_first), _mm_cmpeq_epi8(last, blk_last)));
+    while (mask != 0) {
+      unsigned bit = __builtin_ctz(mask);
+      if (memcmp(hay + i + bit + 1, needle + 1, m - 2) == 0) {
+        return hay + i + bit;
+      }
+      mask &= mask - 1;
+    }
+  }
+  const char *tail = findScalar(hay + i, n - i, needle, m);
+  return tail;
+}
+
+__attribute__((target("sse2"))) static const char *chrSse2(const char *hay,
+                                                           size_t n, char c) {
+  const __m128i v = _mm_set1_epi8(c);
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m128i blk = _mm_loadu_si128((const __m128i *)(hay + i));
+    unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(blk, v));
+    if (mask != 0) return hay + i + __builtin_ctz(mask);
+  }
+  return chrScalar(hay + i, n - i, c);
+}
+
+__attribute__((target("sse2"))) static const char *anySse2(
+    const char *hay, size_t n, const char *delims, size_t k) {
+  __m128i sets[8];
+  for (size_t j = 0; j < k; j++) sets[j] = _mm_set1_epi8(delims[j]);
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m128i blk = _mm_loadu_si128((const __m128i *)(hay + i));
+    __m128i hit = _mm_setzero_si128();
+    for (size_t j = 0; j < k; j++) {
+      hit = _mm_or_si128(hit, _mm_cmpeq_epi8(blk, sets[j]));
+    }
+    unsigned mask = _mm_movemask_epi8(hit);
+    if (mask != 0) return hay + i + __builtin_ctz(mask);
+  }
+  return anyScalar(hay + i, n - i, delims, k);
+}
+
+//============================ AVX2实现 ============================
+
+__attribute__((target("avx2"))) static const char *findAvx2(
+    const char *hay, size_t n, const char *needle, size_t m) {
+  const __m256i first = _mm256_set1_epi8(needle[0]);
+  const __m256i last = _mm256_set1_epi8(needle[m - 1]);
+  size_t i = 0;
+  for (; i + m - 1 + 32 <= n; i += 32) {
+    __m256i blk_first = _mm256_loadu_si256((const __m256i *)(hay + i));
+    __m256i blk_last = _mm256_loadu_si256((const __m256i *)(hay + i + m - 1));
+    unsigned mask = (unsigned)_mm256_movemask_epi8(
+        _mm256_and_si256(_mm256_cmpeq_epi8(first, blk_first),
+                         _mm256_cmpeq_epi8(last, blk_last)));
+    while (mask != 0) {
+      unsigned bit = __builtin_ctz(mask);
+      if (memcmp(hay + i + bit + 1, needle + 1, m - 2) == 0) {
+        return hay + i + bit;
+      }
+      mask &= mask - 1;
+    }
+  }
+  return findSse2(hay + i, n - i, needle, m);
+}
+
+__attribute__((target("avx2"))) static const char *chrAvx2(const char *hay,
+                                                           size_t n, char c) {
+  const __m256i v = _mm256_set1_epi8(c);
+  size_t i = 0;
+  for (; i + 32 <= n; i += 32) {
+    __m256i blk = _mm256_loadu_si256((const __m256i *)(hay + i));
+    unsigned mask = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(blk, v));
+    if (mask != 0) return hay + i + __builtin_ctz(mask);
+  }
+  return chrSse2(hay + i, n - i, c);
+}
+
+__attribute__((target("avx2"))) static const char *anyAvx2(
+    const char *hay, size_t n, const char *delims, size_t k) {
+  __m256i sets[8];
+  for (size_t j = 0; j < k; j++) sets[j] = _mm256_set1_epi8(delims[j]);
+  size_t i = 0;
+  for (; i + 32 <= n; i += 32) {
+    __m256i blk = _mm256_loadu_si256((const __m256i *)(hay + i));
+    __m256i hit = _mm256_setzero_si256();
+    for (size_t j = 0; j < k; j++) {
+      hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(blk, sets[j]));
+    }
+    unsigned mask = (unsigned)_mm256_movemask_epi8(hit);
+    if (mask != 0) return hay + i + __builtin_ctz(mask);
+  }
+  return anySse2(hay + i, n - i, delims, k);
+}
+
+#endif  // STR_SCAN_X86
+
+//============================ 运行时选择 ============================
+
+struct ScanOps {
+  const char *(*find)(const char *, size_t, const char *, size_t);
+  const char *(*chr)(const char *, size_t, char);
+  const char *(*any)(const char *, size_t, const char *, size_t);
+};
+
+static const ScanOps scalar_ops = {findScalar, chrScalar, anyScalar};
+#ifdef STR_SCAN_X86
+static const ScanOps sse2_ops = {findSse2, chrSse2, anySse2};
+static const ScanOps avx2_ops = {findAvx2, chrAvx2, anyAvx2};
+#endif
+
+static bool cpuSupports(ScanImpl impl) {
+#ifdef STR_SCAN_X86
+  switch (impl) {
+    case ScanImpl::AVX2:
+      return __builtin_cpu_supports("avx2");
+    case ScanImpl::SSE2:
+      return __builtin_cpu_supports("sse2");
+    default:
+      return true;
+  }
+#else
+  return impl == ScanImpl::SCALAR;
+#endif
+}
+
+static ScanImpl detectImpl() {
+  if (cpuSupports(ScanImpl::AVX2)) return ScanImpl::AVX2;
+  if (cpuSupports(ScanImpl::SSE2)) return ScanImpl::SSE2;
+  return ScanImpl::SCALAR;
+}
+
+static const ScanOps *opsOf(ScanImpl impl) {
+#ifdef STR_SCAN_X86
+  if (impl == ScanImpl::AVX2) return &avx2_ops;
+  if (impl == ScanImpl::SSE2) return &sse2_ops;
+#endif
+  return &scalar_ops;
+}
+
+static ScanImpl g_impl = detectImpl();
+static const ScanOps *g_ops = opsOf(g_impl);
+
+//============================ 对外接口 ============================
+
+/**
+ * @brief  在hay中查找needle第一次出现的位置
+ *
+ * @param hay        源数据首地址
+ * @param hay_len    源数据长度
+ * @param needle     匹配数据首地址
+ * @param needle_len 匹配数据长度
+ *
+ * @return 成功: 匹配位置首地址 失败: nullptr
+ */
+const char *scanFind(const char *hay, size_t hay_len, const char *needle,
+                     size_t needle_len) {
+  if (hay == nullptr || needle == nullptr || needle_len == 0 ||
+      hay_len < needle_len) {
+    return nullptr;
+  }
+  if (needle_len == 1) {
+    return g_ops->chr(hay, hay_len, needle[0]);
+  }
+  return g_ops->find(hay, hay_len, needle, needle_len);
+}
+
+/**
+ * @brief  在hay中查找字符c第一次出现的位置
+ *
+ * @return 成功: 字符地址 失败: nullptr
+ */
+const char *scanChr(const char *hay, size_t hay_len, char c) {
+  if (hay == nullptr) return nullptr;
+  return g_ops->chr(hay, hay_len, c);
+}
+
+/**
+ * @brief  在hay中查找delims中任意一个字符第一次出现的位置
+ *
+ * @param hay     源数据首地址
+ * @param hay_len 源数据长度
+ * @param delims  分隔符集合，最多8个字符
+ *
+ * @return 成功: 分隔符地址 失败: nullptr
+ */
+const char *scanAny(const char *hay, size_t hay_len, const char *delims) {
+  size_t k = strlen(delims);
+  if (hay == nullptr || k == 0 || k > 8) return nullptr;
+  if (k == 1) return g_ops->chr(hay, hay_len, delims[0]);
+  return g_ops->any(hay, hay_len, delims, k);
+}
+
+/**
+ * @brief  从pos开始在字符串中查找needle，用法同string::find
+ *
+ * @return 成功: 匹配位置 失败: string::npos
+ */
+size_t scanFind(const string &hay, const char *needle, size_t pos) {
+  if (pos > hay.size()) return string::npos;
+  const char *p = scanFind(hay.data() + pos, hay.size() - pos, needle,
+                           strlen(needle));
+  return p == nullptr ? string::npos : (size_t)(p - hay.data());
+}
+
+ScanImpl scanImpl() { return g_impl; }
+
+const char *scanImplName(ScanImpl impl) {
+  switch (impl) {
+    case ScanImpl::AVX2:
+      return "avx2";
+    case ScanImpl::SSE2:
+      return "sse2";
+    default:
+      return "scalar";
+  }
+}
+
+bool scanSetImpl(ScanImpl impl) {
+  if (!cpuSupports(impl)) return false;
+  g_impl = impl;
+  g_ops = opsOf(impl);
+  return true;
+}
@@ -0,0 +1,32 @@
+#ifndef STR_SCAN_H
+#define STR_SCAN_H
+
+#include <cstddef>
+#include <string>
+
+using namespace std;
+
+// 字符串扫描的实现，启动时按cpu支持的指令集选择
+enum class ScanImpl { SCALAR, SSE2, AVX2 };
+
+// 在hay中查找needle第一次出现的位置，找不到返回nullptr
+const char *scanFind(const char *hay, size_t hay_len, const char *needle,
+                     size_t needle_len);
+
+// 在hay中查找字符c第一次出现的位置，找不到返回nullptr
+const char *scanChr(const char *hay, size_t hay_len, char c);
+
+// 在hay中查找delims(最多8个字符)中任意一个字符第一次出现的位置，找不到返回nullptr
+const char *scanAny(const char *hay, size_t hay_len, const char *delims);
+
+// 从pos开始在字符串中查找needle，用法同string::find
+size_t scanFind(const string &hay, const char *needle, size_t pos = 0);
+
+// 当前使用的实现
+ScanImpl scanImpl();
+const char *scanImplName(ScanImpl impl);
+
+// 强制使用某个实现(测试和基准测试用)，cpu不支持时返回false
+bool scanSetImpl(ScanImpl impl);
+
+#endif
@@ -0,0 +1,296 @@
+#include "trace_util.h"
+
+#include <unistd.h>
+
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+
+#include "cgi_util.h"
+#include "make_log.h"
+#include "rapidjson/document.h"
+#include "rapidjson/istreamwrapper.h"
+
+static TraceConfig trace_cfg;
+
+static int64_t monotonicNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+static int64_t unixNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
+// 每个线程一个splitmix64，只用于生成id，不需要密码学强度
+static uint64_t randomId() {
+  thread_local uint64_t state = 0;
+  if (state == 0) {
+    state = (uint64_t)unixNs() ^ ((uint64_t)getpid() << 32) ^
+            (uint64_t)(uintptr_t)&state;
+  }
+  uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  z = z ^ (z >> 31);
+  return z == 0 ? 1 : z;  // OTLP中全0的id无效
+}
+
+static void hex64(uint64_t v, char *out) {
+  snprintf(out, 17, "%016llx", (unsigned long long)v);
+}
+
+// 请求id只接受字母、数字和-_.，避免日志和json被注入
+static bool validRequestId(std::string_view id) {
+  if (id.empty() || id.size() > TRACE_ID_MAX) {
+    return false;
+  }
+  for (char c : id) {
+    if (!(isalnum((unsigned char)c) || c == '-' || c == '_' || c == '.')) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool isHex32(std::string_view id) {
+  if (id.size() != 32) {
+    return false;
+  }
+  for (char c : id) {
+    if (!isxdigit((unsigned char)c)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * @brief 开始一个请求
+ *
+ * @param request_id 请求头X-Request-Id，nginx的$request_id为32位十六进制，
+ *                   此时同时作为OTLP的traceId，与nginx的access日志对应
+ * @param path       请求路径
+ */
+void RequestTrace::begin(std::string_view request_id, std::string_view path) {
+  start_ns_ = monotonicNs();
+  start_unix_ns_ = unixNs();
+  count_ = 0;
+  open_ = -1;
+  active_ = true;
+  root_span_id_ = randomId();
+
+  if (isHex32(request_id)) {
+    for (int i = 0; i < 32; i++) {
+      trace_id_[i] = (char)tolower((unsigned char)request_id[i]);
+    }
+    trace_id_[32] = '\0';
+  } else {
+    hex64(randomId(), trace_id_);
+    hex64(randomId(), trace_id_ + 16);
+  }
+  if (validRequestId(request_id)) {
+    memcpy(id_, request_id.data(), request_id.size());
+    id_[request_id.size()] = '\0';
+  } else {
+    memcpy(id_, trace_id_, sizeof(trace_id_));
+  }
+
+  size_t n = path.size() < sizeof(path_) - 1 ? path.size() : sizeof(path_) - 1;
+  for (size_t i = 0; i < n; i++) {
+    char c = path[i];  // 路径写进日志和json，只保留可打印字符
+    path_[i] = (c == '"' || c == '\\' || (unsigned char)c < 0x20 ||
+                (unsigned char)c >= 0x7f)
+                   ? '_'
+                   : c;
+  }
+  path_[n] = '\0';
+}
+
+double RequestTrace::elapsedMs() const {
+  return (monotonicNs() - start_ns_) / 1e6;
+}
+
+/**
+ * @brief 开始一个阶段，当前未结束的阶段为它的父阶段
+ *
+ * @param name 阶段名，需为字符串常量
+ *
+ * @return 阶段编号，未开始请求或阶段过多时返回-1
+ */
+int RequestTrace::spanBegin(const char *name) {
+  if (!active_ || count_ >= TRACE_MAX_SPANS) {
+    return -1;
+  }
+  Span &s = spans_[count_];
+  s.name = name;
+  s.start_ns = monotonicNs() - start_ns_;
+  s.end_ns = -1;
+  s.parent = open_;
+  s.span_id = randomId();
+  open_ = count_;
+  return count_++;
+}
+
+void RequestTrace::spanEnd(int index) {
+  if (!active_ || index < 0 || index >= count_) {
+    return;
+  }
+  spans_[index].end_ns = monotonicNs() - start_ns_;
+  open_ = spans_[index].parent;
+}
+
+/**
+ * @brief 按OTLP/JSON(ExportTraceServiceRequest)格式写一行，
+ *        请求本身为SERVER span，各阶段为它的子span
+ */
+void RequestTrace::writeOtlp(int64_t total_ns) const {
+  char id[17], parent[17];
+  std::string line;
+  line.reserve(512 + count_ * 192);
+  line +=
+      "{\"resourceSpans\":[{\"resource\":{\"attributes\":[{\"key\":"
+      "\"service.name\",\"value\":{\"stringValue\":\"filehub\"}}]},"
+      "\"scopeSpans\":[{\"scope\":{\"name\":\"filehub\"},\"spans\":[";
+
+  auto appendSpan = [&](const char *name, uint64_t span_id,
+                        uint64_t parent_id, int kind, int64_t start,
+                        int64_t end) {
+    hex64(span_id, id);
+    line += "{\"traceId\":\"";
+    line += trace_id_;
+    line += "\",\"spanId\":\"";
+    line += id;
+    if (parent_id != 0) {
+      hex64(parent_id, parent);
+      line += "\",\"parentSpanId\":\"";
+      line += parent;
+    }
+    line += "\",\"name\":\"";
+    line += name;
+    line += "\",\"kind\":" + std::to_string(kind);
+    line += ",\"startTimeUnixNano\":\"" +
+            std::to_string(start_unix_ns_ + start) + "\"";
+    line += ",\"endTimeUnixNano\":\"" + std::to_string(start_unix_ns_ + end) +
+            "\"";
+  };
+
+  appendSpan(path_, root_span_id_, 0, 2, 0, total_ns);
+  line += ",\"attributes\":[{\"key\":\"http.request_id\",\"value\":{"
+          "\"stringValue\":\"";
+  line += id_;
+  line += "\"}}]}";
+  for (int i = 0; i < count_; i++) {
+    line += ",";
+    const Span &s = spans_[i];
+    uint64_t parent_id =
+        s.parent < 0 ? root_span_id_ : spans_[s.parent].span_id;
+    appendSpan(s.name, s.span_id, parent_id, 1, s.start_ns,
+               s.end_ns < 0 ? total_ns : s.end_ns);
+    line += "}";
+  }
+  line += "]}]}]}\n";
+  appendLogFile(trace_cfg.otlp_file, line);
+}
+
+/**
+ * @brief 结束请求：
+ *        trace日志一行摘要，总耗时超过slow_ms时slow日志再写一行，
+ *        配置了otlp_file时写span
+ */
+void RequestTrace::end() {
+  if (!active_) {
+    return;
+  }
+  active_ = false;
+  int64_t total_ns = monotonicNs() - start_ns_;
+  double total_ms = total_ns / 1e6;
+  bool slow = trace_cfg.slow_ms > 0 && total_ms >= (double)trace_cfg.slow_ms;
+  if (!trace_cfg.enabled && !slow && trace_cfg.otlp_file.empty()) {
+    return;
+  }
+
+  // id=... path=/upload total_ms=12.345 recv=3.210 fdfs_upload=8.001 ...
+  char line[1024];
+  int n = snprintf(line, sizeof(line), "id=%s path=%s total_ms=%.3f", id_,
+                   path_, total_ms);
+  for (int i = 0; i < count_ && n > 0 && n < (int)sizeof(line); i++) {
+    const Span &s = spans_[i];
+    int64_t end_ns = s.end_ns < 0 ? total_ns : s.end_ns;
+    n += snprintf(line + n, sizeof(line) - n, " %s=%.3f", s.name,
+                  (end_ns - s.start_ns) / 1e6);
+  }
+
+  if (trace_cfg.enabled) {
+    LOG_INFO(TRACE_LOG_MODULE, TRACE_LOG_PROC, "%s\n", line);
+  }
+  if (slow) {
+    LOG_WARNING(TRACE_LOG_MODULE, TRACE_SLOW_LOG_PROC, "%s\n", line);
+  }
+  if (!trace_cfg.otlp_file.empty()) {
+    writeOtlp(total_ns);
+  }
+}
+
+// 数字可以写成数字或字符串
+static double cfgNumber(const rapidjson::Value &v, const char *key,
+                        double def) {
+  if (!v.IsObject() || !v.HasMember(key)) {
+    return def;
+  }
+  const rapidjson::Value &x = v[key];
+  if (x.IsNumber()) return x.GetDouble();
+  if (x.IsString()) return atof(x.GetString());
+  if (x.IsBool()) return x.GetBool() ? 1 : 0;
+  return def;
+}
+
+/**
+ * @brief  从cfg.json中读取追踪配置
+ *
+ * @param cfg (out) 配置，缺少的项为默认值
+ *
+ * @return 0 成功，-1 配置文件打不开
+ */
+int getTraceConfig(TraceConfig *cfg) {
+  *cfg = TraceConfig();
+  std::ifstream ifs(CFG_PATH);
+  if (!ifs.is_open()) {
+    LOG_ERROR(TRACE_LOG_MODULE, TRACE_LOG_PROC, "Failed to open cfg.json");
+    return -1;
+  }
+  rapidjson::IStreamWrapper isw(ifs);
+  rapidjson::Document doc;
+  doc.ParseStream(isw);
+  if (doc.HasParseError() || !doc.IsObject() || !doc.HasMember("trace")) {
+    return 0;
+  }
+
+  const rapidjson::Value &t = doc["trace"];
+  cfg->enabled = cfgNumber(t, "enabled", 1) != 0;
+  cfg->slow_ms = (long)cfgNumber(t, "slow_ms", (double)cfg->slow_ms);
+  if (t.HasMember("otlp_file") && t["otlp_file"].IsString()) {
+    cfg->otlp_file = t["otlp_file"].GetString();
+  }
+  return 0;
+}
+
+int traceInit() {
+  TraceConfig cfg;
+  getTraceConfig(&cfg);  // 读不到配置时使用默认值
+  traceInit(cfg);
+  return 0;
+}
+
+void traceInit(const TraceConfig &cfg) {
+  trace_cfg = cfg;
+  LOG_INFO(TRACE_LOG_MODULE, TRACE_LOG_PROC,
+           "trace enabled = %d, slow_ms = %ld, otlp_file = %s\n",
+           cfg.enabled ? 1 : 0, cfg.slow_ms, cfg.otlp_file.c_str());
+}
@@ -0,0 +1,108 @@
+#ifndef TRACE_UTIL_H
+#define TRACE_UTIL_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+/*
+   请求级别的追踪：
+   每个请求一个RequestTrace，请求id取nginx传来的X-Request-Id
+   (fastcgi_param HTTP_X_REQUEST_ID $request_id;)，没有时生成32位十六进制。
+   处理函数用TraceSpan包住各个阶段，计时使用单调时钟：
+
+   {
+     TraceSpan span(ctx->trace, "fdfs_upload");
+     ret = uploadToStorage(filename, fileid);
+   }
+
+   请求结束时：
+   - trace日志中写一行摘要：id=... path=/upload total_ms=... recv=... fdfs_upload=...
+   - 总耗时超过slow_ms时在slow日志中再写一行
+   - 配置了otlp_file时按OTLP/JSON格式追加一行span，可由collector的filelog读取
+
+   "trace": {"enabled": true, "slow_ms": 1000, "otlp_file": ""}
+*/
+
+const char *const TRACE_LOG_MODULE = "cgi";
+const char *const TRACE_LOG_PROC = "trace";
+const char *const TRACE_SLOW_LOG_PROC = "slow";
+
+// 请求id的最大长度，更长的不使用，重新生成
+const int TRACE_ID_MAX = 64;
+
+// 一个请求最多记录的阶段数，超出的阶段不计时
+const int TRACE_MAX_SPANS = 16;
+
+struct TraceConfig {
+  bool enabled = true;    // 是否写摘要日志
+  long slow_ms = 1000;    // 慢请求阈值，<= 0时不写慢请求日志
+  std::string otlp_file;  // OTLP/JSON span文件，为空时不写
+};
+
+class RequestTrace {
+ public:
+  // 开始一个请求，request_id为空或含有非法字符时生成一个
+  void begin(std::string_view request_id, std::string_view path);
+
+  // 结束请求，写摘要、慢请求日志和span
+  void end();
+
+  const char *id() const { return id_; }
+
+  // 开始一个阶段，返回编号，阶段过多时返回-1
+  int spanBegin(const char *name);
+  void spanEnd(int index);
+
+  // 请求开始以来的毫秒数
+  double elapsedMs() const;
+
+ private:
+  struct Span {
+    const char *name;
+    int64_t start_ns;  // 相对请求开始
+    int64_t end_ns;    // -1为还没结束
+    int parent;        // -1为请求本身
+    uint64_t span_id;
+  };
+
+  void writeOtlp(int64_t total_ns) const;
+
+  char id_[TRACE_ID_MAX + 1] = {0};  // 请求id
+  char trace_id_[33] = {0};  // OTLP traceId(32位十六进制)
+  uint64_t root_span_id_ = 0;
+  char path_[64] = {0};
+  int64_t start_ns_ = 0;       // 单调时钟
+  int64_t start_unix_ns_ = 0;  // 墙上时钟，只用于span的时间戳
+  Span spans_[TRACE_MAX_SPANS];
+  int count_ = 0;
+  int open_ = -1;  // 最内层未结束的阶段
+  bool active_ = false;
+};
+
+// 包住一个阶段的计时器，trace为nullptr时什么也不做
+class TraceSpan {
+ public:
+  TraceSpan(RequestTrace *trace, const char *name)
+      : trace_(trace), index_(trace == nullptr ? -1 : trace->spanBegin(name)) {}
+  ~TraceSpan() {
+    if (index_ >= 0) {
+      trace_->spanEnd(index_);
+    }
+  }
+  TraceSpan(const TraceSpan &) = delete;
+  TraceSpan &operator=(const TraceSpan &) = delete;
+
+ private:
+  RequestTrace *trace_;
+  int index_;
+};
+
+// 从cfg.json读取追踪配置，缺少时使用默认值
+int getTraceConfig(TraceConfig *cfg);
+
+// 读取配置，进程启动时调用一次
+int traceInit();
+void traceInit(const TraceConfig &cfg);
+
+#endif
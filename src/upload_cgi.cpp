@@ -15,21 +15,34 @@
 #include <sys/wait.h>
 #include <unistd.h>
 
+#include <atomic>
+#include <cerrno>
 #include <cstdlib>
 #include <cstring>
 #include <iostream>
 #include <string>
 #include <vector>
 
+#include "admission_util.h"
+#include "backend_util.h"
+#include "cgi_handlers.h"
+#include "cgi_server.h"
 #include "cgi_util.h"
+#include "compress_util.h"
 #include "fcgi_config.h"
 #include "fcgi_stdio.h"
+#include "json_util.h"
 // #include "fdfs_api.h"
 #include "make_log.h"
 #include "mysql_util.h"
+#include "pack_util.h"
+#include "quota_util.h"
 #include "rapidjson/document.h"
 #include "rapidjson/stringbuffer.h"
 #include "rapidjson/writer.h"
+#include "response_util.h"
+#include "storage_util.h"
+#include "str_scan.h"
 
 using namespace rapidjson;
 using namespace std;
@@ -37,7 +50,22 @@ using namespace sw::redis;
 
 const char *const UPLOAD_LOG_MODULE = "cgi";
 const char *const UPLOAD_LOG_PROC = "upload";
-thread_local FCGX_Request request;  // 定义线程局部变量
+static PackConfig pack_cfg;          // 小文件打包配置
+static CompressConfig compress_cfg;  // 入库压缩配置
+// 临时文件名的序号，线程池和prefork的多个进程同时上传同名文件时不冲突
+static atomic<unsigned long> tmp_seq{0};
+
+/**
+ * @brief 进程启动时读取一次上传相关配置
+ *
+ * @return 0
+ */
+int uploadInit() {
+  getPackConfig(&pack_cfg);
+  getCompressConfig(&compress_cfg);
+  quotaInit();
+  return 0;
+}
 
 /**
  * @brief 从web服务器接收文件
@@ -46,12 +74,14 @@ thread_local FCGX_Request request;  // 定义线程局部变量
  * @param user 用户名
  * @param filename 文件名
  * @param md5 文件md5
- * @param p_size 文件大小
+ * @param p_size 文件大小，为实际收到的字节数(与表单中的size不一致时失败)
+ * @param local_file (out) 本地临时文件名，pid_序号_文件名，
+ *                   至少FILE_NAME_LEN + 32字节
  *
  * @return 0为成功，-1为失败
  */
 int recvSaveFile(long len, char *user, char *filename, char *md5,
-                 long *p_size) {
+                 long *p_size, char *local_file) {
   //===========> 前端发送过来的post数据的请求体数据 <============
   /*
   ------WebKitFormBoundary88asdgewtgewx\r\n
@@ -78,7 +108,7 @@ int recvSaveFile(long len, char *user, char *filename, char *md5,
             request_body.c_str());
 
   // 获取分界线信息
-  size_t boundary_end_pos = request_body.find("\r\n");
+  size_t boundary_end_pos = scanFind(request_body, "\r\n");
   if (boundary_end_pos == string::npos) {
     LOG_ERROR(UPLOAD_LOG_MODULE, UPLOAD_LOG_PROC, "post no boundary!\n");
     return -1;
@@ -88,10 +118,12 @@ int recvSaveFile(long len, char *user, char *filename, char *md5,
             boundary.c_str());
 
   // 获取文件的信息
-  size_t user_start_pos = request_body.find("user=\"", boundary_end_pos) + 6;
-  size_t user_end_pos = request_body.find("\"", user_start_pos);
+  size_t user_start_pos = scanFind(request_body, "user=\"", boundary_end_pos);
+  if (user_start_pos != string::npos) user_start_pos += 6;
+  size_t user_end_pos = scanFind(request_body, "\"", user_start_pos);
   size_t user_len = user_end_pos - user_start_pos;
-  if (user_start_pos == string::npos) {
+  if (user_start_pos == string::npos || user_end_pos == string::npos ||
+      user_len >= USER_NAME_LEN) {
     LOG_ERROR(UPLOAD_LOG_MODULE, UPLOAD_LOG_PROC, "user_start_pos error\n");
     return -1;
   }
@@ -101,10 +133,12 @@ int recvSaveFile(long len, char *user, char *filename, char *md5,
   trimSpace(user);
 
   size_t filename_start_pos =
-      request_body.find("filename=\"", user_end_pos) + 10;
-  size_t filename_end_pos = request_body.find("\"", filename_start_pos);
+      scanFind(request_body, "filename=\"", user_end_pos);
+  if (filename_start_pos != string::npos) filename_start_pos += 10;
+  size_t filename_end_pos = scanFind(request_body, "\"", filename_start_pos);
   size_t filename_len = filename_end_pos - filename_start_pos;
-  if (filename_start_pos == string::npos) {
+  if (filename_start_pos == string::npos || filename_end_pos == string::npos ||
+      filename_len >= FILE_NAME_LEN) {
     LOG_ERROR(UPLOAD_LOG_MODULE, UPLOAD_LOG_PROC, "filename_start_pos error\n");
     return -1;
   }
@@ -113,11 +147,17 @@ int recvSaveFile(long len, char *user, char *filename, char *md5,
           filename_len);
   filename[filename_len] = '\0';
   trimSpace(filename);
+  if (filename[0] == '\0' || strchr(filename, '/') != nullptr) {
+    LOG_ERROR(UPLOAD_LOG_MODULE, UPLOAD_LOG_PROC, "非法文件名 %s\n", filename);
+    return -1;
+  }
 
-  size_t md5_start_pos = request_body.find("md5=\"", filename_end_pos) + 5;
-  size_t md5_end_pos = request_body.find("\"", md5_start_pos);
+  size_t md5_start_pos = scanFind(request_body, "md5=\"", filename_end_pos);
+  if (md5_start_pos != string::npos) md5_start_pos += 5;
+  size_t md5_end_pos = scanFind(request_body, "\"", md5_start_pos);
   size_t md5_len = md5_end_pos - md5_start_pos;
-  if (md5_start_pos == string::npos) {
+  if (md5_start_pos == string::npos || md5_end_pos == string::npos ||
+      md5_len >= MD5_LEN) {
     LOG_ERROR(UPLOAD_LOG_MODULE, UPLOAD_LOG_PROC, "md5_start_pos error\n");
     return -1;
   }
@@ -125,404 +165,187 @@ int recvSaveFile(long len, char *user, char *filename, char *md5,
   md5[md5_len] = '\0';
   trimSpace(md5);
 
-  size_t size_start_pos = request_body.find("size=", md5_end_pos) + 5;
-  size_t size_end_pos = request_body.find("\r\n", size_start_pos);
-  *p_size =
+  size_t size_start_pos = scanFind(request_body, "size=", md5_end_pos);
+  size_t size_end_pos = scanFind(request_body, "\r\n", size_start_pos);
+  if (size_start_pos == string::npos || size_end_pos == string::npos) {
+    LOG_ERROR(UPLOAD_LOG_MODULE, UPLOAD_LOG_PROC, "size_start_pos error\n");
+    return -1;
+  }
+  size_start_pos += 5;
+  long declared_size =
       strtol(request_body.substr(size_start_pos, size_end_pos - size_start_pos)
                  .c_str(),
              nullptr, 10);
   LOG_DEBUG(UPLOAD_LOG_MODULE, UPLOAD_LOG_PROC,
             "user:[%s], filename:[%s], "
             "md5:[%s], size:[%ld]\n\n",
-            user, filename, md5, *p_size);
+            user, filename, md5, declared_size);
 
   // 写入文件
-  size_t content_start_pos = request_body.find("\r\n\r\n", size_end_pos) + 4;
-  size_t content_end_pos = request_body.find(boundary, content_start_pos) - 2;
-  if (content_start_pos == string::npos || content_end_pos == string::npos) {
+  // 文件内容可能很大，分界线的查找走向量化扫描
+  size_t content_start_pos = scanFind(request_body, "\r\n\r\n", size_end_pos);
+  if (content_start_pos != string::npos) content_start_pos += 4;
+  size_t content_end_pos =
+      scanFind(request_body, boundary.c_str(), content_start_pos);
+  if (content_start_pos == string::npos || content_end_pos == string::npos ||
+      content_end_pos < content_start_pos + 2) {
     LOG_ERROR(UPLOAD_LOG_MODULE, UPLOAD_LOG_PROC, "content_start_pos error\n");
     return -1;
   }
-  // todo: 这里加上user防止文件名重复可能会更好
-  int fd = open(filename, O_CREAT | O_WRONLY, 0644);
-  if (fd < 0) {
-    LOG_ERROR(UPLOAD_LOG_MODULE, UPLOAD_LOG_PROC, "open %s error\n", filename);
-    return -1;
-  }
-
-  ftruncate(fd, content_end_pos - content_start_pos);
-  write(fd, request_body.data() + content_start_pos,
-        content_end_pos - content_start_pos);
-  close(fd);
-  return 0;
-}
-
-/**
- * @brief 上传本地接收的文件到分布式存储
- * @param filename 文件名
- * @param fileid 文件id
- * @return 0 成功，-1 失败
- */
-// todo:添加调用api上传的方法，目前因为fdfs的变量名和chrono的变量名冲突，无法编译
-// int uploadToStorage(char *filename, char *fileid) {
-//   // 读取fdfs client 配置文件的路径
-//   string fdfs_cli_conf_path = "";
-//   getCfgValue(CFG_PATH, "dfs_path", "client", fdfs_cli_conf_path);
-//   int res = fdfs_upload_file(fdfs_cli_conf_path.c_str(), filename, fileid);
-//   // 去掉一个字符串两边的空白字符
-//   trimSpace(fileid);
-//   return res;
-// }
-
-int uploadToStorage(char *filename, char *fileid) {
-  int ret = 0;
-
-  pid_t pid;
-  int fd[2];
-  if (pipe(fd) < 0) {
-    LOG_DEBUG(UPLOAD_LOG_MODULE, UPLOAD_LOG_PROC, "pip error\n");
-    ret = -1;
-    goto END;
-  }
-
-  // 创建子进程，调用fdfs_upload_file上传文件
-  pid = fork();
-  if (pid < 0) {
-    LOG_DEBUG(UPLOAD_LOG_MODULE, UPLOAD_LOG_PROC, "fork error\n");
-    ret = -1;
-    goto END;
-  }
-
-  if (pid == 0)  // 子进程
-  {
-    // 关闭读端
-    close(fd[0]);
-
-    // 将标准输出 重定向 写管道
-    dup2(fd[1], STDOUT_FILENO);
-
-    // 读取fdfs client 配置文件的路径
-    string fdfs_cli_conf_path = "";
-    getCfgValue(CFG_PATH, "dfs_path", "client", fdfs_cli_conf_path);
-
-    execlp("fdfs_upload_file", "fdfs_upload_file", fdfs_cli_conf_path.c_str(),
-           filename, NULL);
-
-    // 执行失败
-    LOG_DEBUG(UPLOAD_LOG_MODULE, UPLOAD_LOG_PROC, "execlp error\n");
-    _exit(127);
-
-    close(fd[1]);
-  } else  // 父进程
-  {
-    // 关闭写端
-    close(fd[1]);
-
-    // 从管道中去读数据
-    read(fd[0], fileid, TEMP_BUF_MAX_LEN);
-    trimSpace(fileid);
-
-    if (strlen(fileid) == 0) {
-      LOG_DEBUG(UPLOAD_LOG_MODULE, UPLOAD_LOG_PROC, "fdfs_upload_file error\n");
-      ret = -1;
-      goto END;
-    }
-
-    LOG_DEBUG(UPLOAD_LOG_MODULE, UPLOAD_LOG_PROC, "fileid = %s\n", fileid);
-    wait(nullptr);
-    close(fd[0]);
-  }
-
-END:
-  LOG_DEBUG(UPLOAD_LOG_MODULE, UPLOAD_LOG_PROC, "\n");
-  return ret;
-}
-
-/**
- * @brief  封装文件存储在分布式系统中的 完整 url
- *
- * @param fileid        (in)    文件分布式id路径
- * @param fdfs_file_url (out)   文件的完整url地址
- *
- * @returns 0 成功，-1 失败
- */
-int makeFileUrl(char *fileid, char *fdfs_file_url) {
-  int ret = 0;
-
-  char *p = NULL;
-  char *q = NULL;
-  char *k = NULL;
-
-  char fdfs_file_stat_buf[TEMP_BUF_MAX_LEN] = {0};
-  char fdfs_file_host_name[HOST_NAME_LEN] = {0};  // storage所在服务器ip地址
-
-  pid_t pid;
-  int fd[2];
-
-  // 无名管道的创建
-  if (pipe(fd) < 0) {
-    LOG_ERROR(UPLOAD_LOG_MODULE, UPLOAD_LOG_PROC, "pip error\n");
-    return -1;
-  }
-
-  // 创建进程
-  pid = fork();
-  if (pid < 0)  // 进程创建失败
-  {
-    LOG_ERROR(UPLOAD_LOG_MODULE, UPLOAD_LOG_PROC, "fork error\n");
-    return -1;
-  }
-
-  if (pid == 0)  // 子进程
-  {
-    // 关闭读端
-    close(fd[0]);
-
-    // 将标准输出 重定向 写管道
-    dup2(fd[1], STDOUT_FILENO);  // dup2(fd[1], 1);
-
-    // 读取fdfs client 配置文件的路径
-    string fdfs_cli_conf_path = "";
-    getCfgValue(CFG_PATH, "dfs_path", "client", fdfs_cli_conf_path);
-
-    execlp("fdfs_file_info", "fdfs_file_info", fdfs_cli_conf_path.c_str(),
-           fileid, NULL);
-
-    // 执行失败
+  content_end_pos -= 2;
+  const char *content = request_body.data() + content_start_pos;
+  size_t content_len = content_end_pos - content_start_pos;
+  // 配额和file_info.size都用实际收到的字节数，不信任表单中的size
+  if (declared_size != (long)content_len) {
     LOG_ERROR(UPLOAD_LOG_MODULE, UPLOAD_LOG_PROC,
-              "execlp fdfs_file_info error\n");
-
-    close(fd[1]);
-  } else  // 父进程
-  {
-    // 关闭写端
-    close(fd[1]);
-
-    // 从管道中去读数据
-    read(fd[0], fdfs_file_stat_buf, TEMP_BUF_MAX_LEN);
-    LOG_INFO(UPLOAD_LOG_MODULE, UPLOAD_LOG_PROC, "get file_ip [%s] succ\n",
-             fdfs_file_stat_buf);
-
-    wait(NULL);  // 等待子进程结束，回收其资源
-    close(fd[0]);
-
-    // 拼接上传文件的完整url地址--->http://host_name/group1/M00/00/00/D12313123232312.png
-    p = strstr(fdfs_file_stat_buf, "source ip address: ");
-
-    q = p + strlen("source ip address: ");  // 这里得到的是本地ip地址
-    k = strstr(q, "\n");
-
-    strncpy(fdfs_file_host_name, q, k - q);
-    fdfs_file_host_name[k - q] = '\0';
-
-    // printf("host_name:[%s]\n", fdfs_file_host_name);
-
-    // 读取storage_web_server服务器的端口
-    string storage_web_server_port = "";
-    getCfgValue(CFG_PATH, "storage_web_server", "port",
-                storage_web_server_port);
-
-    // todo:通过配置文件的映射进行修改（fdfs_file_info返回的是内网地址，因为目前只有一个storage，直接写入）
-    strcpy(fdfs_file_host_name, "s5.s100.vip");  // 穿透地址
-    strcat(fdfs_file_url, "http://");
-    strcat(fdfs_file_url, fdfs_file_host_name);
-    strcat(fdfs_file_url, ":");
-    strcat(fdfs_file_url, storage_web_server_port.c_str());
-    strcat(fdfs_file_url, "/");
-    strcat(fdfs_file_url, fileid);
-
-    // printf("[%s]\n", fdfs_file_url);
-    LOG_INFO(UPLOAD_LOG_MODULE, UPLOAD_LOG_PROC, "file url is: %s\n\n",
-             fdfs_file_url);
-  }
-
-  return ret;
-}
-
-int storeFileinfoToMysql(MYSQL *conn, char *user, char *filename, char *md5,
-                         long size, char *fileid, char *fdfs_file_url) {
-  time_t now;
-  char create_time[TIME_STRING_LEN];
-  char suffix[SUFFIX_LEN];
-  char sql_cmd[SQL_MAX_LEN] = {0};
-
-  getFileSuffix(filename, suffix);  // mp4, jpg, png
-
-  // sql 语句
-  /*
-     -- =============================================== 文件信息表
-     -- md5 文件md5
-     -- file_id 文件id
-     -- url 文件url
-     -- size 文件大小, 以字节为单位
-     -- type 文件类型： png, zip, mp4……
-     -- count 文件引用计数， 默认为1， 每增加一个用户拥有此文件，此计数器+1
-     */
-  sprintf(sql_cmd,
-          "insert into file_info (md5, file_id, url, size, type, count) values "
-          "('%s', '%s', '%s', '%ld', '%s', %d)",
-          md5, fileid, fdfs_file_url, size, suffix, 1);
-
-  if (mysql_query(conn, sql_cmd) != 0)  // 执行sql语句
-  {
-    LOG_ERROR(UPLOAD_LOG_MODULE, UPLOAD_LOG_PROC, "%s 插入失败: %s\n", sql_cmd,
-              mysql_error(conn));
+              "size mismatch: declared %ld, received %zu\n", declared_size,
+              content_len);
     return -1;
   }
+  *p_size = (long)content_len;
 
-  LOG_INFO(UPLOAD_LOG_MODULE, UPLOAD_LOG_PROC, "%s 文件信息插入成功\n\n",
-           sql_cmd);
+  // 保留原文件名，上传到fastDFS后的file_id沿用其后缀
+  snprintf(local_file, FILE_NAME_LEN + 32, "%d_%lu_%s", (int)getpid(),
+           tmp_seq.fetch_add(1), filename);
 
-  // 获取当前时间
-  now = time(NULL);
-  strftime(create_time, TIME_STRING_LEN - 1, "%Y-%m-%d %H:%M:%S",
-           localtime(&now));
-
-  /*
-     -- =============================================== 用户文件列表
-     -- user 文件所属用户
-     -- md5 文件md5
-     -- createtime 文件创建时间
-     -- filename 文件名字
-     -- shared_status 共享状态, 0为没有共享， 1为共享
-     -- pv 文件下载量，默认值为0，下载一次加1
-     */
-  // sql语句
-  sprintf(sql_cmd,
-          "insert into user_file_list(user, md5, createtime, filename, "
-          "shared_status, pv) values ('%s', '%s', '%s', '%s', %d, %d)",
-          user, md5, create_time, filename, 0, 0);
-  if (mysql_query(conn, sql_cmd) != 0) {
-    LOG_ERROR(UPLOAD_LOG_MODULE, UPLOAD_LOG_PROC, "%s 操作失败: %s\n", sql_cmd,
-              mysql_error(conn));
+  int fd = open(local_file, O_CREAT | O_TRUNC | O_WRONLY | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    LOG_ERROR(UPLOAD_LOG_MODULE, UPLOAD_LOG_PROC, "open %s error\n",
+              local_file);
     return -1;
   }
-
-  // 查询用户文件数量
-  sprintf(sql_cmd, "select count from user_file_count where user = '%s'", user);
-  int ret2 = 0;
-  char tmp[512] = {0};
-  int count = 0;
-  // 返回值： 0成功并保存记录集，1没有记录集，2有记录集但是没有保存，-1失败
-  ret2 = processResultOne(conn, sql_cmd, tmp);  // 执行sql语句
-  if (ret2 == 1)                                  // 没有记录
-  {
-    // 插入记录
-    sprintf(sql_cmd,
-            " insert into user_file_count (user, count) values('%s', %d)", user,
-            1);
-  } else if (ret2 == 0) {
-    // 更新用户文件数量count字段
-    count = atoi(tmp);
-    sprintf(sql_cmd, "update user_file_count set count = %d where user = '%s'",
-            count + 1, user);
-  }
-
-  if (mysql_query(conn, sql_cmd) != 0) {
-    LOG_ERROR(UPLOAD_LOG_MODULE, UPLOAD_LOG_PROC, "%s 操作失败: %s\n", sql_cmd,
-              mysql_error(conn));
+  if (ftruncate(fd, content_len) != 0) {
+    LOG_ERROR(UPLOAD_LOG_MODULE, UPLOAD_LOG_PROC, "ftruncate %s err: %s\n",
+              local_file, strerror(errno));
+    close(fd);
+    unlink(local_file);
     return -1;
   }
-
+  size_t done = 0;
+  while (done < content_len) {
+    ssize_t n = write(fd, content + done, content_len - done);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      LOG_ERROR(UPLOAD_LOG_MODULE, UPLOAD_LOG_PROC, "write %s err: %s\n",
+                local_file, strerror(errno));
+      close(fd);
+      unlink(local_file);
+      return -1;
+    }
+    done += n;
+  }
+  close(fd);
   return 0;
 }
 
-int main() {
-  FCGX_Init();   // 初始化 FastCGI 环境
-  request = {};  // 在主线程中初始化线程局部变量
-  FCGX_InitRequest(&request, 0, 0);
-
-  Redis *redisconn = redisConn();
-  MYSQL *mysqlconn = mysqlConn();
-  if (mysqlconn == nullptr || redisconn == nullptr) {
-    LOG_ERROR(UPLOAD_LOG_MODULE, UPLOAD_LOG_PROC,
-              "mysqlConn or redis_conn failed!");
-    return -1;
-  }
-
-  while (FCGX_Accept_r(&request) == 0) {
-    int ret = 0;
-    char filename[FILE_NAME_LEN] = {0};   // 文件名
-    char user[USER_NAME_LEN] = {0};       // 文件上传者
-    char md5[MD5_LEN] = {0};              // 文件md5码
-    long size;                            // 文件大小
-    char fileid[TEMP_BUF_MAX_LEN] = {0};  // 文件上传到fastDFS后的文件id
-    char fdfs_file_url[FILE_URL_LEN] = {0};  // 文件所存放storage的host_name
-
-    char cmd[20];
-    char *query = FCGX_GetParam("QUERY_STRING",
-                                request.envp);  // 从环境变量中获取请求参数
-
-    queryParseKeyValue(query, "cmd", cmd, nullptr);
-    LOG_INFO(UPLOAD_LOG_MODULE, UPLOAD_LOG_PROC, "cmd = %s\n", cmd);
-
-    // todo: 请求头中不包含Content-Length字段，则可能无法精确获取请求体的长度
-    const char *contentLength = FCGX_GetParam("CONTENT_LENGTH", request.envp);
-    int len = (contentLength == nullptr) ? 0 : atoi(contentLength);
-
-    FCGX_FPrintF(request.out,
-                 "Content-type: text/html\r\n\r\n");  // 写入响应头
+static string_view paramOrEmpty(const char *name) {
+  const char *value = FCGX_GetParam(name, request.envp);
+  return value == nullptr ? string_view() : string_view(value);
+}
 
-    if (len <= 0) {
-      FCGX_FPrintF(request.out, "No data from standard input.<p>\n");
-      LOG_WARNING(UPLOAD_LOG_MODULE, UPLOAD_LOG_PROC,
-                  "len = 0, No data from standard input\n");
-    } else {
-      //===============> 得到上传文件  <============
-      if (recvSaveFile(len, user, filename, md5, &size) != 0) {
-        ret = -1;
+// 处理一个上传请求
+void uploadHandler(CgiContext *ctx) {
+  int ret = 0;
+  char filename[FILE_NAME_LEN] = {0};   // 文件名
+  char local_file[FILE_NAME_LEN + 32] = {0};  // 本地临时文件
+  char user[USER_NAME_LEN] = {0};       // 文件上传者
+  char md5[MD5_LEN] = {0};              // 文件md5码
+  long size;                            // 文件大小
+  string_view auth_user, auth_token;  // 准入时验证过的凭证
+  QuotaReservation quota;             // 配额预留，入库成功后提交
+
+  string_view cmd = ctx->query->get("cmd");
+  LOG_INFO(UPLOAD_LOG_MODULE, UPLOAD_LOG_PROC, "cmd = %.*s\n",
+           (int)cmd.size(), cmd.data());
+
+  // todo: 请求头中不包含Content-Length字段，则可能无法精确获取请求体的长度
+  const char *contentLength = FCGX_GetParam("CONTENT_LENGTH", request.envp);
+  int len = (contentLength == nullptr) ? 0 : atoi(contentLength);
+
+  if (len <= 0) {
+    writeNoData(request.out);  // 响应头和提示一次写入
+    LOG_WARNING(UPLOAD_LOG_MODULE, UPLOAD_LOG_PROC,
+                "len = 0, No data from standard input\n");
+  } else {
+    // 带了凭证时用户已知，读请求体之前按请求体长度预留配额
+    admissionCredentials(*ctx->query, paramOrEmpty("HTTP_X_USER"),
+                         paramOrEmpty("HTTP_X_TOKEN"), &auth_user,
+                         &auth_token);
+    if (!auth_token.empty() && auth_user.size() < sizeof(user)) {
+      memcpy(user, auth_user.data(), auth_user.size());
+      user[auth_user.size()] = '\0';
+      TraceSpan span(ctx->trace, "quota");
+      if (quotaReserve(ctx->redis, user, len, &quota) == QUOTA_EXCEEDED) {
+        ret = -2;
         goto END;
       }
-      LOG_INFO(UPLOAD_LOG_MODULE, UPLOAD_LOG_PROC,
-               "%s成功上传[%s, 大小：%ld, md5码：%s]到本地\n", user, filename,
-               size, md5);
+    }
 
-      //===============> 将该文件存入fastDFS中,并得到文件的file_id
-      //<============
-      if (uploadToStorage(filename, fileid) < 0) {
+    //===============> 得到上传文件  <============
+    // 各阶段放在块中计时，goto跳出块时结束计时
+    {
+      TraceSpan span(ctx->trace, "recv");
+      if (recvSaveFile(len, user, filename, md5, &size, local_file) != 0) {
         ret = -1;
         goto END;
       }
+    }
+    LOG_INFO(UPLOAD_LOG_MODULE, UPLOAD_LOG_PROC,
+             "%s成功上传[%s, 大小：%ld, md5码：%s]到本地\n", user, filename,
+             size, md5);
+
+    // 带了凭证时只能以自己的名义上传
+    if (!auth_token.empty() && auth_user != user) {
+      LOG_ERROR(UPLOAD_LOG_MODULE, UPLOAD_LOG_PROC,
+                "form user %s does not match token user %.*s\n", user,
+                (int)auth_user.size(), auth_user.data());
+      ret = -1;
+      goto END;
+    }
 
-      //================> 得到文件所存放storage的host_name <=================
-      if (makeFileUrl(fileid, fdfs_file_url) < 0) {
-        ret = -1;
+    // 没有凭证时，解析出用户和大小后、存储之前预留
+    if (!quota.active()) {
+      TraceSpan span(ctx->trace, "quota");
+      if (quotaReserve(ctx->redis, user, size, &quota) == QUOTA_EXCEEDED) {
+        ret = -2;
         goto END;
       }
+    }
 
-      //===============> 将该文件的FastDFS相关信息存入mysql中 <======
-      if (storeFileinfoToMysql(mysqlconn, user, filename, md5, size, fileid,
-                               fdfs_file_url) < 0) {
-        ret = -1;
-        goto END;
-      }
+    //===============> 压缩、存入fastDFS，文件信息存入mysql <======
+    if (storeLocalFile(ctx->mysql, ctx->meta, ctx->blobs, ctx->trace,
+                       &pack_cfg, &compress_cfg, user, filename, md5, size,
+                       local_file) < 0) {
+      ret = -1;
+      goto END;
+    }
 
-    END:
-      unlink(filename);  // 删除本地临时存放的上传文件
-      memset(filename, 0, FILE_NAME_LEN);
-      memset(user, 0, USER_NAME_LEN);
-      memset(md5, 0, MD5_LEN);
-      memset(fileid, 0, TEMP_BUF_MAX_LEN);
-      memset(fdfs_file_url, 0, FILE_URL_LEN);
+    quotaCommit(ctx->redis, &quota, user, size);
 
-      // 给前端返回，上传情况
-      // 成功：{"code":"008"}
-      // 失败：{"code":"009"}
-      char *out = nullptr;
-      if (ret == 0) {
-        out = returnStatus("008");
-      } else {
-        out = returnStatus("009");
-      }
-      if (out != nullptr) {
-        FCGX_FPrintF(request.out, "%s", out);  // 返回给web服务器
-        LOG_INFO(UPLOAD_LOG_MODULE, UPLOAD_LOG_PROC, "%s\n", out);
-        free(out);
-      }
+  END:
+    quotaRelease(ctx->redis, &quota);  // 失败时释放，已提交时不做任何事
+    if (local_file[0] != '\0') {
+      unlink(local_file);  // 删除本地临时存放的上传文件
     }
-
-    FCGX_Finish_r(&request);
+    memset(filename, 0, FILE_NAME_LEN);
+    memset(user, 0, USER_NAME_LEN);
+    memset(md5, 0, MD5_LEN);
+
+    // 给前端返回，上传情况
+    // 成功：{"code":"008"}
+    // 失败：{"code":"009"}
+    // 超出配额：{"code":"010"}
+    const char *out = ret == 0 ? "008" : (ret == -2 ? "010" : "009");
+    writeStatus(request.out, out);  // 响应头和状态码一次写入，返回给web服务器
+    LOG_INFO(UPLOAD_LOG_MODULE, UPLOAD_LOG_PROC, "code = %s\n", out);
   }
+}
 
-  return 0;
+#ifndef CGI_GATEWAY
+int main() {
+  const CgiRoute route = {"/upload", nullptr, uploadHandler, uploadInit};
+  return runCgi(&route, 1);
 }
+#endif
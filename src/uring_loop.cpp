@@ -0,0 +1,371 @@
+#include "uring_loop.h"
+
+#include <fcntl.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <unordered_map>
+
+#include "make_log.h"
+
+const char *const URING_LOG_MODULE = "cgi";
+const char *const URING_LOG_PROC = "uring";
+
+static thread_local UringLoop *current_loop = nullptr;
+
+UringLoop::~UringLoop() {
+  if (current_loop == this) current_loop = nullptr;
+  if (sqes_ != nullptr) munmap(sqes_, sqes_len_);
+  if (cq_ptr_ != nullptr && cq_ptr_ != sq_ptr_) munmap(cq_ptr_, cq_len_);
+  if (sq_ptr_ != nullptr) munmap(sq_ptr_, sq_len_);
+  if (ring_fd_ >= 0) close(ring_fd_);
+  if (event_fd_ >= 0) close(event_fd_);
+}
+
+/**
+ * @brief 创建io_uring并映射SQ/CQ，并作为当前线程的事件循环
+ *
+ * @param entries SQ长度，CQ为它的两倍
+ *
+ * @return 0成功，-1失败
+ */
+int UringLoop::init(unsigned entries) {
+  struct io_uring_params p;
+  memset(&p, 0, sizeof(p));
+  ring_fd_ = (int)syscall(__NR_io_uring_setup, entries, &p);
+  if (ring_fd_ < 0) {
+    LOG_ERROR(URING_LOG_MODULE, URING_LOG_PROC, "io_uring_setup err: %s\n",
+              strerror(errno));
+    return -1;
+  }
+  entries_ = p.sq_entries;
+
+  sq_len_ = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  cq_len_ = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  bool single_mmap = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+  if (single_mmap) {
+    sq_len_ = cq_len_ = sq_len_ > cq_len_ ? sq_len_ : cq_len_;
+  }
+  sq_ptr_ = mmap(nullptr, sq_len_, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+  if (sq_ptr_ == MAP_FAILED) {
+    sq_ptr_ = nullptr;
+    return -1;
+  }
+  if (single_mmap) {
+    cq_ptr_ = sq_ptr_;
+  } else {
+    cq_ptr_ = mmap(nullptr, cq_len_, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_CQ_RING);
+    if (cq_ptr_ == MAP_FAILED) {
+      cq_ptr_ = nullptr;
+      return -1;
+    }
+  }
+  sqes_len_ = p.sq_entries * sizeof(struct io_uring_sqe);
+  void *sqes = mmap(nullptr, sqes_len_, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES);
+  if (sqes == MAP_FAILED) {
+    return -1;
+  }
+  sqes_ = (struct io_uring_sqe *)sqes;
+
+  char *sq = (char *)sq_ptr_;
+  sq_head_ = (unsigned *)(sq + p.sq_off.head);
+  sq_tail_ = (unsigned *)(sq + p.sq_off.tail);
+  sq_mask_ = (unsigned *)(sq + p.sq_off.ring_mask);
+  sq_array_ = (unsigned *)(sq + p.sq_off.array);
+  char *cq = (char *)cq_ptr_;
+  cq_head_ = (unsigned *)(cq + p.cq_off.head);
+  cq_tail_ = (unsigned *)(cq + p.cq_off.tail);
+  cq_mask_ = (unsigned *)(cq + p.cq_off.ring_mask);
+  cqes_ = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+  event_fd_ = eventfd(0, EFD_CLOEXEC);
+  if (event_fd_ < 0) {
+    return -1;
+  }
+  current_loop = this;  // 之后在本线程创建的协程都提交到这个循环
+  return 0;
+}
+
+int UringLoop::enter(unsigned to_submit, unsigned min_complete,
+                     unsigned flags) {
+  int ret = (int)syscall(__NR_io_uring_enter, ring_fd_, to_submit,
+                         min_complete, flags, nullptr, 0);
+  if (ret > 0) {
+    to_submit_ -= (unsigned)ret < to_submit_ ? (unsigned)ret : to_submit_;
+  }
+  return ret;
+}
+
+/**
+ * @brief 取一个SQE并清零，user_data指向op
+ *        没有使用SQPOLL，内核只在io_uring_enter时读取SQ，所以调用者可以在返回后再填写
+ */
+struct io_uring_sqe *UringLoop::getSqe(UringOp *op) {
+  unsigned head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+  unsigned tail = *sq_tail_;
+  if (tail - head >= entries_) {
+    enter(to_submit_, 0, 0);
+    head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+  }
+  unsigned index = tail & *sq_mask_;
+  struct io_uring_sqe *sqe = &sqes_[index];
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->user_data = (uint64_t)(uintptr_t)op;
+  sq_array_[index] = index;
+  __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+  to_submit_++;
+  return sqe;
+}
+
+void UringLoop::armWakeup() {
+  struct io_uring_sqe *sqe = getSqe(&event_op_);
+  sqe->opcode = IORING_OP_READ;
+  sqe->fd = event_fd_;
+  sqe->addr = (uint64_t)(uintptr_t)&event_val_;
+  sqe->len = sizeof(event_val_);
+}
+
+// 处理CQ中所有完成事件
+void UringLoop::reap() {
+  unsigned head = *cq_head_;
+  for (;;) {
+    unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+    if (head == tail) {
+      break;
+    }
+    struct io_uring_cqe *cqe = &cqes_[head & *cq_mask_];
+    UringOp *op = (UringOp *)(uintptr_t)cqe->user_data;
+    int res = cqe->res;
+    head++;
+    __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+
+    if (op == &event_op_) {
+      if (!stopped_.load()) armWakeup();
+      continue;
+    }
+    op->res = res;
+    if (op->done != nullptr) {
+      op->done(op);
+    } else {
+      op->handle.resume();
+    }
+  }
+}
+
+void UringLoop::run() {
+  current_loop = this;
+  armWakeup();
+  while (!stopped_.load()) {
+    int ret = enter(to_submit_, 1, IORING_ENTER_GETEVENTS);
+    if (ret < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+      LOG_ERROR(URING_LOG_MODULE, URING_LOG_PROC, "io_uring_enter err: %s\n",
+                strerror(errno));
+      break;
+    }
+    reap();
+  }
+  current_loop = nullptr;
+}
+
+void UringLoop::stop() {
+  stopped_.store(true);
+  uint64_t one = 1;
+  if (write(event_fd_, &one, sizeof(one)) < 0) {
+    LOG_ERROR(URING_LOG_MODULE, URING_LOG_PROC, "eventfd write err: %s\n",
+              strerror(errno));
+  }
+}
+
+UringLoop *UringLoop::current() { return current_loop; }
+
+void UringAwait::await_suspend(std::coroutine_handle<> h) {
+  op_.handle = h;
+  struct io_uring_sqe *sqe = UringLoop::current()->getSqe(&op_);
+  sqe->opcode = opcode_;
+  sqe->fd = fd_;
+  sqe->addr = (uint64_t)(uintptr_t)addr_;
+  sqe->len = len_;
+  sqe->off = off_;
+  sqe->rw_flags = (int)op_flags;  // 与msg_flags/accept_flags同一个union
+}
+
+UringAwait uringAccept(int listen_fd) {
+  UringAwait a(IORING_OP_ACCEPT, listen_fd, nullptr, 0, 0);
+  a.op_flags = SOCK_CLOEXEC;
+  return a;
+}
+
+UringAwait uringRecv(int fd, void *buf, size_t len) {
+  return UringAwait(IORING_OP_RECV, fd, buf, (unsigned)len, 0);
+}
+
+UringAwait uringSend(int fd, const void *buf, size_t len) {
+  UringAwait a(IORING_OP_SEND, fd, buf, (unsigned)len, 0);
+  a.op_flags = MSG_NOSIGNAL;
+  return a;
+}
+
+UringAwait uringWrite(int fd, const void *buf, size_t len, off_t off) {
+  return UringAwait(IORING_OP_WRITE, fd, buf, (unsigned)len, (uint64_t)off);
+}
+
+UringAwait uringPoll(int fd, unsigned events) {
+  UringAwait a(IORING_OP_POLL_ADD, fd, nullptr, 0, 0);
+  a.op_flags = events;  // poll32_events
+  return a;
+}
+
+Task uringSleep(long ms) {
+  struct __kernel_timespec ts;
+  ts.tv_sec = ms / 1000;
+  ts.tv_nsec = (ms % 1000) * 1000000;
+  co_await UringAwait(IORING_OP_TIMEOUT, -1, &ts, 1, 0);
+}
+
+Task uringSendAll(int fd, const char *buf, size_t len, int *result) {
+  while (len > 0) {
+    int n = co_await uringSend(fd, buf, len);
+    if (n <= 0) {
+      *result = n == 0 ? -EPIPE : n;
+      co_return;
+    }
+    buf += n;
+    len -= n;
+  }
+  *result = 0;
+}
+
+Task uringWriteAll(int fd, const char *buf, size_t len, off_t off,
+                   int *result) {
+  while (len > 0) {
+    int n = co_await uringWrite(fd, buf, len, off);
+    if (n <= 0) {
+      *result = n == 0 ? -EIO : n;
+      co_return;
+    }
+    buf += n;
+    len -= n;
+    if (off >= 0) off += n;
+  }
+  *result = 0;
+}
+
+//==================== 异步日志 ====================
+
+struct LogFile;
+
+struct LogOp : UringOp {
+  LogFile *file;
+};
+
+// 一个打开的日志文件，inflight正在写入，pending攒着下一批
+struct LogFile {
+  int fd = -1;
+  std::string pending;
+  std::string inflight;
+  size_t written = 0;
+  LogOp op;
+};
+
+// 日志文件按天滚动，超过这个数量时关闭空闲的旧文件
+static const size_t LOG_FILES_MAX = 32;
+static thread_local std::unordered_map<std::string, LogFile *> log_files;
+
+static void issueLogWrite(LogFile *f) {
+  struct io_uring_sqe *sqe = UringLoop::current()->getSqe(&f->op);
+  sqe->opcode = IORING_OP_WRITE;
+  sqe->fd = f->fd;
+  sqe->addr = (uint64_t)(uintptr_t)(f->inflight.data() + f->written);
+  sqe->len = (unsigned)(f->inflight.size() - f->written);
+  sqe->off = (uint64_t)-1;
+}
+
+static void logWriteDone(UringOp *op) {
+  LogFile *f = static_cast<LogOp *>(op)->file;
+  if (op->res > 0) {
+    f->written += op->res;
+    if (f->written < f->inflight.size()) {
+      issueLogWrite(f);
+      return;
+    }
+  }
+  // 写失败时丢弃这一批，不能在事件循环里记录日志
+  f->inflight.clear();
+  f->written = 0;
+  if (!f->pending.empty()) {
+    f->inflight.swap(f->pending);
+    issueLogWrite(f);
+  }
+}
+
+static void writeLogSync(const std::string &path, const std::string &msg) {
+  int fd = open(path.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    return;
+  }
+  if (write(fd, msg.data(), msg.size()) < 0) {
+    // 日志写失败无处可报
+  }
+  close(fd);
+}
+
+static void evictIdleLogFiles() {
+  for (auto it = log_files.begin(); it != log_files.end();) {
+    LogFile *f = it->second;
+    if (f->inflight.empty() && f->pending.empty()) {
+      close(f->fd);
+      delete f;
+      it = log_files.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+/**
+ * @brief 追加一条日志，在事件循环线程中异步写入
+ *
+ * @param path 日志文件路径
+ * @param msg  格式化好的日志
+ */
+void uringLogWrite(const std::string &path, const std::string &msg) {
+  if (UringLoop::current() == nullptr) {
+    writeLogSync(path, msg);
+    return;
+  }
+
+  auto it = log_files.find(path);
+  LogFile *f;
+  if (it != log_files.end()) {
+    f = it->second;
+  } else {
+    if (log_files.size() >= LOG_FILES_MAX) {
+      evictIdleLogFiles();
+    }
+    int fd =
+        open(path.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+      return;
+    }
+    f = new LogFile;
+    f->fd = fd;
+    f->op.done = logWriteDone;
+    f->op.file = f;
+    log_files.emplace(path, f);
+  }
+
+  if (!f->inflight.empty()) {
+    f->pending.append(msg);  // 上一批还没写完，攒到下一批
+    return;
+  }
+  f->inflight.assign(msg);
+  f->written = 0;
+  issueLogWrite(f);
+}
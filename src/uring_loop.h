@@ -0,0 +1,206 @@
+#ifndef URING_LOOP_H
+#define URING_LOOP_H
+
+#include <linux/io_uring.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#include <atomic>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <string>
+
+/*
+   基于io_uring的事件循环和C++20协程：
+   每个线程一个UringLoop(直接使用io_uring系统调用，不依赖liburing)，
+   协程co_await一个UringAwait时提交一个SQE并挂起，对应的CQE到达后在同一线程恢复。
+
+   Task是惰性启动的协程，可以被另一个协程co_await，
+   也可以detach()后独立运行，结束时自己释放。
+*/
+
+// 一个已提交的操作，user_data指向它
+struct UringOp {
+  int res = 0;                     // CQE的结果，失败为-errno
+  std::coroutine_handle<> handle;  // 等待结果的协程
+  void (*done)(UringOp *op) = nullptr;  // 不等待结果的操作完成时调用
+};
+
+class UringLoop {
+ public:
+  UringLoop() = default;
+  ~UringLoop();
+  UringLoop(const UringLoop &) = delete;
+  UringLoop &operator=(const UringLoop &) = delete;
+
+  // 创建io_uring并绑定到当前线程，entries为SQ长度，成功返回0
+  int init(unsigned entries);
+
+  // 取一个空闲的SQE，SQ已满时先提交
+  struct io_uring_sqe *getSqe(UringOp *op);
+
+  // 在当前线程处理完成事件，直到stop()
+  void run();
+
+  // 可在任意线程调用，让run()返回
+  void stop();
+
+  // 当前线程正在运行的事件循环，没有时为nullptr
+  static UringLoop *current();
+
+ private:
+  int enter(unsigned to_submit, unsigned min_complete, unsigned flags);
+  void reap();
+  void armWakeup();
+
+  int ring_fd_ = -1;
+  unsigned entries_ = 0;
+  void *sq_ptr_ = nullptr;
+  size_t sq_len_ = 0;
+  void *cq_ptr_ = nullptr;
+  size_t cq_len_ = 0;
+  struct io_uring_sqe *sqes_ = nullptr;
+  size_t sqes_len_ = 0;
+  unsigned *sq_head_ = nullptr;
+  unsigned *sq_tail_ = nullptr;
+  unsigned *sq_mask_ = nullptr;
+  unsigned *sq_array_ = nullptr;
+  unsigned *cq_head_ = nullptr;
+  unsigned *cq_tail_ = nullptr;
+  unsigned *cq_mask_ = nullptr;
+  struct io_uring_cqe *cqes_ = nullptr;
+  unsigned to_submit_ = 0;
+
+  // 其它线程通过eventfd唤醒
+  int event_fd_ = -1;
+  uint64_t event_val_ = 0;
+  UringOp event_op_;
+  std::atomic<bool> stopped_{false};
+};
+
+// 惰性启动的协程
+class Task {
+ public:
+  struct promise_type {
+    std::coroutine_handle<> continuation;
+    bool detached = false;
+
+    Task get_return_object() {
+      return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+    }
+    std::suspend_always initial_suspend() noexcept { return {}; }
+
+    struct FinalAwaiter {
+      bool await_ready() noexcept { return false; }
+      std::coroutine_handle<> await_suspend(
+          std::coroutine_handle<promise_type> h) noexcept {
+        promise_type &p = h.promise();
+        if (p.continuation) {
+          return p.continuation;
+        }
+        if (p.detached) {
+          h.destroy();
+        }
+        return std::noop_coroutine();
+      }
+      void await_resume() noexcept {}
+    };
+    FinalAwaiter final_suspend() noexcept { return {}; }
+
+    void return_void() {}
+    void unhandled_exception() { std::terminate(); }
+  };
+
+  Task() = default;
+  explicit Task(std::coroutine_handle<promise_type> h) : handle_(h) {}
+  Task(Task &&other) noexcept : handle_(other.handle_) {
+    other.handle_ = nullptr;
+  }
+  Task &operator=(Task &&other) noexcept {
+    if (this != &other) {
+      if (handle_) handle_.destroy();
+      handle_ = other.handle_;
+      other.handle_ = nullptr;
+    }
+    return *this;
+  }
+  Task(const Task &) = delete;
+  Task &operator=(const Task &) = delete;
+  ~Task() {
+    if (handle_) handle_.destroy();
+  }
+
+  // co_await task：启动task，结束后恢复调用者
+  bool await_ready() const noexcept { return !handle_ || handle_.done(); }
+  std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) {
+    handle_.promise().continuation = caller;
+    return handle_;
+  }
+  void await_resume() noexcept {}
+
+  // 独立运行，运行到第一个挂起点后返回，结束时自动释放
+  void detach() {
+    std::coroutine_handle<promise_type> h = handle_;
+    handle_ = nullptr;
+    h.promise().detached = true;
+    h.resume();
+  }
+
+ private:
+  std::coroutine_handle<promise_type> handle_;
+};
+
+// 提交一个SQE并等待它完成，co_await的结果为CQE的res
+class UringAwait {
+ public:
+  UringAwait(uint8_t opcode, int fd, const void *addr, unsigned len,
+             uint64_t off)
+      : opcode_(opcode), fd_(fd), addr_(addr), len_(len), off_(off) {}
+
+  bool await_ready() const noexcept { return false; }
+  void await_suspend(std::coroutine_handle<> h);
+  int await_resume() const noexcept { return op_.res; }
+
+  uint32_t op_flags = 0;  // msg_flags/accept_flags/rw_flags
+
+ private:
+  uint8_t opcode_;
+  int fd_;
+  const void *addr_;
+  unsigned len_;
+  uint64_t off_;
+  UringOp op_;
+};
+
+// 异步接受连接，结果为新的fd或-errno
+UringAwait uringAccept(int listen_fd);
+
+// 异步接收，结果为接收的字节数，0为对端关闭
+UringAwait uringRecv(int fd, void *buf, size_t len);
+
+// 异步发送，结果为发送的字节数
+UringAwait uringSend(int fd, const void *buf, size_t len);
+
+// 异步写文件，off为-1时写到当前位置(O_APPEND文件追加)
+UringAwait uringWrite(int fd, const void *buf, size_t len, off_t off);
+
+// 等待fd就绪(POLLIN/POLLOUT...)，结果为就绪的事件或-errno
+UringAwait uringPoll(int fd, unsigned events);
+
+// 异步等待ms毫秒
+Task uringSleep(long ms);
+
+// 把len字节全部发送出去，成功返回0，失败返回-errno
+Task uringSendAll(int fd, const char *buf, size_t len, int *result);
+
+// 把len字节全部写到文件off处，成功返回0，失败返回-errno
+Task uringWriteAll(int fd, const char *buf, size_t len, off_t off,
+                   int *result);
+
+// make_log的异步写入：同一日志文件只有一个写操作在途，其间的日志攒成一批
+// 当前线程没有事件循环时同步写
+void uringLogWrite(const std::string &path, const std::string &msg);
+
+#endif
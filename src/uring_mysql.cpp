@@ -0,0 +1,248 @@
+#include "uring_mysql.h"
+
+#include <mysql/errmsg.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <system_error>
+#include <thread>
+
+#include "make_log.h"
+#include "metrics_util.h"
+#include "mysql_util.h"
+
+MysqlLease::~MysqlLease() {
+  if (pool_ != nullptr && conn_ != nullptr) {
+    pool_->release(conn_, broken_);
+  }
+}
+
+MysqlPool::~MysqlPool() {
+  for (MYSQL *conn : all_) {
+    mysql_close(conn);
+  }
+}
+
+/**
+ * @brief  建立size条连接
+ *
+ * @param size 连接数
+ *
+ * @return 0 成功，-1 有连接建立失败(已建立的仍可使用)
+ */
+int MysqlPool::init(int size) {
+  for (int i = 0; i < size; i++) {
+    MYSQL *conn = mysqlConn();
+    if (conn == nullptr) {
+      LOG_ERROR(URING_MYSQL_LOG_MODULE, URING_MYSQL_LOG_PROC,
+                "mysqlConn failed, %d/%d connected\n", i, size);
+      return -1;
+    }
+    all_.push_back(conn);
+    idle_.push_back(conn);
+  }
+  return 0;
+}
+
+bool MysqlPool::Acquire::await_ready() {
+  if (pool_->idle_.empty()) {
+    return false;
+  }
+  conn_ = pool_->idle_.back();
+  pool_->idle_.pop_back();
+  return true;
+}
+
+void MysqlPool::Acquire::await_suspend(std::coroutine_handle<> h) {
+  op_.handle = h;
+  pool_->waiters_.push_back(this);
+}
+
+// 服务端断开的连接不能再用
+static bool connLost(MYSQL *conn) {
+  unsigned int err = mysql_errno(conn);
+  return err == CR_SERVER_GONE_ERROR || err == CR_SERVER_LOST;
+}
+
+/**
+ * @brief  归还连接，有协程在等待时交给队首的协程
+ *         连接不可用时先在事件循环外重新连接，完成后才归还
+ *
+ * @param conn   连接
+ * @param broken 调用者认为连接已不可用
+ */
+void MysqlPool::release(MYSQL *conn, bool broken) {
+  if (broken || connLost(conn)) {
+    reconnect(conn).detach();
+    return;
+  }
+  give(conn);
+}
+
+/**
+ * @brief  连接回到池中
+ *         等待者不在这里直接恢复(归还者还在执行中)，而是提交一个NOP，
+ *         由事件循环恢复
+ */
+void MysqlPool::give(MYSQL *conn) {
+  if (waiters_.empty()) {
+    idle_.push_back(conn);
+    return;
+  }
+  Acquire *w = waiters_.front();
+  waiters_.pop_front();
+  w->conn_ = conn;
+  struct io_uring_sqe *sqe = UringLoop::current()->getSqe(&w->op_);
+  sqe->opcode = IORING_OP_NOP;
+}
+
+/**
+ * @brief  在临时线程中调用mysqlConn，线程通过eventfd通知事件循环
+ *         重连很少发生，不值得为它常驻线程；线程或eventfd创建失败时同步重连
+ *
+ * @param conn 已断开的连接，重连失败时原样归还
+ */
+Task MysqlPool::reconnect(MYSQL *conn) {
+  MYSQL *fresh = nullptr;
+  int efd = eventfd(0, EFD_CLOEXEC);
+  bool started = false;
+  if (efd >= 0) {
+    try {
+      // 线程写完fresh再通知，之后不再访问协程帧
+      std::thread([efd, &fresh] {
+        fresh = mysqlConn();
+        uint64_t one = 1;
+        if (write(efd, &one, sizeof(one)) != sizeof(one)) {
+          LOG_ERROR(URING_MYSQL_LOG_MODULE, URING_MYSQL_LOG_PROC,
+                    "reconnect notify err: %s\n", strerror(errno));
+        }
+      }).detach();
+      started = true;
+    } catch (const std::system_error &e) {
+      LOG_ERROR(URING_MYSQL_LOG_MODULE, URING_MYSQL_LOG_PROC,
+                "reconnect thread: %s\n", e.what());
+    }
+  }
+  if (started) {
+    // 线程一定会通知，等待出错时只能继续等
+    int res;
+    do {
+      res = co_await uringPoll(efd, POLLIN);
+    } while (res == -EINTR || res == -EAGAIN || res == -ECANCELED);
+    uint64_t value;
+    if (read(efd, &value, sizeof(value)) != sizeof(value)) {
+      LOG_ERROR(URING_MYSQL_LOG_MODULE, URING_MYSQL_LOG_PROC,
+                "reconnect wait err: %s\n", strerror(errno));
+    }
+  } else {
+    fresh = mysqlConn();
+  }
+  if (efd >= 0) {
+    close(efd);
+  }
+
+  if (fresh != nullptr) {
+    for (MYSQL *&c : all_) {
+      if (c == conn) c = fresh;
+    }
+    mysql_close(conn);
+    conn = fresh;
+    LOG_INFO(URING_MYSQL_LOG_MODULE, URING_MYSQL_LOG_PROC,
+             "mysql reconnected\n");
+  } else {
+    LOG_ERROR(URING_MYSQL_LOG_MODULE, URING_MYSQL_LOG_PROC,
+              "mysql reconnect failed\n");
+  }
+  give(conn);
+}
+
+/**
+ * @brief  异步执行sql，socket不能继续时挂起当前协程
+ *         发送语句时等待可写(批量insert等长语句可能写不进socket缓冲区)，
+ *         读取结果时等待可读
+ *
+ * @param conn    借出的连接
+ * @param sql_cmd sql语句
+ * @param res     (out) 结果集，为nullptr时不取结果集(insert/update)
+ * @param ret     (out) 0成功，-1失败
+ */
+Task mysqlQueryAsync(MYSQL *conn, const char *sql_cmd, MYSQL_RES **res,
+                     int *ret) {
+  *ret = -1;
+  if (res != nullptr) *res = nullptr;
+  MetricTimer timer(DEP_MYSQL);  // 在协程帧中，挂起的时间也计入
+
+  const unsigned long len = strlen(sql_cmd);
+  net_async_status status;
+  while ((status = mysql_send_query_nonblocking(conn, sql_cmd, len)) ==
+         NET_ASYNC_NOT_READY) {
+    co_await uringPoll(conn->net.fd, POLLOUT);
+  }
+  if (status == NET_ASYNC_ERROR) {
+    LOG_ERROR(URING_MYSQL_LOG_MODULE, URING_MYSQL_LOG_PROC,
+              "mysql_send_query_nonblocking error! sql_cmd=%s, %s\n", sql_cmd,
+              mysql_error(conn));
+    timer.fail();
+    co_return;
+  }
+  while ((status = mysql_read_query_result_nonblocking(conn)) ==
+         NET_ASYNC_NOT_READY) {
+    co_await uringPoll(conn->net.fd, POLLIN);
+  }
+  if (status == NET_ASYNC_ERROR) {
+    LOG_ERROR(URING_MYSQL_LOG_MODULE, URING_MYSQL_LOG_PROC,
+              "mysql_read_query_result_nonblocking error! sql_cmd=%s, %s\n",
+              sql_cmd, mysql_error(conn));
+    timer.fail();
+    co_return;
+  }
+
+  if (res != nullptr) {
+    while ((status = mysql_store_result_nonblocking(conn, res)) ==
+           NET_ASYNC_NOT_READY) {
+      co_await uringPoll(conn->net.fd, POLLIN);
+    }
+    if (status == NET_ASYNC_ERROR || *res == nullptr) {
+      LOG_ERROR(URING_MYSQL_LOG_MODULE, URING_MYSQL_LOG_PROC,
+                "mysql_store_result_nonblocking error! %s\n",
+                mysql_error(conn));
+      timer.fail();
+      co_return;
+    }
+  }
+  *ret = 0;
+}
+
+/**
+ * @brief  processResultOne的异步版本，只处理一条记录的第一个字段
+ *
+ * @param conn    借出的连接
+ * @param sql_cmd sql语句
+ * @param buf     保存结果的缓冲区，为nullptr时只判断有没有记录
+ * @param ret     (out) 0成功并保存记录集，1没有记录集，2有记录集但是没有保存，-1失败
+ */
+Task processResultOneAsync(MYSQL *conn, const char *sql_cmd, char *buf,
+                           int *ret) {
+  MYSQL_RES *res_set = nullptr;
+  co_await mysqlQueryAsync(conn, sql_cmd, &res_set, ret);
+  if (*ret != 0) {
+    co_return;
+  }
+
+  if (mysql_num_rows(res_set) == 0) {
+    *ret = 1;
+  } else if (buf == nullptr) {
+    *ret = 2;
+  } else {
+    MYSQL_ROW row = mysql_fetch_row(res_set);
+    if (row != nullptr && row[0] != nullptr) {
+      strcpy(buf, row[0]);
+    }
+  }
+  // 结果集已全部读到客户端内存，释放不涉及网络
+  mysql_free_result(res_set);
+}
@@ -0,0 +1,114 @@
+#ifndef URING_MYSQL_H
+#define URING_MYSQL_H
+
+#include <mysql/mysql.h>
+
+#include <coroutine>
+#include <deque>
+#include <vector>
+
+#include "uring_loop.h"
+
+/*
+   在io_uring事件循环上执行mysql查询：
+   使用libmysqlclient(MySQL 8)的 mysql_real_query_nonblocking /
+   mysql_store_result_nonblocking，返回NET_ASYNC_NOT_READY时
+   对连接的socket提交一个POLL_ADD并挂起协程，socket可读后继续，
+   一个线程可以同时挂着多条查询。
+
+   一条连接同一时间只能执行一条查询，所以每个线程有一个MysqlPool，
+   协程先 co_await pool->acquire() 借一条连接，MysqlLease析构时归还；
+   连接都忙时排队，归还时按顺序交给等待的协程。
+
+   连接在线程启动时同步建立(mysqlConn)。查询失败且连接已断开时，归还的连接
+   不回到池中，而是在一个临时线程中重新连接(mysqlConn是同步的，不能阻塞事件循环)，
+   连上后再交给等待的协程；重连失败时原连接放回池中，下次使用失败时再试。
+*/
+
+const char *const URING_MYSQL_LOG_MODULE = "cgi";
+const char *const URING_MYSQL_LOG_PROC = "uring_mysql";
+
+class MysqlPool;
+
+// 借出的一条连接，析构时归还
+class MysqlLease {
+ public:
+  MysqlLease() = default;
+  MysqlLease(MysqlPool *pool, MYSQL *conn) : pool_(pool), conn_(conn) {}
+  MysqlLease(MysqlLease &&other) noexcept
+      : pool_(other.pool_), conn_(other.conn_), broken_(other.broken_) {
+    other.pool_ = nullptr;
+    other.conn_ = nullptr;
+  }
+  MysqlLease(const MysqlLease &) = delete;
+  MysqlLease &operator=(const MysqlLease &) = delete;
+  MysqlLease &operator=(MysqlLease &&) = delete;
+  ~MysqlLease();
+
+  MYSQL *conn() const { return conn_; }
+
+  // 连接已不可用，归还时重新连接
+  void markBroken() { broken_ = true; }
+
+ private:
+  MysqlPool *pool_ = nullptr;
+  MYSQL *conn_ = nullptr;
+  bool broken_ = false;
+};
+
+// 一个事件循环线程的mysql连接池，只能在该线程使用
+class MysqlPool {
+ public:
+  MysqlPool() = default;
+  ~MysqlPool();
+  MysqlPool(const MysqlPool &) = delete;
+  MysqlPool &operator=(const MysqlPool &) = delete;
+
+  // 建立size条连接，全部成功返回0
+  int init(int size);
+
+  // co_await的结果为MysqlLease，没有空闲连接时挂起
+  class Acquire {
+   public:
+    explicit Acquire(MysqlPool *pool) : pool_(pool) {}
+    bool await_ready();
+    void await_suspend(std::coroutine_handle<> h);
+    MysqlLease await_resume() { return MysqlLease(pool_, conn_); }
+
+   private:
+    friend class MysqlPool;
+    MysqlPool *pool_;
+    MYSQL *conn_ = nullptr;
+    UringOp op_;  // 归还连接时通过一个NOP在事件循环中恢复等待者
+  };
+
+  Acquire acquire() { return Acquire(this); }
+
+  // 归还连接，broken为true或连接已断开时先重新连接
+  void release(MYSQL *conn, bool broken);
+
+  int size() const { return (int)all_.size(); }
+
+ private:
+  // 连接回到池中，有等待者时交给队首的等待者
+  void give(MYSQL *conn);
+
+  // 在临时线程中重新连接，完成后替换conn并归还
+  Task reconnect(MYSQL *conn);
+
+  std::vector<MYSQL *> all_;
+  std::vector<MYSQL *> idle_;
+  std::deque<Acquire *> waiters_;
+};
+
+// 异步执行sql，res不为nullptr时取回结果集(由调用者mysql_free_result)
+// *ret：0成功，-1失败
+Task mysqlQueryAsync(MYSQL *conn, const char *sql_cmd, MYSQL_RES **res,
+                     int *ret);
+
+// processResultOne的异步版本，*ret的含义相同：
+// 0成功并保存记录集，1没有记录集，2有记录集但是没有保存，-1失败
+Task processResultOneAsync(MYSQL *conn, const char *sql_cmd, char *buf,
+                           int *ret);
+
+#endif
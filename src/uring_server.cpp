@@ -0,0 +1,455 @@
+#include "uring_server.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <unordered_map>
+
+#include "make_log.h"
+
+const char *const URING_LOG_MODULE = "cgi";
+const char *const URING_LOG_PROC = "uring";
+
+// 连接的初始接收缓冲区，遇到更大的记录时扩大
+static const size_t READ_BUF_LEN = 16 * 1024;
+// 一个请求的PARAMS总长度上限
+static const size_t PARAMS_MAX_LEN = 64 * 1024;
+
+// 一个事件循环线程
+struct ThreadState {
+  UringServer *server = nullptr;
+  UringLoop loop;
+  void *ctx = nullptr;
+  int inflight = 0;  // 本线程未结束的请求数
+};
+
+// 一个连接，由读协程和该连接上正在处理的请求共同持有
+struct UringConn {
+  int fd;
+  ThreadState *thread;
+  std::unordered_map<uint16_t, std::unique_ptr<UringRequest>> requests;
+  std::string wbuf;      // 待发送的记录
+  std::string sbuf;      // 正在发送的记录
+  bool sending = false;  // 已有协程在发送
+  bool closing = false;  // 发送完后关闭
+  bool broken = false;   // 连接已断开，不再发送
+
+  UringConn(int f, ThreadState *t) : fd(f), thread(t) {}
+  ~UringConn() { close(fd); }
+};
+
+typedef std::shared_ptr<UringConn> ConnPtr;
+
+UringRequest::~UringRequest() {
+  if (spool_fd >= 0) {
+    close(spool_fd);
+    unlink(spool_path.c_str());
+  }
+}
+
+std::string_view UringRequest::param(std::string_view name) const {
+  for (const auto &p : params) {
+    if (p.first == name) {
+      return p.second;
+    }
+  }
+  return std::string_view();
+}
+
+static void eraseRequest(UringConn *conn, uint16_t id) {
+  if (conn->requests.erase(id) > 0) {
+    conn->thread->inflight--;
+  }
+}
+
+/**
+ * @brief 发送连接上攒下的记录，同一时间只有一个协程在发送，
+ *        发送期间追加的记录由它一并发出
+ */
+static Task flushConn(ConnPtr conn) {
+  if (conn->sending) {
+    co_return;
+  }
+  conn->sending = true;
+  while (!conn->wbuf.empty() && !conn->broken) {
+    conn->sbuf.clear();
+    conn->sbuf.swap(conn->wbuf);
+    int ret = 0;
+    co_await uringSendAll(conn->fd, conn->sbuf.data(), conn->sbuf.size(),
+                          &ret);
+    if (ret != 0) {
+      conn->broken = true;
+    }
+  }
+  conn->sending = false;
+  if (conn->broken) {
+    conn->wbuf.clear();
+  }
+  if (conn->closing || conn->broken) {
+    shutdown(conn->fd, SHUT_RDWR);  // 让读协程的recv返回
+  }
+}
+
+/**
+ * @brief 调用处理函数，把响应编码成STDOUT + END_REQUEST记录发出
+ */
+static Task runRequest(ConnPtr conn, UringRequest *req) {
+  ThreadState *t = conn->thread;
+  co_await t->server->dispatch()(req, t->ctx);
+
+  uint16_t id = req->id;
+  bool keep_conn = req->keep_conn && !req->abort_conn;
+  if (!conn->broken) {
+    fcgiAppendStream(&conn->wbuf, FCGI_TYPE_STDOUT, id, req->out.data(),
+                     req->out.size());
+    // 中断的请求没有结束记录，nginx把连接关闭视为响应不完整
+    if (!req->abort_conn) {
+      fcgiAppendRecord(&conn->wbuf, FCGI_TYPE_STDOUT, id, nullptr, 0);
+      fcgiAppendEndRequest(&conn->wbuf, id, 0, FCGI_STATUS_REQUEST_COMPLETE);
+    }
+  }
+  eraseRequest(conn.get(), id);
+  if (!keep_conn) {
+    conn->closing = true;
+  }
+  co_await flushConn(conn);
+}
+
+static int openSpool(const UringConfig &cfg, UringRequest *req) {
+  req->spool_path = cfg.spool_dir + "/fcgi_spool_XXXXXX";
+  req->spool_fd = mkstemp(req->spool_path.data());
+  if (req->spool_fd < 0) {
+    LOG_ERROR(URING_LOG_MODULE, URING_LOG_PROC, "mkstemp %s err: %s\n",
+              req->spool_path.c_str(), strerror(errno));
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * @brief 处理STDIN以外的记录，回复追加到conn->wbuf
+ *
+ * @return 0成功，-1协议错误需关闭连接
+ */
+static int handleRecord(UringConn *conn, const FcgiRecord &rec) {
+  const UringConfig &cfg = conn->thread->server->config();
+  auto it = conn->requests.find(rec.id);
+  UringRequest *req = it == conn->requests.end() ? nullptr : it->second.get();
+  const unsigned char *data = (const unsigned char *)rec.data;
+
+  switch (rec.type) {
+    case FCGI_TYPE_BEGIN_REQUEST: {
+      if (rec.len < 8 || rec.id == 0 || req != nullptr) {
+        return -1;
+      }
+      uint16_t role = (uint16_t)((data[0] << 8) | data[1]);
+      if (role != FCGI_ROLE_RESPONDER) {
+        fcgiAppendEndRequest(&conn->wbuf, rec.id, 0, FCGI_STATUS_UNKNOWN_ROLE);
+        break;
+      }
+      if (conn->thread->inflight >= cfg.max_requests) {
+        fcgiAppendEndRequest(&conn->wbuf, rec.id, 0, FCGI_STATUS_OVERLOADED);
+        break;
+      }
+      auto r = std::make_unique<UringRequest>();
+      r->id = rec.id;
+      r->keep_conn = (data[2] & FCGI_FLAG_KEEP_CONN) != 0;
+      conn->requests.emplace(rec.id, std::move(r));
+      conn->thread->inflight++;
+      break;
+    }
+    case FCGI_TYPE_ABORT_REQUEST:
+      if (req == nullptr) {
+        break;
+      }
+      if (req->started) {
+        req->aborted = true;  // 处理函数结束后照常回复END_REQUEST
+      } else {
+        eraseRequest(conn, rec.id);
+        fcgiAppendEndRequest(&conn->wbuf, rec.id, 0,
+                             FCGI_STATUS_REQUEST_COMPLETE);
+      }
+      break;
+    case FCGI_TYPE_PARAMS:
+      if (req == nullptr || req->started) {
+        break;
+      }
+      if (rec.len == 0) {
+        // 参数结束，名值对指向params_buf，之后不能再修改它
+        if (fcgiParseParams(req->params_buf.data(), req->params_buf.size(),
+                            &req->params) != 0) {
+          return -1;
+        }
+        // 准入检查不通过时直接回复，之后这个请求的STDIN记录都被丢弃
+        UringAdmit admit = conn->thread->server->admit();
+        if (admit != nullptr && !admit(req, conn->thread->ctx)) {
+          fcgiAppendStream(&conn->wbuf, FCGI_TYPE_STDOUT, rec.id,
+                           req->out.data(), req->out.size());
+          fcgiAppendRecord(&conn->wbuf, FCGI_TYPE_STDOUT, rec.id, nullptr, 0);
+          fcgiAppendEndRequest(&conn->wbuf, rec.id, 0,
+                               FCGI_STATUS_REQUEST_COMPLETE);
+          eraseRequest(conn, rec.id);
+        }
+        break;
+      }
+      if (!req->params.empty() ||
+          req->params_buf.size() + rec.len > PARAMS_MAX_LEN) {
+        return -1;
+      }
+      req->params_buf.append(rec.data, rec.len);
+      break;
+    case FCGI_TYPE_GET_VALUES: {
+      FcgiParams names;
+      if (fcgiParseParams(rec.data, rec.len, &names) != 0) {
+        return -1;
+      }
+      std::string max = std::to_string(cfg.max_requests * cfg.threads);
+      std::string body;
+      for (const auto &n : names) {
+        if (n.first == "FCGI_MAX_CONNS" || n.first == "FCGI_MAX_REQS") {
+          fcgiAppendParam(&body, n.first, max);
+        } else if (n.first == "FCGI_MPXS_CONNS") {
+          fcgiAppendParam(&body, n.first, "1");
+        }
+      }
+      fcgiAppendRecord(&conn->wbuf, FCGI_TYPE_GET_VALUES_RESULT, 0,
+                       body.data(), body.size());
+      break;
+    }
+    case FCGI_TYPE_DATA:
+      break;  // 只支持RESPONDER角色，忽略DATA
+    default:
+      if (rec.id == 0) {
+        char body[8] = {(char)rec.type};
+        fcgiAppendRecord(&conn->wbuf, FCGI_TYPE_UNKNOWN, 0, body,
+                         sizeof(body));
+      }
+      break;
+  }
+  return 0;
+}
+
+/**
+ * @brief 连接的读协程：解析记录，请求体收齐后启动处理协程
+ */
+static Task serveConn(ThreadState *t, int fd) {
+  ConnPtr conn = std::make_shared<UringConn>(fd, t);
+  const UringConfig &cfg = t->server->config();
+  std::string rbuf(READ_BUF_LEN, '\0');
+  size_t used = 0;
+  bool ok = true;
+
+  while (ok) {
+    int n = co_await uringRecv(fd, rbuf.data() + used, rbuf.size() - used);
+    if (n <= 0) {
+      break;
+    }
+    used += n;
+
+    size_t pos = 0;
+    while (ok) {
+      FcgiRecord rec;
+      long r = fcgiParseRecord(rbuf.data() + pos, used - pos, &rec);
+      if (r <= 0) {
+        ok = (r == 0);
+        break;
+      }
+      pos += r;
+
+      if (rec.type != FCGI_TYPE_STDIN) {
+        ok = handleRecord(conn.get(), rec) == 0;
+        continue;
+      }
+
+      auto it = conn->requests.find(rec.id);
+      if (it == conn->requests.end() || it->second->started) {
+        continue;
+      }
+      UringRequest *req = it->second.get();
+      if (rec.len == 0) {
+        // 请求体结束，交给处理协程，它运行到第一次挂起或结束才返回
+        req->started = true;
+        runRequest(conn, req).detach();
+      } else if (req->spool_fd < 0 &&
+                 req->body.size() + rec.len <= cfg.spool_threshold) {
+        req->body.append(rec.data, rec.len);
+        req->body_len += rec.len;
+      } else {
+        // 大请求体写入临时文件，写完再读下一条记录
+        int ret = 0;
+        if (req->spool_fd < 0) {
+          if (openSpool(cfg, req) != 0) {
+            ok = false;
+            break;
+          }
+          co_await uringWriteAll(req->spool_fd, req->body.data(),
+                                 req->body.size(), 0, &ret);
+          std::string().swap(req->body);
+        }
+        if (ret == 0) {
+          co_await uringWriteAll(req->spool_fd, rec.data, rec.len,
+                                 (off_t)req->body_len, &ret);
+        }
+        if (ret != 0) {
+          LOG_ERROR(URING_LOG_MODULE, URING_LOG_PROC, "spool write err: %s\n",
+                    strerror(-ret));
+          ok = false;
+          break;
+        }
+        req->body_len += rec.len;
+      }
+    }
+
+    if (!conn->wbuf.empty()) {
+      flushConn(conn).detach();
+    }
+
+    // 半条记录移到开头，放不下的大记录扩大缓冲区
+    memmove(rbuf.data(), rbuf.data() + pos, used - pos);
+    used -= pos;
+    if (used >= FCGI_HEADER_LEN) {
+      const unsigned char *h = (const unsigned char *)rbuf.data();
+      size_t need = FCGI_HEADER_LEN + ((h[4] << 8) | h[5]) + h[6];
+      if (need > rbuf.size()) {
+        rbuf.resize(need);
+      }
+    }
+  }
+
+  // 连接断开，丢弃还没开始处理的请求，正在处理的请求结束后释放连接
+  for (auto it = conn->requests.begin(); it != conn->requests.end();) {
+    if (it->second->started) {
+      ++it;
+    } else {
+      it = conn->requests.erase(it);
+      t->inflight--;
+    }
+  }
+  if (!conn->sending) {
+    conn->broken = true;
+    shutdown(fd, SHUT_RDWR);
+  }
+}
+
+static Task acceptLoop(ThreadState *t, int listen_fd) {
+  for (;;) {
+    int fd = co_await uringAccept(listen_fd);
+    if (fd < 0) {
+      if (fd == -EBADF || fd == -EINVAL || fd == -ENOTSOCK) {
+        LOG_ERROR(URING_LOG_MODULE, URING_LOG_PROC, "accept err: %s\n",
+                  strerror(-fd));
+        co_return;
+      }
+      if (fd == -EMFILE || fd == -ENFILE || fd == -ENOBUFS ||
+          fd == -ENOMEM) {
+        // fd耗尽时稍等再accept，避免空转
+        LOG_WARNING(URING_LOG_MODULE, URING_LOG_PROC, "accept err: %s\n",
+                    strerror(-fd));
+        co_await uringSleep(100);
+      }
+      continue;
+    }
+    // unix socket上会失败，忽略
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    serveConn(t, fd).detach();
+  }
+}
+
+UringServer::UringServer(const UringConfig &cfg, UringDispatch dispatch,
+                         UringThreadInit init, UringAdmit admit)
+    : cfg_(cfg), dispatch_(dispatch), init_(init), admit_(admit) {}
+
+void UringServer::threadMain(int listen_fd) {
+  ThreadState t;
+  t.server = this;
+  if (t.loop.init(cfg_.entries) != 0) {
+    return;
+  }
+  if (init_ != nullptr) {
+    t.ctx = init_();
+    if (t.ctx == nullptr) {
+      LOG_ERROR(URING_LOG_MODULE, URING_LOG_PROC, "thread init failed!\n");
+      return;
+    }
+  }
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    if (stopping_) {
+      return;
+    }
+    loops_.push_back(&t.loop);
+  }
+
+  acceptLoop(&t, listen_fd).detach();
+  t.loop.run();
+
+  std::lock_guard<std::mutex> lock(lock_);
+  for (size_t i = 0; i < loops_.size(); i++) {
+    if (loops_[i] == &t.loop) {
+      loops_.erase(loops_.begin() + i);
+      break;
+    }
+  }
+}
+
+/**
+ * @brief 启动cfg.threads个事件循环线程，共用listen_fd
+ *
+ * @return 0
+ */
+int UringServer::start(int listen_fd) {
+  LOG_INFO(URING_LOG_MODULE, URING_LOG_PROC,
+           "uring server start, threads = %d, entries = %u\n", cfg_.threads,
+           cfg_.entries);
+  for (int i = 0; i < cfg_.threads; i++) {
+    threads_.emplace_back([this, listen_fd] { threadMain(listen_fd); });
+  }
+  return 0;
+}
+
+// 退出时未结束的协程不再恢复，随进程退出释放
+void UringServer::stop() {
+  std::lock_guard<std::mutex> lock(lock_);
+  stopping_ = true;
+  for (UringLoop *loop : loops_) {
+    loop->stop();
+  }
+}
+
+void UringServer::wait() {
+  for (std::thread &th : threads_) {
+    th.join();
+  }
+  threads_.clear();
+}
+
+int uringListen(const char *host, int port) {
+  int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    return -1;
+  }
+  int one = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  if (inet_pton(AF_INET, host, &addr.sin_addr) != 1 ||
+      bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+      listen(fd, SOMAXCONN) != 0) {
+    LOG_ERROR(URING_LOG_MODULE, URING_LOG_PROC, "listen %s:%d err: %s\n", host,
+              port, strerror(errno));
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
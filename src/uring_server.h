@@ -0,0 +1,99 @@
+#ifndef URING_SERVER_H
+#define URING_SERVER_H
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "fcgi_proto.h"
+#include "uring_loop.h"
+
+/*
+   直接解析FastCGI记录协议的io_uring服务端：
+   每个线程一个事件循环，各自在同一个监听socket上accept，
+   连接的读写、请求体落盘都是异步的，一个线程可以同时挂着成千上万个请求。
+
+   支持同一连接上多路复用多个请求(FCGI_MPXS_CONNS)，
+   BEGIN_REQUEST带FCGI_KEEP_CONN时请求结束后保持连接(nginx: fastcgi_keep_conn on)。
+*/
+
+// 一个FastCGI请求
+struct UringRequest {
+  uint16_t id = 0;
+  bool keep_conn = false;   // 请求结束后保持连接
+  bool aborted = false;     // 收到ABORT_REQUEST
+  bool started = false;     // 已交给处理函数
+  bool abort_conn = false;  // 处理函数要求中断：发出已有的响应后关闭连接
+  std::string params_buf;   // PARAMS记录的原始内容
+  FcgiParams params;        // 名值对，指向params_buf
+  std::string body;         // 请求体(未落盘时)
+  int spool_fd = -1;        // 请求体超过阈值时写入的临时文件
+  std::string spool_path;   // 临时文件路径，请求结束后删除
+  size_t body_len = 0;      // 请求体总长度
+  std::string out;          // 响应(响应头 + body)，处理函数返回后发出
+  std::shared_ptr<void> hold;  // 准入时预留的资源，请求结束时释放
+
+  ~UringRequest();
+
+  // 取一个参数，不存在时返回空
+  std::string_view param(std::string_view name) const;
+};
+
+// 服务端配置
+struct UringConfig {
+  int threads = 4;                      // 事件循环线程数
+  unsigned entries = 256;               // 每个io_uring的SQ长度
+  size_t spool_threshold = 1 << 20;     // 请求体超过该长度时写入临时文件
+  std::string spool_dir = "/tmp";       // 临时文件目录
+  int max_requests = 4096;              // 每个线程同时处理的请求数上限
+  std::string host = "127.0.0.1";       // 自己监听时的地址
+  int port = 10011;                     // 自己监听时的端口
+};
+
+// 处理一个请求，把响应写入req->out，ctx为线程初始化函数的返回值
+typedef Task (*UringDispatch)(UringRequest *req, void *ctx);
+
+// 参数收齐、读请求体之前调用，返回false时以req->out回复并丢弃请求体
+typedef bool (*UringAdmit)(UringRequest *req, void *ctx);
+
+// 每个线程启动时调用一次，返回nullptr时该线程退出
+typedef void *(*UringThreadInit)();
+
+class UringServer {
+ public:
+  UringServer(const UringConfig &cfg, UringDispatch dispatch,
+              UringThreadInit init, UringAdmit admit = nullptr);
+
+  // 在listen_fd上启动所有线程，成功返回0
+  int start(int listen_fd);
+
+  // 通知所有线程退出
+  void stop();
+
+  // 等待所有线程退出
+  void wait();
+
+  const UringConfig &config() const { return cfg_; }
+  UringDispatch dispatch() const { return dispatch_; }
+  UringAdmit admit() const { return admit_; }
+
+ private:
+  void threadMain(int listen_fd);
+
+  UringConfig cfg_;
+  UringDispatch dispatch_;
+  UringThreadInit init_;
+  UringAdmit admit_;
+  std::vector<std::thread> threads_;
+  std::mutex lock_;
+  std::vector<UringLoop *> loops_;
+  bool stopping_ = false;
+};
+
+// 监听host:port，返回监听fd，失败返回-1
+int uringListen(const char *host, int port);
+
+#endif
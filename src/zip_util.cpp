@@ -0,0 +1,335 @@
+/**
+ * @file zip_util.cpp
+ * @brief 边生成边发送的ZIP64归档
+ * @author ward
+ * @version 1.0
+ * @date 2023年7月6日
+ */
+
+#include "zip_util.h"
+
+#include <cstring>
+#include <utility>
+
+#include "make_log.h"
+
+static const uint32_t ZIP_LOCAL_SIG = 0x04034b50;
+static const uint32_t ZIP_DESCRIPTOR_SIG = 0x08074b50;
+static const uint32_t ZIP_CENTRAL_SIG = 0x02014b50;
+static const uint32_t ZIP64_END_SIG = 0x06064b50;
+static const uint32_t ZIP64_LOCATOR_SIG = 0x07064b50;
+static const uint32_t ZIP_END_SIG = 0x06054b50;
+
+static const uint16_t ZIP_VERSION = 20;    // 2.0，deflate
+static const uint16_t ZIP64_VERSION = 45;  // 4.5，ZIP64
+static const uint16_t ZIP_MADE_BY_UNIX = 3 << 8;
+// bit 3: crc和大小在数据描述符中；bit 11: 文件名为UTF-8
+static const uint16_t ZIP_FLAGS = 0x0808;
+static const uint16_t ZIP_STORED = 0;
+static const uint16_t ZIP_DEFLATED = 8;
+static const uint32_t ZIP_MAX32 = 0xffffffff;
+static const uint16_t ZIP_MAX16 = 0xffff;
+
+// 输出缓冲区大小
+static const size_t ZIP_BUF_SIZE = 64 * 1024;
+
+static void put16(std::string *s, uint16_t v) {
+  s->push_back((char)(v & 0xff));
+  s->push_back((char)(v >> 8));
+}
+
+static void put32(std::string *s, uint32_t v) {
+  put16(s, (uint16_t)(v & 0xffff));
+  put16(s, (uint16_t)(v >> 16));
+}
+
+static void put64(std::string *s, uint64_t v) {
+  put32(s, (uint32_t)(v & 0xffffffff));
+  put32(s, (uint32_t)(v >> 32));
+}
+
+// 本地文件头，crc和大小在数据描述符中
+// ZIP64的文件大小字段为0xffffffff，并带大小为0的ZIP64扩展字段，
+// 解压程序据此按8字节读数据描述符中的大小
+static std::string localHeader(const ZipEntry &e) {
+  std::string s;
+  put32(&s, ZIP_LOCAL_SIG);
+  put16(&s, e.zip64 ? ZIP64_VERSION : ZIP_VERSION);
+  put16(&s, ZIP_FLAGS);
+  put16(&s, e.method);
+  put16(&s, e.time);
+  put16(&s, e.date);
+  put32(&s, 0);  // crc
+  put32(&s, e.zip64 ? ZIP_MAX32 : 0);  // 压缩后大小
+  put32(&s, e.zip64 ? ZIP_MAX32 : 0);  // 原始大小
+  put16(&s, (uint16_t)e.name.size());
+  put16(&s, e.zip64 ? 20 : 0);  // 扩展字段长度
+  s += e.name;
+  if (e.zip64) {
+    put16(&s, 0x0001);  // ZIP64扩展字段
+    put16(&s, 16);
+    put64(&s, 0);  // 原始大小
+    put64(&s, 0);  // 压缩后大小
+  }
+  return s;
+}
+
+// 大小超过4G的文件，中央目录中的大小为8字节
+static bool sizes64(const ZipEntry &e) {
+  return e.usize >= ZIP_MAX32 || e.csize >= ZIP_MAX32;
+}
+
+// 预期大小为size的文件是否按ZIP64写，deflate按压缩后可能的最大长度算
+static bool needZip64(uint64_t size, bool deflate) {
+  return size >= ZIP_MAX32 ||
+         (deflate && compressBound((uLong)size) >= ZIP_MAX32);
+}
+
+static std::string descriptor(const ZipEntry &e) {
+  std::string s;
+  put32(&s, ZIP_DESCRIPTOR_SIG);
+  put32(&s, e.crc);
+  if (e.zip64) {
+    put64(&s, e.csize);
+    put64(&s, e.usize);
+  } else {
+    put32(&s, (uint32_t)e.csize);
+    put32(&s, (uint32_t)e.usize);
+  }
+  return s;
+}
+
+static std::string centralHeader(const ZipEntry &e) {
+  bool big_sizes = sizes64(e);
+  bool big_offset = e.offset >= ZIP_MAX32;
+  std::string extra;
+  if (big_sizes || big_offset) {
+    std::string fields;
+    if (big_sizes) {
+      put64(&fields, e.usize);
+      put64(&fields, e.csize);
+    }
+    if (big_offset) {
+      put64(&fields, e.offset);
+    }
+    put16(&extra, 0x0001);  // ZIP64扩展字段
+    put16(&extra, (uint16_t)fields.size());
+    extra += fields;
+  }
+
+  std::string s;
+  uint16_t version = extra.empty() ? ZIP_VERSION : ZIP64_VERSION;
+  put32(&s, ZIP_CENTRAL_SIG);
+  put16(&s, ZIP_MADE_BY_UNIX | version);
+  put16(&s, version);
+  put16(&s, ZIP_FLAGS);
+  put16(&s, e.method);
+  put16(&s, e.time);
+  put16(&s, e.date);
+  put32(&s, e.crc);
+  put32(&s, big_sizes ? ZIP_MAX32 : (uint32_t)e.csize);
+  put32(&s, big_sizes ? ZIP_MAX32 : (uint32_t)e.usize);
+  put16(&s, (uint16_t)e.name.size());
+  put16(&s, (uint16_t)extra.size());
+  put16(&s, 0);  // 注释长度
+  put16(&s, 0);  // 磁盘号
+  put16(&s, 0);  // 内部属性
+  put32(&s, 0100644 << 16);  // 外部属性：普通文件，rw-r--r--
+  put32(&s, big_offset ? ZIP_MAX32 : (uint32_t)e.offset);
+  s += e.name;
+  s += extra;
+  return s;
+}
+
+// 中央目录之后的结束记录，需要时先写ZIP64结束记录和定位器
+static std::string endRecords(uint64_t count, uint64_t cd_offset,
+                              uint64_t cd_size) {
+  std::string s;
+  bool zip64 = count >= ZIP_MAX16 || cd_offset >= ZIP_MAX32 ||
+               cd_size >= ZIP_MAX32;
+  if (zip64) {
+    uint64_t end64_offset = cd_offset + cd_size;
+    put32(&s, ZIP64_END_SIG);
+    put64(&s, 44);  // 之后的记录长度
+    put16(&s, ZIP_MADE_BY_UNIX | ZIP64_VERSION);
+    put16(&s, ZIP64_VERSION);
+    put32(&s, 0);  // 磁盘号
+    put32(&s, 0);  // 中央目录所在磁盘
+    put64(&s, count);
+    put64(&s, count);
+    put64(&s, cd_size);
+    put64(&s, cd_offset);
+
+    put32(&s, ZIP64_LOCATOR_SIG);
+    put32(&s, 0);
+    put64(&s, end64_offset);
+    put32(&s, 1);  // 磁盘总数
+  }
+  put32(&s, ZIP_END_SIG);
+  put16(&s, 0);
+  put16(&s, 0);
+  put16(&s, count >= ZIP_MAX16 ? ZIP_MAX16 : (uint16_t)count);
+  put16(&s, count >= ZIP_MAX16 ? ZIP_MAX16 : (uint16_t)count);
+  put32(&s, cd_size >= ZIP_MAX32 ? ZIP_MAX32 : (uint32_t)cd_size);
+  put32(&s, cd_offset >= ZIP_MAX32 ? ZIP_MAX32 : (uint32_t)cd_offset);
+  put16(&s, 0);  // 注释长度
+  return s;
+}
+
+// DOS格式的日期时间，早于1980年的按1980-01-01
+static void dosTime(time_t t, uint16_t *dos_time, uint16_t *dos_date) {
+  struct tm tm;
+  localtime_r(&t, &tm);
+  if (tm.tm_year < 80) {
+    *dos_time = 0;
+    *dos_date = (1 << 5) | 1;
+    return;
+  }
+  *dos_time = (uint16_t)((tm.tm_hour << 11) | (tm.tm_min << 5) |
+                         (tm.tm_sec / 2));
+  *dos_date = (uint16_t)(((tm.tm_year - 80) << 9) | ((tm.tm_mon + 1) << 5) |
+                         tm.tm_mday);
+}
+
+ZipWriter::ZipWriter(DataSink out, int level)
+    : out_(std::move(out)), level_(level), zbuf_(ZIP_BUF_SIZE) {
+  memset(&zs_, 0, sizeof(zs_));
+}
+
+ZipWriter::~ZipWriter() {
+  if (deflate_init_) {
+    deflateEnd(&zs_);
+  }
+}
+
+int ZipWriter::emit(const char *data, size_t len) {
+  if (failed_) {
+    return -1;
+  }
+  if (len > 0 && out_(data, len) != 0) {
+    failed_ = true;
+    return -1;
+  }
+  offset_ += len;
+  return 0;
+}
+
+int ZipWriter::begin(const std::string &name, bool deflate, uint64_t size,
+                     time_t mtime) {
+  if (failed_ || open_ || name.empty() || name.size() >= ZIP_MAX16) {
+    return -1;
+  }
+  cur_ = ZipEntry();
+  cur_.name = name;
+  cur_.crc = (uint32_t)crc32(0, Z_NULL, 0);
+  cur_.offset = offset_;
+  cur_.method = deflate ? ZIP_DEFLATED : ZIP_STORED;
+  cur_.zip64 = needZip64(size, deflate);
+  dosTime(mtime, &cur_.time, &cur_.date);
+  expected_ = size;
+
+  if (deflate) {
+    int ret = deflate_init_ ? deflateReset(&zs_)
+                            : deflateInit2(&zs_, level_, Z_DEFLATED, -MAX_WBITS,
+                                           8, Z_DEFAULT_STRATEGY);
+    if (ret != Z_OK) {
+      LOG_ERROR(ZIP_LOG_MODULE, ZIP_LOG_PROC, "deflate init err: %d\n", ret);
+      failed_ = true;
+      return -1;
+    }
+    deflate_init_ = true;
+  }
+  if (emit(localHeader(cur_)) != 0) {
+    return -1;
+  }
+  open_ = true;
+  return 0;
+}
+
+// 压缩并输出，flush为Z_FINISH时输出压缩流的结尾
+int ZipWriter::deflateOut(const char *data, size_t len, int flush) {
+  zs_.next_in = (Bytef *)data;
+  zs_.avail_in = (uInt)len;
+  while (true) {
+    zs_.next_out = (Bytef *)zbuf_.data();
+    zs_.avail_out = (uInt)zbuf_.size();
+    int ret = deflate(&zs_, flush);
+    if (ret == Z_STREAM_ERROR) {
+      failed_ = true;
+      return -1;
+    }
+    size_t n = zbuf_.size() - zs_.avail_out;
+    if (emit(zbuf_.data(), n) != 0) {
+      return -1;
+    }
+    cur_.csize += n;
+    if (flush == Z_FINISH ? ret == Z_STREAM_END : zs_.avail_out != 0) {
+      return 0;
+    }
+  }
+}
+
+int ZipWriter::write(const char *data, size_t len) {
+  if (failed_ || !open_) {
+    return -1;
+  }
+  cur_.crc = (uint32_t)crc32(cur_.crc, (const Bytef *)data, (uInt)len);
+  cur_.usize += len;
+  if (cur_.method == ZIP_DEFLATED) {
+    return deflateOut(data, len, Z_NO_FLUSH);
+  }
+  cur_.csize += len;
+  return emit(data, len);
+}
+
+int ZipWriter::end() {
+  if (failed_ || !open_) {
+    return -1;
+  }
+  open_ = false;
+  if (cur_.method == ZIP_DEFLATED && deflateOut(nullptr, 0, Z_FINISH) != 0) {
+    return -1;
+  }
+  if (cur_.usize != expected_) {
+    LOG_ERROR(ZIP_LOG_MODULE, ZIP_LOG_PROC,
+              "%s: wrote %llu bytes, expected %llu\n", cur_.name.c_str(),
+              (unsigned long long)cur_.usize,
+              (unsigned long long)expected_);
+    failed_ = true;
+    return -1;
+  }
+  if (emit(descriptor(cur_)) != 0) {
+    return -1;
+  }
+  entries_.push_back(std::move(cur_));
+  return 0;
+}
+
+int ZipWriter::finish() {
+  if (failed_ || open_) {
+    return -1;
+  }
+  uint64_t cd_offset = offset_;
+  for (const ZipEntry &e : entries_) {
+    if (emit(centralHeader(e)) != 0) {
+      return -1;
+    }
+  }
+  return emit(endRecords(entries_.size(), cd_offset, offset_ - cd_offset));
+}
+
+uint64_t ZipWriter::storedSize(const std::vector<ZipStoredEntry> &entries) {
+  // 与实际写出时相同的头部，只是不输出
+  ZipEntry e;
+  e.method = ZIP_STORED;
+  uint64_t offset = 0, cd_size = 0;
+  for (const ZipStoredEntry &entry : entries) {
+    e.name = entry.name;
+    e.usize = e.csize = entry.size;
+    e.zip64 = needZip64(entry.size, false);
+    e.offset = offset;
+    offset += localHeader(e).size() + entry.size + descriptor(e).size();
+    cd_size += centralHeader(e).size();
+  }
+  return offset + cd_size + endRecords(entries.size(), offset, cd_size).size();
+}
@@ -0,0 +1,106 @@
+#ifndef ZIP_UTIL_H
+#define ZIP_UTIL_H
+
+#include <zlib.h>
+
+#include <cstdint>
+#include <ctime>
+#include <string>
+#include <vector>
+
+#include "backend_util.h"
+
+/*
+   边生成边发送的zip归档(APPNOTE 6.3)，不落临时文件，内存占用与文件大小无关：
+   - 每个文件先写本地文件头(bit 3，crc和大小为0)，再写内容，
+     内容写完后在数据描述符中给出crc32和大小；文件名为UTF-8(bit 11)
+   - 内容原样存储(stored)或用deflate压缩
+   - 文件或偏移超过4G、文件超过65535个时按ZIP64写：超过4G的文件本地文件头
+     带大小为0的ZIP64扩展字段、数据描述符用8字节大小，
+     中央目录带ZIP64扩展字段，结尾加ZIP64中央目录结束记录和定位器
+   中央目录每个文件只记几十字节，其余状态是固定大小的缓冲区。
+
+   ZipWriter zip(sink);
+   zip.begin("a.txt", true, size, mtime);
+   zip.write(data, len);  // 可以多次
+   zip.end();
+   zip.finish();
+*/
+
+const char *const ZIP_LOG_MODULE = "cgi";
+const char *const ZIP_LOG_PROC = "zip";
+
+// 只存储的文件，用于预先计算归档长度
+struct ZipStoredEntry {
+  std::string name;
+  uint64_t size;
+};
+
+// 中央目录中记录的一个文件
+struct ZipEntry {
+  std::string name;
+  uint32_t crc = 0;
+  uint64_t csize = 0;   // 压缩后大小
+  uint64_t usize = 0;   // 原始大小
+  uint64_t offset = 0;  // 本地文件头在归档中的位置
+  uint16_t method = 0;
+  uint16_t time = 0;
+  uint16_t date = 0;
+  bool zip64 = false;   // begin时按预期大小决定，本地文件头和数据描述符一致
+};
+
+class ZipWriter {
+ public:
+  // out接收归档的字节流，返回非0时后续写入都失败
+  explicit ZipWriter(DataSink out, int level = Z_DEFAULT_COMPRESSION);
+  ~ZipWriter();
+  ZipWriter(const ZipWriter &) = delete;
+  ZipWriter &operator=(const ZipWriter &) = delete;
+
+  /**
+   * @brief 开始一个文件
+   *
+   * @param name    归档中的文件名
+   * @param deflate 是否用deflate压缩
+   * @param size    文件大小，end()时检查写入的长度与它一致
+   * @param mtime   修改时间
+   *
+   * @return 0成功，-1失败
+   */
+  int begin(const std::string &name, bool deflate, uint64_t size,
+            time_t mtime);
+
+  // 写入当前文件的一段内容，0成功，-1失败
+  int write(const char *data, size_t len);
+
+  // 结束当前文件，写数据描述符，0成功，-1失败(包括长度与begin的size不一致)
+  int end();
+
+  // 写中央目录，结束归档，0成功，-1失败
+  int finish();
+
+  // 已输出的字节数
+  uint64_t written() const { return offset_; }
+
+  // 全部只存储时归档的总长度，可以作为Content-Length
+  static uint64_t storedSize(const std::vector<ZipStoredEntry> &entries);
+
+ private:
+  int emit(const char *data, size_t len);
+  int emit(const std::string &data) { return emit(data.data(), data.size()); }
+  int deflateOut(const char *data, size_t len, int flush);
+
+  DataSink out_;
+  int level_;
+  bool failed_ = false;
+  bool open_ = false;         // 是否有文件还没有end()
+  bool deflate_init_ = false;
+  z_stream zs_;
+  std::vector<char> zbuf_;
+  uint64_t offset_ = 0;
+  uint64_t expected_ = 0;
+  ZipEntry cur_;
+  std::vector<ZipEntry> entries_;
+};
+
+#endif
@@ -0,0 +1,111 @@
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <string>
+
+#include "admission_util.h"
+
+static int failed = 0;
+
+static void check(const char *name, bool ok) {
+  printf("%-40s %s\n", name, ok ? "OK" : "WRONG");
+  if (!ok) failed++;
+}
+
+static std::string shmName(const char *tag) {
+  return "/filehub_inflight_test_" + std::to_string(getpid()) + tag;
+}
+
+//==================== 在途字节 ====================
+
+static void testBudget() {
+  std::string name = shmName("_budget");
+  InflightBudget budget;
+  check("open budget", budget.open(name.c_str(), 1000) == 0);
+  check("acquire within limit", budget.acquire(600) && budget.acquire(400));
+  check("acquire over limit", !budget.acquire(1));
+  budget.release(400);
+  check("acquire after release", budget.acquire(300) && budget.used() == 900);
+
+  // 另一个进程打开同一块共享内存，看到同样的总数
+  pid_t pid = fork();
+  if (pid == 0) {
+    InflightBudget other;
+    other.open(name.c_str(), 1000);
+    bool ok = other.used() == 900 && other.acquire(100) && !other.acquire(1);
+    _exit(ok ? 0 : 1);  // 退出时不归还，留给回收
+  }
+  int status = 0;
+  waitpid(pid, &status, 0);
+  check("shared across processes", WIFEXITED(status) &&
+                                       WEXITSTATUS(status) == 0);
+
+  // 已退出进程预留的100字节在额度不够时被回收
+  check("reclaim exited process", budget.acquire(100) &&
+                                      budget.used() == 1000);
+  budget.release(600);
+  budget.release(300);
+  budget.release(100);
+  check("all released", budget.used() == 0);
+  shm_unlink(name.c_str());
+}
+
+//==================== 准入检查 ====================
+
+static void testCheck() {
+  AdmissionConfig cfg;
+  cfg.max_body = 1000;
+  cfg.inflight_bytes = 1500;
+  cfg.staging_dir = "";
+  cfg.shm_name = shmName("_check");
+  check("init", admissionInit(cfg) == 0);
+  check("applies to upload", admissionApplies("/upload") &&
+                                 admissionApplies("/delta"));
+  check("not applies to login", !admissionApplies("/login"));
+
+  check("parse length", admissionLength("1234") == 1234);
+  check("missing length", admissionLength("") == -1 &&
+                              admissionLength("12a") == -1);
+
+  long r1 = 0, r2 = 0, r3 = 0;
+  check("no length", admissionCheck(-1, "", "", nullptr, &r1) ==
+                         ADMIT_NO_LENGTH);
+  check("too large", admissionCheck(1001, "", "", nullptr, &r1) ==
+                         ADMIT_TOO_LARGE);
+  // 带了token但没有redis，验证失败
+  check("bad token", admissionCheck(10, "alice", "t", nullptr, &r1) ==
+                         ADMIT_BAD_TOKEN);
+  check("admit first", admissionCheck(900, "", "", nullptr, &r1) ==
+                           ADMIT_OK && r1 == 900);
+  check("defer when busy", admissionCheck(900, "", "", nullptr, &r2) ==
+                               ADMIT_BUSY && r2 == 0);
+  check("empty body admitted", admissionCheck(0, "", "", nullptr, &r3) ==
+                                   ADMIT_OK && r3 == 0);
+  admissionRelease(r1);
+  check("admit after release", admissionCheck(900, "", "", nullptr, &r2) ==
+                                   ADMIT_OK);
+  admissionRelease(r2);
+
+  std::string out;
+  appendAdmitReject(&out, ADMIT_BUSY);
+  check("busy response", out.find("503") != std::string::npos &&
+                             out.find("Retry-After") != std::string::npos);
+  out.clear();
+  appendAdmitReject(&out, ADMIT_BAD_TOKEN);
+  check("token response", out.find("\"111\"") != std::string::npos);
+
+  cfg.require_token = true;
+  admissionInit(cfg);
+  check("require token", admissionCheck(10, "", "", nullptr, &r1) ==
+                             ADMIT_BAD_TOKEN);
+  shm_unlink(cfg.shm_name.c_str());
+}
+
+int main() {
+  testBudget();
+  testCheck();
+  printf(failed == 0 ? "ALL OK\n" : "%d FAILED\n", failed);
+  return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,3 @@
+#!/bin/bash
+g++ -std=c++17 -I ../../src admission_test.cpp ../../src/admission_util.cpp ../../src/response_util.cpp ../../src/query_util.cpp ../../src/cgi_util.cpp ../../src/str_scan.cpp ../../src/mysql_util.cpp ../../src/metrics_util.cpp ../../src/make_log.cpp -o admission_test -lmysqlclient -lredis++ -lfcgi -lpthread -lrt
+./admission_test
@@ -0,0 +1,164 @@
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "cache_util.h"
+
+static int failed = 0;
+
+static void check(const char *name, bool ok) {
+  printf("%-40s %s\n", name, ok ? "OK" : "WRONG");
+  if (!ok) failed++;
+}
+
+static const char *const DIR = "cache_test_dir";
+
+// md5("hello")、md5("world")、md5("abcdefgh")
+static const char *const MD5_HELLO = "5d41402abc4b2a76b9719d911017c592";
+static const char *const MD5_WORLD = "7d793037a0760186574b0282f2f435e7";
+static const char *const MD5_ABCD = "e8dc4081b13434b45189a720b77b6818";
+
+static std::atomic<int> fetches{0};
+
+// 写入content的fetch，记下调用次数
+static CacheFetch writer(const std::string &content, int delay_ms = 0) {
+  return [content, delay_ms](const char *path) {
+    fetches++;
+    if (delay_ms > 0) usleep(delay_ms * 1000);
+    std::ofstream out(path, std::ios::binary);
+    out << content;
+    return out ? 0 : -1;
+  };
+}
+
+static std::string readFile(const std::string &path) {
+  std::ifstream in(path, std::ios::binary);
+  std::stringstream ss;
+  ss << in.rdbuf();
+  return ss.str();
+}
+
+static bool exists(const std::string &path) {
+  struct stat st;
+  return stat(path.c_str(), &st) == 0;
+}
+
+static void clearDir() {
+  system((std::string("rm -rf ") + DIR).c_str());
+}
+
+int main() {
+  clearDir();
+  std::string path;
+
+  CacheConfig off;
+  check("disabled init", cacheInit(off) == 0 && !cacheEnabled());
+  check("disabled bypass", cacheGet("g/a", 5, MD5_HELLO, writer("hello"),
+                                    &path) == CACHE_BYPASS &&
+                               fetches == 0);
+
+  shm_unlink("/filehub_cache_sketch_1024");
+  shm_unlink("/filehub_cache_index");
+  CacheConfig cfg;
+  cfg.dir = DIR;
+  cfg.max_bytes = 12;
+  cfg.max_object_bytes = 8;
+  cfg.sketch_width = 1024;
+  check("init", cacheInit(cfg) == 0 && cacheEnabled());
+  check("name", cacheName("group1/M00/00/00/a.txt") == "group1_M00_00_00_a.txt");
+
+  // 第一次访问不接纳，第二次取入，之后命中不再取
+  check("first access bypass",
+        cacheGet("g/hello", 5, MD5_HELLO, writer("hello"), &path) ==
+                CACHE_BYPASS &&
+            fetches == 0);
+  check("second access fills",
+        cacheGet("g/hello", 5, MD5_HELLO, writer("hello"), &path) ==
+                CACHE_HIT &&
+            fetches == 1 && path == std::string(DIR) + "/g_hello" &&
+            readFile(path) == "hello");
+  check("hit", cacheGet("g/hello", 5, MD5_HELLO, writer("hello"), &path) ==
+                       CACHE_HIT &&
+                   fetches == 1);
+  check("frequency", cacheFrequency("g/hello") == 3);
+
+  // md5不一致的内容不进缓存
+  cacheGet("g/bad", 5, MD5_WORLD, writer("hello"), &path);
+  check("md5 mismatch", cacheGet("g/bad", 5, MD5_WORLD, writer("hello"),
+                                 &path) == CACHE_ERROR &&
+                            !exists(std::string(DIR) + "/g_bad"));
+  check("fetch failed",
+        cacheGet("g/bad", 5, MD5_WORLD,
+                 [](const char *) { return -1; }, &path) == CACHE_ERROR);
+  check("too large", cacheGet("g/large", 9, MD5_HELLO, writer("123456789"),
+                              &path) == CACHE_BYPASS);
+
+  // 大小不对的缓存文件删除后重新取
+  { std::ofstream(std::string(DIR) + "/g_hello") << "hell"; }
+  fetches = 0;
+  check("bad entry refetched",
+        cacheGet("g/hello", 5, MD5_HELLO, writer("hello"), &path) ==
+                CACHE_HIT &&
+            fetches == 1 && readFile(path) == "hello");
+
+  // 已用5字节，再放8字节需要淘汰hello(访问4次)，
+  // 没有hello热的文件不接纳，更热后淘汰hello
+  for (int i = 0; i < 3; i++) {
+    cacheGet("g/abcd", 8, MD5_ABCD, writer("abcdefgh"), &path);
+  }
+  check("tinylfu rejects colder",
+        cacheGet("g/abcd", 8, MD5_ABCD, writer("abcdefgh"), &path) ==
+                CACHE_BYPASS &&
+            exists(std::string(DIR) + "/g_hello"));
+  check("tinylfu admits hotter",
+        cacheGet("g/abcd", 8, MD5_ABCD, writer("abcdefgh"), &path) ==
+                CACHE_HIT &&
+            readFile(path) == "abcdefgh" &&
+            !exists(std::string(DIR) + "/g_hello"));
+
+  // 并发未命中只取一次
+  cacheGet("g/world", 5, MD5_WORLD, writer("world"), &path);
+  for (int i = 0; i < 5; i++) {
+    cacheGet("g/world", 5, MD5_WORLD, [](const char *) { return -1; },
+             &path);
+  }
+  fetches = 0;
+  std::atomic<int> hits{0};
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 8; i++) {
+    threads.emplace_back([&hits] {
+      std::string p;
+      if (cacheGet("g/world", 5, MD5_WORLD, writer("world", 100), &p) ==
+              CACHE_HIT &&
+          readFile(p) == "world") {
+        hits++;
+      }
+    });
+  }
+  for (std::thread &t : threads) t.join();
+  check("coalesced misses", fetches == 1 && hits == 8);
+  check("no lock left", !exists(std::string(DIR) + "/g_world.lock"));
+
+  // 已用字节数在共享内存的索引中：abcd淘汰后只用了5字节，hello不需要淘汰world；
+  // 重新初始化时索引已是这个目录的，不再扫描
+  check("reinit", cacheInit(cfg) == 0);
+  check("admit without eviction",
+        cacheGet("g/hello", 5, MD5_HELLO, writer("hello"), &path) ==
+                CACHE_HIT &&
+            exists(std::string(DIR) + "/g_world") &&
+            !exists(std::string(DIR) + "/g_abcd"));
+
+  clearDir();
+  shm_unlink("/filehub_cache_sketch_1024");
+  shm_unlink("/filehub_cache_index");
+  printf(failed == 0 ? "ALL OK\n" : "%d FAILED\n", failed);
+  return failed == 0 ? 0 : 1;
+}
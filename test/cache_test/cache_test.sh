@@ -0,0 +1,3 @@
+#!/bin/bash
+g++ -std=c++17 -I ../../src cache_test.cpp ../../src/cache_util.cpp ../../src/delta_util.cpp ../../src/cgi_util.cpp ../../src/str_scan.cpp ../../src/mysql_util.cpp ../../src/make_log.cpp -o cache_test -lfastcommon -lmysqlclient -lfcgi -lpthread -lrt
+./cache_test
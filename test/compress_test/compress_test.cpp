@@ -0,0 +1,74 @@
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+
+#include "compress_util.h"
+
+using namespace std;
+
+static string readFile(const char *path) {
+  ifstream ifs(path, ios::binary);
+  return string(istreambuf_iterator<char>(ifs), istreambuf_iterator<char>());
+}
+
+int main() {
+  CompressConfig cfg;
+  cfg.enable = true;
+  cfg.level = 3;
+  cfg.types = "txt,log,csv,json";
+
+  // 1MB重复的日志文本
+  string text;
+  while (text.size() < 1024 * 1024) {
+    text += "2023-06-10 12:00:00 [INFO] upload user=mike size=10240 ok\n";
+  }
+
+  printf("shouldCompress log: %d\n",
+         shouldCompress(&cfg, "log", text.data(), text.size()));
+  printf("shouldCompress png: %d\n",
+         shouldCompress(&cfg, "png", text.data(), text.size()));
+  printf("shouldCompress jpg named txt: %d\n",
+         shouldCompress(&cfg, "txt", "\xff\xd8\xff\xe0", 4));
+
+  const char *codec = nullptr;
+  if (compressBufferToFile(&cfg, text.data(), text.size(), "test.log",
+                           &codec) != 0 ||
+      decompressFile("test.log", "test.out") != 0) {
+    printf("compress failed\n");
+    return 1;
+  }
+  size_t stored = readFile("test.log").size();
+  bool same = readFile("test.out") == text;
+  printf("%zu -> %zu (%s), %s\n", text.size(), stored, codec,
+         same ? "OK" : "MISMATCH");
+
+  // 已落盘的文件(差量重建的新文件)压缩后替换原文件
+  ofstream("test.txt", ios::binary) << text;
+  const char *file_codec = nullptr;
+  bool file_same = compressLocalFile(&cfg, "txt", "test.txt", &file_codec) == 0 &&
+                   decompressFile("test.txt", "test.out") == 0 &&
+                   readFile("test.out") == text;
+  printf("compress local file: %s (%s)\n", file_same ? "OK" : "MISMATCH",
+         file_codec);
+  ofstream("test.png", ios::binary) << text;
+  const char *png_codec = nullptr;
+  bool png_kept = compressLocalFile(&cfg, "png", "test.png", &png_codec) == 0 &&
+                  readFile("test.png") == text;
+  printf("compress local png: %s (%s)\n", png_kept ? "kept" : "CHANGED",
+         png_codec);
+
+  printf("accepts zstd: %d %d %d\n", acceptsEncoding("gzip, zstd", "zstd"),
+         acceptsEncoding("gzip, zstd;q=0", "zstd"),
+         acceptsEncoding("gzip, br", "zstd"));
+
+  remove("test.log");
+  remove("test.txt");
+  remove("test.png");
+  remove("test.out");
+  return same && strcmp(codec, CODEC_ZSTD) == 0 && file_same &&
+                 strcmp(file_codec, CODEC_ZSTD) == 0 && png_kept &&
+                 strcmp(png_codec, CODEC_NONE) == 0
+             ? 0
+             : 1;
+}
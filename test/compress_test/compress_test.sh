@@ -0,0 +1,3 @@
+#!/bin/bash
+g++ -std=c++17 -I ../../src compress_test.cpp ../../src/compress_util.cpp ../../src/cgi_util.cpp ../../src/str_scan.cpp ../../src/mysql_util.cpp ../../src/metrics_util.cpp ../../src/make_log.cpp -o compress_test -lzstd -lmysqlclient -lredis++ -lfcgi
+./compress_test
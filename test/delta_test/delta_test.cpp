@@ -0,0 +1,83 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "delta_util.h"
+
+using namespace std;
+
+static void writeFile(const char *path, const string &data) {
+  ofstream ofs(path, ios::binary | ios::trunc);
+  ofs.write(data.data(), data.size());
+}
+
+static string readFile(const char *path) {
+  ifstream ifs(path, ios::binary);
+  return string(istreambuf_iterator<char>(ifs), istreambuf_iterator<char>());
+}
+
+int main() {
+  // 滚动校验和与直接计算一致
+  string s = "0123456789abcdefghijklmnopqrstuvwxyz";
+  const unsigned char *u = (const unsigned char *)s.data();
+  uint32_t sum = weakChecksum(u, 8);
+  for (size_t i = 0; i + 8 < s.size(); i++) {
+    sum = rollWeakChecksum(sum, 8, u[i], u[i + 8]);
+    if (sum != weakChecksum(u + i + 1, 8)) {
+      printf("rollWeakChecksum mismatch at %zu\n", i);
+      return 1;
+    }
+  }
+
+  // 旧版本1MB随机数据，新版本在中间插入和修改少量字节
+  mt19937 gen(42);
+  string base(1024 * 1024, '\0');
+  for (char &c : base) c = (char)(gen() & 0xff);
+  string modified = base;
+  modified.insert(300000, "inserted bytes");
+  modified[700000] ^= 0x5a;
+  modified.erase(900000, 100);
+  writeFile("base.bin", base);
+  writeFile("new.bin", modified);
+
+  int bs = chooseBlockSize(base.size());
+  vector<BlockSignature> sigs;
+  string delta;
+  long size = 0;
+  if (computeSignatures("base.bin", bs, sigs) != 0 ||
+      generateDelta(sigs, bs, "new.bin", delta) != 0 ||
+      applyDelta("base.bin", bs, delta.data(), delta.size(), "out.bin",
+                 &size) != 0) {
+    printf("delta failed\n");
+    return 1;
+  }
+
+  bool same = readFile("out.bin") == modified;
+  // 不重建也能算出新文件大小，用于预留配额
+  long predicted = deltaOutputSize(base.size(), bs, delta.data(), delta.size());
+  string bad_copy = delta + "C" + string("\x7f\xff\xff\xff", 4);
+  if (predicted != size || (long)modified.size() != size ||
+      deltaOutputSize(base.size(), bs, bad_copy.data(), bad_copy.size()) !=
+          -1 ||
+      deltaOutputSize(base.size(), bs, delta.data(), delta.size() - 1) !=
+          -1) {
+    printf("deltaOutputSize %ld, expected %ld\n", predicted, size);
+    same = false;
+  }
+  printf("blocksize = %d, blocks = %zu, file = %zu, delta = %zu, %s\n", bs,
+         sigs.size(), modified.size(), delta.size(), same ? "OK" : "MISMATCH");
+
+  char md5_a[33], md5_b[33];
+  md5File("new.bin", md5_a);
+  md5File("out.bin", md5_b);
+  printf("md5: %s %s\n", md5_a, md5_b);
+
+  remove("base.bin");
+  remove("new.bin");
+  remove("out.bin");
+  return same && strcmp(md5_a, md5_b) == 0 ? 0 : 1;
+}
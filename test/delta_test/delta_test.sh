@@ -0,0 +1,3 @@
+#!/bin/bash
+g++ -std=c++17 -I ../../src delta_test.cpp ../../src/delta_util.cpp ../../src/make_log.cpp -o delta_test -lfastcommon
+./delta_test
@@ -0,0 +1,691 @@
+/**
+ * @file fcgi_bench.cpp
+ * @brief 直接按FastCGI协议压测cgi进程(不经过nginx)
+ *
+ * 按固定速率(开环)发送混合请求，每个请求的延迟从它的计划发送时刻算起，
+ * 服务端变慢时不会少发请求，排队的时间也计入延迟(没有coordinated omission)。
+ *
+ *   ./fcgi_bench -a 127.0.0.1 -p 10010 -r 200 -d 10 -u bench -w bench \
+ *       -m login=5,count=20,list=40,md5hit=10,md5miss=10,upload=15 \
+ *       -s 4k=70,256k=25,8m=5 -j result.json
+ *
+ * 请求种类：
+ *   login    /login                   用户名密码登录
+ *   count    /myfiles?cmd=count       文件个数
+ *   list     /myfiles?cmd=normal      文件列表的一页(-l条)
+ *   md5hit   /md5                     秒传命中(开始前先上传一个文件)
+ *   md5miss  /md5                     秒传未命中(随机md5)
+ *   upload   /upload                  上传，大小按-s的分布抽取
+ * 开始前先登录一次取得token，其他请求都带这个token。
+ */
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <deque>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "fcgi_proto.h"
+
+enum Kind { LOGIN, COUNT, LIST, MD5HIT, MD5MISS, UPLOAD, KIND_COUNT };
+
+static const char *const kind_names[KIND_COUNT] = {
+    "login", "count", "list", "md5hit", "md5miss", "upload",
+};
+
+struct Options {
+  std::string host = "127.0.0.1";  // 以'/'开头时为unix socket
+  int port = 10010;
+  double rate = 100;      // 每秒请求数
+  double duration = 10;   // 秒
+  int max_conns = 256;    // 同时打开的连接数上限，超出的请求排队
+  double timeout = 30;    // 单个请求的超时(秒)
+  int page = 10;          // list每页条数
+  unsigned seed = 1;
+  std::string user = "bench";
+  std::string pwd = "bench";
+  std::string json;       // 结果另写成json文件
+  double mix[KIND_COUNT] = {5, 20, 40, 10, 10, 15};
+  std::vector<std::pair<long, double>> sizes = {
+      {4 << 10, 70}, {256 << 10, 25}, {8 << 20, 5}};
+};
+
+static Options opt;
+static std::mt19937_64 rng;
+
+static int64_t nowNs() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static std::string randomHex(int len) {
+  static const char hex[] = "0123456789abcdef";
+  std::string s(len, '0');
+  for (char &c : s) {
+    c = hex[rng() & 15];
+  }
+  return s;
+}
+
+//==================== 请求 ====================
+
+// 一个请求：BEGIN_REQUEST + PARAMS先放在pending中，
+// 请求体由 pre + payload + post 三段组成，按需切成STDIN记录，大文件不复制
+struct Request {
+  Kind kind;
+  int64_t scheduled;  // 计划发送时刻
+  int fd = -1;
+  bool connected = false;
+  std::string pending;
+  size_t pending_off = 0;
+  std::string pre, post;
+  const char *payload = nullptr;
+  size_t payload_len = 0;
+  size_t body_off = 0;
+  bool stdin_closed = false;
+  std::string in;      // 收到还没解析的数据
+  std::string response;  // 响应的前4KB，够取状态行和code
+  bool done = false;
+  bool failed = false;
+};
+
+static std::string payload_buf;  // 上传内容，各请求共用前缀
+static std::string token;
+static std::string hit_md5;
+static long upload_seq = 0;
+
+static size_t bodyLen(const Request *r) {
+  return r->pre.size() + r->payload_len + r->post.size();
+}
+
+// 从请求体off处复制至多n字节到out
+static void copyBody(const Request *r, size_t off, size_t n, std::string *out) {
+  const std::pair<const char *, size_t> pieces[] = {
+      {r->pre.data(), r->pre.size()},
+      {r->payload, r->payload_len},
+      {r->post.data(), r->post.size()},
+  };
+  for (const auto &p : pieces) {
+    if (n == 0) break;
+    if (off >= p.second) {
+      off -= p.second;
+      continue;
+    }
+    size_t take = std::min(n, p.second - off);
+    out->append(p.first + off, take);
+    n -= take;
+    off = 0;
+  }
+}
+
+// 准备下一段要写的数据，没有时返回false
+static bool fillPending(Request *r) {
+  if (r->pending_off < r->pending.size()) {
+    return true;
+  }
+  r->pending.clear();
+  r->pending_off = 0;
+  size_t len = bodyLen(r);
+  if (r->body_off < len) {
+    std::string chunk;
+    copyBody(r, r->body_off, std::min<size_t>(32768, len - r->body_off),
+             &chunk);
+    r->body_off += chunk.size();
+    fcgiAppendRecord(&r->pending, FCGI_TYPE_STDIN, 1, chunk.data(),
+                     chunk.size());
+    return true;
+  }
+  if (!r->stdin_closed) {
+    fcgiAppendRecord(&r->pending, FCGI_TYPE_STDIN, 1, nullptr, 0);
+    r->stdin_closed = true;
+    return true;
+  }
+  return false;
+}
+
+static std::string jsonBody(std::initializer_list<
+                            std::pair<const char *, std::string>> fields) {
+  std::string s = "{";
+  for (const auto &f : fields) {
+    if (s.size() > 1) s += ",";
+    s += "\"";
+    s += f.first;
+    s += "\":";
+    s += f.second;
+  }
+  return s + "}";
+}
+
+static std::string quoted(const std::string &v) { return "\"" + v + "\""; }
+
+static long pickSize() {
+  double total = 0;
+  for (const auto &s : opt.sizes) total += s.second;
+  double x = std::uniform_real_distribution<double>(0, total)(rng);
+  for (const auto &s : opt.sizes) {
+    if (x < s.second) return s.first;
+    x -= s.second;
+  }
+  return opt.sizes.back().first;
+}
+
+static void buildRequest(Request *r, const char *md5 = nullptr) {
+  std::string path, query, type = "application/json";
+  switch (r->kind) {
+    case LOGIN:
+      path = "/login";
+      r->pre = jsonBody({{"userName", quoted(opt.user)},
+                         {"passWord", quoted(opt.pwd)}});
+      break;
+    case COUNT:
+      path = "/myfiles";
+      query = "cmd=count";
+      r->pre = jsonBody({{"user", quoted(opt.user)}, {"token", quoted(token)}});
+      break;
+    case LIST: {
+      path = "/myfiles";
+      query = "cmd=normal";
+      r->pre = jsonBody({{"user", quoted(opt.user)},
+                         {"token", quoted(token)},
+                         {"start", "0"},
+                         {"count", std::to_string(opt.page)}});
+      break;
+    }
+    case MD5HIT:
+    case MD5MISS: {
+      path = "/md5";
+      std::string m = r->kind == MD5HIT && !hit_md5.empty() ? hit_md5
+                                                            : randomHex(32);
+      r->pre = jsonBody({{"user", quoted(opt.user)},
+                         {"token", quoted(token)},
+                         {"md5", quoted(m)},
+                         {"filename",
+                          quoted("bench_" + std::to_string(++upload_seq) +
+                                 ".bin")}});
+      break;
+    }
+    case UPLOAD: {
+      path = "/upload";
+      long size = md5 != nullptr ? 4096 : pickSize();
+      if ((size_t)size > payload_buf.size()) size = payload_buf.size();
+      const std::string boundary = "----FileHubBenchBoundary" + randomHex(8);
+      type = "multipart/form-data; boundary=" + boundary;
+      r->pre = "--" + boundary +
+               "\r\nContent-Disposition: form-data; user=\"" + opt.user +
+               "\"; filename=\"bench_" + std::to_string(++upload_seq) +
+               ".bin\"; md5=\"" + (md5 != nullptr ? md5 : randomHex(32)) +
+               "\"; size=" + std::to_string(size) +
+               "\r\nContent-Type: application/octet-stream\r\n\r\n";
+      r->payload = payload_buf.data();
+      r->payload_len = size;
+      r->post = "\r\n--" + boundary + "--\r\n";
+      break;
+    }
+    default:
+      break;
+  }
+
+  std::string params;
+  fcgiAppendParam(&params, "GATEWAY_INTERFACE", "CGI/1.1");
+  fcgiAppendParam(&params, "REQUEST_METHOD", "POST");
+  fcgiAppendParam(&params, "SCRIPT_NAME", path);
+  fcgiAppendParam(&params, "DOCUMENT_URI", path);
+  fcgiAppendParam(&params, "REQUEST_URI",
+                  query.empty() ? path : path + "?" + query);
+  fcgiAppendParam(&params, "QUERY_STRING", query);
+  fcgiAppendParam(&params, "CONTENT_TYPE", type);
+  fcgiAppendParam(&params, "CONTENT_LENGTH", std::to_string(bodyLen(r)));
+  fcgiAppendParam(&params, "REMOTE_ADDR", "127.0.0.1");
+  fcgiAppendParam(&params, "SERVER_PROTOCOL", "HTTP/1.1");
+  fcgiAppendParam(&params, "HTTP_X_REQUEST_ID", randomHex(32));
+  if (!token.empty()) {
+    fcgiAppendParam(&params, "HTTP_X_USER", opt.user);
+    fcgiAppendParam(&params, "HTTP_X_TOKEN", token);
+  }
+  fcgiAppendBeginRequest(&r->pending, 1, FCGI_ROLE_RESPONDER, 0);
+  fcgiAppendStream(&r->pending, FCGI_TYPE_PARAMS, 1, params.data(),
+                   params.size());
+  fcgiAppendRecord(&r->pending, FCGI_TYPE_PARAMS, 1, nullptr, 0);
+}
+
+//==================== 连接和事件循环 ====================
+
+static int epfd = -1;
+static int active = 0;
+
+static int openSocket() {
+  int fd;
+  int ret;
+  if (opt.host[0] == '/') {
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", opt.host.c_str());
+    ret = connect(fd, (sockaddr *)&addr, sizeof(addr));
+  } else {
+    fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(opt.port);
+    inet_pton(AF_INET, opt.host.c_str(), &addr.sin_addr);
+    ret = connect(fd, (sockaddr *)&addr, sizeof(addr));
+  }
+  if (ret != 0 && errno != EINPROGRESS) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+static void finish(Request *r, bool failed) {
+  if (r->fd >= 0) {
+    epoll_ctl(epfd, EPOLL_CTL_DEL, r->fd, nullptr);
+    close(r->fd);
+    r->fd = -1;
+    active--;
+  }
+  r->done = true;
+  r->failed = failed;
+}
+
+static void start(Request *r) {
+  r->fd = openSocket();
+  if (r->fd < 0) {
+    r->done = r->failed = true;
+    return;
+  }
+  active++;
+  epoll_event ev = {};
+  ev.events = EPOLLIN | EPOLLOUT;
+  ev.data.ptr = r;
+  epoll_ctl(epfd, EPOLL_CTL_ADD, r->fd, &ev);
+}
+
+static void onWritable(Request *r) {
+  while (fillPending(r)) {
+    ssize_t n = write(r->fd, r->pending.data() + r->pending_off,
+                      r->pending.size() - r->pending_off);
+    if (n < 0) {
+      if (errno != EAGAIN) finish(r, true);
+      return;
+    }
+    r->pending_off += n;
+  }
+  // 全部写完，只等响应
+  epoll_event ev = {};
+  ev.events = EPOLLIN;
+  ev.data.ptr = r;
+  epoll_ctl(epfd, EPOLL_CTL_MOD, r->fd, &ev);
+}
+
+static void onReadable(Request *r) {
+  char buf[65536];
+  bool closed = false;
+  for (;;) {
+    ssize_t n = read(r->fd, buf, sizeof(buf));
+    if (n <= 0) {
+      closed = n == 0 || errno != EAGAIN;
+      break;
+    }
+    r->in.append(buf, n);
+  }
+  size_t off = 0;
+  FcgiRecord rec;
+  long used;
+  while ((used = fcgiParseRecord(r->in.data() + off, r->in.size() - off,
+                                 &rec)) > 0) {
+    off += used;
+    if (rec.type == FCGI_TYPE_STDOUT && r->response.size() < 4096) {
+      r->response.append(rec.data, std::min<size_t>(rec.len, 4096));
+    } else if (rec.type == FCGI_TYPE_END_REQUEST) {
+      finish(r, false);
+      return;
+    }
+  }
+  if (used < 0 || closed) {
+    finish(r, true);  // 格式错误，或没有END_REQUEST就关闭了
+    return;
+  }
+  r->in.erase(0, off);
+}
+
+// 处理事件直到timeout_ns(绝对时刻)
+static void pump(int64_t until) {
+  epoll_event events[256];
+  int64_t wait_ns = until - nowNs();
+  int timeout_ms = wait_ns <= 0 ? 0 : (int)((wait_ns + 999999) / 1000000);
+  int n = epoll_wait(epfd, events, 256, timeout_ms);
+  for (int i = 0; i < n; i++) {
+    Request *r = (Request *)events[i].data.ptr;
+    if (r->done) continue;
+    if (events[i].events & (EPOLLERR | EPOLLHUP) &&
+        !(events[i].events & EPOLLIN)) {
+      finish(r, true);
+      continue;
+    }
+    if (events[i].events & EPOLLOUT) onWritable(r);
+    if (!r->done && (events[i].events & EPOLLIN)) onReadable(r);
+  }
+}
+
+// 同步发送一个请求，用于开始前的登录和上传
+static bool runOne(Request *r) {
+  r->scheduled = nowNs();
+  start(r);
+  int64_t deadline = r->scheduled + (int64_t)(opt.timeout * 1e9);
+  while (!r->done && nowNs() < deadline) {
+    pump(deadline);
+  }
+  if (!r->done) finish(r, true);
+  return !r->failed;
+}
+
+//==================== 结果 ====================
+
+static int httpStatus(const std::string &out) {
+  size_t end = out.find("\r\n\r\n");
+  size_t pos = out.find("Status: ");
+  if (pos == std::string::npos || (end != std::string::npos && pos > end)) {
+    return 200;
+  }
+  return atoi(out.c_str() + pos + 8);
+}
+
+static std::string appCode(const std::string &out) {
+  size_t pos = out.find("\"code\":\"");
+  if (pos == std::string::npos || pos + 11 > out.size()) return "";
+  return out.substr(pos + 8, 3);
+}
+
+struct Stats {
+  std::vector<int64_t> latency;  // ns
+  long sent = 0;
+  long failed = 0;    // 连接失败、超时、没有END_REQUEST
+  long non2xx = 0;
+  std::map<std::string, long> codes;
+};
+
+static double percentile(const std::vector<int64_t> &sorted, double q) {
+  if (sorted.empty()) return 0;
+  size_t idx = (size_t)std::ceil(q * sorted.size());
+  idx = idx == 0 ? 0 : idx - 1;
+  return sorted[std::min(idx, sorted.size() - 1)] / 1e6;
+}
+
+static void record(Stats *s, const Request *r, int64_t end) {
+  s->sent++;
+  if (r->failed) {
+    s->failed++;
+    return;
+  }
+  s->latency.push_back(end - r->scheduled);
+  int status = httpStatus(r->response);
+  if (status < 200 || status >= 300) s->non2xx++;
+  std::string code = appCode(r->response);
+  s->codes[code.empty() ? std::to_string(status) : code]++;
+}
+
+static void report(Stats *stats, double elapsed) {
+  Stats all;
+  for (int k = 0; k < KIND_COUNT; k++) {
+    all.sent += stats[k].sent;
+    all.failed += stats[k].failed;
+    all.non2xx += stats[k].non2xx;
+    all.latency.insert(all.latency.end(), stats[k].latency.begin(),
+                       stats[k].latency.end());
+    for (const auto &c : stats[k].codes) all.codes[c.first] += c.second;
+  }
+
+  FILE *json = opt.json.empty() ? nullptr : fopen(opt.json.c_str(), "w");
+  if (json != nullptr) {
+    fprintf(json,
+            "{\"rate\":%.1f,\"duration_s\":%.3f,\"seed\":%u,\"kinds\":{",
+            opt.rate, elapsed, opt.seed);
+  }
+  printf("%-8s %8s %8s %7s %7s %9s %9s %9s %9s %9s  codes\n", "kind", "sent",
+         "rps", "failed", "non2xx", "p50(ms)", "p90(ms)", "p99(ms)",
+         "p999(ms)", "max(ms)");
+  bool first = true;
+  for (int k = 0; k <= KIND_COUNT; k++) {
+    Stats *s = k < KIND_COUNT ? &stats[k] : &all;
+    const char *name = k < KIND_COUNT ? kind_names[k] : "all";
+    if (s->sent == 0) continue;
+    std::sort(s->latency.begin(), s->latency.end());
+    double p50 = percentile(s->latency, 0.5), p90 = percentile(s->latency, 0.9),
+           p99 = percentile(s->latency, 0.99),
+           p999 = percentile(s->latency, 0.999),
+           max = s->latency.empty() ? 0 : s->latency.back() / 1e6;
+    double rps = (s->sent - s->failed) / elapsed;
+    std::string codes;
+    for (const auto &c : s->codes) {
+      codes += c.first + ":" + std::to_string(c.second) + " ";
+    }
+    printf("%-8s %8ld %8.1f %7ld %7ld %9.3f %9.3f %9.3f %9.3f %9.3f  %s\n",
+           name, s->sent, rps, s->failed, s->non2xx, p50, p90, p99, p999, max,
+           codes.c_str());
+    if (json != nullptr) {
+      fprintf(json,
+              "%s\"%s\":{\"sent\":%ld,\"throughput\":%.3f,\"failed\":%ld,"
+              "\"non2xx\":%ld,\"p50_ms\":%.3f,\"p90_ms\":%.3f,\"p99_ms\":%.3f,"
+              "\"p999_ms\":%.3f,\"max_ms\":%.3f}",
+              first ? "" : ",", name, s->sent, rps, s->failed, s->non2xx, p50,
+              p90, p99, p999, max);
+      first = false;
+    }
+  }
+  if (json != nullptr) {
+    fprintf(json, "}}\n");
+    fclose(json);
+  }
+}
+
+//==================== 参数 ====================
+
+static long parseSize(const char *s) {
+  char *end;
+  double v = strtod(s, &end);
+  switch (*end) {
+    case 'k': case 'K': v *= 1 << 10; break;
+    case 'm': case 'M': v *= 1 << 20; break;
+    case 'g': case 'G': v *= 1 << 30; break;
+    default: break;
+  }
+  return (long)v;
+}
+
+// "a=1,b=2" 拆成名值对
+static std::vector<std::pair<std::string, std::string>> parseList(
+    const char *s) {
+  std::vector<std::pair<std::string, std::string>> out;
+  std::string str(s);
+  size_t pos = 0;
+  while (pos <= str.size()) {
+    size_t comma = str.find(',', pos);
+    if (comma == std::string::npos) comma = str.size();
+    std::string item = str.substr(pos, comma - pos);
+    size_t eq = item.find('=');
+    if (eq != std::string::npos) {
+      out.emplace_back(item.substr(0, eq), item.substr(eq + 1));
+    }
+    pos = comma + 1;
+  }
+  return out;
+}
+
+static void usage(const char *prog) {
+  fprintf(stderr,
+          "usage: %s [-a host|/unix.sock] [-p port] [-r rate] [-d seconds]\n"
+          "          [-c max_conns] [-t timeout] [-u user] [-w pwd] [-l page]\n"
+          "          [-m login=5,count=20,list=40,md5hit=10,md5miss=10,"
+          "upload=15]\n"
+          "          [-s 4k=70,256k=25,8m=5] [-S seed] [-j result.json]\n",
+          prog);
+}
+
+static int parseArgs(int argc, char **argv) {
+  int c;
+  while ((c = getopt(argc, argv, "a:p:r:d:c:t:u:w:l:m:s:S:j:h")) != -1) {
+    switch (c) {
+      case 'a': opt.host = optarg; break;
+      case 'p': opt.port = atoi(optarg); break;
+      case 'r': opt.rate = atof(optarg); break;
+      case 'd': opt.duration = atof(optarg); break;
+      case 'c': opt.max_conns = atoi(optarg); break;
+      case 't': opt.timeout = atof(optarg); break;
+      case 'u': opt.user = optarg; break;
+      case 'w': opt.pwd = optarg; break;
+      case 'l': opt.page = atoi(optarg); break;
+      case 'S': opt.seed = (unsigned)atoi(optarg); break;
+      case 'j': opt.json = optarg; break;
+      case 'm':
+        for (double &m : opt.mix) m = 0;
+        for (const auto &kv : parseList(optarg)) {
+          int k = 0;
+          while (k < KIND_COUNT && kv.first != kind_names[k]) k++;
+          if (k == KIND_COUNT) {
+            fprintf(stderr, "unknown kind %s\n", kv.first.c_str());
+            return -1;
+          }
+          opt.mix[k] = atof(kv.second.c_str());
+        }
+        break;
+      case 's':
+        opt.sizes.clear();
+        for (const auto &kv : parseList(optarg)) {
+          opt.sizes.emplace_back(parseSize(kv.first.c_str()),
+                                 atof(kv.second.c_str()));
+        }
+        break;
+      default:
+        usage(argv[0]);
+        return -1;
+    }
+  }
+  if (opt.rate <= 0 || opt.duration <= 0 || opt.max_conns <= 0 ||
+      opt.sizes.empty()) {
+    usage(argv[0]);
+    return -1;
+  }
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  if (parseArgs(argc, argv) != 0) {
+    return 1;
+  }
+  rng.seed(opt.seed);
+  epfd = epoll_create1(EPOLL_CLOEXEC);
+
+  long max_size = 4096;
+  for (const auto &s : opt.sizes) max_size = std::max(max_size, s.first);
+  payload_buf.resize(max_size);
+  for (char &c : payload_buf) c = (char)rng();
+
+  // 开始前登录取得token，再上传一个文件作为秒传命中的目标
+  Request login;
+  login.kind = LOGIN;
+  buildRequest(&login);
+  if (runOne(&login)) {
+    size_t pos = login.response.find("\"token\":\"");
+    if (pos != std::string::npos && appCode(login.response) == "000") {
+      pos += 9;
+      token = login.response.substr(pos, login.response.find('"', pos) - pos);
+    }
+  }
+  if (token.empty()) {
+    fprintf(stderr, "login as %s failed, requests go without token\n",
+            opt.user.c_str());
+  }
+  if (opt.mix[MD5HIT] > 0) {
+    std::string md5 = randomHex(32);
+    Request seed;
+    seed.kind = UPLOAD;
+    buildRequest(&seed, md5.c_str());
+    if (runOne(&seed) && appCode(seed.response) == "008") {
+      hit_md5 = md5;
+    } else {
+      fprintf(stderr, "seed upload failed, md5hit requests will miss\n");
+    }
+  }
+
+  double mix_total = 0;
+  for (double m : opt.mix) mix_total += m;
+  if (mix_total <= 0) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  // 开环：第i个请求计划在 start + i/rate 发出
+  const long total = (long)(opt.rate * opt.duration);
+  const int64_t interval = (int64_t)(1e9 / opt.rate);
+  const int64_t timeout = (int64_t)(opt.timeout * 1e9);
+  std::deque<Request *> backlog;  // 连接数已满时排队
+  std::vector<Request *> running;
+  Stats stats[KIND_COUNT];
+  long issued = 0;
+  const int64_t begin = nowNs();
+
+  while (issued < total || !backlog.empty() || !running.empty()) {
+    int64_t now = nowNs();
+    while (issued < total && begin + issued * interval <= now) {
+      Request *r = new Request;
+      double x = std::uniform_real_distribution<double>(0, mix_total)(rng);
+      int k = 0;
+      while (k < KIND_COUNT - 1 && x >= opt.mix[k]) x -= opt.mix[k++];
+      r->kind = (Kind)k;
+      r->scheduled = begin + issued * interval;
+      buildRequest(r);
+      backlog.push_back(r);
+      issued++;
+    }
+    while (!backlog.empty() && active < opt.max_conns) {
+      Request *r = backlog.front();
+      backlog.pop_front();
+      start(r);
+      running.push_back(r);
+    }
+
+    int64_t next = issued < total ? begin + issued * interval : now + 10000000;
+    pump(next);
+
+    now = nowNs();
+    for (size_t i = 0; i < running.size();) {
+      Request *r = running[i];
+      if (!r->done && now - r->scheduled > timeout) {
+        finish(r, true);
+      }
+      if (r->done) {
+        record(&stats[r->kind], r, now);
+        delete r;
+        running[i] = running.back();
+        running.pop_back();
+      } else {
+        i++;
+      }
+    }
+  }
+
+  report(stats, (nowNs() - begin) / 1e9);
+  close(epfd);
+  return 0;
+}
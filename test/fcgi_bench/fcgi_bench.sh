@@ -0,0 +1,17 @@
+#!/bin/bash
+# 直接按FastCGI协议压测cgi程序，不经过nginx，参数见fcgi_bench.cpp开头
+#   ./fcgi_bench.sh -p 10010 -r 200 -d 30 -j result.json
+#
+# 本地替身：
+#   存储  stub_bin/下的fdfs_*都指向fdfs_stub.sh，启动cgi时放到PATH最前面：
+#         PATH=$(pwd)/stub_bin:$PATH spawn-fcgi -a 127.0.0.1 -p 10010 -f ../../src/gateway_cgi
+#   mysql/redis  cfg.json中的mysql、redis指向本机的实例(如redis-server --port 6380 --save "")，
+#         压测用户先注册好：-u/-w与注册的用户名密码一致
+g++ -std=c++17 -O2 -I ../../src fcgi_bench.cpp ../../src/fcgi_proto.cpp -o fcgi_bench || exit 1
+
+mkdir -p stub_bin
+for tool in fdfs_upload_file fdfs_upload_appender fdfs_append_file fdfs_download_file fdfs_delete_file fdfs_file_info; do
+  ln -sf ../fdfs_stub.sh stub_bin/$tool
+done
+
+./fcgi_bench "$@"
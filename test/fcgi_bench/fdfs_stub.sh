@@ -0,0 +1,51 @@
+#!/bin/bash
+# 压测用的fastDFS替身：按调用名(软链接名)模拟fdfs_*命令行工具，文件存在本地目录
+# FDFS_STUB_DIR   存放目录，默认/tmp/fdfs_stub
+# FDFS_STUB_DELAY 每次调用前等待的秒数(如0.005)，模拟存储的延迟
+# 参数和真实工具一致：第一个参数是client配置文件，忽略
+
+DIR=${FDFS_STUB_DIR:-/tmp/fdfs_stub}
+mkdir -p "$DIR/group1/M00"
+[ -n "$FDFS_STUB_DELAY" ] && sleep "$FDFS_STUB_DELAY"
+shift
+
+newId() {
+  local ext="${1##*.}"
+  [ "$ext" = "$1" ] && ext=""
+  echo "group1/M00/$(date +%s%N)_$$${ext:+.$ext}"
+}
+
+case "$(basename "$0")" in
+  fdfs_upload_file | fdfs_upload_appender)
+    ID=$(newId "$1")
+    cp "$1" "$DIR/$ID" || exit 1
+    echo "$ID"
+    ;;
+  fdfs_append_file)
+    cat "$2" >> "$DIR/$1" || exit 1
+    ;;
+  fdfs_download_file)
+    if [ -n "$3" ]; then
+      tail -c +$(($3 + 1)) "$DIR/$1" | head -c "$4" > "$2"
+    else
+      cp "$DIR/$1" "$2"
+    fi
+    ;;
+  fdfs_delete_file)
+    rm "$DIR/$1" || exit 1
+    ;;
+  fdfs_file_info)
+    [ -f "$DIR/$1" ] || exit 1
+    echo "GET FROM SERVER: true"
+    echo
+    echo "file type: normal"
+    echo "source storage id: 0"
+    echo "source ip address: 127.0.0.1"
+    echo "file create timestamp: $(date '+%Y-%m-%d %H:%M:%S')"
+    echo "file size: $(stat -c %s "$DIR/$1")"
+    ;;
+  *)
+    echo "unknown tool $(basename "$0")" >&2
+    exit 1
+    ;;
+esac
@@ -0,0 +1,690 @@
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+
+#include "cache_util.h"
+#include "cgi_handlers.h"
+#include "cgi_util.h"
+#include "fake_util.h"
+#include "link_util.h"
+#include "pv_util.h"
+#include "share_util.h"
+
+static int failed = 0;
+
+static void check(const char *name, bool ok) {
+  printf("%-40s %s\n", name, ok ? "OK" : "WRONG");
+  if (!ok) failed++;
+}
+
+static const char *const MD5 = "e8ea6031b779ac26c319ddf949ad9d8d";
+
+static std::string md5Body(const char *token, const char *md5,
+                           const char *filename) {
+  return std::string("{\"user\":\"mike\",\"token\":\"") + token +
+         "\",\"md5\":\"" + md5 + "\",\"filename\":\"" + filename + "\"}";
+}
+
+static std::string uploadBody(const std::string &content,
+                              const char *filename = "handler_test.bin",
+                              long size = -1) {
+  const std::string boundary = "------WebKitFormBoundary88asdgewtgewx";
+  return boundary +
+         "\r\nContent-Disposition: form-data; user=\"mike\"; "
+         "filename=\"" + filename + "\"; md5=\"" +
+         MD5 + "\"; size=" +
+         std::to_string(size < 0 ? (long)content.size() : size) +
+         "\r\nContent-Type: application/octet-stream\r\n\r\n" + content +
+         "\r\n" + boundary + "--\r\n";
+}
+
+//==================== 秒传 ====================
+
+static void testMd5(CgiContext *ctx, FakeMetaStore *meta) {
+  FakeRequest req;
+  req.reset("/md5", "", md5Body("tok", MD5, "a.mp4"));
+  fakeRun(md5Handler, ctx, &req);
+  check("md5 miss", req.code() == "007");
+
+  meta->addFileInfo(MD5, "group1/M00/00/00/x", "http://x", 100, "mp4");
+  req.rewind();
+  fakeRun(md5Handler, ctx, &req);
+  const FakeMetaStore::File *f = meta->file(MD5);
+  check("md5 hit", req.code() == "006" && f->count == 2 &&
+                       meta->userFiles("mike")->size() == 1);
+
+  req.rewind();
+  fakeRun(md5Handler, ctx, &req);
+  check("md5 already owned", req.code() == "005" && f->count == 2);
+
+  req.reset("/md5", "", md5Body("bad", MD5, "b.mp4"));
+  fakeRun(md5Handler, ctx, &req);
+  check("md5 bad token", req.code() == "111");
+
+  meta->setFail(true);
+  req.reset("/md5", "", md5Body("tok", MD5, "b.mp4"));
+  fakeRun(md5Handler, ctx, &req);
+  meta->setFail(false);
+  check("md5 store error", req.code() == "007");
+}
+
+//==================== 文件列表 ====================
+
+static void testMyfiles(CgiContext *ctx) {
+  FakeRequest req;
+  req.reset("/myfiles", "cmd=count", "{\"user\":\"mike\",\"token\":\"tok\"}");
+  fakeRun(myfilesHandler, ctx, &req);
+  check("count", req.out().find("{\"num\":1,\"token\":\"110\"}") !=
+                     std::string::npos);
+
+  req.reset("/myfiles", "cmd=normal",
+            "{\"user\":\"mike\",\"token\":\"tok\",\"start\":0,\"count\":10}");
+  fakeRun(myfilesHandler, ctx, &req);
+  check("list", req.out().find("\"filename\":\"a.mp4\"") != std::string::npos &&
+                    req.out().find("\"size\":100") != std::string::npos);
+
+  req.reset("/myfiles", "cmd=normal",
+            "{\"user\":\"mike\",\"token\":\"tok\",\"start\":5,\"count\":10}");
+  fakeRun(myfilesHandler, ctx, &req);
+  check("list past end", req.out().find("\"015\"") != std::string::npos);
+
+  req.reset("/myfiles", "cmd=nope",
+            "{\"user\":\"mike\",\"token\":\"tok\",\"start\":0,\"count\":10}");
+  fakeRun(myfilesHandler, ctx, &req);
+  check("list unknown cmd", req.out().find("\"015\"") != std::string::npos);
+
+  req.reset("/myfiles", "cmd=count", "{\"user\":\"mike\",\"token\":\"bad\"}");
+  fakeRun(myfilesHandler, ctx, &req);
+  check("count bad token", req.out().find("\"111\"") != std::string::npos);
+
+  // 打包的文件在storage上的url是整个容器，给/dl的地址
+  const char *MD5_P = "0cc175b9c0f1b6a831c399e269772661";
+  FakeMetaStore meta;
+  CgiContext mc = *ctx;
+  mc.meta = &meta;
+  meta.addFileInfo(MD5_P, "group1/M00/00/00/pack", "http://pack", 5, "txt");
+  meta.file(MD5_P)->pack_offset = 100;
+  meta.file(MD5_P)->pack_length = 5;
+  meta.addUserFile("mike", MD5_P, "p 1.txt", "2023-07-06 12:00:00");
+  req.reset("/myfiles", "cmd=normal",
+            "{\"user\":\"mike\",\"token\":\"tok\",\"start\":0,\"count\":10}");
+  fakeRun(myfilesHandler, &mc, &req);
+  check("list packed url",
+        req.out().find("\"url\":\"/dl?owner=mike&md5=" + std::string(MD5_P) +
+                       "&filename=p%201.txt\"") != std::string::npos &&
+            req.out().find("http://pack") == std::string::npos);
+}
+
+//==================== 上传 ====================
+
+static void testUpload(CgiContext *ctx, FakeMetaStore *meta,
+                       FakeBlobStore *blobs) {
+  std::string content(3000, 'x');
+  content += "\r\nnot a boundary\r\n";
+
+  FakeMetaStore fresh;
+  CgiContext up = *ctx;
+  up.meta = &fresh;
+  FakeRequest req;
+  req.reset("/upload", "", uploadBody(content));
+  fakeRun(uploadHandler, &up, &req);
+  const FakeMetaStore::File *f = fresh.file(MD5);
+  long count = 0;
+  check("upload", req.code() == "008" && f != nullptr &&
+                      f->size == (long)content.size() && f->type == "bin");
+  check("upload blob", f != nullptr && blobs->blob(f->fileid.c_str()) &&
+                           *blobs->blob(f->fileid.c_str()) == content);
+  check("upload meta", fresh.userFileCount("mike", &count) == 0 &&
+                           count == 1 && access("handler_test.bin", F_OK) != 0);
+
+  // 文件名不能跳出临时目录
+  FakeMetaStore other;
+  up.meta = &other;
+  req.reset("/upload", "", uploadBody(content, "../handler_test.bin"));
+  fakeRun(uploadHandler, &up, &req);
+  check("upload bad filename", req.code() == "009" &&
+                                   other.file(MD5) == nullptr &&
+                                   access("../handler_test.bin", F_OK) != 0);
+
+  // 表单中的size与收到的字节数不一致(如size=0绕过配额)
+  req.reset("/upload", "", uploadBody(content, "handler_test.bin", 0));
+  fakeRun(uploadHandler, &up, &req);
+  check("upload size mismatch", req.code() == "009" &&
+                                    other.file(MD5) == nullptr);
+
+  // 已有同一个md5的文件，file_info插入失败
+  req.reset("/upload", "", uploadBody(content));
+  fakeRun(uploadHandler, ctx, &req);
+  check("upload duplicate md5", req.code() == "009" &&
+                                    meta->file(MD5)->count == 2);
+}
+
+//==================== 下载 ====================
+
+// 内容放入blobs，返回文件id
+static std::string putBlob(FakeBlobStore *blobs, const std::string &content) {
+  std::ofstream("handler_test.blob") << content;
+  char fileid[TEMP_BUF_MAX_LEN] = {0};
+  blobs->upload("handler_test.blob", fileid);
+  unlink("handler_test.blob");
+  return fileid;
+}
+
+static std::string dlQuery(const char *user, const char *token,
+                           const char *md5, const char *filename) {
+  return std::string("user=") + user + "&token=" + token + "&md5=" + md5 +
+         "&filename=" + filename;
+}
+
+static void testDl(CgiContext *ctx, FakeTokenStore *tokens,
+                   FakeBlobStore *blobs) {
+  const char *MD5_A = "0cc175b9c0f1b6a831c399e269772661";
+  const char *MD5_B = "92eb5ffee6ae2fec3ad71c777531578f";
+  const char *MD5_C = "4a8a08f09d37b73795649038408b5f33";
+  FakeMetaStore meta;
+  CgiContext dl = *ctx;
+  dl.meta = &meta;
+  tokens->put("jack", "tok2");
+
+  std::string id_a = putBlob(blobs, "hello");
+  meta.addFileInfo(MD5_A, id_a.c_str(), "http://x", 5, "bin");
+  meta.addUserFile("mike", MD5_A, "a b.bin", "2023-06-28 12:00:00");
+  std::string id_b = putBlob(blobs, "xxxxhelloyyyy");
+  meta.addFileInfo(MD5_B, id_b.c_str(), "http://x", 5, "txt");
+  meta.file(MD5_B)->pack_offset = 4;
+  meta.file(MD5_B)->pack_length = 5;
+  meta.addUserFile("mike", MD5_B, "b.txt", "2023-06-28 12:00:00");
+  meta.setShared("mike", MD5_B, "b.txt", true, 1688000000);
+  std::string id_c = putBlob(blobs, "zstd frame");
+  meta.addFileInfo(MD5_C, id_c.c_str(), "http://x", 100, "log");
+  meta.file(MD5_C)->codec = "zstd";
+  meta.addUserFile("mike", MD5_C, "c.log", "2023-06-28 12:00:00");
+
+  FakeRequest req;
+  req.reset("/dl", dlQuery("mike", "tok", MD5_A, "a%20b.bin").c_str(), "");
+  fakeRun(dlHandler, &dl, &req);
+  check("dl redirect",
+        req.out().find("X-Accel-Redirect: /dl_internal/" + id_a + "\r\n") !=
+                std::string::npos &&
+            req.out().find("filename*=UTF-8''a%20b.bin") !=
+                std::string::npos &&
+            req.out().find("hello") == std::string::npos);
+
+  req.reset("/dl", dlQuery("mike", "bad", MD5_A, "a%20b.bin").c_str(), "");
+  fakeRun(dlHandler, &dl, &req);
+  check("dl bad token", req.code() == "111");
+
+  req.reset("/dl", dlQuery("mike", "tok", MD5_A, "x.bin").c_str(), "");
+  fakeRun(dlHandler, &dl, &req);
+  check("dl not found", req.out().find("404") != std::string::npos);
+
+  // 别人没共享的文件
+  req.reset("/dl",
+            (dlQuery("jack", "tok2", MD5_A, "a%20b.bin") + "&owner=mike")
+                .c_str(),
+            "");
+  fakeRun(dlHandler, &dl, &req);
+  check("dl not shared", req.out().find("404") != std::string::npos);
+
+  // 共享的打包文件，由cgi从容器中取出发送
+  req.reset("/dl",
+            (dlQuery("jack", "tok2", MD5_B, "b.txt") + "&owner=mike").c_str(),
+            "");
+  fakeRun(dlHandler, &dl, &req);
+  const std::string &out = req.out();
+  check("dl packed", out.find("X-Accel-Redirect") == std::string::npos &&
+                         out.find("Content-Length: 5\r\n") !=
+                             std::string::npos &&
+                         out.size() > 5 &&
+                         out.compare(out.size() - 5, 5, "hello") == 0);
+
+  // 打包文件的Range，由cgi处理
+  const std::string b_query =
+      dlQuery("mike", "tok", MD5_B, "b.txt") + "&owner=mike";
+  req.reset("/dl", b_query.c_str(), "");
+  req.param("HTTP_RANGE", "bytes=1-3");
+  fakeRun(dlHandler, &dl, &req);
+  check("dl range", req.out().find("Status: 206") == 0 &&
+                        req.out().find("Content-Range: bytes 1-3/5\r\n") !=
+                            std::string::npos &&
+                        req.out().compare(req.out().size() - 5, 5,
+                                          "\r\nell") == 0);
+
+  req.reset("/dl", b_query.c_str(), "");
+  req.param("HTTP_RANGE", "bytes=0-0,-1");
+  fakeRun(dlHandler, &dl, &req);
+  check("dl multi range",
+        req.out().find("multipart/byteranges; boundary=") !=
+                std::string::npos &&
+            req.out().find("Content-Range: bytes 0-0/5\r\n\r\nh\r\n") !=
+                std::string::npos &&
+            req.out().find("Content-Range: bytes 4-4/5\r\n\r\no\r\n") !=
+                std::string::npos);
+
+  req.reset("/dl", b_query.c_str(), "");
+  req.param("HTTP_RANGE", "bytes=1-3");
+  req.param("HTTP_IF_RANGE", "\"0cc175b9c0f1b6a831c399e269772661\"");
+  fakeRun(dlHandler, &dl, &req);
+  check("dl if-range changed", req.out().find("Status: 206") ==
+                                       std::string::npos &&
+                                   req.out().find("\r\n\r\nhello") !=
+                                       std::string::npos);
+
+  req.reset("/dl", b_query.c_str(), "");
+  req.param("HTTP_RANGE", "bytes=5-");
+  fakeRun(dlHandler, &dl, &req);
+  check("dl range unsatisfiable",
+        req.out().find("Status: 416") == 0 &&
+            req.out().find("Content-Range: bytes */5") != std::string::npos);
+
+  // 压缩存储的文件，客户端接受zstd时原样交给nginx
+  req.reset("/dl", dlQuery("mike", "tok", MD5_C, "c.log").c_str(), "");
+  req.param("HTTP_ACCEPT_ENCODING", "gzip, zstd");
+  fakeRun(dlHandler, &dl, &req);
+  check("dl encoded", req.out().find("X-Accel-Redirect: /dl_internal/" +
+                                     id_c) != std::string::npos &&
+                          req.out().find("X-File-Encoding: zstd\r\n") !=
+                              std::string::npos);
+
+  // 下载量记在文件主人的文件上
+  pvFlush(&meta, nullptr, true);
+  std::unique_ptr<MetaRows> rows = meta.listUserFiles("pvdesc", "mike", 0, 10);
+  char **row = rows->next();
+  long pv_a = 0, pv_b = 0;
+  for (; row != nullptr; row = rows->next()) {
+    if (strcmp(row[3], "a b.bin") == 0) pv_a = atol(row[5]);
+    if (strcmp(row[3], "b.txt") == 0) pv_b = atol(row[5]);
+  }
+  check("dl pv", pv_a == 1 && pv_b == 3);
+}
+
+// 本机磁盘缓存：访问第二次时取入，之后由nginx从缓存目录发送
+static void testDlCache(CgiContext *ctx, FakeBlobStore *blobs) {
+  const char *MD5_HELLO = "5d41402abc4b2a76b9719d911017c592";
+  const char *MD5_WORLD = "7d793037a0760186574b0282f2f435e7";
+  const char *MD5_BAD = "00000000000000000000000000000000";
+  FakeMetaStore meta;
+  CgiContext dl = *ctx;
+  dl.meta = &meta;
+
+  std::string id_h = putBlob(blobs, "xxxxhelloyyyy");
+  meta.addFileInfo(MD5_HELLO, id_h.c_str(), "http://x", 5, "txt");
+  meta.file(MD5_HELLO)->pack_offset = 4;
+  meta.file(MD5_HELLO)->pack_length = 5;
+  meta.addUserFile("mike", MD5_HELLO, "h.txt", "2023-07-04 12:00:00");
+  std::string id_w = putBlob(blobs, "world");
+  meta.addFileInfo(MD5_WORLD, id_w.c_str(), "http://x", 5, "txt");
+  meta.addUserFile("mike", MD5_WORLD, "w.txt", "2023-07-04 12:00:00");
+  std::string id_bad = putBlob(blobs, "hello");
+  meta.addFileInfo(MD5_BAD, id_bad.c_str(), "http://x", 5, "txt");
+  meta.file(MD5_BAD)->pack_offset = 0;
+  meta.file(MD5_BAD)->pack_length = 5;
+  meta.addUserFile("mike", MD5_BAD, "bad.txt", "2023-07-04 12:00:00");
+
+  shm_unlink("/filehub_cache_sketch_1024");
+  CacheConfig cfg;
+  cfg.dir = "dl_cache_test";
+  cfg.sketch_width = 1024;
+  cacheInit(cfg);
+
+  FakeRequest req;
+  const std::string h_query = dlQuery("mike", "tok", MD5_HELLO, "h.txt");
+  req.reset("/dl", h_query.c_str(), "");
+  fakeRun(dlHandler, &dl, &req);
+  check("dl cache first access",
+        req.out().find("X-Accel-Redirect") == std::string::npos &&
+            req.out().compare(req.out().size() - 5, 5, "hello") == 0);
+
+  const std::string cached =
+      "X-Accel-Redirect: /dl_cache/" + cacheName(id_h) + "@4\r\n";
+  req.reset("/dl", h_query.c_str(), "");
+  fakeRun(dlHandler, &dl, &req);
+  long downloads = blobs->downloads();
+  check("dl cache fill", req.out().find(cached) != std::string::npos);
+  req.reset("/dl", h_query.c_str(), "");
+  fakeRun(dlHandler, &dl, &req);
+  check("dl cache hit", req.out().find(cached) != std::string::npos &&
+                            blobs->downloads() == downloads);
+
+  const std::string w_query = dlQuery("mike", "tok", MD5_WORLD, "w.txt");
+  req.reset("/dl", w_query.c_str(), "");
+  fakeRun(dlHandler, &dl, &req);
+  check("dl cache plain miss",
+        req.out().find("X-Accel-Redirect: /dl_internal/" + id_w) !=
+            std::string::npos);
+  req.reset("/dl", w_query.c_str(), "");
+  fakeRun(dlHandler, &dl, &req);
+  check("dl cache plain fill",
+        req.out().find("X-Accel-Redirect: /dl_cache/" + cacheName(id_w)) !=
+            std::string::npos);
+
+  // 内容与md5不一致时不缓存，仍由cgi发送
+  const std::string bad_query = dlQuery("mike", "tok", MD5_BAD, "bad.txt");
+  req.reset("/dl", bad_query.c_str(), "");
+  fakeRun(dlHandler, &dl, &req);
+  req.reset("/dl", bad_query.c_str(), "");
+  fakeRun(dlHandler, &dl, &req);
+  check("dl cache md5 mismatch",
+        req.out().find("X-Accel-Redirect") == std::string::npos &&
+            req.out().compare(req.out().size() - 5, 5, "hello") == 0);
+
+  cacheInit(CacheConfig());
+  system("rm -rf dl_cache_test");
+  shm_unlink("/filehub_cache_sketch_1024");
+}
+
+static std::string zipBody(const char *token, const std::string &files) {
+  return std::string("{\"user\":\"mike\",\"token\":\"") + token +
+         "\",\"name\":\"my files.zip\",\"files\":[" + files + "]}";
+}
+
+static std::string zipFile(const char *md5, const char *filename) {
+  return std::string("{\"md5\":\"") + md5 + "\",\"filename\":\"" +
+         filename + "\"}";
+}
+
+// 打包下载：检查响应头和归档中的文件名，内容由zip_test检查
+static void testDlZip(CgiContext *ctx, FakeBlobStore *blobs) {
+  const char *MD5_A = "0cc175b9c0f1b6a831c399e269772661";
+  const char *MD5_A2 = "92eb5ffee6ae2fec3ad71c777531578f";
+  const char *MD5_T = "4a8a08f09d37b73795649038408b5f33";
+  FakeMetaStore meta;
+  CgiContext dl = *ctx;
+  dl.meta = &meta;
+
+  std::string id_a = putBlob(blobs, "hello");
+  meta.addFileInfo(MD5_A, id_a.c_str(), "http://x", 5, "bin");
+  meta.addUserFile("mike", MD5_A, "a.bin", "2023-07-06 12:00:00");
+  std::string id_a2 = putBlob(blobs, "world!");
+  meta.addFileInfo(MD5_A2, id_a2.c_str(), "http://x", 6, "bin");
+  meta.addUserFile("mike", MD5_A2, "a.bin", "2023-07-06 12:00:00");
+  std::string id_t = putBlob(blobs, "xxxx" + std::string(10000, 't'));
+  meta.addFileInfo(MD5_T, id_t.c_str(), "http://x", 10000, "txt");
+  meta.file(MD5_T)->pack_offset = 4;
+  meta.file(MD5_T)->pack_length = 10000;
+  meta.addUserFile("mike", MD5_T, "t.txt", "2023-07-06 12:00:00");
+
+  // 全部原样存储，有Content-Length，重名的文件加序号
+  FakeRequest req;
+  req.reset("/dl", "cmd=zip",
+            zipBody("tok", zipFile(MD5_A, "a.bin") + "," +
+                               zipFile(MD5_A2, "a.bin")));
+  fakeRun(dlHandler, &dl, &req);
+  const std::string &out = req.out();
+  size_t body = out.find("\r\n\r\n") + 4;
+  check("zip stored",
+        out.find("Content-Type: application/zip\r\n") != std::string::npos &&
+            out.find("filename*=UTF-8''my%20files.zip") !=
+                std::string::npos &&
+            out.find("Content-Length: " + std::to_string(out.size() - body) +
+                     "\r\n") != std::string::npos &&
+            out.compare(body, 4, "PK\x03\x04") == 0 &&
+            out.find("hello") != std::string::npos &&
+            out.find("a (1).bin") != std::string::npos);
+
+  // 文本文件用deflate压缩，长度未知
+  req.reset("/dl", "cmd=zip", zipBody("tok", zipFile(MD5_T, "t.txt")));
+  fakeRun(dlHandler, &dl, &req);
+  check("zip deflated",
+        req.out().find("Content-Length") == std::string::npos &&
+            req.out().find("PK\x05\x06") != std::string::npos &&
+            req.out().size() < 1000);
+
+  // 响应头发出后storage出错：中断连接，不写中央目录
+  const char *MD5_G = "d41d8cd98f00b204e9800998ecf8427e";
+  meta.addFileInfo(MD5_G, "group1/M00/00/00/gone", "http://x", 3, "bin");
+  meta.addUserFile("mike", MD5_G, "gone.bin", "2023-07-06 12:00:00");
+  req.reset("/dl", "cmd=zip",
+            zipBody("tok", zipFile(MD5_A, "a.bin") + "," +
+                               zipFile(MD5_G, "gone.bin")));
+  fakeRun(dlHandler, &dl, &req);
+  check("zip aborted", req.aborted() &&
+                           req.out().find("PK\x03\x04") != std::string::npos &&
+                           req.out().find("PK\x05\x06") == std::string::npos);
+  req.reset("/dl", "cmd=zip", zipBody("tok", zipFile(MD5_A, "a.bin")));
+  fakeRun(dlHandler, &dl, &req);
+  check("zip not aborted", !req.aborted());
+
+  req.reset("/dl", "cmd=zip",
+            zipBody("tok", zipFile(MD5_A, "a.bin") + "," +
+                               zipFile(MD5_A, "missing.bin")));
+  fakeRun(dlHandler, &dl, &req);
+  check("zip not found", req.out().find("404") != std::string::npos &&
+                             req.out().find("PK") == std::string::npos);
+
+  req.reset("/dl", "cmd=zip", zipBody("bad", zipFile(MD5_A, "a.bin")));
+  fakeRun(dlHandler, &dl, &req);
+  check("zip bad token", req.code() == "111");
+
+  req.reset("/dl", "cmd=zip", zipBody("tok", ""));
+  fakeRun(dlHandler, &dl, &req);
+  check("zip no files", req.code() == "016");
+}
+
+//==================== 循环 ====================
+
+// 同一个请求反复处理，结果不变，输出每次的耗时供参考
+//==================== 共享文件 ====================
+
+static std::string shareBody(const char *token, const char *md5,
+                             const char *filename) {
+  return std::string("{\"user\":\"mike\",\"token\":\"") + token +
+         "\",\"md5\":\"" + md5 + "\",\"filename\":\"" + filename + "\"}";
+}
+
+// 列表只读排行，排行没有建立时由定时任务从mysql同步，这里直接调用shareSync
+static void testSharefiles(CgiContext *ctx) {
+  const char *MD5_A = "0cc175b9c0f1b6a831c399e269772661";
+  const char *MD5_B = "92eb5ffee6ae2fec3ad71c777531578f";
+  FakeMetaStore meta;
+  FakeShareIndex shares;
+  CgiContext sc = *ctx;
+  sc.meta = &meta;
+  sc.shares = &shares;
+  meta.addFileInfo(MD5_A, "group1/M00/00/00/a", "http://a", 5, "txt");
+  meta.addFileInfo(MD5_B, "group1/M00/00/00/b", "http://b", 7, "png");
+  meta.addUserFile("mike", MD5_A, "old.txt", "2023-06-01 12:00:00");
+  meta.addUserFile("mike", MD5_B, "new.png", "2023-06-01 12:00:00");
+  meta.setShared("mike", MD5_A, "old.txt", true, 1688040000);
+
+  FakeRequest req;
+  req.reset("/sharefiles", "cmd=normal", "");
+  fakeRun(sharefilesHandler, &sc, &req);
+  check("share list not built", req.code() == "015" && shares.syncs() == 0);
+
+  // 请求路径上不重建，shareSyncSoon让下一次同步不等间隔
+  check("share sync soon", shareSync(&meta, &shares, false) == 1);
+  req.reset("/sharefiles", "cmd=normal", "");
+  fakeRun(sharefilesHandler, &sc, &req);
+  check("share list synced",
+        shares.syncs() == 1 &&
+            req.out().find("\"total\":1,") != std::string::npos &&
+            req.out().find("\"filename\":\"old.txt\"") != std::string::npos);
+
+  req.reset("/sharefiles", "cmd=share", shareBody("tok", MD5_B, "new.png"));
+  fakeRun(sharefilesHandler, &sc, &req);
+  bool shared = false;
+  for (const FakeMetaStore::UserFile &f : *meta.userFiles("mike")) {
+    if (f.filename == "new.png") shared = f.shared && f.share_time > 0;
+  }
+  check("share", req.code() == "011" && shared);
+
+  req.reset("/sharefiles", "cmd=share", shareBody("bad", MD5_B, "new.png"));
+  fakeRun(sharefilesHandler, &sc, &req);
+  check("share bad token", req.code() == "111");
+  req.reset("/sharefiles", "cmd=share", shareBody("tok", MD5_B, "x.png"));
+  fakeRun(sharefilesHandler, &sc, &req);
+  check("share not found", req.code() == "012");
+
+  // 新共享的在前
+  req.reset("/sharefiles", "cmd=normal&start=0&count=10", "");
+  fakeRun(sharefilesHandler, &sc, &req);
+  const std::string &out = req.out();
+  check("share list by time",
+        out.find("\"total\":2,") != std::string::npos &&
+            out.find("new.png") < out.find("old.txt") &&
+            out.find("\"time\":\"2023-06-29") != std::string::npos);
+  // 只公开/dl的地址，不公开storage上的url
+  check("share list url",
+        out.find("\"url\":\"/dl?owner=mike&md5=" + std::string(MD5_B) +
+                 "&filename=new.png\"") != std::string::npos &&
+            out.find("http://") == std::string::npos);
+
+  // 下载量推送时累加到排行，不读mysql
+  pvRecord("mike", MD5_A, "old.txt");
+  pvRecord("mike", MD5_A, "old.txt");
+  pvFlush(&meta, nullptr, true, &shares);
+  req.reset("/sharefiles", "cmd=pvdesc&count=1", "");
+  fakeRun(sharefilesHandler, &sc, &req);
+  check("share list by pv",
+        req.out().find("\"filename\":\"old.txt\"") != std::string::npos &&
+            req.out().find("\"pv\":2,") != std::string::npos &&
+            req.out().find("new.png") == std::string::npos &&
+            shares.syncs() == 1);
+
+  req.reset("/sharefiles", "cmd=pvdesc&start=x", "");
+  fakeRun(sharefilesHandler, &sc, &req);
+  check("share list bad start", req.code() == "015");
+
+  req.reset("/sharefiles", "cmd=cancel", shareBody("tok", MD5_A, "old.txt"));
+  fakeRun(sharefilesHandler, &sc, &req);
+  req.reset("/sharefiles", "cmd=count", "");
+  fakeRun(sharefilesHandler, &sc, &req);
+  check("share cancel", req.out().find("{\"num\":1}") != std::string::npos);
+
+  // redis重启后重新从mysql建立
+  shares.clear();
+  req.reset("/sharefiles", "cmd=count", "");
+  fakeRun(sharefilesHandler, &sc, &req);
+  check("share not rebuilt inline", req.code() == "015");
+  shareSync(&meta, &shares, false);
+  req.reset("/sharefiles", "cmd=count", "");
+  fakeRun(sharefilesHandler, &sc, &req);
+  check("share rebuilt", shares.syncs() == 2 &&
+                             req.out().find("{\"num\":1}") !=
+                                 std::string::npos);
+
+  // 读mysql失败时释放锁，其它进程不必等到间隔结束
+  meta.setFail(true);
+  check("share sync failed", shareSync(&meta, &shares, true) == -1 &&
+                                 shares.releases() == 1);
+  meta.setFail(false);
+
+  shares.setFail(true);
+  req.reset("/sharefiles", "cmd=normal", "");
+  fakeRun(sharefilesHandler, &sc, &req);
+  check("share list failed", req.code() == "015");
+}
+
+// 分享短链接：任何人不登录下载，code只解析一次，次数用完后404
+static void testShareLink(CgiContext *ctx, FakeBlobStore *blobs) {
+  const char *MD5_A = "0cc175b9c0f1b6a831c399e269772661";
+  FakeMetaStore meta;
+  CgiContext sc = *ctx;
+  sc.meta = &meta;
+  std::string id_a = putBlob(blobs, "hello");
+  meta.addFileInfo(MD5_A, id_a.c_str(), "http://x", 5, "txt");
+  meta.addUserFile("mike", MD5_A, "a.txt", "2023-07-10 12:00:00");
+
+  FakeRequest req;
+  req.reset("/sharefiles", "cmd=link",
+            "{\"user\":\"mike\",\"token\":\"tok\",\"md5\":\"" +
+                std::string(MD5_A) +
+                "\",\"filename\":\"a.txt\",\"max_downloads\":2}");
+  fakeRun(sharefilesHandler, &sc, &req);
+  size_t pos = req.out().find("\"link\":\"");
+  std::string code =
+      pos == std::string::npos ? "" : req.out().substr(pos + 8, 16);
+  check("link create", req.code() == "011" && meta.link(code.c_str()) &&
+                           meta.link(code.c_str())->max_downloads == 2 &&
+                           req.out().find("\"expire_time\":0") !=
+                               std::string::npos);
+
+  req.reset("/sharefiles", "cmd=link", shareBody("bad", MD5_A, "a.txt"));
+  fakeRun(sharefilesHandler, &sc, &req);
+  check("link bad token", req.code() == "111");
+  req.reset("/sharefiles", "cmd=link", shareBody("tok", MD5_A, "x.txt"));
+  fakeRun(sharefilesHandler, &sc, &req);
+  check("link not found", req.code() == "012");
+
+  // 续传的请求不计次数
+  const std::string query = "link=" + code;
+  req.reset("/dl", query.c_str(), "");
+  fakeRun(dlHandler, &sc, &req);
+  check("link dl",
+        req.out().find("X-Accel-Redirect: /dl_internal/" + id_a + "\r\n") !=
+                std::string::npos &&
+            req.out().find("filename*=UTF-8''a.txt") != std::string::npos);
+  req.reset("/dl", query.c_str(), "");
+  req.param("HTTP_RANGE", "bytes=2-");
+  fakeRun(dlHandler, &sc, &req);
+  check("link dl resume",
+        req.out().find("X-Accel-Redirect") != std::string::npos);
+  req.reset("/dl", query.c_str(), "");
+  fakeRun(dlHandler, &sc, &req);
+  check("link dl second", req.out().find("X-Accel-Redirect") !=
+                              std::string::npos);
+  req.reset("/dl", query.c_str(), "");
+  fakeRun(dlHandler, &sc, &req);
+  check("link dl limit", req.out().find("404") != std::string::npos &&
+                             meta.linkLookups() == 1);
+  req.reset("/dl", query.c_str(), "");
+  req.param("HTTP_RANGE", "bytes=1-");
+  fakeRun(dlHandler, &sc, &req);
+  check("link dl limit range",
+        req.out().find("X-Accel-Redirect") != std::string::npos);
+
+  req.reset("/dl", "link=0000000000000000", "");
+  fakeRun(dlHandler, &sc, &req);
+  check("link dl unknown", req.out().find("404") != std::string::npos);
+
+  linkFlush(&meta, nullptr, true);
+  check("link hits", meta.link(code.c_str())->hits == 2);
+}
+
+static void testLoop(CgiContext *ctx) {
+  FakeRequest req;
+  req.reset("/myfiles", "cmd=normal",
+            "{\"user\":\"mike\",\"token\":\"tok\",\"start\":0,\"count\":10}");
+  fakeRun(myfilesHandler, ctx, &req);
+  const std::string first = req.out();
+
+  const int n = 10000;
+  bool same = true;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < n; i++) {
+    req.rewind();
+    fakeRun(myfilesHandler, ctx, &req);
+    same = same && req.out() == first;
+  }
+  auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start)
+                .count();
+  printf("myfiles list: %.0f ns/op\n", (double)ns / n);
+  check("loop stable", same);
+}
+
+int main() {
+  FakeMetaStore meta;
+  FakeTokenStore tokens;
+  FakeBlobStore blobs;
+  CgiContext ctx = fakeCgiContext(&meta, &tokens, &blobs);
+  tokens.put("mike", "tok");
+
+  testMd5(&ctx, &meta);
+  testMyfiles(&ctx);
+  testUpload(&ctx, &meta, &blobs);
+  testDl(&ctx, &tokens, &blobs);
+  testDlCache(&ctx, &blobs);
+  testDlZip(&ctx, &blobs);
+  testSharefiles(&ctx);
+  testShareLink(&ctx, &blobs);
+  testLoop(&ctx);
+  printf(failed == 0 ? "ALL OK\n" : "%d FAILED\n", failed);
+  return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,3 @@
+#!/bin/bash
+g++ -std=c++17 -O2 -DCGI_GATEWAY -I ../../src handler_test.cpp ../../src/fake_util.cpp ../../src/backend_util.cpp ../../src/md5_cgi.cpp ../../src/myfiles_cgi.cpp ../../src/upload_cgi.cpp ../../src/dl_cgi.cpp ../../src/pv_util.cpp ../../src/link_util.cpp ../../src/range_util.cpp ../../src/cache_util.cpp ../../src/zip_util.cpp ../../src/sharefiles_cgi.cpp ../../src/share_util.cpp ../../src/delta_util.cpp ../../src/cgi_server.cpp ../../src/prefork_util.cpp ../../src/ratelimit_util.cpp ../../src/admission_util.cpp ../../src/trace_util.cpp ../../src/metrics_util.cpp ../../src/quota_util.cpp ../../src/storage_util.cpp ../../src/pack_util.cpp ../../src/compress_util.cpp ../../src/cgi_util.cpp ../../src/str_scan.cpp ../../src/mysql_util.cpp ../../src/json_util.cpp ../../src/response_util.cpp ../../src/query_util.cpp ../../src/make_log.cpp -o handler_test -lfcgi -lmysqlclient -lredis++ -lhiredis -lzstd -lfastcommon -lz -lpthread -lrt
+./handler_test
@@ -0,0 +1,80 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "json_util.h"
+
+extern "C" void *__libc_malloc(size_t size);
+
+// 统计malloc调用次数，验证稳定状态下解码不再申请内存
+static long malloc_count = 0;
+
+extern "C" void *malloc(size_t size) {
+  malloc_count++;
+  return __libc_malloc(size);
+}
+
+static int failed = 0;
+
+static void check(const char *name, bool ok) {
+  printf("%-40s %s\n", name, ok ? "OK" : "WRONG");
+  if (!ok) failed++;
+}
+
+struct ListInfo {
+  char user[16];
+  char token[16];
+  int start;
+  int count;
+};
+
+static int decodeList(const char *json, ListInfo *info) {
+  char buf[256];
+  strcpy(buf, json);
+  const JsonField fields[] = {
+      jsonStr("user", info->user, sizeof(info->user)),
+      jsonStr("token", info->token, sizeof(info->token)),
+      jsonInt("start", &info->start),
+      jsonInt("count", &info->count, false),
+  };
+  return jsonDecode(buf, fields, "json_test");
+}
+
+int main() {
+  ListInfo info = {};
+  info.count = 10;
+
+  check("decode",
+        decodeList("{\"user\":\"mike\",\"token\":\"abc\",\"start\":5}", &info) ==
+                0 &&
+            strcmp(info.user, "mike") == 0 && info.start == 5);
+  check("optional keeps default", info.count == 10);
+  check("escaped string",
+        decodeList("{\"user\":\"a\\\"b\",\"token\":\"t\",\"start\":0}",
+                   &info) == 0 &&
+            strcmp(info.user, "a\"b") == 0);
+  check("missing field",
+        decodeList("{\"user\":\"mike\",\"start\":0}", &info) == -1);
+  check("wrong type",
+        decodeList("{\"user\":\"mike\",\"token\":\"t\",\"start\":\"0\"}",
+                   &info) == -1);
+  check("too long",
+        decodeList("{\"user\":\"0123456789abcdef\",\"token\":\"t\",\"start\":0}",
+                   &info) == -1);
+  check("bad json", decodeList("{\"user\":", &info) == -1);
+
+  // 预热后重复解码+回收，不应再有malloc
+  const char *json =
+      "{\"user\":\"mike\",\"token\":\"abc\",\"start\":0,\"count\":10}";
+  decodeList(json, &info);
+  jsonResetArena();
+  long before = malloc_count;
+  for (int i = 0; i < 10000; i++) {
+    decodeList(json, &info);
+    jsonResetArena();
+  }
+  check("no malloc in steady state", malloc_count == before);
+
+  printf("%s\n", failed == 0 ? "ALL OK" : "FAILED");
+  return failed == 0 ? 0 : 1;
+}
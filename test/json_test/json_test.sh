@@ -0,0 +1,3 @@
+#!/bin/bash
+g++ -std=c++17 -I ../../src json_test.cpp ../../src/json_util.cpp ../../src/make_log.cpp -o json_test
+./json_test
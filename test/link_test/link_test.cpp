@@ -0,0 +1,130 @@
+#include <cstdio>
+#include <ctime>
+#include <set>
+#include <string>
+
+#include "fake_util.h"
+#include "link_util.h"
+
+static int failed = 0;
+
+static void check(const char *name, bool ok) {
+  printf("%-40s %s\n", name, ok ? "OK" : "WRONG");
+  if (!ok) failed++;
+}
+
+static bool base62(const std::string &code) {
+  if ((int)code.size() != LINK_CODE_LEN) return false;
+  for (char c : code) {
+    if (!((c >= '0' && c <= '9') || (c >= 'A' && c <= 'Z') ||
+          (c >= 'a' && c <= 'z'))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static ShareLink newLink(const char *filename, long expire_time = 0,
+                         long max_downloads = 0) {
+  ShareLink link;
+  link.user = "mike";
+  link.md5 = "5d41402abc4b2a76b9719d911017c592";
+  link.filename = filename;
+  link.expire_time = expire_time;
+  link.max_downloads = max_downloads;
+  return link;
+}
+
+int main() {
+  // 没有redis：LRU -> mysql，计数直接落库
+  FakeMetaStore meta;
+  LinkConfig cfg;
+  cfg.cache_size = 2;
+  linkInit(cfg);
+
+  std::set<std::string> codes;
+  bool ok = true;
+  for (int i = 0; i < 1000; i++) {
+    std::string code = linkCode();
+    ok = ok && base62(code);
+    codes.insert(code);
+  }
+  check("code format", ok);
+  check("code unique", codes.size() == 1000);
+
+  ShareLink a = newLink("a.txt");
+  check("create", linkCreate(&meta, nullptr, &a) == 0 && base62(a.code) &&
+                      meta.link(a.code.c_str()) != nullptr &&
+                      meta.link(a.code.c_str())->filename == "a.txt");
+
+  ShareLink got;
+  long lookups = meta.linkLookups();
+  ok = true;
+  for (int i = 0; i < 100; i++) {
+    ok = ok && linkResolve(&meta, nullptr, a.code.c_str(), &got) == 0 &&
+         got.filename == "a.txt" && got.user == "mike";
+  }
+  check("resolve cached", ok && meta.linkLookups() == lookups + 1);
+
+  // 不存在的code也只查一次，格式不对的不查
+  const char *unknown = "0000000000000000";
+  lookups = meta.linkLookups();
+  ok = true;
+  for (int i = 0; i < 100; i++) {
+    ok = ok && linkResolve(&meta, nullptr, unknown, &got) == 1;
+  }
+  check("negative cached", ok && meta.linkLookups() == lookups + 1);
+  check("bad code no lookup",
+        linkResolve(&meta, nullptr, "short", &got) == 1 &&
+            linkResolve(&meta, nullptr, "000000000000000'", &got) == 1 &&
+            linkResolve(&meta, nullptr, "00000000000000000", &got) == 1 &&
+            meta.linkLookups() == lookups + 1);
+
+  ShareLink expired = newLink("b.txt", time(nullptr) - 1);
+  linkCreate(&meta, nullptr, &expired);
+  ShareLink later = newLink("c.txt", time(nullptr) + 3600);
+  linkCreate(&meta, nullptr, &later);
+  check("expired", linkResolve(&meta, nullptr, expired.code.c_str(), &got) == 1);
+  check("not expired",
+        linkResolve(&meta, nullptr, later.code.c_str(), &got) == 0 &&
+            got.expire_time == later.expire_time);
+
+  // 容量为2，a最久没用，被淘汰后重新查mysql
+  lookups = meta.linkLookups();
+  linkResolve(&meta, nullptr, a.code.c_str(), &got);
+  check("lru evicted", meta.linkLookups() == lookups + 1);
+  linkResolve(&meta, nullptr, a.code.c_str(), &got);
+  check("lru refilled", meta.linkLookups() == lookups + 1);
+
+  // 次数限制：落库前后都按累计的点击量判断
+  ShareLink limited = newLink("d.txt", 0, 3);
+  linkCreate(&meta, nullptr, &limited);
+  linkResolve(&meta, nullptr, limited.code.c_str(), &got);
+  check("hit", linkHit(nullptr, got, true) == 0 && linkHit(nullptr, got, true) == 0);
+  check("flush", linkFlush(&meta, nullptr, true) == 1 &&
+                     meta.link(limited.code.c_str())->hits == 2);
+  linkResolve(&meta, nullptr, limited.code.c_str(), &got);
+  // 只检查不计数，否则下面第二次就用完了
+  check("check only", linkHit(nullptr, got, false) == 0 &&
+                          linkHit(nullptr, got, false) == 0);
+  check("limit", got.hits == 2 && linkHit(nullptr, got, true) == 0 &&
+                     linkHit(nullptr, got, true) == 1);
+  // 次数用完后，用掉最后一次的下载仍可以续传
+  check("limit range", linkHit(nullptr, got, false) == 0);
+  check("unlimited", linkHit(nullptr, a, true) == 0 && linkHit(nullptr, a, true) == 0);
+  check("flush batched", linkFlush(&meta, nullptr, true) == 2 &&
+                             meta.link(limited.code.c_str())->hits == 3 &&
+                             meta.link(a.code.c_str())->hits == 2);
+  check("nothing to flush", linkFlush(&meta, nullptr, true) == 0);
+
+  // mysql出错时计数留到下一次
+  linkHit(nullptr, a, true);
+  meta.setFail(true);
+  check("flush failed", linkFlush(&meta, nullptr, true) == -1);
+  meta.setFail(false);
+  check("flush retried", linkFlush(&meta, nullptr, true) == 1 &&
+                             meta.link(a.code.c_str())->hits == 3);
+
+  printf(failed == 0 ? "ALL OK\n" : "%d FAILED\n", failed);
+  return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,3 @@
+#!/bin/bash
+g++ -std=c++17 -I ../../src link_test.cpp ../../src/link_util.cpp ../../src/pv_util.cpp ../../src/fake_util.cpp ../../src/backend_util.cpp ../../src/cgi_server.cpp ../../src/prefork_util.cpp ../../src/ratelimit_util.cpp ../../src/admission_util.cpp ../../src/trace_util.cpp ../../src/metrics_util.cpp ../../src/storage_util.cpp ../../src/pack_util.cpp ../../src/compress_util.cpp ../../src/cgi_util.cpp ../../src/str_scan.cpp ../../src/mysql_util.cpp ../../src/json_util.cpp ../../src/response_util.cpp ../../src/query_util.cpp ../../src/make_log.cpp -o link_test -lfcgi -lmysqlclient -lredis++ -lhiredis -lzstd -lfastcommon -lz -lpthread -lrt
+./link_test
@@ -0,0 +1,133 @@
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "metrics_util.h"
+
+static int failed = 0;
+
+static void check(const char *name, bool ok) {
+  printf("%-40s %s\n", name, ok ? "OK" : "WRONG");
+  if (!ok) failed++;
+}
+
+// 取指标的值，line为"名字{标签}"
+static long long value(const std::string &text, const std::string &line) {
+  size_t pos = text.find("\n" + line + " ");
+  if (pos == std::string::npos) {
+    return -1;
+  }
+  return atoll(text.c_str() + pos + line.size() + 2);
+}
+
+//==================== 分桶 ====================
+
+static void testBuckets() {
+  check("small in first bucket", metricsBucket(0) == 0 &&
+                                     metricsBucket(15) == 0);
+  check("bucket 16us", metricsBucket(16) == 1 &&
+                           metricsBucketUpper(1) == 20);
+  check("overflow", metricsBucket(1LL << 26) == METRICS_BUCKETS &&
+                        metricsBucket(-1) == 0);
+
+  // 每个值落在的桶上界大于它，前一个桶的上界不大于它
+  bool ok = true;
+  for (int64_t us = 16; us < (1LL << 26); us = us * 9 / 8 + 1) {
+    int b = metricsBucket(us);
+    if (!(us < metricsBucketUpper(b) && metricsBucketUpper(b - 1) <= us)) {
+      ok = false;
+    }
+    // 桶的相对宽度不超过25%
+    int64_t width = metricsBucketUpper(b) - metricsBucketUpper(b - 1);
+    if (b > 1 && width * 4 > metricsBucketUpper(b - 1)) {
+      ok = false;
+    }
+  }
+  check("bucket bounds", ok);
+  check("last bucket 67s",
+        metricsBucketUpper(METRICS_BUCKETS - 1) == (1LL << 26));
+}
+
+//==================== 记录和合并 ====================
+
+static void testRecord() {
+  std::string name = "/filehub_metrics_test_" + std::to_string(getpid());
+  check("open", metricsOpen(name.c_str()) == 0);
+  int upload = metricsEndpoint("/upload", nullptr);
+  int login = metricsEndpoint("/login", nullptr);
+  check("endpoint ids", upload == 0 && login == 1 &&
+                            metricsEndpoint("/upload", nullptr) == upload);
+
+  metricsRequestBegin(upload, 1000);
+  metricsRequestBegin(upload, 500);
+  metricsRequestEnd(upload, 2000);
+  metricsDep(DEP_MYSQL, 300, true);
+  metricsDep(DEP_MYSQL, 100000, false);
+  {
+    MetricTimer timer(DEP_STORAGE_UPLOAD);
+    timer.fail();
+  }
+
+  // 其他线程各写自己的分片
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 4; i++) {
+    threads.emplace_back([login] {
+      for (int j = 0; j < 1000; j++) {
+        metricsRequestBegin(login, 10);
+        metricsRequestEnd(login, 50);
+      }
+    });
+  }
+  for (auto &t : threads) t.join();
+
+  // 已退出进程的计数仍然计入，在途数不计入
+  pid_t pid = fork();
+  if (pid == 0) {
+    metricsRequestBegin(upload, 7);
+    metricsRequestBegin(upload, 0);
+    metricsRequestEnd(upload, 40);
+    _exit(0);
+  }
+  waitpid(pid, nullptr, 0);
+
+  std::string text;
+  metricsRender(&text);
+  const std::string u = "{endpoint=\"/upload\",cmd=\"\"}";
+  const std::string l = "{endpoint=\"/login\",cmd=\"\"}";
+  check("requests merged",
+        value(text, "filehub_requests_total" + u) == 2 &&
+            value(text, "filehub_requests_total" + l) == 4000);
+  check("bytes", value(text, "filehub_request_bytes_total" + u) == 1507 &&
+                     value(text, "filehub_request_bytes_total" + l) == 40000);
+  check("inflight", value(text, "filehub_inflight_requests" + u) == 1 &&
+                        value(text, "filehub_inflight_requests" + l) == 0);
+  check("histogram buckets",
+        value(text, "filehub_request_duration_seconds_bucket{endpoint="
+                    "\"/upload\",cmd=\"\",le=\"4.8e-05\"}") == 1 &&
+            value(text, "filehub_request_duration_seconds_bucket{endpoint="
+                        "\"/upload\",cmd=\"\",le=\"+Inf\"}") == 2);
+  check("dependency",
+        value(text, "filehub_dependency_duration_seconds_count"
+                    "{dep=\"mysql\"}") == 2 &&
+            value(text, "filehub_dependency_errors_total{dep=\"mysql\"}") ==
+                1 &&
+            value(text, "filehub_dependency_errors_total"
+                        "{dep=\"storage_upload\"}") == 1);
+  check("type lines",
+        text.find("# TYPE filehub_request_duration_seconds histogram") !=
+            std::string::npos);
+  shm_unlink(name.c_str());
+}
+
+int main() {
+  testBuckets();
+  testRecord();
+  printf(failed == 0 ? "ALL OK\n" : "%d FAILED\n", failed);
+  return failed == 0 ? 0 : 1;
+}
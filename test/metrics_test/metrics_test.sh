@@ -0,0 +1,3 @@
+#!/bin/bash
+g++ -std=c++17 -I ../../src metrics_test.cpp ../../src/metrics_util.cpp ../../src/make_log.cpp -o metrics_test -lpthread -lrt
+./metrics_test
@@ -0,0 +1,266 @@
+#include <benchmark/benchmark.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#include "cgi_handlers.h"
+#include "cgi_util.h"
+#include "fake_util.h"
+#include "make_log.h"
+#include "query_util.h"
+#include "response_util.h"
+
+/*
+   热点函数的微基准，结果以JSON输出(见micro_bench.sh)，优化前后各跑一次对比：
+
+     ./micro_bench.sh                                 # 全部
+     ./micro_bench.sh --benchmark_filter=Multipart    # 只跑上传解析
+*/
+
+static const char *const MD5 = "e8ea6031b779ac26c319ddf949ad9d8d";
+
+//==================== cgi_util ====================
+
+static void BM_TrimSpace(benchmark::State &state) {
+  char buf[64];
+  for (auto _ : state) {
+    strcpy(buf, "   mike.mp4 \t  ");
+    benchmark::DoNotOptimize(trimSpace(buf));
+  }
+}
+BENCHMARK(BM_TrimSpace);
+
+// 在range(0)字节的数据末尾查找分界线，最坏情况
+static void BM_Memstr(benchmark::State &state) {
+  std::string hay(state.range(0), 'x');
+  char needle[] = "------WebKitFormBoundary88asdgewtgewx";
+  hay.replace(hay.size() - sizeof(needle) + 1, sizeof(needle) - 1, needle);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(memstr(hay.data(), hay.size(), needle));
+  }
+  state.SetBytesProcessed(state.iterations() * hay.size());
+}
+BENCHMARK(BM_Memstr)->RangeMultiplier(32)->Range(1 << 10, 1 << 20);
+
+static void BM_QueryParse(benchmark::State &state) {
+  QueryParams params;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(
+        params.parse("cmd=normal&user=mike&file=%E6%96%87%E4%BB%B6.mp4&n=10"));
+    benchmark::DoNotOptimize(params.get("cmd"));
+  }
+}
+BENCHMARK(BM_QueryParse);
+
+static void BM_GetFileSuffix(benchmark::State &state) {
+  char suffix[SUFFIX_LEN];
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(getFileSuffix("holiday.2023.tar.gz", suffix));
+  }
+}
+BENCHMARK(BM_GetFileSuffix);
+
+//==================== 响应 ====================
+
+static void BM_AppendStatus(benchmark::State &state) {
+  std::string out;
+  for (auto _ : state) {
+    out.clear();
+    appendStatus(&out, "006");
+    benchmark::DoNotOptimize(out.data());
+  }
+}
+BENCHMARK(BM_AppendStatus);
+
+// 经FCGX流写出，与处理函数中的writeStatus相同
+static void BM_WriteStatus(benchmark::State &state) {
+  FakeRequest req;
+  for (auto _ : state) {
+    req.rewind();
+    writeStatus(request.out, "006");
+  }
+}
+BENCHMARK(BM_WriteStatus);
+
+//==================== json解析 ====================
+
+// 解析函数原地修改缓冲区，每次先拷贝一份
+template <typename Parse>
+static void runParse(benchmark::State &state, const char *json, Parse parse) {
+  char buf[1024];
+  size_t len = strlen(json) + 1;
+  for (auto _ : state) {
+    memcpy(buf, json, len);
+    benchmark::DoNotOptimize(parse(buf));
+  }
+}
+
+static void BM_ParseLogin(benchmark::State &state) {
+  char user[USER_NAME_LEN], pwd[PWD_LEN];
+  runParse(state,
+           "{\"userName\":\"mike\","
+           "\"passWord\":\"e10adc3949ba59abbe56e057f20f883e\"}",
+           [&](char *buf) {
+             return getLoginInfo(buf, user, sizeof(user), pwd, sizeof(pwd));
+           });
+}
+BENCHMARK(BM_ParseLogin);
+
+static void BM_ParseReg(benchmark::State &state) {
+  char user[128], nick[128], pwd[128], email[128];
+  runParse(state,
+           "{\"userName\":\"mike\",\"nickName\":\"Mike\","
+           "\"firstPwd\":\"e10adc3949ba59abbe56e057f20f883e\","
+           "\"email\":\"mike@example.com\"}",
+           [&](char *buf) {
+             return getRegInfo(buf, user, nick, pwd, email, sizeof(user));
+           });
+}
+BENCHMARK(BM_ParseReg);
+
+static void BM_ParseMd5(benchmark::State &state) {
+  char user[USER_NAME_LEN], token[TOKEN_LEN], md5[MD5_LEN],
+      filename[FILE_NAME_LEN];
+  runParse(state,
+           "{\"user\":\"mike\",\"token\":\"3a8a1d3dbf6f0e3b6c2c5f4a1e9d0b7c\","
+           "\"md5\":\"e8ea6031b779ac26c319ddf949ad9d8d\","
+           "\"filename\":\"holiday.mp4\"}",
+           [&](char *buf) {
+             return get_md5_info(buf, user, token, md5, filename);
+           });
+}
+BENCHMARK(BM_ParseMd5);
+
+static void BM_ParseCount(benchmark::State &state) {
+  char user[USER_NAME_LEN], token[TOKEN_LEN];
+  runParse(state,
+           "{\"user\":\"mike\","
+           "\"token\":\"3a8a1d3dbf6f0e3b6c2c5f4a1e9d0b7c\"}",
+           [&](char *buf) { return get_count_info(buf, user, token); });
+}
+BENCHMARK(BM_ParseCount);
+
+static void BM_ParseFilesList(benchmark::State &state) {
+  char user[USER_NAME_LEN], token[TOKEN_LEN];
+  int start, count;
+  runParse(state,
+           "{\"user\":\"mike\",\"token\":\"3a8a1d3dbf6f0e3b6c2c5f4a1e9d0b7c\","
+           "\"start\":0,\"count\":10}",
+           [&](char *buf) {
+             return get_fileslist_info(buf, user, token, start, count);
+           });
+}
+BENCHMARK(BM_ParseFilesList);
+
+static void BM_ParseDelta(benchmark::State &state) {
+  DeltaInfo info;
+  runParse(state,
+           "{\"user\":\"mike\",\"token\":\"3a8a1d3dbf6f0e3b6c2c5f4a1e9d0b7c\","
+           "\"base_md5\":\"e8ea6031b779ac26c319ddf949ad9d8d\","
+           "\"md5\":\"0cc175b9c0f1b6a831c399e269772661\","
+           "\"filename\":\"holiday.mp4\",\"blocksize\":4096}",
+           [&](char *buf) { return getDeltaInfo(buf, &info, true); });
+}
+BENCHMARK(BM_ParseDelta);
+
+//==================== 日志 ====================
+
+static void discardLog(const std::string &, const std::string &msg) {
+  benchmark::DoNotOptimize(msg.data());
+}
+
+// 只格式化，不写文件
+static void BM_LogFormat(benchmark::State &state) {
+  setLogWriter(discardLog);
+  for (auto _ : state) {
+    LOG_INFO("cgi", "bench", "user = %s, token = %s, start = %d, count = %d\n",
+             "mike", "3a8a1d3dbf6f0e3b6c2c5f4a1e9d0b7c", 0, 10);
+  }
+  setLogWriter(nullptr);
+}
+BENCHMARK(BM_LogFormat);
+
+// 格式化并追加到日志文件，range(0)为消息长度
+static void BM_LogFile(benchmark::State &state) {
+  std::string msg(state.range(0), 'x');
+  for (auto _ : state) {
+    LOG_INFO("cgi", "bench", "%s\n", msg.c_str());
+  }
+  state.SetBytesProcessed(state.iterations() * msg.size());
+}
+BENCHMARK(BM_LogFile)->Arg(64)->Arg(1024)->Arg(4000);
+
+//==================== 上传解析 ====================
+
+// 解析range(0)字节的multipart请求体并落盘(未开启压缩)
+static void BM_Multipart(benchmark::State &state) {
+  const std::string boundary = "------WebKitFormBoundary88asdgewtgewx";
+  const size_t size = state.range(0);
+  std::string head = boundary +
+                     "\r\nContent-Disposition: form-data; user=\"mike\"; "
+                     "filename=\"micro_bench.bin\"; md5=\"" +
+                     MD5 + "\"; size=" + std::to_string(size) +
+                     "\r\nContent-Type: application/octet-stream\r\n\r\n";
+  std::string body;
+  body.reserve(head.size() + size + boundary.size() + 6);
+  body += head;
+  body.append(size, 'x');
+  body += "\r\n" + boundary + "--\r\n";
+  const long len = body.size();
+
+  FakeRequest req;
+  req.reset("/upload", "", std::move(body));
+  char user[USER_NAME_LEN], filename[FILE_NAME_LEN], md5[MD5_LEN];
+  char local_file[FILE_NAME_LEN + 32];
+  long file_size = 0;
+  for (auto _ : state) {
+    req.rewind();
+    if (recvSaveFile(len, user, filename, md5, &file_size, local_file) != 0) {
+      state.SkipWithError("recvSaveFile failed");
+      break;
+    }
+    unlink(local_file);
+  }
+  state.SetBytesProcessed(state.iterations() * len);
+}
+BENCHMARK(BM_Multipart)
+    ->RangeMultiplier(32)
+    ->Range(1 << 10, 1 << 30)
+    ->Unit(benchmark::kMicrosecond);
+
+//==================== 文件列表 ====================
+
+// cmd=normal一次取出range(0)个文件，包括读请求、生成json和写响应
+static void BM_FileList(benchmark::State &state) {
+  const int n = state.range(0);
+  FakeMetaStore meta;
+  FakeTokenStore tokens;
+  FakeBlobStore blobs;
+  CgiContext ctx = fakeCgiContext(&meta, &tokens, &blobs);
+  tokens.put("mike", "tok");
+  for (int i = 0; i < n; i++) {
+    char md5[MD5_LEN];
+    snprintf(md5, sizeof(md5), "%032d", i);
+    std::string name = "file" + std::to_string(i) + ".mp4";
+    meta.addFileInfo(md5, "group1/M00/00/00/fake", "http://127.0.0.1:80/fake",
+                     1024L * i, "mp4");
+    meta.addUserFile("mike", md5, name.c_str(), "2023-06-24 12:00:00");
+  }
+
+  FakeRequest req;
+  req.reset("/myfiles", "cmd=normal",
+            "{\"user\":\"mike\",\"token\":\"tok\",\"start\":0,\"count\":" +
+                std::to_string(n) + "}");
+  size_t bytes = 0;
+  for (auto _ : state) {
+    req.rewind();
+    fakeRun(myfilesHandler, &ctx, &req);
+    bytes += req.out().size();
+  }
+  state.SetBytesProcessed(bytes);
+}
+BENCHMARK(BM_FileList)->RangeMultiplier(10)->Range(10, 10000);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,9 @@
+#!/bin/bash
+# 热点函数的微基准(Google Benchmark)，结果同时写入micro_bench-<提交>.json，
+# 优化前后各跑一次，用benchmark自带的tools/compare.py对比两个json：
+#   ./micro_bench.sh
+#   ./micro_bench.sh --benchmark_filter='Parse|FileList' --benchmark_repetitions=5
+g++ -std=c++17 -O2 -DCGI_GATEWAY -I ../../src micro_bench.cpp ../../src/fake_util.cpp ../../src/backend_util.cpp ../../src/login_cgi.cpp ../../src/reg_cgi.cpp ../../src/md5_cgi.cpp ../../src/myfiles_cgi.cpp ../../src/upload_cgi.cpp ../../src/delta_cgi.cpp ../../src/dl_cgi.cpp ../../src/pv_util.cpp ../../src/link_util.cpp ../../src/range_util.cpp ../../src/cache_util.cpp ../../src/zip_util.cpp ../../src/sharefiles_cgi.cpp ../../src/share_util.cpp ../../src/delta_util.cpp ../../src/cgi_server.cpp ../../src/prefork_util.cpp ../../src/ratelimit_util.cpp ../../src/admission_util.cpp ../../src/trace_util.cpp ../../src/metrics_util.cpp ../../src/quota_util.cpp ../../src/storage_util.cpp ../../src/pack_util.cpp ../../src/compress_util.cpp ../../src/cgi_util.cpp ../../src/str_scan.cpp ../../src/mysql_util.cpp ../../src/json_util.cpp ../../src/response_util.cpp ../../src/query_util.cpp ../../src/make_log.cpp -o micro_bench -lbenchmark -lfcgi -lmysqlclient -lredis++ -lhiredis -lfastcommon -lzstd -lz -lm -lpthread -lrt || exit 1
+
+rev=$(git rev-parse --short HEAD 2>/dev/null || echo local)
+./micro_bench --benchmark_out=micro_bench-$rev.json --benchmark_out_format=json "$@"
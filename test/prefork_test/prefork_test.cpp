@@ -0,0 +1,199 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+
+#include "prefork_util.h"
+
+/*
+   同一个程序既是master也是worker：
+   没有FILEHUB_WORKER环境变量时fork出master(runPrefork)，
+   master再exec本程序得到worker。worker在fd 0上accept，每个请求
+   处理30ms后返回自己的pid，用来观察热重启前后是哪一代在处理请求。
+*/
+
+static int failed = 0;
+
+static void check(const char *name, bool ok) {
+  printf("%-40s %s\n", name, ok ? "OK" : "WRONG");
+  if (!ok) failed++;
+}
+
+//==================== worker ====================
+
+static int workerMain() {
+  preforkWorkerInit();
+  preforkWorkerReady();
+  while (preforkAcceptBegin()) {
+    int fd = accept(0, nullptr, nullptr);
+    preforkAcceptEnd();
+    if (fd < 0) {
+      continue;  // SIGTERM打断accept
+    }
+    char c;
+    if (read(fd, &c, 1) == 1) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(30));
+      int pid = getpid();
+      if (write(fd, &pid, sizeof(pid)) != sizeof(pid)) {
+        perror("write");
+      }
+    }
+    close(fd);
+  }
+  return 0;
+}
+
+//==================== 客户端 ====================
+
+static int port = 0;
+
+// 发一个请求，返回处理它的worker的pid，失败返回-1
+static int request() {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  int pid = -1;
+  if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+    char c = 'x';
+    if (write(fd, &c, 1) != 1 || read(fd, &pid, sizeof(pid)) != sizeof(pid)) {
+      pid = -1;
+    }
+  }
+  close(fd);
+  return pid;
+}
+
+struct Load {
+  std::atomic<bool> stop{false};
+  std::atomic<int> ok{0};
+  std::atomic<int> errors{0};
+  std::mutex lock;
+  std::set<int> pids;  // 最近处理请求的worker
+
+  void run() {
+    while (!stop) {
+      int pid = request();
+      if (pid < 0) {
+        errors++;
+        continue;
+      }
+      ok++;
+      std::lock_guard<std::mutex> guard(lock);
+      pids.insert(pid);
+    }
+  }
+
+  std::set<int> takePids() {
+    std::lock_guard<std::mutex> guard(lock);
+    std::set<int> out;
+    out.swap(pids);
+    return out;
+  }
+};
+
+static void sleepMs(int ms) {
+  std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+int main() {
+  if (getenv("FILEHUB_WORKER") != nullptr) {
+    return workerMain();
+  }
+
+  int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr));
+  listen(listen_fd, 128);
+  socklen_t len = sizeof(addr);
+  getsockname(listen_fd, (struct sockaddr *)&addr, &len);
+  port = ntohs(addr.sin_port);
+
+  PreforkConfig cfg;
+  cfg.workers = 3;
+  cfg.backoff_min_ms = 50;
+  cfg.drain_timeout_s = 5;
+  pid_t master = fork();
+  if (master == 0) {
+    _exit(runPrefork(cfg, listen_fd));
+  }
+  close(listen_fd);  // 只有master持有监听socket
+
+  Load load;
+  std::vector<std::thread> clients;
+  for (int i = 0; i < 8; i++) {
+    clients.emplace_back([&load] { load.run(); });
+  }
+
+  sleepMs(500);
+  std::set<int> gen1 = load.takePids();
+  check("workers serving", (int)gen1.size() == cfg.workers);
+
+  // 热重启：新一代接手，旧一代处理完手上的请求退出
+  kill(master, SIGUSR2);
+  sleepMs(800);
+  load.takePids();
+  sleepMs(400);
+  std::set<int> gen2 = load.takePids();
+  bool disjoint = true;
+  for (int pid : gen2) {
+    if (gen1.count(pid) != 0) disjoint = false;
+  }
+  check("hot restart replaced workers",
+        (int)gen2.size() == cfg.workers && disjoint);
+  bool old_gone = true;
+  for (int pid : gen1) {
+    if (kill(pid, 0) == 0) old_gone = false;
+  }
+  check("old workers exited", old_gone);
+
+  // 热重启期间没有请求被拒绝或截断
+  check("no failed requests under restart", load.errors == 0);
+
+  // 崩溃的worker被重新启动，它手上的请求会失败
+  int victim = *gen2.begin();
+  kill(victim, SIGKILL);
+  sleepMs(600);
+  load.takePids();
+  sleepMs(400);
+  std::set<int> gen3 = load.takePids();
+  check("crashed worker restarted",
+        (int)gen3.size() == cfg.workers && gen3.count(victim) == 0);
+
+  load.stop = true;
+  for (std::thread &t : clients) {
+    t.join();
+  }
+  check("at most one request lost by crash", load.errors <= 1);
+  printf("requests = %d, errors = %d\n", load.ok.load(), load.errors.load());
+
+  kill(master, SIGTERM);
+  int status = 0;
+  waitpid(master, &status, 0);
+  check("master exit", WIFEXITED(status) && WEXITSTATUS(status) == 0);
+  bool all_gone = true;
+  for (int pid : gen3) {
+    if (kill(pid, 0) == 0) all_gone = false;
+  }
+  check("workers exited with master", all_gone);
+
+  printf(failed == 0 ? "ALL OK\n" : "%d FAILED\n", failed);
+  return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,3 @@
+#!/bin/bash
+g++ -std=c++17 -I ../../src prefork_test.cpp ../../src/prefork_util.cpp ../../src/cgi_util.cpp ../../src/str_scan.cpp ../../src/mysql_util.cpp ../../src/metrics_util.cpp ../../src/make_log.cpp -o prefork_test -lmysqlclient -lredis++ -lfcgi -lpthread
+./prefork_test
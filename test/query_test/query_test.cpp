@@ -0,0 +1,74 @@
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+#include "query_util.h"
+
+using namespace std;
+
+static int failed = 0;
+
+static void check(const char *name, bool ok) {
+  printf("%-40s %s\n", name, ok ? "OK" : "WRONG");
+  if (!ok) failed++;
+}
+
+int main() {
+  QueryParams params;
+
+  // key全名匹配，xcmd不会被当成cmd
+  params.parse("xcmd=bad&cmd=count&user=mike");
+  check("exact key match", params.get("cmd") == "count");
+  check("param count", params.size() == 3);
+  check("missing key", !params.has("token"));
+
+  // 百分号解码和'+'
+  params.parse("filename=a%2Fb+c.txt&empty=&flag&bad=%zz%4");
+  check("percent decode", params.get("filename") == "a/b c.txt");
+  check("empty value", params.has("empty") && params.get("empty").empty());
+  check("key without '='", params.has("flag"));
+  check("invalid escape kept", params.get("bad") == "%zz%4");
+
+  // '#'之后的内容忽略
+  params.parse("cmd=sig#cmd=patch&x=1");
+  check("fragment ignored", params.get("cmd") == "sig" && !params.has("x"));
+
+  // 拷贝时检查缓冲区大小
+  char small[4];
+  params.parse("cmd=normal");
+  check("copy too long", params.copy("cmd", small, sizeof(small)) == -1);
+  char cmd[20];
+  check("copy ok", params.copy("cmd", cmd, sizeof(cmd)) == 0 &&
+                       strcmp(cmd, "normal") == 0);
+
+  // 原地解析urlencoded请求体
+  char body[] = "user=mike&token=a%3Db";
+  params.parseInPlace(body, strlen(body));
+  check("parse in place", params.get("token") == "a=b");
+
+  // 空值和nullptr
+  check("null query", params.parse(nullptr) == 0 && !params.has("cmd"));
+
+  // 超出容量的参数丢弃
+  string many;
+  for (int i = 0; i < QUERY_MAX_PARAMS + 4; i++) {
+    many += "k" + to_string(i) + "=v&";
+  }
+  params.parse(many.c_str());
+  check("capacity", params.size() == QUERY_MAX_PARAMS);
+
+  // 编码后能解析回原值
+  string encoded = "filename=";
+  urlEncode("a b&c=d/日志.txt", &encoded);
+  params.parse(encoded.c_str());
+  check("encode", encoded.find_first_of(" &/") == string::npos &&
+                      params.get("filename") == "a b&c=d/日志.txt");
+
+  string url;
+  dlUrl("mike", "abc", "a b.txt", &url);
+  check("dl url", url == "/dl?owner=mike&md5=abc&filename=a%20b.txt");
+
+  printf("%s\n", failed == 0 ? "ALL OK" : "FAILED");
+  return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,3 @@
+#!/bin/bash
+g++ -std=c++17 -I ../../src query_test.cpp ../../src/query_util.cpp ../../src/str_scan.cpp ../../src/make_log.cpp -o query_test
+./query_test
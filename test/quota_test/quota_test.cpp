@@ -0,0 +1,80 @@
+#include <unistd.h>
+
+#include <cstdio>
+#include <string>
+
+#include "quota_util.h"
+
+/*
+   需要本机redis(127.0.0.1:6379)，使用一个带pid的测试用户，结束时删除它的key
+*/
+
+static int failed = 0;
+
+static void check(const char *name, bool ok) {
+  printf("%-40s %s\n", name, ok ? "OK" : "WRONG");
+  if (!ok) failed++;
+}
+
+int main() {
+  sw::redis::Redis redis("tcp://127.0.0.1:6379");
+  std::string user = "quota_test_" + std::to_string(getpid());
+  const char *u = user.c_str();
+
+  QuotaConfig cfg;
+  cfg.enabled = true;
+  cfg.default_limit = 1000;
+  cfg.reserve_timeout_s = 1;
+  quotaInit(cfg);
+
+  long used = 0, reserved = 0, limit = 0;
+  QuotaReservation a, b, c;
+  check("reserve within limit",
+        quotaReserve(&redis, u, 600, &a) == QUOTA_OK && a.active());
+  check("reserve over limit",
+        quotaReserve(&redis, u, 500, &b) == QUOTA_EXCEEDED && !b.active());
+  quotaRelease(&redis, &a);
+  check("release", !a.active() &&
+                       quotaUsage(&redis, u, &used, &reserved, &limit) == 0 &&
+                       reserved == 0);
+
+  // 按实际大小提交
+  check("reserve after release", quotaReserve(&redis, u, 500, &b) == QUOTA_OK);
+  quotaCommit(&redis, &b, u, 400);
+  quotaUsage(&redis, u, &used, &reserved, &limit);
+  check("commit actual size", used == 400 && reserved == 0 && limit == 1000);
+  check("used counts against limit",
+        quotaReserve(&redis, u, 700, &c) == QUOTA_EXCEEDED);
+
+  // 没有释放的预留过期后被回收
+  check("reserve and abandon", quotaReserve(&redis, u, 600, &c) == QUOTA_OK);
+  check("abandoned blocks others",
+        quotaReserve(&redis, u, 100, &a) == QUOTA_EXCEEDED);
+  usleep(1100 * 1000);
+  check("expired reservation reclaimed",
+        quotaReserve(&redis, u, 600, &a) == QUOTA_OK);
+  quotaUsage(&redis, u, &used, &reserved, &limit);
+  check("reserved after reclaim", reserved == 600);
+  quotaRelease(&redis, &a);
+  quotaRelease(&redis, &c);  // 已过期，不重复扣减
+  quotaUsage(&redis, u, &used, &reserved, &limit);
+  check("late release ignored", reserved == 0);
+
+  // 单独设置的配额
+  quotaSetLimit(&redis, u, 5000);
+  check("per-user limit", quotaReserve(&redis, u, 4000, &a) == QUOTA_OK);
+  quotaRelease(&redis, &a);
+  quotaSetLimit(&redis, u, -1);
+  check("back to default", quotaReserve(&redis, u, 4000, &a) ==
+                               QUOTA_EXCEEDED);
+
+  // 没有预留的提交也计入已用
+  quotaCommit(&redis, &a, u, 100);
+  quotaUsage(&redis, u, &used, &reserved, &limit);
+  check("commit without reservation", used == 500);
+
+  redis.del("quota:{" + user + "}");
+  redis.del("quota:{" + user + "}:resv");
+  printf(failed == 0 ? "ALL OK\n" : "%d FAILED\n", failed);
+  return failed == 0 ? 0 : 1;
+}
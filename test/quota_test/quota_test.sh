@@ -0,0 +1,3 @@
+#!/bin/bash
+g++ -std=c++17 -I ../../src quota_test.cpp ../../src/quota_util.cpp ../../src/cgi_util.cpp ../../src/str_scan.cpp ../../src/mysql_util.cpp ../../src/metrics_util.cpp ../../src/make_log.cpp -o quota_test -lmysqlclient -lredis++ -lhiredis -lfcgi -lpthread
+./quota_test
@@ -0,0 +1,92 @@
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "range_util.h"
+
+using namespace std;
+
+static int failed = 0;
+
+static void check(const char *name, bool ok) {
+  printf("%-40s %s\n", name, ok ? "OK" : "WRONG");
+  if (!ok) failed++;
+}
+
+static const string ETAG = "\"e8ea6031b779ac26c319ddf949ad9d8d\"";
+
+// 解析结果，段写成"start-end,..."便于比较
+static string ranges(const char *range, long size, const char *if_range,
+                     RangeResult *rr) {
+  vector<ByteRange> out;
+  *rr = parseRange(range, if_range, ETAG, size, &out);
+  string s;
+  for (const ByteRange &r : out) {
+    if (!s.empty()) s += ",";
+    s += to_string(r.start) + "-" + to_string(r.end);
+  }
+  return s;
+}
+
+int main() {
+  RangeResult rr;
+
+  check("no range", ranges(nullptr, 1000, nullptr, &rr) == "" &&
+                        rr == RANGE_NONE);
+  check("first 500", ranges("bytes=0-499", 1000, nullptr, &rr) == "0-499" &&
+                         rr == RANGE_OK);
+  check("open end", ranges("bytes=500-", 1000, nullptr, &rr) == "500-999");
+  check("suffix", ranges("bytes=-100", 1000, nullptr, &rr) == "900-999");
+  check("suffix longer than file",
+        ranges("bytes=-5000", 1000, nullptr, &rr) == "0-999");
+  check("end clamped", ranges("bytes=900-5000", 1000, nullptr, &rr) ==
+                           "900-999");
+
+  // 多段：排序并合并重叠、相邻的段
+  check("multi", ranges("bytes=0-0, -1", 1000, nullptr, &rr) == "0-0,999-999");
+  check("merge", ranges("bytes=500-599,0-99,100-199,550-700", 1000, nullptr,
+                        &rr) == "0-199,500-700");
+
+  // 超出文件的段丢弃，全部超出为416
+  check("skip unsatisfiable",
+        ranges("bytes=2000-3000,0-9", 1000, nullptr, &rr) == "0-9" &&
+            rr == RANGE_OK);
+  ranges("bytes=1000-", 1000, nullptr, &rr);
+  check("unsatisfiable", rr == RANGE_UNSATISFIABLE);
+  ranges("bytes=-0", 1000, nullptr, &rr);
+  check("empty suffix", rr == RANGE_UNSATISFIABLE);
+  ranges("bytes=0-", 0, nullptr, &rr);
+  check("empty file", rr == RANGE_UNSATISFIABLE);
+
+  // 语法错误或不认识的单位按没有Range处理
+  ranges("bytes=5-1", 1000, nullptr, &rr);
+  check("reversed", rr == RANGE_NONE);
+  ranges("items=0-1", 1000, nullptr, &rr);
+  check("unknown unit", rr == RANGE_NONE);
+  ranges("bytes=0-1;x", 1000, nullptr, &rr);
+  check("garbage", rr == RANGE_NONE);
+  ranges("bytes=99999999999999999999-", 1000, nullptr, &rr);
+  check("overflow", rr == RANGE_NONE);
+
+  string many = "bytes=";
+  for (int i = 0; i < RANGE_MAX_PARTS + 1; i++) {
+    many += (i ? "," : "") + to_string(i * 10) + "-" + to_string(i * 10 + 1);
+  }
+  ranges(many.c_str(), 1000, nullptr, &rr);
+  check("too many parts", rr == RANGE_NONE);
+
+  // If-Range
+  check("if-range match",
+        ranges("bytes=0-9", 1000, ETAG.c_str(), &rr) == "0-9" &&
+            rr == RANGE_OK);
+  ranges("bytes=0-9", 1000, "\"0cc175b9c0f1b6a831c399e269772661\"", &rr);
+  check("if-range changed", rr == RANGE_NONE);
+  ranges("bytes=0-9", 1000, "Wed, 21 Oct 2015 07:28:00 GMT", &rr);
+  check("if-range date", rr == RANGE_NONE);
+
+  check("content-range", contentRange(ByteRange{0, 499}, 1234) ==
+                             "bytes 0-499/1234");
+
+  printf(failed == 0 ? "ALL OK\n" : "%d FAILED\n", failed);
+  return failed == 0 ? 0 : 1;
+}
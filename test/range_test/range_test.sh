@@ -0,0 +1,3 @@
+#!/bin/bash
+g++ -std=c++17 -I ../../src range_test.cpp ../../src/range_util.cpp -o range_test
+./range_test
@@ -0,0 +1,174 @@
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#include "ratelimit_util.h"
+
+static int failed = 0;
+
+static void check(const char *name, bool ok) {
+  printf("%-40s %s\n", name, ok ? "OK" : "WRONG");
+  if (!ok) failed++;
+}
+
+static std::string shmName() {
+  return "/filehub_ratelimit_test_" + std::to_string(getpid());
+}
+
+static void unlinkTable(const std::string &name, size_t slots) {
+  shm_unlink((name + "_" + std::to_string(slots)).c_str());
+}
+
+//==================== 令牌桶 ====================
+
+static void testBucket() {
+  std::string name = shmName();
+  RateTable table;
+  check("open table", table.open(name.c_str(), 1024) == 0);
+
+  // 容量5，每秒2个：先放行5个，之后拒绝
+  int allowed = 0;
+  for (int i = 0; i < 10; i++) {
+    if (table.take(42, 2, 5, 1000)) allowed++;
+  }
+  check("burst then reject", allowed == 5);
+
+  // 500ms补充1个令牌
+  check("refill after 500ms", table.take(42, 2, 5, 1500));
+  check("no more tokens", !table.take(42, 2, 5, 1500));
+
+  // 补充不超过容量
+  allowed = 0;
+  for (int i = 0; i < 10; i++) {
+    if (table.take(42, 2, 5, 100000)) allowed++;
+  }
+  check("refill capped at burst", allowed == 5);
+
+  // 不同的key互不影响
+  check("other key unaffected", table.take(43, 2, 5, 100000));
+
+  // 时间回绕
+  for (int i = 0; i < 5; i++) table.take(44, 1, 5, 0xFFFFFF00u);
+  check("clock wrap refills", table.take(44, 1, 5, 0x00000F00u));
+
+  // 表满时回收旧桶，不会失败
+  bool all_ok = true;
+  for (uint64_t k = 1000; k < 1000 + 4 * table.slots(); k++) {
+    if (!table.take(k, 1, 1, 2000)) all_ok = false;
+  }
+  check("evict when full", all_ok);
+  unlinkTable(name, 1024);
+}
+
+// 多个进程共用一个桶，总共放行的请求数等于容量
+static void testShared() {
+  std::string name = shmName() + "_shared";
+  const int procs = 4, per_proc = 5000, burst = 1000;
+  std::atomic<int> *total = (std::atomic<int> *)mmap(
+      nullptr, sizeof(std::atomic<int>), PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  new (total) std::atomic<int>(0);
+
+  for (int p = 0; p < procs; p++) {
+    if (fork() == 0) {
+      RateTable table;
+      table.open(name.c_str(), 1024);
+      int n = 0;
+      for (int i = 0; i < per_proc; i++) {
+        // 时间不变，不补充令牌
+        if (table.take(7, 0.001, burst, 5000)) n++;
+      }
+      total->fetch_add(n);
+      _exit(0);
+    }
+  }
+  for (int p = 0; p < procs; p++) {
+    wait(nullptr);
+  }
+  check("shared across processes", total->load() == burst);
+  munmap(total, sizeof(std::atomic<int>));
+  unlinkTable(name, 1024);
+}
+
+//==================== 用户名和策略 ====================
+
+static void testScan() {
+  char user[32];
+  const char body[] = "{\"token\":\"t\", \"userName\" : \"alice\",\"user\":\"bob\"}";
+  check("scan user", rateLimitScanUser(body, strlen(body), "user", user,
+                                       sizeof(user)) &&
+                         strcmp(user, "bob") == 0);
+  check("scan userName", rateLimitScanUser(body, strlen(body), "userName",
+                                           user, sizeof(user)) &&
+                             strcmp(user, "alice") == 0);
+  check("scan missing", !rateLimitScanUser(body, strlen(body), "email", user,
+                                           sizeof(user)));
+  // 转义按json解码，与处理函数看到的用户名一致
+  const char esc[] = "{\"user\":\"a\\\"b\"}";
+  check("scan escaped", rateLimitScanUser(esc, strlen(esc), "user", user,
+                                          sizeof(user)) &&
+                            strcmp(user, "a\"b") == 0);
+  const char uesc[] = "{\"user\":\"\\u006dike\\u00e9\\ud83d\\ude00\"}";
+  check("scan unicode escape",
+        rateLimitScanUser(uesc, strlen(uesc), "user", user, sizeof(user)) &&
+            strcmp(user, "mike\xc3\xa9\xf0\x9f\x98\x80") == 0);
+  const char bad[] = "{\"user\":\"\\ud83d\"}";
+  check("scan bad escape",
+        !rateLimitScanUser(bad, strlen(bad), "user", user, sizeof(user)));
+  // 字段名出现在值里时跳过
+  const char inval[] = "{\"name\":\"user\",\"user\":\"carol\"}";
+  check("scan key not value",
+        rateLimitScanUser(inval, strlen(inval), "user", user, sizeof(user)) &&
+            strcmp(user, "carol") == 0);
+  check("scan too long", !rateLimitScanUser(body, strlen(body), "userName",
+                                            user, 3));
+}
+
+static void testPolicy() {
+  RateLimitConfig cfg;
+  cfg.shm_name = shmName() + "_policy";
+  cfg.slots = 1024;
+  RatePolicy login;
+  login.path = "/login";
+  login.user_field = "userName";
+  login.ip.rate = 0.001;
+  login.ip.burst = 3;
+  login.user.rate = 0.001;
+  login.user.burst = 2;
+  cfg.policies.push_back(login);
+  check("init", rateLimitInit(cfg) == 0);
+
+  check("no policy", rateLimitPolicy("/md5") == nullptr);
+  const RatePolicy *p = rateLimitPolicy("/login");
+  check("policy found", p != nullptr && p->user_field == "userName");
+
+  // 同一个用户换IP：用户规则先拦住
+  bool a = rateLimitAllow(p, "10.0.0.1", "alice", nullptr);
+  bool b = rateLimitAllow(p, "10.0.0.2", "alice", nullptr);
+  bool c = rateLimitAllow(p, "10.0.0.3", "alice", nullptr);
+  check("user limit", a && b && !c);
+
+  // 同一个IP换用户：IP规则拦住
+  a = rateLimitAllow(p, "10.0.0.9", "u1", nullptr);
+  b = rateLimitAllow(p, "10.0.0.9", "u2", nullptr);
+  c = rateLimitAllow(p, "10.0.0.9", "u3", nullptr);
+  bool d = rateLimitAllow(p, "10.0.0.9", "u4", nullptr);
+  check("ip limit", a && b && c && !d);
+
+  check("empty key skipped", rateLimitAllow(p, "", "", nullptr));
+  unlinkTable(cfg.shm_name, 1024);
+}
+
+int main() {
+  testBucket();
+  testShared();
+  testScan();
+  testPolicy();
+  printf(failed == 0 ? "ALL OK\n" : "%d FAILED\n", failed);
+  return failed == 0 ? 0 : 1;
+}
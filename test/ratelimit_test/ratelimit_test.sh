@@ -0,0 +1,3 @@
+#!/bin/bash
+g++ -std=c++17 -I ../../src ratelimit_test.cpp ../../src/ratelimit_util.cpp ../../src/cgi_util.cpp ../../src/str_scan.cpp ../../src/mysql_util.cpp ../../src/metrics_util.cpp ../../src/make_log.cpp -o ratelimit_test -lmysqlclient -lredis++ -lfcgi -lpthread -lrt
+./ratelimit_test
@@ -0,0 +1,92 @@
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#include "str_scan.h"
+
+using namespace std;
+
+// 原来cgi_util.cpp中逐字节memcmp的memstr，作为对照
+static char *memstrOld(char *full_data, int full_data_len, char *substr) {
+  int substr_len = strlen(substr);
+  for (int i = 0; i <= full_data_len - substr_len; i++) {
+    if (memcmp(full_data + i, substr, substr_len) == 0) {
+      return full_data + i;
+    }
+  }
+  return nullptr;
+}
+
+template <typename F>
+static void bench(const char *name, size_t bytes, size_t expect, F f) {
+  auto start = chrono::steady_clock::now();
+  size_t pos = f();
+  auto end = chrono::steady_clock::now();
+  double sec = chrono::duration<double>(end - start).count();
+  printf("%-16s %8.3f GB/s  %s\n", name, bytes / sec / 1e9,
+         pos == expect ? "OK" : "WRONG");
+}
+
+int main() {
+  const char *boundary = "------WebKitFormBoundary88asdgewtgewx";
+  const size_t body_len = 256UL * 1024 * 1024;
+
+  // 模拟一个256MB的multipart请求体，内容中散布'-'和'\r\n'制造候选
+  string body;
+  body.reserve(body_len + 128);
+  unsigned seed = 1;
+  while (body.size() < body_len) {
+    seed = seed * 1103515245 + 12345;
+    char c = (char)(seed >> 16);
+    if (c == '\r') c = '-';
+    body.push_back(c);
+  }
+  size_t expect = body.size() + 2;
+  body += "\r\n";
+  body += boundary;
+  body += "--\r\n";
+
+  // 正确性：各实现在不同偏移、不同长度下的结果和string::find一致
+  int failed = 0;
+  const ScanImpl impls[] = {ScanImpl::SCALAR, ScanImpl::SSE2, ScanImpl::AVX2};
+  for (ScanImpl impl : impls) {
+    if (!scanSetImpl(impl)) continue;
+    string s(300, 'a');
+    for (size_t pos = 0; pos + 5 <= s.size(); pos += 7) {
+      string t = s;
+      t.replace(pos, 5, "ab\r\nc");
+      for (const char *needle : {"ab\r\nc", "\r\n", "b", "zz"}) {
+        if (scanFind(t, needle) != t.find(needle)) {
+          printf("%s find '%s' at %zu WRONG\n", scanImplName(impl), needle,
+                 pos);
+          failed++;
+        }
+      }
+      const char *any = scanAny(t.data(), t.size(), "&#\r");
+      if (any == nullptr || (size_t)(any - t.data()) != pos + 2) {
+        printf("%s any at %zu WRONG\n", scanImplName(impl), pos);
+        failed++;
+      }
+    }
+  }
+
+  // 吞吐量：在请求体末尾查找分界线
+  bench("memstr(old)", body.size(), expect, [&]() -> size_t {
+    char *p = memstrOld(&body[0], body.size(), (char *)boundary);
+    return p == nullptr ? string::npos : p - body.data();
+  });
+  bench("string::find", body.size(), expect,
+        [&]() { return body.find(boundary); });
+  for (ScanImpl impl : impls) {
+    if (!scanSetImpl(impl)) {
+      printf("%-16s unsupported\n", scanImplName(impl));
+      continue;
+    }
+    bench(scanImplName(impl), body.size(), expect,
+          [&]() { return scanFind(body, boundary); });
+  }
+
+  printf("%s\n", failed == 0 ? "ALL OK" : "FAILED");
+  return failed == 0 ? 0 : 1;
+}
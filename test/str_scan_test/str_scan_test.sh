@@ -0,0 +1,3 @@
+#!/bin/bash
+g++ -std=c++17 -O2 -I ../../src str_scan_test.cpp ../../src/str_scan.cpp -o str_scan_test
+./str_scan_test
@@ -0,0 +1,168 @@
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include "trace_util.h"
+
+static int failed = 0;
+
+static void check(const char *name, bool ok) {
+  printf("%-40s %s\n", name, ok ? "OK" : "WRONG");
+  if (!ok) failed++;
+}
+
+static std::string otlpFile() {
+  return "/tmp/trace_test_" + std::to_string(getpid()) + ".json";
+}
+
+static std::string readFile(const std::string &path) {
+  std::ifstream ifs(path);
+  std::stringstream ss;
+  ss << ifs.rdbuf();
+  return ss.str();
+}
+
+// 取json中"name":"xxx"所在span的某个字段，简单查找，够测试用
+static std::string spanField(const std::string &json, const char *name,
+                             const char *field) {
+  std::string key = std::string("\"name\":\"") + name + "\"";
+  size_t pos = json.find(key);
+  if (pos == std::string::npos) {
+    return "";
+  }
+  size_t begin = json.rfind("{\"traceId\"", pos);
+  size_t end = json.find("{\"traceId\"", pos);
+  std::string span = json.substr(begin, end == std::string::npos
+                                            ? std::string::npos
+                                            : end - begin);
+  std::string f = std::string("\"") + field + "\":\"";
+  size_t p = span.find(f);
+  if (p == std::string::npos) {
+    return "";
+  }
+  p += f.size();
+  return span.substr(p, span.find('"', p) - p);
+}
+
+static bool isHex(const std::string &s, size_t len) {
+  if (s.size() != len) {
+    return false;
+  }
+  for (char c : s) {
+    if (!((c >= '0' && c <= '9') || (c >= 'a' && c <= 'f'))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+//==================== 请求id ====================
+
+static void testId() {
+  TraceConfig cfg;
+  cfg.enabled = false;
+  cfg.slow_ms = 0;
+  traceInit(cfg);
+
+  RequestTrace trace;
+  trace.begin("0123456789ABCDEF0123456789abcdef", "/upload");
+  check("keep nginx request id",
+        strcmp(trace.id(), "0123456789ABCDEF0123456789abcdef") == 0);
+  trace.end();
+
+  trace.begin("client-7.a_b", "/upload");
+  check("keep client request id", strcmp(trace.id(), "client-7.a_b") == 0);
+  trace.end();
+
+  trace.begin("", "/upload");
+  std::string first = trace.id();
+  trace.end();
+  trace.begin("bad id\"", "/upload");
+  std::string second = trace.id();
+  trace.end();
+  check("generate id", isHex(first, 32) && isHex(second, 32) &&
+                           first != second);
+  std::string long_id(TRACE_ID_MAX + 1, 'a');
+  trace.begin(long_id, "/upload");
+  check("reject too long id", isHex(trace.id(), 32));
+  trace.end();
+}
+
+//==================== 阶段和OTLP ====================
+
+static void testSpans() {
+  TraceConfig cfg;
+  cfg.enabled = false;
+  cfg.slow_ms = 0;
+  cfg.otlp_file = otlpFile();
+  traceInit(cfg);
+
+  RequestTrace trace;
+  trace.begin("0123456789abcdef0123456789abcdef", "/upload");
+  {
+    TraceSpan recv(&trace, "recv");
+    usleep(20000);
+  }
+  {
+    TraceSpan mysql(&trace, "mysql");
+    TraceSpan inner(&trace, "insert");
+    usleep(5000);
+  }
+  TraceSpan none(nullptr, "ignored");  // 没有追踪时什么也不做
+  check("elapsed", trace.elapsedMs() >= 25);
+  trace.end();
+
+  // 结束后的阶段不再记录
+  int after = trace.spanBegin("late");
+  check("span after end", after == -1);
+
+  std::string json = readFile(cfg.otlp_file);
+  check("one line per request",
+        !json.empty() && json.find('\n') == json.size() - 1);
+  check("trace id from request id",
+        spanField(json, "recv", "traceId") ==
+            "0123456789abcdef0123456789abcdef");
+
+  std::string root = spanField(json, "/upload", "spanId");
+  check("root span", isHex(root, 16) &&
+                         spanField(json, "/upload", "parentSpanId").empty());
+  check("stage parent is request",
+        spanField(json, "recv", "parentSpanId") == root &&
+            spanField(json, "mysql", "parentSpanId") == root);
+  check("nested parent",
+        spanField(json, "insert", "parentSpanId") ==
+            spanField(json, "mysql", "spanId"));
+  check("no span for null trace",
+        json.find("ignored") == std::string::npos);
+
+  long long start = atoll(spanField(json, "recv", "startTimeUnixNano").c_str());
+  long long end = atoll(spanField(json, "recv", "endTimeUnixNano").c_str());
+  check("stage duration", end - start >= 20000000LL &&
+                              end - start < 2000000000LL);
+  check("request id attribute",
+        json.find("\"http.request_id\"") != std::string::npos);
+  unlink(cfg.otlp_file.c_str());
+
+  // 阶段过多时超出的不计时
+  trace.begin("", "/upload");
+  int last = 0;
+  for (int i = 0; i <= TRACE_MAX_SPANS; i++) {
+    last = trace.spanBegin("s");
+    if (last >= 0) trace.spanEnd(last);
+  }
+  check("span limit", last == -1);
+  trace.end();
+  unlink(cfg.otlp_file.c_str());
+}
+
+int main() {
+  testId();
+  testSpans();
+  printf(failed == 0 ? "ALL OK\n" : "%d FAILED\n", failed);
+  return failed == 0 ? 0 : 1;
+}
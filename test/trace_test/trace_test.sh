@@ -0,0 +1,3 @@
+#!/bin/bash
+g++ -std=c++17 -I ../../src trace_test.cpp ../../src/trace_util.cpp ../../src/make_log.cpp -o trace_test
+./trace_test
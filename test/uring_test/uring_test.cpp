@@ -0,0 +1,373 @@
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "fcgi_proto.h"
+#include "uring_loop.h"
+#include "uring_server.h"
+
+static int failed = 0;
+
+static void check(const char *name, bool ok) {
+  printf("%-40s %s\n", name, ok ? "OK" : "WRONG");
+  if (!ok) failed++;
+}
+
+//==================== 协议编解码 ====================
+
+static void testProto() {
+  std::string params;
+  std::string long_value(300, 'v');
+  fcgiAppendParam(&params, "QUERY_STRING", "cmd=count");
+  fcgiAppendParam(&params, "LONG", long_value);
+  fcgiAppendParam(&params, "EMPTY", "");
+
+  std::string rec;
+  fcgiAppendStream(&rec, FCGI_TYPE_PARAMS, 7, params.data(), params.size());
+  FcgiRecord r;
+  long n = fcgiParseRecord(rec.data(), rec.size(), &r);
+  check("record length padded", n == (long)rec.size() && rec.size() % 8 == 0);
+  check("record fields", r.type == FCGI_TYPE_PARAMS && r.id == 7 &&
+                             r.len == params.size());
+  check("partial record", fcgiParseRecord(rec.data(), rec.size() - 1, &r) == 0);
+
+  FcgiParams parsed;
+  check("parse params", fcgiParseParams(params.data(), params.size(),
+                                        &parsed) == 0 &&
+                            parsed.size() == 3);
+  check("param values", parsed[0].second == "cmd=count" &&
+                            parsed[1].second == long_value &&
+                            parsed[2].second.empty());
+  check("truncated params",
+        fcgiParseParams(params.data(), params.size() - 1, &parsed) == -1);
+
+  std::string big(200000, 'x'), out;
+  fcgiAppendStream(&out, FCGI_TYPE_STDOUT, 1, big.data(), big.size());
+  size_t pos = 0, total = 0;
+  int records = 0;
+  while (pos < out.size()) {
+    n = fcgiParseRecord(out.data() + pos, out.size() - pos, &r);
+    if (n <= 0) break;
+    total += r.len;
+    records++;
+    pos += n;
+  }
+  check("stream split", total == big.size() && records == 4);
+
+  char bad[8] = {2, 1, 0, 1, 0, 0, 0, 0};
+  check("bad version", fcgiParseRecord(bad, sizeof(bad), &r) == -1);
+}
+
+//==================== 服务端 ====================
+
+// 测试用处理函数：/sleep先异步等待，返回请求体长度和字节和
+static Task echoDispatch(UringRequest *req, void *) {
+  if (req->param("SCRIPT_NAME") == "/sleep") {
+    co_await uringSleep(100);
+  }
+  unsigned long sum = 0;
+  if (req->spool_fd >= 0) {
+    char buf[8192];
+    ssize_t n;
+    off_t off = 0;
+    while ((n = pread(req->spool_fd, buf, sizeof(buf), off)) > 0) {
+      for (ssize_t i = 0; i < n; i++) sum += (unsigned char)buf[i];
+      off += n;
+    }
+  } else {
+    for (char c : req->body) sum += (unsigned char)c;
+  }
+  char body[128];
+  snprintf(body, sizeof(body), "%.*s len=%zu sum=%lu spool=%d",
+           (int)req->param("SCRIPT_NAME").size(),
+           req->param("SCRIPT_NAME").data(), req->body_len, sum,
+           req->spool_fd >= 0 ? 1 : 0);
+  req->out = "Content-type: text/html\r\n\r\n";
+  req->out += body;
+}
+
+// 测试用准入检查：/limited在读请求体之前拒绝，/held挂一个请求结束时释放的资源
+static std::atomic<int> held_released{0};
+
+static bool limitAdmit(UringRequest *req, void *) {
+  if (req->param("SCRIPT_NAME") == "/limited") {
+    req->out = "Status: 413 Payload Too Large\r\n\r\nrejected";
+    return false;
+  }
+  if (req->param("SCRIPT_NAME") == "/held") {
+    req->hold = std::shared_ptr<void>(nullptr, [](void *) { held_released++; });
+  }
+  return true;
+}
+
+static int connectTo(int port) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+  if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+static void appendRequest(std::string *out, uint16_t id, bool keep_conn,
+                          const char *path, const std::string &body) {
+  fcgiAppendBeginRequest(out, id, FCGI_ROLE_RESPONDER,
+                         keep_conn ? FCGI_FLAG_KEEP_CONN : 0);
+  std::string params;
+  fcgiAppendParam(&params, "SCRIPT_NAME", path);
+  fcgiAppendParam(&params, "CONTENT_LENGTH", std::to_string(body.size()));
+  fcgiAppendStream(out, FCGI_TYPE_PARAMS, id, params.data(), params.size());
+  fcgiAppendRecord(out, FCGI_TYPE_PARAMS, id, nullptr, 0);
+  fcgiAppendStream(out, FCGI_TYPE_STDIN, id, body.data(), body.size());
+  fcgiAppendRecord(out, FCGI_TYPE_STDIN, id, nullptr, 0);
+}
+
+static bool sendAll(int fd, const std::string &data) {
+  size_t pos = 0;
+  while (pos < data.size()) {
+    ssize_t n = send(fd, data.data() + pos, data.size() - pos, MSG_NOSIGNAL);
+    if (n <= 0) return false;
+    pos += n;
+  }
+  return true;
+}
+
+// 读取响应直到收齐count个END_REQUEST，stdout按请求id保存
+struct Reply {
+  std::string stdout_data[8];
+  int ended = 0;
+  int end_status[8] = {0};
+  std::string values;
+  bool eof = false;
+};
+
+static bool readReplies(int fd, int count, Reply *reply) {
+  std::string buf;
+  char tmp[65536];
+  while (reply->ended < count) {
+    ssize_t n = recv(fd, tmp, sizeof(tmp), 0);
+    if (n <= 0) return false;
+    buf.append(tmp, n);
+    FcgiRecord r;
+    long len;
+    while ((len = fcgiParseRecord(buf.data(), buf.size(), &r)) > 0) {
+      if (r.type == FCGI_TYPE_STDOUT && r.id < 8) {
+        reply->stdout_data[r.id].append(r.data, r.len);
+      } else if (r.type == FCGI_TYPE_END_REQUEST && r.id < 8) {
+        reply->end_status[r.id] = (unsigned char)r.data[4];
+        reply->ended++;
+      } else if (r.type == FCGI_TYPE_GET_VALUES_RESULT) {
+        reply->values.assign(r.data, r.len);
+        reply->ended++;
+      }
+      buf.erase(0, len);
+    }
+  }
+  reply->eof = recv(fd, tmp, sizeof(tmp), MSG_DONTWAIT) == 0;
+  return true;
+}
+
+static bool endsWith(const std::string &s, const std::string &suffix) {
+  return s.size() >= suffix.size() &&
+         s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+static void testServer() {
+  int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+  bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr));
+  listen(listen_fd, 1024);
+  socklen_t alen = sizeof(addr);
+  getsockname(listen_fd, (struct sockaddr *)&addr, &alen);
+  int port = ntohs(addr.sin_port);
+
+  UringConfig cfg;
+  cfg.threads = 2;
+  cfg.spool_threshold = 4096;
+  UringServer server(cfg, echoDispatch, nullptr, limitAdmit);
+  server.start(listen_fd);
+
+  // 1、不保持连接：回复后服务端关闭连接
+  {
+    int fd = connectTo(port);
+    std::string req;
+    appendRequest(&req, 1, false, "/echo", "hello");
+    Reply reply;
+    bool ok = sendAll(fd, req) && readReplies(fd, 1, &reply);
+    check("single request",
+          ok && endsWith(reply.stdout_data[1], "/echo len=5 sum=532 spool=0"));
+    usleep(10000);
+    char c;
+    check("closed without keep_conn", recv(fd, &c, 1, 0) == 0);
+    close(fd);
+  }
+
+  // 2、保持连接：同一连接上先后两个请求
+  {
+    int fd = connectTo(port);
+    std::string req;
+    appendRequest(&req, 1, true, "/a", "x");
+    Reply r1, r2;
+    bool ok = sendAll(fd, req) && readReplies(fd, 1, &r1);
+    req.clear();
+    appendRequest(&req, 2, true, "/b", "yy");
+    ok = ok && sendAll(fd, req) && readReplies(fd, 1, &r2);
+    check("keep_conn reuse",
+          ok && endsWith(r1.stdout_data[1], "/a len=1 sum=120 spool=0") &&
+              endsWith(r2.stdout_data[2], "/b len=2 sum=242 spool=0") &&
+              !r2.eof);
+    close(fd);
+  }
+
+  // 3、多路复用：慢请求先发，快请求先回
+  {
+    int fd = connectTo(port);
+    std::string req;
+    appendRequest(&req, 1, true, "/sleep", "");
+    appendRequest(&req, 2, true, "/fast", "");
+    Reply reply;
+    bool ok = sendAll(fd, req) && readReplies(fd, 2, &reply);
+    check("multiplexed",
+          ok && endsWith(reply.stdout_data[1], "/sleep len=0 sum=0 spool=0") &&
+              endsWith(reply.stdout_data[2], "/fast len=0 sum=0 spool=0"));
+    close(fd);
+  }
+
+  // 4、大请求体写入临时文件
+  {
+    int fd = connectTo(port);
+    std::string body(200000, '\0');
+    unsigned long sum = 0;
+    for (size_t i = 0; i < body.size(); i++) {
+      body[i] = (char)(i * 31);
+      sum += (unsigned char)body[i];
+    }
+    std::string req;
+    appendRequest(&req, 1, false, "/upload", body);
+    Reply reply;
+    bool ok = sendAll(fd, req) && readReplies(fd, 1, &reply);
+    char expect[128];
+    snprintf(expect, sizeof(expect), "/upload len=%zu sum=%lu spool=1",
+             body.size(), sum);
+    check("spooled body", ok && endsWith(reply.stdout_data[1], expect));
+    close(fd);
+  }
+
+  // 5、GET_VALUES
+  {
+    int fd = connectTo(port);
+    std::string names, req;
+    fcgiAppendParam(&names, "FCGI_MPXS_CONNS", "");
+    fcgiAppendRecord(&req, FCGI_TYPE_GET_VALUES, 0, names.data(),
+                     names.size());
+    Reply reply;
+    bool ok = sendAll(fd, req) && readReplies(fd, 1, &reply);
+    FcgiParams values;
+    ok = ok && fcgiParseParams(reply.values.data(), reply.values.size(),
+                               &values) == 0;
+    check("get values", ok && values.size() == 1 &&
+                            values[0].second == "1");
+    close(fd);
+  }
+
+  // 6、准入拒绝：不等请求体直接回复，丢弃的请求体不影响同一连接上的下一个请求
+  {
+    int fd = connectTo(port);
+    std::string req;
+    appendRequest(&req, 1, true, "/limited", std::string(100000, 'x'));
+    appendRequest(&req, 2, true, "/held", "zz");
+    Reply reply;
+    bool ok = sendAll(fd, req) && readReplies(fd, 2, &reply);
+    check("admission rejected",
+          ok && endsWith(reply.stdout_data[1], "rejected") &&
+              endsWith(reply.stdout_data[2], "/held len=2 sum=244 spool=0"));
+    usleep(10000);
+    check("admission hold released", held_released == 1);
+    close(fd);
+  }
+
+  // 7、500个连接同时挂起100ms，两个线程应在远小于串行时间内处理完
+  {
+    const int conns = 500;
+    std::vector<int> fds;
+    auto begin = std::chrono::steady_clock::now();
+    for (int i = 0; i < conns; i++) {
+      int fd = connectTo(port);
+      std::string req;
+      appendRequest(&req, 1, false, "/sleep", "");
+      sendAll(fd, req);
+      fds.push_back(fd);
+    }
+    int done = 0;
+    for (int fd : fds) {
+      Reply reply;
+      if (readReplies(fd, 1, &reply) && reply.end_status[1] == 0) done++;
+      close(fd);
+    }
+    long ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                  std::chrono::steady_clock::now() - begin)
+                  .count();
+    printf("%d concurrent requests in %ld ms\n", conns, ms);
+    check("concurrent in-flight", done == conns && ms < 2000);
+  }
+
+  server.stop();
+  server.wait();
+  close(listen_fd);
+}
+
+//==================== 异步日志 ====================
+
+static Task writeLogs(UringLoop *loop, const char *path, int lines) {
+  for (int i = 0; i < lines; i++) {
+    uringLogWrite(path, "line " + std::to_string(i) + "\n");
+  }
+  co_await uringSleep(200);
+  loop->stop();
+}
+
+static void testLog() {
+  const char *path = "/tmp/uring_test.log";
+  unlink(path);
+  UringLoop loop;
+  loop.init(64);
+  writeLogs(&loop, path, 1000).detach();
+  loop.run();
+
+  std::string expect;
+  for (int i = 0; i < 1000; i++) expect += "line " + std::to_string(i) + "\n";
+  std::string got;
+  int fd = open(path, O_RDONLY);
+  char buf[4096];
+  ssize_t n;
+  while (fd >= 0 && (n = read(fd, buf, sizeof(buf))) > 0) got.append(buf, n);
+  if (fd >= 0) close(fd);
+  check("async log in order", got == expect);
+  unlink(path);
+}
+
+int main() {
+  testProto();
+  testServer();
+  testLog();
+  printf("%s\n", failed == 0 ? "ALL OK" : "FAILED");
+  return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,3 @@
+#!/bin/bash
+g++ -std=c++20 -O2 -I ../../src uring_test.cpp ../../src/fcgi_proto.cpp ../../src/uring_loop.cpp ../../src/uring_server.cpp ../../src/make_log.cpp -o uring_test -lpthread
+./uring_test
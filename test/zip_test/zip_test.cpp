@@ -0,0 +1,253 @@
+#include <zlib.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "zip_util.h"
+
+static int failed = 0;
+
+static void check(const char *name, bool ok) {
+  printf("%-40s %s\n", name, ok ? "OK" : "WRONG");
+  if (!ok) failed++;
+}
+
+static uint32_t get16(const std::string &s, size_t pos) {
+  return (unsigned char)s[pos] | (unsigned char)s[pos + 1] << 8;
+}
+
+static uint32_t get32(const std::string &s, size_t pos) {
+  return get16(s, pos) | get16(s, pos + 2) << 16;
+}
+
+static uint64_t get64(const std::string &s, size_t pos) {
+  return get32(s, pos) | (uint64_t)get32(s, pos + 4) << 32;
+}
+
+// 从中央目录读出的一个文件
+struct Member {
+  std::string name;
+  uint16_t method;
+  uint32_t crc;
+  uint64_t csize;
+  uint64_t usize;
+  uint64_t offset;
+};
+
+// 按结束记录找到中央目录，解析出所有文件
+static bool readCentral(const std::string &zip, std::vector<Member> *members) {
+  if (zip.size() < 22) return false;
+  size_t end = zip.size() - 22;
+  if (get32(zip, end) != 0x06054b50) return false;
+  uint64_t count = get16(zip, end + 10);
+  uint64_t cd_offset = get32(zip, end + 16);
+  if (count == 0xffff || cd_offset == 0xffffffff) {
+    // ZIP64定位器在结束记录之前
+    size_t locator = end - 20;
+    if (get32(zip, locator) != 0x07064b50) return false;
+    size_t end64 = get64(zip, locator + 8);
+    if (get32(zip, end64) != 0x06064b50) return false;
+    count = get64(zip, end64 + 32);
+    cd_offset = get64(zip, end64 + 48);
+  }
+  size_t pos = cd_offset;
+  for (uint64_t i = 0; i < count; i++) {
+    if (get32(zip, pos) != 0x02014b50) return false;
+    Member m;
+    m.method = get16(zip, pos + 10);
+    m.crc = get32(zip, pos + 16);
+    m.csize = get32(zip, pos + 20);
+    m.usize = get32(zip, pos + 24);
+    size_t name_len = get16(zip, pos + 28);
+    size_t extra_len = get16(zip, pos + 30);
+    m.offset = get32(zip, pos + 42);
+    m.name = zip.substr(pos + 46, name_len);
+    pos += 46 + name_len + extra_len;
+    members->push_back(m);
+  }
+  return true;
+}
+
+// 取出文件内容，deflate的解压，并检查crc
+static bool extract(const std::string &zip, const Member &m,
+                    std::string *data) {
+  if (get32(zip, m.offset) != 0x04034b50) return false;
+  size_t pos = m.offset + 30 + get16(zip, m.offset + 26) +
+               get16(zip, m.offset + 28);
+  std::string raw = zip.substr(pos, m.csize);
+  if (m.method == 0) {
+    *data = raw;
+  } else {
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    inflateInit2(&zs, -MAX_WBITS);
+    data->assign(m.usize, '\0');
+    zs.next_in = (Bytef *)raw.data();
+    zs.avail_in = raw.size();
+    zs.next_out = (Bytef *)&(*data)[0];
+    zs.avail_out = data->size();
+    int ret = inflate(&zs, Z_FINISH);
+    inflateEnd(&zs);
+    if (ret != Z_STREAM_END) return false;
+  }
+  return crc32(0, (const Bytef *)data->data(), data->size()) == m.crc;
+}
+
+static DataSink appender(std::string *out) {
+  return [out](const char *data, size_t len) {
+    out->append(data, len);
+    return 0;
+  };
+}
+
+int main() {
+  const time_t mtime = 1688601600;  // 2023-07-06
+  std::string text;
+  for (int i = 0; i < 2000; i++) {
+    text += "line " + std::to_string(i) + " of a compressible log file\n";
+  }
+  std::string binary(100000, '\0');
+  for (size_t i = 0; i < binary.size(); i++) {
+    binary[i] = (char)(i * 7919 % 251);
+  }
+
+  // 一个存储、一个压缩、一个空文件，内容分多次写入
+  std::string zip;
+  {
+    ZipWriter w(appender(&zip));
+    bool ok = w.begin("bin/data.bin", false, binary.size(), mtime) == 0;
+    for (size_t i = 0; i < binary.size(); i += 4096) {
+      ok = ok && w.write(binary.data() + i,
+                         std::min((size_t)4096, binary.size() - i)) == 0;
+    }
+    ok = ok && w.end() == 0;
+    ok = ok && w.begin("日志.log", true, text.size(), mtime) == 0;
+    ok = ok && w.write(text.data(), 1000) == 0;
+    ok = ok && w.write(text.data() + 1000, text.size() - 1000) == 0;
+    ok = ok && w.end() == 0;
+    ok = ok && w.begin("empty", false, 0, mtime) == 0 && w.end() == 0;
+    ok = ok && w.finish() == 0;
+    check("write", ok && w.written() == zip.size());
+  }
+  // 留给zip_test.sh用unzip再检查一遍
+  std::ofstream("zip_test.zip", std::ios::binary) << zip;
+
+  std::vector<Member> members;
+  check("central directory", readCentral(zip, &members) &&
+                                 members.size() == 3 &&
+                                 members[1].name == "日志.log");
+  std::string data;
+  check("stored entry", members.size() == 3 && members[0].method == 0 &&
+                            extract(zip, members[0], &data) &&
+                            data == binary);
+  check("deflated entry", members.size() == 3 && members[1].method == 8 &&
+                              members[1].csize < text.size() / 4 &&
+                              extract(zip, members[1], &data) &&
+                              data == text);
+  check("empty entry", members.size() == 3 && extract(zip, members[2], &data) &&
+                           data.empty());
+
+  // 写入长度与声明的大小不一致
+  {
+    std::string out;
+    ZipWriter w(appender(&out));
+    w.begin("a", false, 10, mtime);
+    w.write("hello", 5);
+    check("size mismatch", w.end() != 0 && w.finish() != 0);
+  }
+
+  // 下游中止后不再输出
+  {
+    std::string out;
+    int calls = 0;
+    ZipWriter w(
+        [&calls](const char *, size_t) { return ++calls > 1 ? -1 : 0; });
+    w.begin("a", false, 5, mtime);
+    check("sink abort", w.write("hello", 5) != 0 && w.end() != 0 &&
+                            calls == 2);
+  }
+
+  // 全部存储时预先算出的长度与实际一致
+  {
+    std::string out;
+    ZipWriter w(appender(&out));
+    std::vector<ZipStoredEntry> entries = {{"a.txt", 5}, {"目录/b.bin", 0}};
+    w.begin("a.txt", false, 5, mtime);
+    w.write("hello", 5);
+    w.end();
+    w.begin("目录/b.bin", false, 0, mtime);
+    w.end();
+    w.finish();
+    check("stored size", ZipWriter::storedSize(entries) == out.size());
+  }
+
+  // 超过65535个文件时写ZIP64结束记录
+  {
+    std::string out;
+    ZipWriter w(appender(&out));
+    std::vector<ZipStoredEntry> entries;
+    bool ok = true;
+    for (int i = 0; i < 70000 && ok; i++) {
+      std::string name = "f" + std::to_string(i);
+      entries.push_back({name, 1});
+      ok = w.begin(name, false, 1, mtime) == 0 && w.write("x", 1) == 0 &&
+           w.end() == 0;
+    }
+    ok = ok && w.finish() == 0;
+    std::vector<Member> many;
+    check("zip64 many entries",
+          ok && readCentral(out, &many) && many.size() == 70000 &&
+              many.back().name == "f69999" &&
+              extract(out, many.back(), &data) && data == "x");
+    check("zip64 stored size", ZipWriter::storedSize(entries) == out.size());
+  }
+
+  // 超过4G的文件：内容是同一块全0缓冲区，sink只保留头部和结尾的记录
+  {
+    const uint64_t big = (4ULL << 30) + 16;
+    std::vector<char> zeros(1 << 20, 0);
+    std::string meta;
+    uint64_t total = 0;
+    ZipWriter w([&](const char *data, size_t len) {
+      total += len;
+      if (data != zeros.data()) meta.append(data, len);
+      return 0;
+    });
+    bool ok = w.begin("big.bin", false, big, mtime) == 0;
+    for (uint64_t left = big; left > 0 && ok;) {
+      size_t n = left < zeros.size() ? (size_t)left : zeros.size();
+      ok = w.write(zeros.data(), n) == 0;
+      left -= n;
+    }
+    ok = ok && w.end() == 0 && w.begin("tail.txt", false, 4, mtime) == 0 &&
+         w.write("tail", 4) == 0 && w.end() == 0 && w.finish() == 0;
+    check("zip64 big entry", ok && total == w.written());
+    // 本地文件头：版本4.5，大小为0xffffffff，ZIP64扩展字段中的大小为0
+    size_t name_end = 30 + 7;
+    check("zip64 local extra",
+          get16(meta, 4) == 45 && get32(meta, 18) == 0xffffffff &&
+              get32(meta, 22) == 0xffffffff && get16(meta, 28) == 20 &&
+              get16(meta, name_end) == 1 && get16(meta, name_end + 2) == 16 &&
+              get64(meta, name_end + 4) == 0 && get64(meta, name_end + 12) == 0);
+    // 数据描述符紧跟内容，大小为8字节
+    size_t desc = name_end + 20;
+    check("zip64 descriptor", get32(meta, desc) == 0x08074b50 &&
+                                  get64(meta, desc + 8) == big &&
+                                  get64(meta, desc + 16) == big);
+    // 小文件的本地文件头不带扩展字段
+    size_t tail = desc + 24;
+    check("zip64 small entry", get32(meta, tail) == 0x04034b50 &&
+                                   get16(meta, tail + 4) == 20 &&
+                                   get16(meta, tail + 28) == 0);
+    std::vector<ZipStoredEntry> entries = {{"big.bin", big}, {"tail.txt", 4}};
+    check("zip64 big stored size", ZipWriter::storedSize(entries) == total);
+  }
+
+  printf(failed == 0 ? "ALL OK\n" : "%d FAILED\n", failed);
+  return failed == 0 ? 0 : 1;
+}
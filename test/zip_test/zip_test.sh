@@ -0,0 +1,8 @@
+#!/bin/bash
+g++ -std=c++17 -I ../../src zip_test.cpp ../../src/zip_util.cpp ../../src/make_log.cpp -o zip_test -lz || exit 1
+./zip_test || exit 1
+# 有unzip时用它检查生成的归档
+if command -v unzip > /dev/null; then
+  unzip -tq zip_test.zip || exit 1
+fi
+rm -f zip_test.zip